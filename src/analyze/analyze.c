@@ -0,0 +1,863 @@
+#include "analyze.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "../initiator/initiator_output.h"
+#include "../archive/archive.h"
+#include "../macmap/macmap.h"
+
+#define LOG_SUFFIX "-log.txt"
+#define BIN_SUFFIX ".bin"
+#define ARCHIVE_SUFFIX ".ftma"
+/* archives hold several times fewer bytes per result than other files */
+#define ARCHIVE_CHUNK_SIZE (ANALYZE_CHUNK_SIZE / 8)
+/* "xx:xx:xx:xx:xx:xx" */
+#define MAC_STR_LEN 17
+
+enum analyze_format {
+    ANALYZE_LOG,
+    ANALYZE_BIN,
+    ANALYZE_ARCHIVE,
+};
+
+/**
+ * struct analyze_file - A mapped file
+ * 
+ * @path: path of the file
+ * @data: the mapping
+ * @size: size of the file
+ * @format: @enum analyze_format
+ * @mac_addr: peer of a log file
+ */
+struct analyze_file {
+    char *path;
+    const char *data;
+    size_t size;
+    enum analyze_format format;
+    uint8_t mac_addr[6];
+};
+
+/**
+ * struct analyze_chunk - A part of a file, the unit of work
+ * 
+ * @file: the file
+ * @start: offset of the first byte
+ * @end: offset past the last byte
+ * 
+ * @note
+ * Chunks of a binary stream hold whole records, and chunks of an archive
+ * whole blocks. A line of a log file belongs to the chunk holding its first
+ * byte.
+ */
+struct analyze_chunk {
+    struct analyze_file *file;
+    size_t start;
+    size_t end;
+};
+
+/**
+ * struct analyze_job - Work shared by the thread pool
+ * 
+ * @chunks: chunks of all files
+ * @chunk_count: number of @chunks
+ * @next: next chunk to take
+ * @dist_truth: true distance of results without one, NAN if unknown
+ */
+struct analyze_job {
+    struct analyze_chunk *chunks;
+    int chunk_count;
+    int next;
+    float dist_truth;
+};
+
+/**
+ * struct analyze_peers - Aggregates of peers, found by mac address
+ * 
+ * @peers: the aggregates, in the order the peers were seen
+ * @count: number of @peers
+ * @capacity: room in @peers, doubled when full
+ * @index: index in @peers of each mac address
+ */
+struct analyze_peers {
+    struct analyze_peer *peers;
+    int count;
+    int capacity;
+    struct mac_map index;
+};
+
+/**
+ * struct analyze_worker - A thread and its partial aggregates
+ * 
+ * @job: the shared work
+ * @peers: aggregates of the peers seen by this thread
+ * @skipped: malformed lines or records skipped
+ * @error: whether the thread failed to allocate
+ */
+struct analyze_worker {
+    pthread_t thread;
+    struct analyze_job *job;
+    struct analyze_peers peers;
+    uint64_t skipped;
+    bool error;
+};
+
+static void init_peer(struct analyze_peer *peer, const uint8_t *mac_addr) {
+    memset(peer, 0, sizeof(struct analyze_peer));
+    memcpy(peer->mac_addr, mac_addr, 6);
+    peer->dist_min = INFINITY;
+    peer->dist_max = -INFINITY;
+}
+
+/* aggregates of a peer, added if not seen yet, NULL on failure */
+static struct analyze_peer *find_peer(struct analyze_peers *peers,
+                                      const uint8_t *mac_addr) {
+    int idx = mac_map_get(&peers->index, mac_addr);
+    if (idx >= 0)
+        return &peers->peers[idx];
+    if (peers->count == peers->capacity) {
+        int capacity = peers->capacity ? 2 * peers->capacity : 16;
+        struct analyze_peer *grown = realloc(peers->peers, capacity *
+                                             sizeof(struct analyze_peer));
+        if (!grown)
+            return NULL;
+        peers->peers = grown;
+        peers->capacity = capacity;
+    }
+    if (mac_map_put(&peers->index, mac_addr, peers->count))
+        return NULL;
+    struct analyze_peer *peer = &peers->peers[peers->count++];
+    init_peer(peer, mac_addr);
+    return peer;
+}
+
+static struct hist *alloc_hist() {
+    struct hist *hist = malloc(sizeof(struct hist));
+    if (hist)
+        hist_init(hist);
+    return hist;
+}
+
+/*
+ * hist_record() without its atomic operations, the histograms of a worker
+ * being its own
+ */
+static void hist_add(struct hist *hist, uint64_t value) {
+    hist->counts[hist_bucket_index(value)]++;
+    hist->total++;
+    hist->sum += value;
+    if (value < hist->min)
+        hist->min = value;
+    if (value > hist->max)
+        hist->max = value;
+}
+
+static void add_time(struct analyze_peer *peer, uint64_t timestamp_ns) {
+    if (!timestamp_ns)
+        return;
+    if (!peer->first_ns || timestamp_ns < peer->first_ns)
+        peer->first_ns = timestamp_ns;
+    if (timestamp_ns > peer->last_ns)
+        peer->last_ns = timestamp_ns;
+}
+
+static void add_failure(struct analyze_peer *peer, uint32_t reason) {
+    if (reason >= METRICS_FAIL_REASON_MAX - 1)
+        reason = METRICS_FAIL_REASON_MAX - 1;
+    peer->results++;
+    peer->fail_reasons[reason]++;
+}
+
+/*
+ * a success with the raw rtt_avg, the distance and the true distance, 1 on
+ * failure to allocate
+ */
+static int add_success(struct analyze_peer *peer, int64_t rtt, float dist,
+                       float dist_truth) {
+    struct hist **hist = dist < 0 ? &peer->neg_dist_hist : &peer->dist_hist;
+    if (!*hist && !(*hist = alloc_hist()))
+        return 1;
+    hist_add(*hist, llroundf(fabsf(dist) * 1000));
+
+    peer->results++;
+    peer->successes++;
+    peer->dist_sum += dist;
+    peer->dist_sq_sum += (double)dist * dist;
+    if (dist < peer->dist_min)
+        peer->dist_min = dist;
+    if (dist > peer->dist_max)
+        peer->dist_max = dist;
+    if (!isnan(dist_truth)) {
+        peer->truth_count++;
+        peer->calib_sum += DIST_TO_RTT((double)dist_truth) - rtt;
+    }
+    return 0;
+}
+
+/* add @src into @dst, allocated if needed, 1 on failure */
+static int merge_hist(struct hist **dst, const struct hist *src) {
+    if (!src)
+        return 0;
+    if (!*dst && !(*dst = alloc_hist()))
+        return 1;
+    hist_merge(*dst, src);
+    return 0;
+}
+
+static int merge_peer(struct analyze_peer *dst,
+                      const struct analyze_peer *src) {
+    dst->results += src->results;
+    dst->successes += src->successes;
+    for (int i = 0; i < METRICS_FAIL_REASON_MAX; i++)
+        dst->fail_reasons[i] += src->fail_reasons[i];
+    dst->dist_sum += src->dist_sum;
+    dst->dist_sq_sum += src->dist_sq_sum;
+    if (src->dist_min < dst->dist_min)
+        dst->dist_min = src->dist_min;
+    if (src->dist_max > dst->dist_max)
+        dst->dist_max = src->dist_max;
+    dst->rssi_sum += src->rssi_sum;
+    dst->rssi_count += src->rssi_count;
+    dst->truth_count += src->truth_count;
+    dst->calib_sum += src->calib_sum;
+    add_time(dst, src->first_ns);
+    add_time(dst, src->last_ns);
+    return merge_hist(&dst->dist_hist, src->dist_hist) ||
+           merge_hist(&dst->neg_dist_hist, src->neg_dist_hist);
+}
+
+/* parse a decimal integer, NULL if there is none */
+static const char *parse_int(const char *pos, const char *end,
+                             int64_t *value) {
+    while (pos < end && *pos == ' ')
+        pos++;
+    bool negative = pos < end && *pos == '-';
+    if (negative)
+        pos++;
+    if (pos == end || *pos < '0' || *pos > '9')
+        return NULL;
+    uint64_t abs = 0;
+    while (pos < end && *pos >= '0' && *pos <= '9')
+        abs = abs * 10 + (*pos++ - '0');
+    *value = negative ? -(int64_t)abs : (int64_t)abs;
+    return pos;
+}
+
+static int analyze_log(struct analyze_worker *worker,
+                       struct analyze_chunk *chunk) {
+    struct analyze_file *file = chunk->file;
+    const char *pos = file->data + chunk->start;
+    const char *end = file->data + chunk->end;
+    const char *file_end = file->data + file->size;
+    /* the line cut by the start belongs to the previous chunk */
+    if (chunk->start && pos[-1] != '\n') {
+        while (pos < file_end && *pos != '\n')
+            pos++;
+        pos++;
+    }
+    struct analyze_peer *peer = find_peer(&worker->peers, file->mac_addr);
+    if (!peer)
+        return 1;
+    float dist_truth = worker->job->dist_truth;
+    while (pos < end) {
+        const char *eol = memchr(pos, '\n', file_end - pos);
+        if (!eol)
+            eol = file_end;
+        int64_t values[5];
+        const char *cur = pos;
+        int i;
+        for (i = 0; i < 4 && cur; i++)
+            cur = parse_int(cur, eol, &values[i]);
+        pos = eol + 1;
+        if (!cur) {
+            worker->skipped++;
+            continue;
+        }
+        /* the receive time, missing from older logs, 0 if unknown */
+        if (parse_int(cur, eol, &values[4]) && values[4] > 0)
+            add_time(peer, values[4]);
+        /* start_measurement writes 0 for absent attributes */
+        int64_t rtt = values[0], rssi = values[3];
+        if (!rtt) {
+            add_failure(peer, METRICS_FAIL_REASON_MAX - 1);
+            continue;
+        }
+        if (add_success(peer, rtt, RTT_TO_DIST(rtt), dist_truth))
+            return 1;
+        if (rssi) {
+            peer->rssi_sum += rssi;
+            peer->rssi_count++;
+        }
+    }
+    return 0;
+}
+
+static int analyze_record(struct analyze_worker *worker,
+                          const struct ftm_output_bin_record *record) {
+    if (!(record->present & (1u << FTM_RESP_FLAG_mac_addr))) {
+        worker->skipped++;
+        return 0;
+    }
+    struct analyze_peer *peer = find_peer(&worker->peers, record->mac_addr);
+    if (!peer)
+        return 1;
+    add_time(peer, record->timestamp_ns);
+#define __PRESENT(name) (record->present & (1u << FTM_RESP_FLAG_##name))
+    if (__PRESENT(rssi_avg)) {
+        peer->rssi_sum += record->rssi_avg;
+        peer->rssi_count++;
+    }
+    if (__PRESENT(fail_reason)) {
+        add_failure(peer, record->fail_reason);
+    } else if (!__PRESENT(rtt_avg)) {
+        add_failure(peer, METRICS_FAIL_REASON_MAX - 1);
+    } else {
+        float dist_truth = __PRESENT(dist_truth) ? record->dist_truth :
+                           worker->job->dist_truth;
+        return add_success(peer, record->rtt_avg, record->dist,
+                           dist_truth);
+    }
+    return 0;
+}
+
+static int analyze_bin(struct analyze_worker *worker,
+                       struct analyze_chunk *chunk) {
+    for (size_t off = chunk->start; off < chunk->end;
+         off += sizeof(struct ftm_output_bin_record)) {
+        struct ftm_output_bin_record record;
+        memcpy(&record, chunk->file->data + off, sizeof(record));
+        if (analyze_record(worker, &record))
+            return 1;
+    }
+    return 0;
+}
+
+static int analyze_archive(struct analyze_worker *worker,
+                           struct analyze_chunk *chunk) {
+    struct ftm_output_bin_record *records = malloc(ARCHIVE_BLOCK_RECORDS *
+                                                   sizeof(*records));
+    if (!records)
+        return 1;
+    const uint8_t *data = (const uint8_t *)chunk->file->data;
+    int err = 0;
+    for (size_t off = chunk->start; off < chunk->end && !err;
+         off += archive_block_size(data + off, chunk->end - off)) {
+        int count = archive_decode_block(data + off, records);
+        if (count < 0) {
+            struct archive_block_header header;
+            memcpy(&header, data + off, sizeof(header));
+            worker->skipped += header.count;
+        }
+        for (int i = 0; i < count && !err; i++)
+            err = analyze_record(worker, &records[i]);
+    }
+    free(records);
+    return err;
+}
+
+static void *analyze_thread(void *arg) {
+    struct analyze_worker *worker = arg;
+    struct analyze_job *job = worker->job;
+    while (1) {
+        int idx = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (idx >= job->chunk_count)
+            break;
+        struct analyze_chunk *chunk = &job->chunks[idx];
+        int err;
+        switch (chunk->file->format) {
+            case ANALYZE_BIN:
+                err = analyze_bin(worker, chunk);
+                break;
+            case ANALYZE_ARCHIVE:
+                err = analyze_archive(worker, chunk);
+                break;
+            default:
+                err = analyze_log(worker, chunk);
+        }
+        if (err) {
+            worker->error = true;
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* peer of a log file, from the mac address before LOG_SUFFIX */
+static int parse_log_name(const char *path, uint8_t *mac_addr) {
+    size_t len = strlen(path);
+    size_t suffix = strlen(LOG_SUFFIX);
+    if (len < suffix + MAC_STR_LEN ||
+        strcmp(path + len - suffix, LOG_SUFFIX))
+        return 1;
+    const char *mac = path + len - suffix - MAC_STR_LEN;
+    return sscanf(mac, "%02hhx:%02hhx:%02hhx:%02hhx:%02hhx:%02hhx",
+                  &mac_addr[0], &mac_addr[1], &mac_addr[2], &mac_addr[3],
+                  &mac_addr[4], &mac_addr[5]) != 6;
+}
+
+static int open_file(struct analyze_file *file) {
+    int fd = open(file->path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st)) {
+        fprintf(stderr, "Fail to open %s: %s\n", file->path,
+                strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return 1;
+    }
+    file->size = st.st_size;
+    file->data = NULL;
+    if (file->size) {
+        void *data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            fprintf(stderr, "Fail to map %s: %s\n", file->path,
+                    strerror(errno));
+            close(fd);
+            return 1;
+        }
+        madvise(data, file->size, MADV_SEQUENTIAL);
+        file->data = data;
+    }
+    close(fd);
+
+    struct ftm_output_bin_header header;
+    if (file->size >= sizeof(header)) {
+        memcpy(&header, file->data, sizeof(header));
+        if (header.magic == FTM_OUTPUT_BIN_MAGIC) {
+            if (header.version != FTM_OUTPUT_BIN_VERSION ||
+                header.record_size != sizeof(struct ftm_output_bin_record)) {
+                fprintf(stderr, "Unsupported binary output %s!\n",
+                        file->path);
+                return 1;
+            }
+            file->format = ANALYZE_BIN;
+            return 0;
+        }
+        if (header.magic == ARCHIVE_MAGIC) {
+            if (header.version != ARCHIVE_VERSION ||
+                header.record_size != sizeof(struct ftm_output_bin_record)) {
+                fprintf(stderr, "Unsupported archive %s!\n", file->path);
+                return 1;
+            }
+            file->format = ANALYZE_ARCHIVE;
+            return 0;
+        }
+    }
+    if (parse_log_name(file->path, file->mac_addr)) {
+        fprintf(stderr, "No mac address in the name of %s!\n", file->path);
+        return 1;
+    }
+    file->format = ANALYZE_LOG;
+    return 0;
+}
+
+static int add_path(struct analyze_file **files, int *count, const char *dir,
+                    const char *name) {
+    struct analyze_file *grown = realloc(*files, (*count + 1) *
+                                         sizeof(struct analyze_file));
+    if (!grown)
+        return 1;
+    *files = grown;
+    struct analyze_file *file = &grown[*count];
+    memset(file, 0, sizeof(struct analyze_file));
+    size_t len = (dir ? strlen(dir) + 1 : 0) + strlen(name) + 1;
+    file->path = malloc(len);
+    if (!file->path)
+        return 1;
+    if (dir)
+        snprintf(file->path, len, "%s/%s", dir, name);
+    else
+        snprintf(file->path, len, "%s", name);
+    (*count)++;
+    return 0;
+}
+
+static bool has_suffix(const char *name, const char *suffix) {
+    size_t len = strlen(name), suffix_len = strlen(suffix);
+    return len >= suffix_len && !strcmp(name + len - suffix_len, suffix);
+}
+
+static int compare_name(const struct dirent **a, const struct dirent **b) {
+    return strcmp((*a)->d_name, (*b)->d_name);
+}
+
+static int filter_name(const struct dirent *entry) {
+    return has_suffix(entry->d_name, LOG_SUFFIX) ||
+           has_suffix(entry->d_name, BIN_SUFFIX) ||
+           has_suffix(entry->d_name, ARCHIVE_SUFFIX);
+}
+
+/* the files of the paths, directories expanded in order of name */
+static int collect_files(const char **paths, int path_count,
+                         struct analyze_file **files, int *count) {
+    for (int i = 0; i < path_count; i++) {
+        struct stat st;
+        if (stat(paths[i], &st)) {
+            fprintf(stderr, "Fail to open %s: %s\n", paths[i],
+                    strerror(errno));
+            return 1;
+        }
+        if (!S_ISDIR(st.st_mode)) {
+            if (add_path(files, count, NULL, paths[i]))
+                return 1;
+            continue;
+        }
+        struct dirent **entries;
+        int entry_count = scandir(paths[i], &entries, filter_name,
+                                  compare_name);
+        if (entry_count < 0) {
+            fprintf(stderr, "Fail to read %s: %s\n", paths[i],
+                    strerror(errno));
+            return 1;
+        }
+        int err = 0;
+        for (int j = 0; j < entry_count; j++) {
+            if (!err && add_path(files, count, paths[i], entries[j]->d_name))
+                err = 1;
+            free(entries[j]);
+        }
+        free(entries);
+        if (err)
+            return 1;
+    }
+    return 0;
+}
+
+/* chunks of whole blocks, up to the first block that is cut or malformed */
+static void split_archive(struct analyze_file *file,
+                          struct analyze_chunk *chunks, int *chunk_count) {
+    const uint8_t *data = (const uint8_t *)file->data;
+    size_t off = sizeof(struct ftm_output_bin_header), start = off;
+    while (off < file->size) {
+        size_t size = archive_block_size(data + off, file->size - off);
+        if (!size) {
+            fprintf(stderr, "Ignore %zu bytes at the end of %s\n",
+                    file->size - off, file->path);
+            break;
+        }
+        off += size;
+        if (off - start >= ARCHIVE_CHUNK_SIZE) {
+            chunks[*chunk_count] = (struct analyze_chunk){file, start, off};
+            (*chunk_count)++;
+            start = off;
+        }
+    }
+    if (off > start) {
+        chunks[*chunk_count] = (struct analyze_chunk){file, start, off};
+        (*chunk_count)++;
+    }
+}
+
+/* bytes of the records of a text or binary file, and the chunk size */
+static void file_span(const struct analyze_file *file, size_t *start,
+                      size_t *end, size_t *step) {
+    size_t record = sizeof(struct ftm_output_bin_record);
+    *start = 0;
+    *end = file->size;
+    *step = ANALYZE_CHUNK_SIZE;
+    if (file->format == ANALYZE_BIN) {
+        *start = sizeof(struct ftm_output_bin_header);
+        *end = *start + (file->size - *start) / record * record;
+        *step = ANALYZE_CHUNK_SIZE / record * record;
+    }
+}
+
+/*
+ * split the files into chunks, binary streams at record boundaries and
+ * archives at block boundaries
+ */
+static struct analyze_chunk *split_files(struct analyze_file *files,
+                                         int count, int *chunk_count) {
+    size_t total = 0, start, end, step;
+    for (int i = 0; i < count; i++) {
+        /* every chunk of an archive but the last is at least this big */
+        if (files[i].format == ANALYZE_ARCHIVE) {
+            total += files[i].size / ARCHIVE_CHUNK_SIZE + 1;
+            continue;
+        }
+        file_span(&files[i], &start, &end, &step);
+        total += (end - start + step - 1) / step;
+    }
+    struct analyze_chunk *chunks = malloc((total ? total : 1) *
+                                          sizeof(struct analyze_chunk));
+    if (!chunks)
+        return NULL;
+    *chunk_count = 0;
+    for (int i = 0; i < count; i++) {
+        struct analyze_file *file = &files[i];
+        if (file->format == ANALYZE_ARCHIVE) {
+            split_archive(file, chunks, chunk_count);
+            continue;
+        }
+        file_span(file, &start, &end, &step);
+        for (size_t off = start; off < end; off += step) {
+            struct analyze_chunk *chunk = &chunks[(*chunk_count)++];
+            chunk->file = file;
+            chunk->start = off;
+            chunk->end = off + step < end ? off + step : end;
+        }
+    }
+    return chunks;
+}
+
+static int compare_peer(const void *a, const void *b) {
+    return memcmp(((const struct analyze_peer *)a)->mac_addr,
+                  ((const struct analyze_peer *)b)->mac_addr, 6);
+}
+
+static void free_peers(struct analyze_peer *peers, int count) {
+    for (int i = 0; i < count; i++) {
+        free(peers[i].dist_hist);
+        free(peers[i].neg_dist_hist);
+    }
+    free(peers);
+}
+
+/* merge the partial aggregates of the workers into @result */
+static int merge_workers(struct analyze_worker *workers, int count,
+                         struct analyze_result *result) {
+    struct analyze_peers merged = {0};
+    int err = 0;
+    for (int i = 0; i < count && !err; i++) {
+        struct analyze_worker *worker = &workers[i];
+        result->skipped += worker->skipped;
+        for (int j = 0; j < worker->peers.count && !err; j++) {
+            struct analyze_peer *src = &worker->peers.peers[j];
+            struct analyze_peer *dst = find_peer(&merged, src->mac_addr);
+            err = !dst || merge_peer(dst, src);
+        }
+    }
+    mac_map_free(&merged.index);
+    result->peers = merged.peers;
+    result->peer_count = merged.count;
+    if (err)
+        return 1;
+    qsort(result->peers, result->peer_count, sizeof(struct analyze_peer),
+          compare_peer);
+    return 0;
+}
+
+int ftm_analyze(const char **paths, int path_count, int threads,
+                float dist_truth, struct analyze_result *result) {
+    memset(result, 0, sizeof(struct analyze_result));
+    struct analyze_file *files = NULL;
+    struct analyze_chunk *chunks = NULL;
+    struct analyze_worker *workers = NULL;
+    int file_count = 0, started = 0, err = 1;
+
+    if (collect_files(paths, path_count, &files, &file_count))
+        goto clean_up;
+    for (int i = 0; i < file_count; i++) {
+        if (open_file(&files[i]))
+            goto clean_up;
+        result->bytes += files[i].size;
+    }
+    result->files = file_count;
+
+    struct analyze_job job = {NULL, 0, 0, dist_truth};
+    chunks = split_files(files, file_count, &job.chunk_count);
+    if (!chunks) {
+        fprintf(stderr, "Fail to allocate chunks!\n");
+        goto clean_up;
+    }
+    job.chunks = chunks;
+    if (threads > job.chunk_count)
+        threads = job.chunk_count;
+    if (threads < 1)
+        threads = 1;
+    workers = calloc(threads, sizeof(struct analyze_worker));
+    if (!workers) {
+        fprintf(stderr, "Fail to allocate threads!\n");
+        goto clean_up;
+    }
+    for (started = 0; started < threads; started++) {
+        workers[started].job = &job;
+        if (pthread_create(&workers[started].thread, NULL, analyze_thread,
+                           &workers[started])) {
+            fprintf(stderr, "Fail to create thread!\n");
+            break;
+        }
+    }
+    bool failed = started < threads;
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        failed |= workers[i].error;
+    }
+    if (failed) {
+        if (started == threads)
+            fprintf(stderr, "Fail to allocate aggregates!\n");
+        goto clean_up;
+    }
+    if (merge_workers(workers, started, result)) {
+        fprintf(stderr, "Fail to allocate aggregates!\n");
+        goto clean_up;
+    }
+    err = 0;
+
+clean_up:
+    for (int i = 0; workers && i < started; i++) {
+        free_peers(workers[i].peers.peers, workers[i].peers.count);
+        mac_map_free(&workers[i].peers.index);
+    }
+    free(workers);
+    free(chunks);
+    for (int i = 0; i < file_count; i++) {
+        if (files[i].data)
+            munmap((void *)files[i].data, files[i].size);
+        free(files[i].path);
+    }
+    free(files);
+    if (err)
+        free_analyze_result(result);
+    return err;
+}
+
+void free_analyze_result(struct analyze_result *result) {
+    free_peers(result->peers, result->peer_count);
+    result->peers = NULL;
+    result->peer_count = 0;
+}
+
+/* the value of rank @rank in a histogram, the middle of its bucket */
+static double hist_rank(const struct hist *hist, uint64_t rank) {
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen > rank) {
+            uint64_t lower = i ? hist_bucket_upper(i - 1) + 1 : 0;
+            return (lower + hist_bucket_upper(i)) / 2.0;
+        }
+    }
+    return hist->max;
+}
+
+float analyze_quantile(const struct analyze_peer *peer, double q) {
+    if (!peer->successes)
+        return NAN;
+    uint64_t rank = q * peer->successes;
+    if (rank >= peer->successes)
+        rank = peer->successes - 1;
+    /* the negative distances come first, largest magnitude first */
+    uint64_t neg = peer->neg_dist_hist ? peer->neg_dist_hist->total : 0;
+    float dist = rank < neg ?
+                 -hist_rank(peer->neg_dist_hist, neg - 1 - rank) / 1000 :
+                 hist_rank(peer->dist_hist, rank - neg) / 1000;
+    /* within the exact bounds */
+    if (dist < peer->dist_min)
+        dist = peer->dist_min;
+    if (dist > peer->dist_max)
+        dist = peer->dist_max;
+    return dist;
+}
+
+void analyze_print(FILE *file, const struct analyze_result *result) {
+    fprintf(file, "%-17s %9s %7s %8s %7s %8s %8s %8s %8s %8s %6s %9s\n",
+            "peer", "results", "success", "mean_m", "std_m", "min_m",
+            "p5_m", "p50_m", "p95_m", "max_m", "rssi", "calib_ps");
+    for (int i = 0; i < result->peer_count; i++) {
+        const struct analyze_peer *peer = &result->peers[i];
+        const uint8_t *addr = peer->mac_addr;
+        fprintf(file, "%02x:%02x:%02x:%02x:%02x:%02x %9lu %6.1f%%", addr[0],
+                addr[1], addr[2], addr[3], addr[4], addr[5], peer->results,
+                peer->results ? 100.0 * peer->successes / peer->results : 0);
+        if (peer->successes) {
+            double mean = peer->dist_sum / peer->successes;
+            double var = peer->dist_sq_sum / peer->successes - mean * mean;
+            fprintf(file, " %8.2f %7.2f %8.2f %8.2f %8.2f %8.2f %8.2f",
+                    mean, sqrt(var > 0 ? var : 0), peer->dist_min,
+                    analyze_quantile(peer, 0.05),
+                    analyze_quantile(peer, 0.5),
+                    analyze_quantile(peer, 0.95), peer->dist_max);
+        } else {
+            fprintf(file, " %8s %7s %8s %8s %8s %8s %8s", "-", "-", "-", "-",
+                    "-", "-", "-");
+        }
+        if (peer->rssi_count)
+            fprintf(file, " %6.1f",
+                    (double)peer->rssi_sum / peer->rssi_count);
+        else
+            fprintf(file, " %6s", "-");
+        if (peer->truth_count)
+            fprintf(file, " %9.0f\n", peer->calib_sum / peer->truth_count);
+        else
+            fprintf(file, " %9s\n", "-");
+
+        if (peer->successes == peer->results)
+            continue;
+        fprintf(file, "  failures:");
+        for (int j = 0; j < METRICS_FAIL_REASON_MAX; j++) {
+            if (peer->fail_reasons[j])
+                fprintf(file, " %s=%lu", metrics_fail_reason_name(j),
+                        peer->fail_reasons[j]);
+        }
+        fprintf(file, "\n");
+    }
+}
+
+static void print_usage() {
+    printf("Valid args: [--threads=<count>] [--dist-truth=<m>] "
+           "<log file|bin file|archive|directory>...\n");
+}
+
+static double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int ftm_analyze_main(int argc, char **argv) {
+    static struct option long_options[] = {
+        {"threads", required_argument, NULL, 't'},
+        {"dist-truth", required_argument, NULL, 'd'},
+        {NULL, 0, NULL, 0}
+    };
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    float dist_truth = NAN;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 't':
+                threads = atoi(optarg);
+                if (threads < 1) {
+                    print_usage();
+                    return 1;
+                }
+                break;
+            case 'd':
+                dist_truth = atof(optarg);
+                break;
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+    if (optind == argc) {
+        printf("Invalid arguments!\n");
+        print_usage();
+        return 1;
+    }
+
+    double start = now_s();
+    struct analyze_result result;
+    if (ftm_analyze((const char **)argv + optind, argc - optind, threads,
+                    dist_truth, &result))
+        return 1;
+    double elapsed = now_s() - start;
+    analyze_print(stdout, &result);
+    fprintf(stderr, "%d files, %.1f MB analyzed in %.3f s (%.0f MB/s)",
+            result.files, result.bytes / 1e6, elapsed,
+            elapsed > 0 ? result.bytes / 1e6 / elapsed : 0);
+    if (result.skipped)
+        fprintf(stderr, ", %lu malformed records skipped", result.skipped);
+    fprintf(stderr, "\n");
+    free_analyze_result(&result);
+    return 0;
+}
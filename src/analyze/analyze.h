@@ -0,0 +1,148 @@
+#ifndef _FTM_ANALYZE_H
+#define _FTM_ANALYZE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "../hist/hist.h"
+#include "../metrics/metrics.h"
+
+/**
+ * DOC: Offline analysis of recorded measurements
+ * 
+ * Summarizes recorded measurements per peer: distance statistics and
+ * quantiles, the breakdown of fail reasons, and the rtt_correct that
+ * would calibrate the peer against its true distance.
+ * 
+ * Two kinds of files are read:
+ * 
+ * - the "<time>-<mac_addr>-log.txt" files written by start_measurement,
+ *   one line "rtt_avg rtt_variance rtt_spread rssi_avg rx_time_ns" per
+ *   session, the peer being given by the file name, older logs lacking
+ *   rx_time_ns. They carry no rtt_correct, and a line with no rtt_avg is a
+ *   failed session of unknown reason
+ * - the binary streams of "start_measurement --output=bin", see
+ *   initiator_output.h, which carry every attribute, the time and the
+ *   true distance of each result
+ * - archives of these streams, see archive.h, read by whole blocks
+ * 
+ * Files are mapped and split into chunks of ANALYZE_CHUNK_SIZE bytes, that
+ * is into consecutive time ranges of a file. A pool of threads takes the
+ * chunks one by one and adds each result into partial aggregates of its
+ * own, which are merged once all chunks are done. Every aggregate is a sum,
+ * a bound or a log-linear histogram of the distance in mm (see hist.h), so
+ * merging does not depend on how the work was split. Peers are found by
+ * mac address in a hash table, see macmap.h.
+ * 
+ * The histograms take about 9 KiB per peer and thread, and bound the error
+ * of the quantiles to about 1.5% of the distance, 1 mm below 32 mm.
+ */
+
+#define ANALYZE_CHUNK_SIZE (4 << 20)
+
+/**
+ * struct analyze_peer - Aggregates of a peer
+ * 
+ * @mac_addr: mac address of the peer
+ * @results: number of results
+ * @successes: results carrying an rtt_avg and no fail_reason
+ * @fail_reasons: failed results per fail_reason, the last slot counting
+ * unknown reasons, see metrics_fail_reason_name()
+ * @dist_sum: sum of the distances in m, corrected by rtt_correct
+ * @dist_sq_sum: sum of the squared distances
+ * @dist_min: smallest distance
+ * @dist_max: largest distance
+ * @rssi_sum: sum of rssi_avg
+ * @rssi_count: results carrying an rssi_avg
+ * @truth_count: successes with a known true distance
+ * @calib_sum: sum over @truth_count of the rtt in ps missing from rtt_avg
+ * to match the true distance
+ * @first_ns: earliest result time, CLOCK_REALTIME, 0 if unknown
+ * @last_ns: latest result time, 0 if unknown
+ * @dist_hist: successes per distance in mm, of the distances that are not
+ * negative, NULL until one is added
+ * @neg_dist_hist: successes per negated distance in mm, of the negative
+ * distances, NULL until one is added
+ */
+struct analyze_peer {
+    uint8_t mac_addr[6];
+    uint64_t results;
+    uint64_t successes;
+    uint64_t fail_reasons[METRICS_FAIL_REASON_MAX];
+    double dist_sum;
+    double dist_sq_sum;
+    float dist_min;
+    float dist_max;
+    int64_t rssi_sum;
+    uint64_t rssi_count;
+    uint64_t truth_count;
+    double calib_sum;
+    uint64_t first_ns;
+    uint64_t last_ns;
+    struct hist *dist_hist;
+    struct hist *neg_dist_hist;
+};
+
+/**
+ * struct analyze_result - Aggregates of all peers
+ * 
+ * @peers: the peers, in order of mac address
+ * @peer_count: number of @peers
+ * @files: files read
+ * @bytes: bytes read
+ * @skipped: malformed lines or records skipped, including the records of
+ * damaged blocks of archives
+ */
+struct analyze_result {
+    struct analyze_peer *peers;
+    int peer_count;
+    int files;
+    uint64_t bytes;
+    uint64_t skipped;
+};
+
+/**
+ * ftm_analyze - Summarize recorded measurements
+ * 
+ * @param paths        log files, binary streams, archives, or directories
+ *                     whose "*-log.txt", "*.bin" and "*.ftma" files are
+ *                     read
+ * @param path_count   number of @paths
+ * @param threads      size of the thread pool
+ * @param dist_truth   true distance in m of results that do not carry one,
+ *                     NAN if unknown
+ * @param result       filled with the aggregates, free with
+ *                     free_analyze_result()
+ * 
+ * @note
+ * Errors are printed on stderr. A file that cannot be read fails the
+ * analysis, malformed lines only count in @skipped.
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int ftm_analyze(const char **paths, int path_count, int threads,
+                float dist_truth, struct analyze_result *result);
+
+void free_analyze_result(struct analyze_result *result);
+
+/**
+ * analyze_quantile - Estimate a quantile of the distance of a peer
+ * 
+ * @param q   quantile in [0, 1]
+ * 
+ * @return the distance in m, the middle of the bucket of the histogram
+ * holding it, NAN without successes
+ */
+float analyze_quantile(const struct analyze_peer *peer, double q);
+
+/**
+ * analyze_print - Print one row per peer and its fail reasons
+ */
+void analyze_print(FILE *file, const struct analyze_result *result);
+
+/**
+ * ftm_analyze_main - Entry of "ftm analyze [options] <path>..."
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int ftm_analyze_main(int argc, char **argv);
+#endif
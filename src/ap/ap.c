@@ -0,0 +1,472 @@
+#include "ap.h"
+#include <getopt.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#include "../initiator/initiator_config.h"
+
+/* element ids, IEEE 802.11-2020 9.4.2 */
+#define IE_SSID 0
+#define IE_SUPP_RATES 1
+#define IE_DS_PARAMS 3
+#define IE_HT_CAPABILITIES 45
+#define IE_HT_OPERATION 61
+#define IE_EXT_CAPABILITIES 127
+#define IE_VHT_CAPABILITIES 191
+#define IE_VHT_OPERATION 192
+
+/* Extended Capabilities bit 70: FTM responder */
+#define EXT_CAPA_LEN 9
+#define EXT_CAPA_FTM_RESPONDER_BYTE 8
+#define EXT_CAPA_FTM_RESPONDER_BIT 0x40
+
+#define WLAN_CAPABILITY_ESS 0x0001
+/* VHT-MCS 0-7 for one spatial stream, the others not supported */
+#define VHT_MCS_MAP_1SS 0xfffc
+
+#define BEACON_MAX 512
+
+void ftm_ap_config_init(struct ftm_ap_config *config) {
+    memset(config, 0, sizeof(struct ftm_ap_config));
+    strcpy(config->ssid, FTM_AP_DEFAULT_SSID);
+    config->center_freq = FTM_AP_DEFAULT_FREQ;
+    config->chan_width = NL80211_CHAN_WIDTH_20;
+    config->beacon_interval = FTM_AP_DEFAULT_BEACON_INTERVAL;
+    config->dtim_period = FTM_AP_DEFAULT_DTIM_PERIOD;
+}
+
+static int freq_to_channel(uint32_t freq) {
+    if (freq == 2484)
+        return 14;
+    if (freq < 2484)
+        return (freq - 2407) / 5;
+    if (freq > 5950)
+        return (freq - 5950) / 5;
+    return (freq - 5000) / 5;
+}
+
+static uint32_t channel_to_freq(uint32_t primary_freq, int channel) {
+    if (primary_freq > 5950)
+        return 5950 + channel * 5;
+    if (primary_freq > 4900)
+        return 5000 + channel * 5;
+    return channel == 14 ? 2484 : 2407 + channel * 5;
+}
+
+static int width_mhz(uint32_t chan_width) {
+    switch (chan_width) {
+        case NL80211_CHAN_WIDTH_40:
+            return 40;
+        case NL80211_CHAN_WIDTH_80:
+            return 80;
+        case NL80211_CHAN_WIDTH_160:
+            return 160;
+        default:
+            return 20;
+    }
+}
+
+/* center of the channel of the given width the primary channel lies in */
+static uint32_t default_center_freq(uint32_t freq, uint32_t chan_width) {
+    int width = width_mhz(chan_width);
+    int ch = freq_to_channel(freq);
+    if (width == 20)
+        return freq;
+    /* only 40 MHz in 2.4 GHz, secondary channel above up to channel 7 */
+    if (freq < 2484)
+        return ch <= 7 ? freq + 10 : freq - 10;
+    /* channels of 5 and 6 GHz are grouped from these */
+    int base = freq > 5950 ? 1 : ch >= 149 ? 149 : 36;
+    int blocks = width / 20;
+    int idx = (ch - base) / 4;
+    int start = base + (idx - idx % blocks) * 4;
+    return channel_to_freq(freq, start + (blocks - 1) * 2);
+}
+
+static uint8_t *put_ie(uint8_t *pos, int id, const void *data, int len) {
+    *pos++ = id;
+    *pos++ = len;
+    memcpy(pos, data, len);
+    return pos + len;
+}
+
+static uint8_t *put_le16(uint8_t *pos, uint16_t value) {
+    *pos++ = value & 0xff;
+    *pos++ = value >> 8;
+    return pos;
+}
+
+/* 802.11 header, fixed fields and the elements before the TIM */
+static int build_beacon_head(uint8_t *head, const uint8_t *addr,
+                             struct ftm_ap_config *config) {
+    static const uint8_t rates_2g[] = {0x82, 0x84, 0x8b, 0x96,
+                                       0x0c, 0x12, 0x18, 0x24};
+    static const uint8_t rates_5g[] = {0x8c, 0x12, 0x98, 0x24,
+                                       0xb0, 0x48, 0x60, 0x6c};
+    uint8_t *pos = head;
+    /* frame control: management, beacon */
+    *pos++ = 0x80;
+    *pos++ = 0x00;
+    pos = put_le16(pos, 0);
+    memset(pos, 0xff, 6);
+    memcpy(pos + 6, addr, 6);
+    memcpy(pos + 12, addr, 6);
+    pos += 18;
+    pos = put_le16(pos, 0);
+    /* timestamp, filled by the driver */
+    memset(pos, 0, 8);
+    pos += 8;
+    pos = put_le16(pos, config->beacon_interval);
+    pos = put_le16(pos, WLAN_CAPABILITY_ESS);
+
+    pos = put_ie(pos, IE_SSID, config->ssid, strlen(config->ssid));
+    if (config->center_freq < 2484)
+        pos = put_ie(pos, IE_SUPP_RATES, rates_2g, sizeof(rates_2g));
+    else
+        pos = put_ie(pos, IE_SUPP_RATES, rates_5g, sizeof(rates_5g));
+    uint8_t channel = freq_to_channel(config->center_freq);
+    pos = put_ie(pos, IE_DS_PARAMS, &channel, 1);
+    return pos - head;
+}
+
+/* elements after the TIM: HT, VHT and Extended Capabilities */
+static int build_beacon_tail(uint8_t *tail, struct ftm_ap_config *config) {
+    uint8_t *pos = tail;
+    int width = width_mhz(config->chan_width);
+    uint32_t freq = config->center_freq;
+    uint32_t cf1 = config->center_freq_1;
+
+    if (config->chan_width != NL80211_CHAN_WIDTH_20_NOHT) {
+        uint8_t ht_cap[26] = {0};
+        /* 40 MHz supported, SM power save disabled */
+        ht_cap[0] = (width > 20 ? 0x02 : 0) | 0x0c;
+        /* MCS 0-7 */
+        ht_cap[3] = 0xff;
+        pos = put_ie(pos, IE_HT_CAPABILITIES, ht_cap, sizeof(ht_cap));
+
+        uint8_t ht_op[22] = {0};
+        ht_op[0] = freq_to_channel(freq);
+        if (width > 20) {
+            /* secondary 20 MHz above or below, within the 40 MHz pair */
+            uint32_t cf40 = default_center_freq(freq,
+                                                NL80211_CHAN_WIDTH_40);
+            ht_op[1] = (cf40 > freq ? 1 : 3) | 0x04;
+        }
+        pos = put_ie(pos, IE_HT_OPERATION, ht_op, sizeof(ht_op));
+    }
+
+    if (width >= 80) {
+        uint8_t vht_cap[12] = {0};
+        /* supported channel width set: 160 */
+        if (width == 160)
+            vht_cap[0] = 0x04;
+        put_le16(vht_cap + 4, VHT_MCS_MAP_1SS);
+        put_le16(vht_cap + 8, VHT_MCS_MAP_1SS);
+        pos = put_ie(pos, IE_VHT_CAPABILITIES, vht_cap, sizeof(vht_cap));
+
+        uint8_t vht_op[5] = {0};
+        vht_op[0] = 1;
+        if (width == 160) {
+            /* segment 0 is the 80 MHz holding the primary channel */
+            uint32_t cf80 = freq < cf1 ? cf1 - 40 : cf1 + 40;
+            vht_op[1] = freq_to_channel(cf80);
+            vht_op[2] = freq_to_channel(cf1);
+        } else {
+            vht_op[1] = freq_to_channel(cf1);
+        }
+        put_le16(vht_op + 3, VHT_MCS_MAP_1SS);
+        pos = put_ie(pos, IE_VHT_OPERATION, vht_op, sizeof(vht_op));
+    }
+
+    uint8_t ext_capa[EXT_CAPA_LEN] = {0};
+    ext_capa[EXT_CAPA_FTM_RESPONDER_BYTE] = EXT_CAPA_FTM_RESPONDER_BIT;
+    pos = put_ie(pos, IE_EXT_CAPABILITIES, ext_capa, sizeof(ext_capa));
+    return pos - tail;
+}
+
+/**
+ * struct ap_interface - What GET_INTERFACE tells about the interface
+ * 
+ * @iftype: @enum nl80211_iftype
+ * @addr: mac address
+ */
+struct ap_interface {
+    uint32_t iftype;
+    uint8_t addr[6];
+};
+
+static int get_interface_handler(struct nl_msg *msg, void *arg) {
+    struct ap_interface *info = ((struct nl_cb_arg *)arg)->arg;
+    struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+    struct nlattr *tb[NL80211_ATTR_MAX + 1];
+    nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+              genlmsg_attrlen(gnlh, 0), NULL);
+    if (tb[NL80211_ATTR_IFTYPE])
+        info->iftype = nla_get_u32(tb[NL80211_ATTR_IFTYPE]);
+    if (tb[NL80211_ATTR_MAC])
+        nla_memcpy(info->addr, tb[NL80211_ATTR_MAC], 6);
+    return NL_SKIP;
+}
+
+/* send a command carrying the interface and optionally the type */
+static int send_if_cmd(struct nl80211_state *state, uint8_t cmd,
+                       uint32_t if_index, int iftype,
+                       nl_recvmsg_msg_cb_t handler, void *arg) {
+    struct nl_msg *msg = nlmsg_alloc();
+    if (!msg) {
+        ftm_report_error(state->error, "Fail to allocate message!");
+        return 1;
+    }
+    if (!genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, state->nl80211_id, 0,
+                     0, cmd, 0) ||
+        nla_put_u32(msg, NL80211_ATTR_IFINDEX, if_index) ||
+        (iftype >= 0 && nla_put_u32(msg, NL80211_ATTR_IFTYPE, iftype))) {
+        ftm_report_error(state->error, "Fail to build message!");
+        nlmsg_free(msg);
+        return 1;
+    }
+    struct nl_cb_arg cb_arg = alloc_nl_cb_arg(arg);
+    int err = nl_sock_handle(state, msg, handler, &cb_arg);
+    nlmsg_free(msg);
+    return err;
+}
+
+static int set_link_up(const char *if_name, bool up, char *error) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        ftm_report_error(error, "Fail to open socket: %s", strerror(errno));
+        return 1;
+    }
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, if_name, IF_NAMESIZE - 1);
+    int err = ioctl(fd, SIOCGIFFLAGS, &ifr);
+    if (!err && !!(ifr.ifr_flags & IFF_UP) != up) {
+        if (up)
+            ifr.ifr_flags |= IFF_UP;
+        else
+            ifr.ifr_flags &= ~IFF_UP;
+        err = ioctl(fd, SIOCSIFFLAGS, &ifr);
+    }
+    if (err)
+        ftm_report_error(error, "Fail to bring %s %s: %s", if_name,
+                         up ? "up" : "down", strerror(errno));
+    close(fd);
+    return err != 0;
+}
+
+static int put_start_ap(struct nl_msg *msg, uint32_t if_index,
+                        const uint8_t *addr, struct ftm_ap_config *config) {
+    uint8_t head[BEACON_MAX], tail[BEACON_MAX];
+    int head_len = build_beacon_head(head, addr, config);
+    int tail_len = build_beacon_tail(tail, config);
+
+    NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, if_index);
+    NLA_PUT(msg, NL80211_ATTR_BEACON_HEAD, head_len, head);
+    NLA_PUT(msg, NL80211_ATTR_BEACON_TAIL, tail_len, tail);
+    NLA_PUT_U32(msg, NL80211_ATTR_BEACON_INTERVAL, config->beacon_interval);
+    NLA_PUT_U32(msg, NL80211_ATTR_DTIM_PERIOD, config->dtim_period);
+    NLA_PUT(msg, NL80211_ATTR_SSID, strlen(config->ssid), config->ssid);
+    NLA_PUT_U32(msg, NL80211_ATTR_HIDDEN_SSID, NL80211_HIDDEN_SSID_NOT_IN_USE);
+    NLA_PUT_U32(msg, NL80211_ATTR_AUTH_TYPE, NL80211_AUTHTYPE_OPEN_SYSTEM);
+    NLA_PUT_U32(msg, NL80211_ATTR_WIPHY_FREQ, config->center_freq);
+    NLA_PUT_U32(msg, NL80211_ATTR_CHANNEL_WIDTH, config->chan_width);
+    if (config->chan_width != NL80211_CHAN_WIDTH_20_NOHT)
+        NLA_PUT_U32(msg, NL80211_ATTR_CENTER_FREQ1, config->center_freq_1);
+
+    struct nlattr *ftm = nla_nest_start(msg, NL80211_ATTR_FTM_RESPONDER);
+    if (!ftm)
+        goto nla_put_failure;
+    NLA_PUT_FLAG(msg, NL80211_FTM_RESP_ATTR_ENABLED);
+    if (config->lci_len)
+        NLA_PUT(msg, NL80211_FTM_RESP_ATTR_LCI, config->lci_len, config->lci);
+    if (config->civic_len)
+        NLA_PUT(msg, NL80211_FTM_RESP_ATTR_CIVICLOC, config->civic_len,
+                config->civic);
+    nla_nest_end(msg, ftm);
+    return 0;
+nla_put_failure:
+    return 1;
+}
+
+int ftm_start_ap(const char *if_name, struct ftm_ap_config *config,
+                 char *error) {
+    uint32_t if_index = if_nametoindex(if_name);
+    if (!if_index) {
+        ftm_report_error(error, "Fail to find device interface %s!",
+                         if_name);
+        return 1;
+    }
+    if (!config->center_freq_1)
+        config->center_freq_1 = default_center_freq(config->center_freq,
+                                                    config->chan_width);
+
+    struct nl80211_state state = {0};
+    state.error = error;
+    if (nl80211_init(&state))
+        return 1;
+    int err = 1;
+    struct nl_msg *msg = NULL;
+    struct ap_interface info = {0};
+    if (send_if_cmd(&state, NL80211_CMD_GET_INTERFACE, if_index, -1,
+                    get_interface_handler, &info))
+        goto out;
+
+    /* the type can only change while the interface is down */
+    if (info.iftype != NL80211_IFTYPE_AP) {
+        if (set_link_up(if_name, false, error) ||
+            send_if_cmd(&state, NL80211_CMD_SET_INTERFACE, if_index,
+                        NL80211_IFTYPE_AP, NULL, NULL))
+            goto out;
+    }
+    if (set_link_up(if_name, true, error))
+        goto out;
+
+    /* beacon, channel and responder in a single request */
+    msg = nlmsg_alloc();
+    if (!msg) {
+        ftm_report_error(error, "Fail to allocate message!");
+        goto out;
+    }
+    if (!genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, state.nl80211_id, 0, 0,
+                     NL80211_CMD_START_AP, 0) ||
+        put_start_ap(msg, if_index, info.addr, config)) {
+        ftm_report_error(error, "Fail to build AP request!");
+        goto out;
+    }
+    err = nl_sock_handle(&state, msg, NULL, NULL);
+out:
+    if (msg)
+        nlmsg_free(msg);
+    nl80211_free(&state);
+    return err;
+}
+
+int ftm_stop_ap(const char *if_name, char *error) {
+    uint32_t if_index = if_nametoindex(if_name);
+    if (!if_index) {
+        ftm_report_error(error, "Fail to find device interface %s!",
+                         if_name);
+        return 1;
+    }
+    struct nl80211_state state = {0};
+    state.error = error;
+    if (nl80211_init(&state))
+        return 1;
+    int err = send_if_cmd(&state, NL80211_CMD_STOP_AP, if_index, -1, NULL,
+                          NULL);
+    nl80211_free(&state);
+    return err;
+}
+
+/* "0a1b..." into bytes, returns the length or -1 */
+static int parse_hex(const char *str, uint8_t *buf, int size) {
+    int len = strlen(str);
+    if (len % 2 || len / 2 > size)
+        return -1;
+    for (int i = 0; i < len / 2; i++) {
+        if (sscanf(str + 2 * i, "%2hhx", &buf[i]) != 1)
+            return -1;
+    }
+    return len / 2;
+}
+
+static void print_usage() {
+    printf("Valid args: [--ssid=<ssid>] [--freq=<MHz>] "
+           "[--bw=20_noht|20|40|80|160] [--cf1=<MHz>] "
+           "[--beacon-interval=<TU>] [--lci=<hex>] [--civic=<hex>] "
+           "<if_name>\n");
+}
+
+int ftm_ap_main(int argc, char **argv) {
+    static struct option long_options[] = {
+        {"ssid", required_argument, NULL, 's'},
+        {"freq", required_argument, NULL, 'f'},
+        {"bw", required_argument, NULL, 'b'},
+        {"cf1", required_argument, NULL, 'c'},
+        {"beacon-interval", required_argument, NULL, 'i'},
+        {"lci", required_argument, NULL, 'l'},
+        {"civic", required_argument, NULL, 'v'},
+        {NULL, 0, NULL, 0}
+    };
+    struct ftm_ap_config config;
+    ftm_ap_config_init(&config);
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 's':
+                if (strlen(optarg) > 32) {
+                    fprintf(stderr, "SSID longer than 32 bytes!\n");
+                    return 1;
+                }
+                strcpy(config.ssid, optarg);
+                break;
+            case 'f':
+                config.center_freq = atoi(optarg);
+                break;
+            case 'b':
+                config.chan_width = str_to_bw(optarg);
+                /* str_to_bw() falls back to 20_noht for anything else */
+                if (config.chan_width == NL80211_CHAN_WIDTH_20_NOHT &&
+                    strcasecmp(optarg, "20_noht")) {
+                    fprintf(stderr, "Invalid bandwidth %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'c':
+                config.center_freq_1 = atoi(optarg);
+                break;
+            case 'i':
+                config.beacon_interval = atoi(optarg);
+                break;
+            case 'l':
+                config.lci_len = parse_hex(optarg, config.lci,
+                                           sizeof(config.lci));
+                if (config.lci_len < 0) {
+                    fprintf(stderr, "Invalid LCI %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'v':
+                config.civic_len = parse_hex(optarg, config.civic,
+                                             sizeof(config.civic));
+                if (config.civic_len < 0) {
+                    fprintf(stderr, "Invalid civic location %s\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+    if (argc - optind != 1) {
+        printf("Invalid arguments!\n");
+        print_usage();
+        return 1;
+    }
+    /* 80+80 needs a second segment, which this AP does not set up */
+    if (config.chan_width == NL80211_CHAN_WIDTH_80P80 ||
+        config.chan_width == NL80211_CHAN_WIDTH_5 ||
+        config.chan_width == NL80211_CHAN_WIDTH_10) {
+        fprintf(stderr, "Unsupported bandwidth!\n");
+        return 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    char error[FTM_ERROR_MAX] = "";
+    if (ftm_start_ap(argv[optind], &config, error)) {
+        fprintf(stderr, "Fail to start AP: %s\n", error);
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("AP %s with FTM responder started on %s (%u MHz) in %.1f ms\n",
+           config.ssid, argv[optind], config.center_freq,
+           (end.tv_sec - start.tv_sec) * 1e3 +
+           (end.tv_nsec - start.tv_nsec) / 1e6);
+    return 0;
+}
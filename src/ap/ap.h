@@ -1,6 +1,95 @@
 #ifndef _FTM_AP_H
 #define _FTM_AP_H
 
+#include <stdint.h>
 #include "../nl/nl.h"
 
-#endif
\ No newline at end of file
+/**
+ * DOC: Minimal AP for FTM responders
+ * 
+ * An FTM responder needs a beaconing AP. Instead of running hostapd, the
+ * interface is switched to AP mode and started with a single
+ * NL80211_CMD_START_AP carrying the beacon, the channel and the FTM
+ * responder attributes (including LCI and civic location), so that the
+ * responder is ready as soon as the kernel acknowledges it.
+ * 
+ * The beacon advertises an open network without any station support: it
+ * only carries what initiators need to find the responder (SSID, rates,
+ * HT and VHT Operation for the channel, and the FTM responder bit of the
+ * Extended Capabilities). The AP keeps running after the process exits,
+ * until ftm_stop_ap().
+ */
+
+#define FTM_AP_DEFAULT_SSID "ftm-responder"
+#define FTM_AP_DEFAULT_FREQ 2412
+#define FTM_AP_DEFAULT_BEACON_INTERVAL 100
+#define FTM_AP_DEFAULT_DTIM_PERIOD 2
+#define FTM_AP_LOCATION_MAX 256
+
+/**
+ * struct ftm_ap_config - Config of the AP
+ * 
+ * @ssid: SSID, at most 32 bytes
+ * @center_freq: frequency of the primary channel in MHz
+ * @chan_width: @enum nl80211_chan_width, 20_NOHT leaves out HT and VHT
+ * @center_freq_1: center frequency of the channel, derived from
+ * @center_freq if 0
+ * @beacon_interval: in TU
+ * @dtim_period: in beacon intervals
+ * @lci: LCI report (Measurement Report element body) the responder
+ * returns, see NL80211_FTM_RESP_ATTR_LCI
+ * @lci_len: length of @lci, 0 for none
+ * @civic: civic location report, see NL80211_FTM_RESP_ATTR_CIVICLOC
+ * @civic_len: length of @civic, 0 for none
+ */
+struct ftm_ap_config {
+    char ssid[33];
+    uint32_t center_freq;
+    uint32_t chan_width;
+    uint32_t center_freq_1;
+    uint32_t beacon_interval;
+    uint32_t dtim_period;
+    uint8_t lci[FTM_AP_LOCATION_MAX];
+    int lci_len;
+    uint8_t civic[FTM_AP_LOCATION_MAX];
+    int civic_len;
+};
+
+/**
+ * ftm_ap_config_init - Fill a config with the defaults
+ */
+void ftm_ap_config_init(struct ftm_ap_config *config);
+
+/**
+ * ftm_start_ap - Start an AP with an FTM responder
+ * 
+ * @param if_name   Interface name of the wireless card
+ * @param config    config of the AP
+ * @param error     buffer of FTM_ERROR_MAX bytes receiving the error, or
+ * NULL to print it, see ftm_report_error()
+ * 
+ * @note
+ * The interface is switched to AP mode (taking it down if needed) and
+ * brought up.
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int ftm_start_ap(const char *if_name, struct ftm_ap_config *config,
+                 char *error);
+
+/**
+ * ftm_stop_ap - Stop the AP started by ftm_start_ap()
+ * 
+ * @param error     as of ftm_start_ap()
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int ftm_stop_ap(const char *if_name, char *error);
+
+/**
+ * ftm_ap_main - Entry of "ftm start_ap [options] <if_name>"
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int ftm_ap_main(int argc, char **argv);
+#endif
@@ -0,0 +1,1215 @@
+#define _GNU_SOURCE
+#include "archive.h"
+#include "../nl/nl.h"
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* records read from a binary stream at a time by "ftm archive" */
+#define PACK_BATCH 4096
+
+/**
+ * struct archive_pending - Records of a peer waiting for their block
+ * 
+ * @mac_addr: the peer
+ * @count: number of @records
+ * @records: ARCHIVE_BLOCK_RECORDS records
+ */
+struct archive_pending {
+    uint8_t mac_addr[6];
+    int count;
+    struct ftm_output_bin_record *records;
+};
+
+/* slicing-by-8: crc_table[k][b] is the crc of b followed by k zero bytes */
+static uint32_t crc_table[8][256];
+
+static void init_crc_table() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; j++)
+            crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+        crc_table[0][i] = crc;
+    }
+    for (int k = 1; k < 8; k++) {
+        for (int i = 0; i < 256; i++) {
+            uint32_t crc = crc_table[k - 1][i];
+            crc_table[k][i] = crc_table[0][crc & 0xff] ^ (crc >> 8);
+        }
+    }
+}
+
+uint32_t archive_crc32(const void *buf, size_t len) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, init_crc_table);
+    const uint8_t *pos = buf;
+    uint32_t crc = 0xffffffff;
+    for (; len >= 8; len -= 8, pos += 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, pos, 4);
+        memcpy(&hi, pos + 4, 4);
+        lo = le32toh(lo) ^ crc;
+        hi = le32toh(hi);
+        crc = crc_table[7][lo & 0xff] ^ crc_table[6][(lo >> 8) & 0xff] ^
+              crc_table[5][(lo >> 16) & 0xff] ^ crc_table[4][lo >> 24] ^
+              crc_table[3][hi & 0xff] ^ crc_table[2][(hi >> 8) & 0xff] ^
+              crc_table[1][(hi >> 16) & 0xff] ^ crc_table[0][hi >> 24];
+    }
+    while (len--)
+        crc = crc_table[0][(crc ^ *pos++) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffff;
+}
+
+static inline uint64_t zigzag(uint64_t value) {
+    return (value << 1) ^ (uint64_t)((int64_t)value >> 63);
+}
+
+static inline uint64_t unzigzag(uint64_t value) {
+    return (value >> 1) ^ -(value & 1);
+}
+
+static inline int varint_len(uint64_t value) {
+    int len = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        len++;
+    }
+    return len;
+}
+
+static inline uint8_t *put_varint(uint8_t *pos, uint64_t value) {
+    while (value >= 0x80) {
+        *pos++ = value | 0x80;
+        value >>= 7;
+    }
+    *pos++ = value;
+    return pos;
+}
+
+/* NULL if the varint runs past end or over 10 bytes */
+static inline const uint8_t *get_varint(const uint8_t *pos,
+                                        const uint8_t *end, uint64_t *value) {
+    if (pos < end && *pos < 0x80) {
+        *value = *pos;
+        return pos + 1;
+    }
+    uint64_t result = 0;
+    for (int shift = 0; shift < 70 && pos < end; shift += 7) {
+        uint8_t byte = *pos++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            *value = result;
+            return pos;
+        }
+    }
+    return NULL;
+}
+
+/* what a value becomes in a mode, updating the previous value and delta */
+static inline uint64_t mode_value(enum archive_mode mode, uint64_t value,
+                                  uint64_t *prev, uint64_t *delta) {
+    uint64_t d = value - *prev;
+    uint64_t out = mode == ARCHIVE_RAW ? value :
+                   mode == ARCHIVE_DELTA ? d : d - *delta;
+    *prev = value;
+    *delta = d;
+    return zigzag(out);
+}
+
+/* write a column in the mode taking the fewest bytes */
+static uint8_t *put_column(uint8_t *pos, const uint64_t *values, int count) {
+    size_t sizes[ARCHIVE_MODE_MAX];
+    for (int mode = 0; mode < ARCHIVE_CONST; mode++) {
+        uint64_t prev = 0, delta = 0;
+        sizes[mode] = 0;
+        for (int i = 0; i < count; i++)
+            sizes[mode] += varint_len(mode_value(mode, values[i], &prev,
+                                                 &delta));
+    }
+    sizes[ARCHIVE_CONST] = varint_len(zigzag(values[0]));
+    for (int i = 1; i < count; i++) {
+        if (values[i] != values[0]) {
+            sizes[ARCHIVE_CONST] = SIZE_MAX;
+            break;
+        }
+    }
+    enum archive_mode best = ARCHIVE_RAW;
+    for (int mode = 1; mode < ARCHIVE_MODE_MAX; mode++) {
+        if (sizes[mode] < sizes[best])
+            best = mode;
+    }
+    *pos++ = best;
+    if (best == ARCHIVE_CONST)
+        return put_varint(pos, zigzag(values[0]));
+    uint64_t prev = 0, delta = 0;
+    for (int i = 0; i < count; i++)
+        pos = put_varint(pos, mode_value(best, values[i], &prev, &delta));
+    return pos;
+}
+
+/* read a column, NULL if it is malformed */
+static const uint8_t *get_column(const uint8_t *pos, const uint8_t *end,
+                                 uint64_t *values, int count) {
+    if (pos >= end)
+        return NULL;
+    enum archive_mode mode = *pos++;
+    uint64_t prev = 0, delta = 0, value;
+    switch (mode) {
+        case ARCHIVE_RAW:
+            for (int i = 0; i < count; i++) {
+                if (!(pos = get_varint(pos, end, &value)))
+                    return NULL;
+                values[i] = unzigzag(value);
+            }
+            break;
+        case ARCHIVE_DELTA:
+            for (int i = 0; i < count; i++) {
+                if (!(pos = get_varint(pos, end, &value)))
+                    return NULL;
+                prev += unzigzag(value);
+                values[i] = prev;
+            }
+            break;
+        case ARCHIVE_DELTA2:
+            for (int i = 0; i < count; i++) {
+                if (!(pos = get_varint(pos, end, &value)))
+                    return NULL;
+                delta += unzigzag(value);
+                prev += delta;
+                values[i] = prev;
+            }
+            break;
+        case ARCHIVE_CONST:
+            if (!(pos = get_varint(pos, end, &value)))
+                return NULL;
+            for (int i = 0; i < count; i++)
+                values[i] = unzigzag(value);
+            break;
+        default:
+            return NULL;
+    }
+    return pos;
+}
+
+static inline uint32_t float_bits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static inline float bits_float(uint32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/* distance from rtt_avg corrected by rtt_correct, like the binary output */
+static float record_dist(const struct ftm_output_bin_record *record) {
+    if (!(record->present & (1u << FTM_RESP_FLAG_rtt_avg)))
+        return NAN;
+    int64_t correct = record->present & (1u << FTM_RESP_FLAG_rtt_correct) ?
+                      record->rtt_correct : 0;
+    return RTT_TO_DIST(record->rtt_avg + correct);
+}
+
+/* signed fields are sign extended so that small negatives stay small */
+#define __ARCHIVE_WIDEN_signed(value) ((uint64_t)(int64_t)(value))
+#define __ARCHIVE_WIDEN_unsigned(value) ((uint64_t)(value))
+
+size_t archive_encode_block(const struct ftm_output_bin_record *records,
+                            int count, uint8_t *buf) {
+    /* put_column() reads only count values, zeroed for the compiler */
+    uint64_t values[ARCHIVE_BLOCK_RECORDS] = {0};
+    uint8_t *pos = buf + sizeof(struct archive_block_header);
+#define __ARCHIVE_PUT(name, type, sign)                              \
+    for (int i = 0; i < count; i++)                                  \
+        values[i] = __ARCHIVE_WIDEN_##sign(records[i].name);         \
+    pos = put_column(pos, values, count);
+    ARCHIVE_COLUMNS(__ARCHIVE_PUT)
+    for (int i = 0; i < count; i++)
+        values[i] = float_bits(records[i].dist_truth);
+    pos = put_column(pos, values, count);
+    /* 0 unless dist was not computed the usual way */
+    for (int i = 0; i < count; i++)
+        values[i] = float_bits(records[i].dist) ^
+                    float_bits(record_dist(&records[i]));
+    pos = put_column(pos, values, count);
+
+    struct archive_block_header header = {
+        .magic = ARCHIVE_BLOCK_MAGIC,
+        .size = pos - buf - sizeof(header),
+        .count = count,
+    };
+    memcpy(header.mac_addr, records[0].mac_addr, 6);
+    header.crc = archive_crc32(buf + sizeof(header), header.size);
+    memcpy(buf, &header, sizeof(header));
+    return pos - buf;
+}
+
+size_t archive_block_size(const uint8_t *buf, size_t size) {
+    struct archive_block_header header;
+    if (size < sizeof(header))
+        return 0;
+    memcpy(&header, buf, sizeof(header));
+    if (header.magic != ARCHIVE_BLOCK_MAGIC || !header.count ||
+        header.count > ARCHIVE_BLOCK_RECORDS ||
+        header.size > ARCHIVE_BLOCK_MAX - sizeof(header) ||
+        header.size > size - sizeof(header))
+        return 0;
+    return sizeof(header) + header.size;
+}
+
+int archive_decode_block(const uint8_t *buf,
+                         struct ftm_output_bin_record *records) {
+    struct archive_block_header header;
+    memcpy(&header, buf, sizeof(header));
+    const uint8_t *pos = buf + sizeof(header);
+    const uint8_t *end = pos + header.size;
+    if (archive_crc32(pos, header.size) != header.crc)
+        return -1;
+
+    int count = header.count;
+    uint64_t values[ARCHIVE_BLOCK_RECORDS];
+#define __ARCHIVE_GET(name, type, sign)                 \
+    if (!(pos = get_column(pos, end, values, count)))  \
+        return -1;                                      \
+    for (int i = 0; i < count; i++)                     \
+        records[i].name = (type)values[i];
+    ARCHIVE_COLUMNS(__ARCHIVE_GET)
+    if (!(pos = get_column(pos, end, values, count)))
+        return -1;
+    for (int i = 0; i < count; i++) {
+        records[i].dist_truth = bits_float(values[i]);
+        memcpy(records[i].mac_addr, header.mac_addr, 6);
+    }
+    if (!(pos = get_column(pos, end, values, count)) || pos != end)
+        return -1;
+    for (int i = 0; i < count; i++)
+        records[i].dist = bits_float(values[i] ^
+                                     float_bits(record_dist(&records[i])));
+    return count;
+}
+
+static int write_all(int fd, const uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* 0 on success, 1 at the end before any byte, -1 if cut or on failure */
+static int read_all(int fd, void *buf, size_t len) {
+    uint8_t *pos = buf;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, pos + done, len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            return done ? -1 : 1;
+        done += n;
+    }
+    return 0;
+}
+
+struct archive_writer *alloc_archive_writer(int fd, int index_fd) {
+    struct archive_writer *writer = calloc(1, sizeof(struct archive_writer));
+    if (!writer)
+        return NULL;
+    writer->fd = fd;
+    writer->index_fd = index_fd;
+    writer->buf = malloc(ARCHIVE_BLOCK_MAX);
+    struct ftm_output_bin_header header = {
+        ARCHIVE_MAGIC, ARCHIVE_VERSION, sizeof(struct ftm_output_bin_record)
+    };
+    struct ftm_output_bin_header index_header = {
+        ARCHIVE_INDEX_MAGIC, ARCHIVE_VERSION,
+        sizeof(struct archive_index_entry)
+    };
+    if (!writer->buf ||
+        write_all(fd, (const uint8_t *)&header, sizeof(header)) ||
+        (index_fd >= 0 && write_all(index_fd, (const uint8_t *)&index_header,
+                                    sizeof(index_header)))) {
+        free(writer->buf);
+        free(writer);
+        return NULL;
+    }
+    writer->bytes = sizeof(header);
+    return writer;
+}
+
+/* the entry of a block, from its timestamps */
+static void fill_entry(struct archive_index_entry *entry, uint64_t offset,
+                       size_t size, const uint8_t *mac_addr, int count,
+                       const void *timestamps, size_t stride) {
+    entry->offset = offset;
+    entry->size = size;
+    memcpy(entry->mac_addr, mac_addr, 6);
+    entry->count = count;
+    entry->first_ns = UINT64_MAX;
+    entry->last_ns = 0;
+    for (int i = 0; i < count; i++) {
+        uint64_t ts;
+        memcpy(&ts, (const uint8_t *)timestamps + i * stride, sizeof(ts));
+        if (ts < entry->first_ns)
+            entry->first_ns = ts;
+        if (ts > entry->last_ns)
+            entry->last_ns = ts;
+    }
+}
+
+static int write_block(struct archive_writer *writer,
+                       struct archive_pending *peer) {
+    if (!peer->count)
+        return 0;
+    size_t size = archive_encode_block(peer->records, peer->count,
+                                       writer->buf);
+    struct archive_index_entry entry;
+    fill_entry(&entry, writer->bytes, size, peer->mac_addr, peer->count,
+               &peer->records[0].timestamp_ns,
+               sizeof(struct ftm_output_bin_record));
+    peer->count = 0;
+    if (write_all(writer->fd, writer->buf, size))
+        return 1;
+    writer->blocks++;
+    writer->bytes += size;
+    /* written after its block, the index never points past the archive */
+    if (writer->index_fd >= 0 &&
+        write_all(writer->index_fd, (const uint8_t *)&entry, sizeof(entry)))
+        return 1;
+    return 0;
+}
+
+static struct archive_pending *find_pending(struct archive_writer *writer,
+                                            const uint8_t *mac_addr) {
+    for (int i = 0; i < writer->peer_count; i++) {
+        if (!memcmp(writer->peers[i].mac_addr, mac_addr, 6))
+            return &writer->peers[i];
+    }
+    struct archive_pending *peers = realloc(writer->peers,
+                                            (writer->peer_count + 1) *
+                                            sizeof(struct archive_pending));
+    if (!peers)
+        return NULL;
+    writer->peers = peers;
+    struct archive_pending *peer = &peers[writer->peer_count];
+    peer->records = malloc(ARCHIVE_BLOCK_RECORDS *
+                           sizeof(struct ftm_output_bin_record));
+    if (!peer->records)
+        return NULL;
+    memcpy(peer->mac_addr, mac_addr, 6);
+    peer->count = 0;
+    writer->peer_count++;
+    return peer;
+}
+
+int archive_write(struct archive_writer *writer,
+                  const struct ftm_output_bin_record *record) {
+    struct archive_pending *peer = find_pending(writer, record->mac_addr);
+    if (!peer)
+        return 1;
+    peer->records[peer->count++] = *record;
+    if (peer->count == ARCHIVE_BLOCK_RECORDS)
+        return write_block(writer, peer);
+    return 0;
+}
+
+int archive_flush(struct archive_writer *writer) {
+    for (int i = 0; i < writer->peer_count; i++) {
+        if (write_block(writer, &writer->peers[i]))
+            return 1;
+    }
+    return 0;
+}
+
+void free_archive_writer(struct archive_writer *writer, char *error) {
+    if (!writer)
+        return;
+    if (archive_flush(writer))
+        ftm_report_error(error, "Fail to write archive: %s", strerror(errno));
+    for (int i = 0; i < writer->peer_count; i++)
+        free(writer->peers[i].records);
+    free(writer->peers);
+    free(writer->buf);
+    free(writer);
+}
+
+struct archive_reader *alloc_archive_reader(int fd) {
+    struct ftm_output_bin_header header;
+    if (read_all(fd, &header, sizeof(header)) ||
+        header.magic != ARCHIVE_MAGIC || header.version != ARCHIVE_VERSION ||
+        header.record_size != sizeof(struct ftm_output_bin_record))
+        return NULL;
+    struct archive_reader *reader = calloc(1, sizeof(struct archive_reader));
+    if (!reader)
+        return NULL;
+    reader->fd = fd;
+    reader->buf = malloc(ARCHIVE_BLOCK_MAX);
+    if (!reader->buf) {
+        free(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+int archive_read(struct archive_reader *reader,
+                 struct ftm_output_bin_record *records) {
+    struct archive_block_header header;
+    while (1) {
+        int err = read_all(reader->fd, reader->buf, sizeof(header));
+        if (err > 0)
+            return 0;
+        /* a block cut by the end was being written when the run stopped */
+        if (err < 0) {
+            reader->damaged++;
+            return 0;
+        }
+        memcpy(&header, reader->buf, sizeof(header));
+        if (header.magic != ARCHIVE_BLOCK_MAGIC ||
+            header.size > ARCHIVE_BLOCK_MAX - sizeof(header))
+            return -1;
+        err = read_all(reader->fd, reader->buf + sizeof(header), header.size);
+        if (err) {
+            reader->damaged++;
+            return err < 0 ? 0 : -1;
+        }
+        if (archive_block_size(reader->buf,
+                               sizeof(header) + header.size)) {
+            int count = archive_decode_block(reader->buf, records);
+            if (count > 0)
+                return count;
+        }
+        reader->damaged++;
+    }
+}
+
+void free_archive_reader(struct archive_reader *reader) {
+    if (!reader)
+        return;
+    free(reader->buf);
+    free(reader);
+}
+
+static int pread_all(int fd, void *buf, size_t len, uint64_t offset) {
+    uint8_t *pos = buf;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, pos + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 1;
+        done += n;
+    }
+    return 0;
+}
+
+/* read a block in full, 0 if it is cut or malformed */
+static size_t read_block(int fd, uint8_t *buf, uint64_t offset,
+                         uint64_t file_size) {
+    struct archive_block_header header;
+    if (offset + sizeof(header) > file_size ||
+        pread_all(fd, buf, sizeof(header), offset))
+        return 0;
+    memcpy(&header, buf, sizeof(header));
+    if (header.magic != ARCHIVE_BLOCK_MAGIC ||
+        header.size > ARCHIVE_BLOCK_MAX - sizeof(header) ||
+        offset + sizeof(header) + header.size > file_size ||
+        pread_all(fd, buf + sizeof(header), header.size,
+                  offset + sizeof(header)))
+        return 0;
+    return archive_block_size(buf, sizeof(header) + header.size);
+}
+
+static int check_header(int fd, uint32_t magic, uint16_t record_size) {
+    struct ftm_output_bin_header header;
+    return pread_all(fd, &header, sizeof(header), 0) ||
+           header.magic != magic || header.version != ARCHIVE_VERSION ||
+           header.record_size != record_size;
+}
+
+static int append_entry(struct archive_index *index, int *capacity,
+                        const struct archive_index_entry *entry) {
+    if (index->count == *capacity) {
+        int grown = *capacity ? *capacity * 2 : 64;
+        struct archive_index_entry *entries = realloc(index->entries,
+            grown * sizeof(struct archive_index_entry));
+        if (!entries)
+            return 1;
+        index->entries = entries;
+        *capacity = grown;
+    }
+    index->entries[index->count++] = *entry;
+    return 0;
+}
+
+/* the entries of the sidecar, checking that the last one is in the archive */
+static int read_index_file(int fd, int index_fd, uint64_t file_size,
+                           struct archive_index *index, int *capacity,
+                           uint8_t *buf, char *error) {
+    struct stat st;
+    if (fstat(index_fd, &st) ||
+        check_header(index_fd, ARCHIVE_INDEX_MAGIC,
+                     sizeof(struct archive_index_entry))) {
+        ftm_report_error(error, "Index is not the index of an archive!");
+        return 1;
+    }
+    size_t data = st.st_size - sizeof(struct ftm_output_bin_header);
+    int count = data / sizeof(struct archive_index_entry);
+    if (!count)
+        return 0;
+    index->entries = malloc(count * sizeof(struct archive_index_entry));
+    if (!index->entries ||
+        pread_all(index_fd, index->entries,
+                  count * sizeof(struct archive_index_entry),
+                  sizeof(struct ftm_output_bin_header))) {
+        ftm_report_error(error, "Fail to read index: %s", strerror(errno));
+        return 1;
+    }
+    index->count = *capacity = count;
+    struct archive_index_entry *last = &index->entries[count - 1];
+    struct archive_block_header header;
+    if (read_block(fd, buf, last->offset, file_size) != last->size ||
+        (memcpy(&header, buf, sizeof(header)), header.count != last->count) ||
+        memcmp(header.mac_addr, last->mac_addr, 6)) {
+        ftm_report_error(error, "Index does not match the archive, build it "
+                         "again with \"ftm archive --index\"!");
+        return 1;
+    }
+    index->end = last->offset + last->size;
+    return 0;
+}
+
+/* entries of the blocks past the end of the index, by their timestamps */
+static int index_blocks(int fd, uint64_t file_size,
+                        struct archive_index *index, int *capacity,
+                        uint8_t *buf, char *error) {
+    uint64_t timestamps[ARCHIVE_BLOCK_RECORDS];
+    while (index->end < file_size) {
+        size_t size = read_block(fd, buf, index->end, file_size);
+        if (!size) {
+            index->ignored = file_size - index->end;
+            break;
+        }
+        struct archive_block_header header;
+        memcpy(&header, buf, sizeof(header));
+        const uint8_t *payload = buf + sizeof(header);
+        /* damaged blocks cannot be queried, leave them out */
+        if (archive_crc32(payload, header.size) == header.crc &&
+            get_column(payload, payload + header.size, timestamps,
+                       header.count)) {
+            struct archive_index_entry entry;
+            fill_entry(&entry, index->end, size, header.mac_addr,
+                       header.count, timestamps, sizeof(uint64_t));
+            if (append_entry(index, capacity, &entry)) {
+                ftm_report_error(error, "Fail to allocate index!");
+                return 1;
+            }
+            index->appended++;
+        } else {
+            index->damaged++;
+        }
+        index->end += size;
+    }
+    return 0;
+}
+
+int load_archive_index(int fd, int index_fd, struct archive_index *index,
+                       char *error) {
+    memset(index, 0, sizeof(struct archive_index));
+    struct stat st;
+    if (fstat(fd, &st) || check_header(fd, ARCHIVE_MAGIC,
+                                       sizeof(struct ftm_output_bin_record))) {
+        ftm_report_error(error, "Input is not an archive!");
+        return 1;
+    }
+    uint8_t *buf = malloc(ARCHIVE_BLOCK_MAX);
+    if (!buf) {
+        ftm_report_error(error, "Fail to allocate index!");
+        return 1;
+    }
+    int capacity = 0;
+    index->end = sizeof(struct ftm_output_bin_header);
+    int err = (index_fd >= 0 &&
+               read_index_file(fd, index_fd, st.st_size, index, &capacity,
+                               buf, error)) ||
+              index_blocks(fd, st.st_size, index, &capacity, buf, error);
+    free(buf);
+    if (!err && index->count) {
+        index->max_last_ns = malloc(index->count * sizeof(uint64_t));
+        index->min_first_ns = malloc(index->count * sizeof(uint64_t));
+        err = !index->max_last_ns || !index->min_first_ns;
+        if (err)
+            ftm_report_error(error, "Fail to allocate index!");
+    }
+    if (err) {
+        free_archive_index(index);
+        return 1;
+    }
+    uint64_t bound = 0;
+    for (int i = 0; i < index->count; i++) {
+        if (index->entries[i].last_ns > bound)
+            bound = index->entries[i].last_ns;
+        index->max_last_ns[i] = bound;
+    }
+    bound = UINT64_MAX;
+    for (int i = index->count - 1; i >= 0; i--) {
+        if (index->entries[i].first_ns < bound)
+            bound = index->entries[i].first_ns;
+        index->min_first_ns[i] = bound;
+    }
+    return 0;
+}
+
+int write_archive_index(int index_fd, const struct archive_index *index) {
+    struct ftm_output_bin_header header = {
+        ARCHIVE_INDEX_MAGIC, ARCHIVE_VERSION,
+        sizeof(struct archive_index_entry)
+    };
+    return write_all(index_fd, (const uint8_t *)&header, sizeof(header)) ||
+           write_all(index_fd, (const uint8_t *)index->entries,
+                     index->count * sizeof(struct archive_index_entry));
+}
+
+void free_archive_index(struct archive_index *index) {
+    free(index->entries);
+    free(index->max_last_ns);
+    free(index->min_first_ns);
+    memset(index, 0, sizeof(struct archive_index));
+}
+
+static bool peer_wanted(const uint8_t *mac_addr, const uint8_t *peers,
+                        int peer_count) {
+    if (!peer_count)
+        return true;
+    for (int i = 0; i < peer_count; i++) {
+        if (!memcmp(mac_addr, peers + i * 6, 6))
+            return true;
+    }
+    return false;
+}
+
+int archive_query(int fd, const struct archive_index *index,
+                  uint64_t from_ns, uint64_t to_ns, const uint8_t *peers,
+                  int peer_count, archive_record_handler handler, void *arg,
+                  int *damaged, char *error) {
+    /* the first block whose results may reach from_ns */
+    int lo = 0, hi = index->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (index->max_last_ns[mid] < from_ns)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    uint8_t *buf = malloc(ARCHIVE_BLOCK_MAX);
+    struct ftm_output_bin_record *records = malloc(ARCHIVE_BLOCK_RECORDS *
+                                                   sizeof(*records));
+    if (!buf || !records) {
+        ftm_report_error(error, "Fail to allocate blocks!");
+        free(buf);
+        free(records);
+        return -1;
+    }
+    int decoded = 0;
+    bool stop = false;
+    *damaged = 0;
+    for (int i = lo; i < index->count && index->min_first_ns[i] < to_ns &&
+         !stop; i++) {
+        const struct archive_index_entry *entry = &index->entries[i];
+        if (entry->last_ns < from_ns || entry->first_ns >= to_ns ||
+            !peer_wanted(entry->mac_addr, peers, peer_count))
+            continue;
+        struct archive_block_header header;
+        if (read_block(fd, buf, entry->offset, index->end) != entry->size ||
+            (memcpy(&header, buf, sizeof(header)),
+             header.count != entry->count) ||
+            memcmp(header.mac_addr, entry->mac_addr, 6)) {
+            ftm_report_error(error, "Index does not match the archive at "
+                             "%lu!", entry->offset);
+            decoded = -1;
+            break;
+        }
+        int count = archive_decode_block(buf, records);
+        if (count < 0) {
+            (*damaged)++;
+            continue;
+        }
+        decoded++;
+        for (int j = 0; j < count && !stop; j++) {
+            if (records[j].timestamp_ns >= from_ns &&
+                records[j].timestamp_ns < to_ns)
+                stop = handler(&records[j], arg);
+        }
+    }
+    free(buf);
+    free(records);
+    return decoded;
+}
+
+static void print_usage() {
+    printf("Usage: ftm archive [--unpack] <input> <output>\n");
+    printf("  Compress a binary output into an archive and its index, or "
+           "with --unpack an\n  archive back into a binary output\n");
+    printf("Usage: ftm archive --index <archive>\n");
+    printf("  Build the index of an archive\n");
+    printf("Usage: ftm archive --query [--from=<time>] [--to=<time>] "
+           "[--peer=<mac_addr>]...\n"
+           "                   [--output=csv|ndjson|bin] <archive>\n");
+    printf("  Print the results within a time range, <time> being "
+           "\"YYYY-MM-DD HH:MM[:SS]\"\n  in local time or seconds since "
+           "the epoch\n");
+}
+
+static double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* binary output to archive, counting the records */
+static int pack(int in, int out, int index_fd, uint64_t *records) {
+    struct ftm_output_bin_header header;
+    if (read_all(in, &header, sizeof(header)) ||
+        header.magic != FTM_OUTPUT_BIN_MAGIC ||
+        header.version != FTM_OUTPUT_BIN_VERSION ||
+        header.record_size != sizeof(struct ftm_output_bin_record)) {
+        fprintf(stderr, "Input is not a binary output!\n");
+        return 1;
+    }
+    struct ftm_output_bin_record *batch = malloc(PACK_BATCH *
+                                                 sizeof(*batch));
+    struct archive_writer *writer = alloc_archive_writer(out, index_fd);
+    if (!batch || !writer) {
+        fprintf(stderr, "Fail to start archive: %s\n", strerror(errno));
+        free(batch);
+        free_archive_writer(writer, NULL);
+        return 1;
+    }
+    int err = 0;
+    size_t pending = 0;
+    while (!err) {
+        ssize_t n = read(in, (char *)batch + pending,
+                         PACK_BATCH * sizeof(*batch) - pending);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            err = n < 0;
+            break;
+        }
+        pending += n;
+        size_t count = pending / sizeof(*batch);
+        for (size_t i = 0; i < count && !err; i++)
+            err = archive_write(writer, &batch[i]);
+        *records += count;
+        pending -= count * sizeof(*batch);
+        memmove(batch, batch + count, pending);
+    }
+    if (pending)
+        fprintf(stderr, "Ignore %zu bytes of a cut record\n", pending);
+    if (!err)
+        err = archive_flush(writer);
+    if (err)
+        fprintf(stderr, "Fail to write archive: %s\n", strerror(errno));
+    free_archive_writer(writer, NULL);
+    free(batch);
+    return err;
+}
+
+/* archive to binary output, counting the records */
+static int unpack(int in, int out, uint64_t *records) {
+    struct archive_reader *reader = alloc_archive_reader(in);
+    struct ftm_output_bin_record *block = malloc(ARCHIVE_BLOCK_RECORDS *
+                                                 sizeof(*block));
+    if (!reader || !block) {
+        fprintf(stderr, "Input is not an archive!\n");
+        free_archive_reader(reader);
+        free(block);
+        return 1;
+    }
+    struct ftm_output_bin_header header = {
+        FTM_OUTPUT_BIN_MAGIC, FTM_OUTPUT_BIN_VERSION,
+        sizeof(struct ftm_output_bin_record)
+    };
+    int err = write_all(out, (const uint8_t *)&header, sizeof(header));
+    int count = 0;
+    while (!err && (count = archive_read(reader, block)) > 0) {
+        err = write_all(out, (const uint8_t *)block,
+                        count * sizeof(*block));
+        *records += count;
+    }
+    if (err)
+        fprintf(stderr, "Fail to write output: %s\n", strerror(errno));
+    else if (count < 0)
+        fprintf(stderr, "Archive is malformed after %lu records!\n",
+                *records);
+    if (reader->damaged)
+        fprintf(stderr, "Skip %lu damaged blocks\n", reader->damaged);
+    err = err || count < 0;
+    free_archive_reader(reader);
+    free(block);
+    return err;
+}
+
+static int open_index(const char *path, int flags) {
+    char index_path[PATH_MAX];
+    if (snprintf(index_path, sizeof(index_path), "%s" ARCHIVE_INDEX_SUFFIX,
+                 path) >= (int)sizeof(index_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return open(index_path, flags | O_CLOEXEC, 0644);
+}
+
+static int convert(const char *in_path, const char *out_path,
+                   bool unpacking) {
+    int in = open(in_path, O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        fprintf(stderr, "Fail to open %s: %s\n", in_path, strerror(errno));
+        return 1;
+    }
+    int out = open(out_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int index_fd = unpacking || out < 0 ? -1 :
+                   open_index(out_path, O_WRONLY | O_CREAT | O_TRUNC);
+    if (out < 0 || (!unpacking && index_fd < 0)) {
+        fprintf(stderr, "Fail to open %s: %s\n", out_path, strerror(errno));
+        close(in);
+        if (out >= 0)
+            close(out);
+        return 1;
+    }
+    uint64_t records = 0;
+    double start = now_s();
+    int err = unpacking ? unpack(in, out, &records) :
+                          pack(in, out, index_fd, &records);
+    double elapsed = now_s() - start;
+    off_t packed = lseek(unpacking ? in : out, 0, SEEK_CUR);
+    close(in);
+    if (close(out) || (index_fd >= 0 && close(index_fd)))
+        err = 1;
+    if (err)
+        return 1;
+
+    /* throughput counted in bytes of records, the larger side */
+    double raw = records * sizeof(struct ftm_output_bin_record);
+    printf("%lu records, %.0f bytes unpacked, %ld packed (%.2fx), "
+           "%.3f s, %.1f MB/s\n", records, raw, (long)packed,
+           packed > 0 ? raw / packed : 0.0, elapsed,
+           elapsed > 0 ? raw / elapsed / 1e6 : 0.0);
+    return 0;
+}
+
+/* what loading the index and the query left out */
+static void print_skipped(const struct archive_index *index, int damaged) {
+    if (index->ignored)
+        fprintf(stderr, "Ignore %lu bytes at the end of the archive\n",
+                index->ignored);
+    if (index->damaged + damaged)
+        fprintf(stderr, "Skip %d damaged blocks\n",
+                index->damaged + damaged);
+}
+
+static int build_index(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Fail to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    struct archive_index index;
+    double start = now_s();
+    int err = load_archive_index(fd, -1, &index, NULL);
+    close(fd);
+    if (err)
+        return 1;
+    print_skipped(&index, 0);
+    int index_fd = open_index(path, O_WRONLY | O_CREAT | O_TRUNC);
+    if (index_fd < 0 || write_archive_index(index_fd, &index) ||
+        close(index_fd)) {
+        fprintf(stderr, "Fail to write index: %s\n", strerror(errno));
+        free_archive_index(&index);
+        return 1;
+    }
+    printf("%d blocks indexed in %.3f s\n", index.count, now_s() - start);
+    free_archive_index(&index);
+    return 0;
+}
+
+/**
+ * struct query_result - Records matched by "ftm archive --query"
+ * 
+ * @records: the records
+ * @count: number of @records
+ * @capacity: room in @records
+ * @error: whether growing @records failed
+ */
+struct query_result {
+    struct ftm_output_bin_record *records;
+    size_t count;
+    size_t capacity;
+    bool error;
+};
+
+static int collect_record(const struct ftm_output_bin_record *record,
+                          void *arg) {
+    struct query_result *result = arg;
+    if (result->count == result->capacity) {
+        size_t grown = result->capacity ? result->capacity * 2 : 4096;
+        struct ftm_output_bin_record *records = realloc(result->records,
+            grown * sizeof(struct ftm_output_bin_record));
+        if (!records) {
+            result->error = true;
+            return 1;
+        }
+        result->records = records;
+        result->capacity = grown;
+    }
+    result->records[result->count++] = *record;
+    return 0;
+}
+
+/* in time order, the peers of a session in order of mac address */
+static int compare_record(const void *a, const void *b) {
+    const struct ftm_output_bin_record *x = a, *y = b;
+    if (x->timestamp_ns != y->timestamp_ns)
+        return x->timestamp_ns < y->timestamp_ns ? -1 : 1;
+    if (x->session != y->session)
+        return x->session < y->session ? -1 : 1;
+    return memcmp(x->mac_addr, y->mac_addr, 6);
+}
+
+static void record_to_resp(const struct ftm_output_bin_record *record,
+                           struct ftm_resp_attr *resp) {
+    memset(resp, 0, sizeof(struct ftm_resp_attr));
+    resp->present = record->present;
+    memcpy(resp->mac_addr, record->mac_addr, 6);
+#define __RECORD_FIELD(name, attr, type, nla, spec) resp->name = record->name;
+    FTM_RESP_FIELDS(__RECORD_FIELD)
+    resp->rtt_correct = record->rtt_correct;
+    resp->dist_truth = record->dist_truth;
+    resp->rx_time_ns = record->timestamp_ns;
+}
+
+/* write the records a session at a time, like start_measurement */
+static int write_records(struct ftm_output *output,
+                         const struct query_result *result) {
+    struct ftm_resp_attr *resps = NULL;
+    struct ftm_resp_attr **ptrs = NULL;
+    int capacity = 0, err = 0;
+    for (size_t i = 0; i < result->count && !err;) {
+        const struct ftm_output_bin_record *first = &result->records[i];
+        int count = 1;
+        /* the results of a session carry their own receive times */
+        while (i + count < result->count &&
+               first[count].session == first->session)
+            count++;
+        if (count > capacity) {
+            free(resps);
+            free(ptrs);
+            resps = malloc(count * sizeof(*resps));
+            ptrs = malloc(count * sizeof(*ptrs));
+            capacity = count;
+            if (!resps || !ptrs || ftm_output_resize(output, count)) {
+                err = 1;
+                break;
+            }
+        }
+        for (int j = 0; j < count; j++) {
+            record_to_resp(&first[j], &resps[j]);
+            ptrs[j] = &resps[j];
+        }
+        struct ftm_results_wrap wrap = {.results = ptrs, .count = count};
+        err = ftm_output_write(output, &wrap, first->session,
+                               first->timestamp_ns);
+        i += count;
+    }
+    free(resps);
+    free(ptrs);
+    return err;
+}
+
+/* "YYYY-MM-DD HH:MM[:SS]" in local time or seconds since the epoch */
+static int parse_time(const char *str, uint64_t *ns) {
+    static const char *formats[] = {
+        "%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M:%S",
+        "%Y-%m-%d %H:%M", "%Y-%m-%dT%H:%M",
+    };
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char *end = strptime(str, formats[i], &tm);
+        if (end && !*end) {
+            tm.tm_isdst = -1;
+            time_t t = mktime(&tm);
+            if (t < 0)
+                return 1;
+            *ns = t * 1000000000ull;
+            return 0;
+        }
+    }
+    char *end;
+    double seconds = strtod(str, &end);
+    if (end == str || *end || seconds < 0)
+        return 1;
+    *ns = seconds * 1e9;
+    return 0;
+}
+
+static int parse_mac(const char *str, uint8_t *mac_addr) {
+    int len = 0;
+    return sscanf(str, "%02hhx:%02hhx:%02hhx:%02hhx:%02hhx:%02hhx%n",
+                  &mac_addr[0], &mac_addr[1], &mac_addr[2], &mac_addr[3],
+                  &mac_addr[4], &mac_addr[5], &len) != 6 || str[len];
+}
+
+static int query(const char *path, uint64_t from_ns, uint64_t to_ns,
+                 const uint8_t *peers, int peer_count,
+                 enum ftm_output_format format) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Fail to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    double start = now_s();
+    int index_fd = open_index(path, O_RDONLY);
+    if (index_fd < 0)
+        fprintf(stderr, "No index for %s, reading every block\n", path);
+    struct archive_index index;
+    int err = load_archive_index(fd, index_fd, &index, NULL);
+    if (index_fd >= 0)
+        close(index_fd);
+    if (err) {
+        close(fd);
+        return 1;
+    }
+
+    struct query_result result = {NULL, 0, 0, false};
+    int damaged;
+    int decoded = archive_query(fd, &index, from_ns, to_ns, peers,
+                                peer_count, collect_record, &result,
+                                &damaged, NULL);
+    close(fd);
+    if (decoded >= 0)
+        print_skipped(&index, damaged);
+    err = decoded < 0 || result.error;
+    if (result.error)
+        fprintf(stderr, "Fail to allocate records!\n");
+    if (!err) {
+        qsort(result.records, result.count, sizeof(*result.records),
+              compare_record);
+        struct ftm_output *output = alloc_ftm_output(format, STDOUT_FILENO,
+                                                     1);
+        if (!output || write_records(output, &result)) {
+            fprintf(stderr, "Fail to write output!\n");
+            err = 1;
+        }
+        free_ftm_output(output);
+    }
+    if (!err) {
+        fprintf(stderr, "%zu records from %d of %d blocks in %.3f s\n",
+                result.count, decoded, index.count, now_s() - start);
+        if (index.appended)
+            fprintf(stderr, "%d blocks were not in the index, build it "
+                    "again with \"ftm archive --index\"\n", index.appended);
+    }
+    free(result.records);
+    free_archive_index(&index);
+    return err;
+}
+
+int ftm_archive_main(int argc, char **argv) {
+    static struct option options[] = {
+        {"unpack", no_argument, NULL, 'u'},
+        {"index", no_argument, NULL, 'i'},
+        {"query", no_argument, NULL, 'q'},
+        {"from", required_argument, NULL, 'f'},
+        {"to", required_argument, NULL, 't'},
+        {"peer", required_argument, NULL, 'p'},
+        {"output", required_argument, NULL, 'o'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    char mode = 0;
+    uint64_t from_ns = 0, to_ns = UINT64_MAX;
+    uint8_t *peers = NULL;
+    int peer_count = 0, format = FTM_OUTPUT_CSV, opt, err = 1;
+    optind = 1;
+    while ((opt = getopt_long(argc, argv, "uiqf:t:p:o:h", options,
+                              NULL)) != -1) {
+        switch (opt) {
+            case 'u':
+            case 'i':
+            case 'q':
+                if (mode && mode != opt)
+                    goto handle_usage;
+                mode = opt;
+                break;
+            case 'f':
+                if (parse_time(optarg, &from_ns))
+                    goto handle_usage;
+                break;
+            case 't':
+                if (parse_time(optarg, &to_ns))
+                    goto handle_usage;
+                break;
+            case 'p': {
+                uint8_t *grown = realloc(peers, (peer_count + 1) * 6);
+                if (!grown)
+                    goto handle_free;
+                peers = grown;
+                if (parse_mac(optarg, peers + peer_count * 6))
+                    goto handle_usage;
+                peer_count++;
+                break;
+            }
+            case 'o':
+                format = ftm_output_format_from_str(optarg);
+                /* a query is for reading, archive it again with --unpack */
+                if (format < 0 || format == FTM_OUTPUT_ARCHIVE)
+                    goto handle_usage;
+                break;
+            case 'h':
+                print_usage();
+                err = 0;
+                goto handle_free;
+            default:
+                goto handle_usage;
+        }
+    }
+
+    int args = argc - optind;
+    if (mode == 'q' && args == 1)
+        err = query(argv[optind], from_ns, to_ns, peers, peer_count, format);
+    else if (mode == 'i' && args == 1)
+        err = build_index(argv[optind]);
+    else if ((!mode || mode == 'u') && args == 2)
+        err = convert(argv[optind], argv[optind + 1], mode == 'u');
+    else
+        goto handle_usage;
+handle_free:
+    free(peers);
+    return err;
+handle_usage:
+    print_usage();
+    free(peers);
+    return 1;
+}
@@ -0,0 +1,377 @@
+#ifndef _FTM_ARCHIVE_H
+#define _FTM_ARCHIVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "../initiator/initiator_output.h"
+
+/**
+ * DOC: Compressed archives of results
+ * 
+ * An archive holds the records of the binary output (@struct
+ * ftm_output_bin_record) in a fraction of their size. It starts with a
+ * @struct ftm_output_bin_header carrying ARCHIVE_MAGIC and the size of the
+ * records it decodes to, followed by blocks.
+ * 
+ * A block holds up to ARCHIVE_BLOCK_RECORDS records of a single peer, in
+ * the order they were written, stored column by column: all the
+ * timestamps, then all the sessions, and so on for each field of
+ * ARCHIVE_COLUMNS. Each column is encoded with the mode of @enum
+ * archive_mode that gives the fewest bytes, as zigzag varints (7 bits per
+ * byte, the sign in the lowest bit), so a value that barely changes from
+ * one result to the next takes a single byte, and one that does not change
+ * takes a single byte for the block. dist_truth is stored by its bits, and
+ * dist by how its bits differ from the distance computed from rtt_avg and
+ * rtt_correct, nothing in practice, so decoding gives back the records
+ * byte for byte.
+ * 
+ * Each block starts with a @struct archive_block_header holding the crc32
+ * of its payload. A damaged block is reported and can be skipped without
+ * losing the blocks after it.
+ */
+
+/**
+ * DOC: Time index of an archive
+ * 
+ * The index of an archive is a sidecar file, "<archive>.idx", with a
+ * @struct ftm_output_bin_header carrying ARCHIVE_INDEX_MAGIC followed by
+ * one @struct archive_index_entry per block, in the order of the blocks.
+ * The writer of an archive appends to it as blocks are written.
+ * 
+ * Blocks are written as they fill, so their time ranges roughly follow
+ * the file order, except for the partial blocks flushed at the end and
+ * for steps of the clock. A loaded index holds, for each entry, the latest
+ * last_ns up to it and the earliest first_ns from it to the end, which are
+ * sorted whatever the order of the blocks: a query binary-searches the
+ * first block whose results may reach its start, walks from there until
+ * no later block can start before its end, and decodes only the blocks of
+ * the wanted peers that meet its range.
+ * 
+ * An archive written on stdout has no index, and an archive may be longer
+ * than its index if the writer stopped between a block and its entry:
+ * load_archive_index() indexes the blocks past the end of the index by
+ * decoding their timestamp column only.
+ */
+
+#define ARCHIVE_MAGIC 0x414d5446 /* "FTMA" */
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_BLOCK_MAGIC 0x42415446 /* "FTAB" */
+#define ARCHIVE_BLOCK_RECORDS 1024
+#define ARCHIVE_INDEX_MAGIC 0x49415446 /* "FTAI" */
+#define ARCHIVE_INDEX_SUFFIX ".idx"
+
+/*
+ * Integer fields of struct ftm_output_bin_record stored in a block, in
+ * order, with their type and whether it is signed or unsigned.
+ */
+#define ARCHIVE_COLUMNS(X)                        \
+    X(timestamp_ns, uint64_t, unsigned)           \
+    X(session, uint32_t, unsigned)                \
+    X(present, uint32_t, unsigned)                \
+    X(fail_reason, uint32_t, unsigned)            \
+    X(burst_index, uint32_t, unsigned)            \
+    X(num_ftmr_attempts, uint32_t, unsigned)      \
+    X(num_ftmr_successes, uint32_t, unsigned)     \
+    X(busy_retry_time, uint32_t, unsigned)        \
+    X(num_bursts_exp, uint8_t, unsigned)          \
+    X(burst_duration, uint8_t, unsigned)          \
+    X(ftms_per_burst, uint8_t, unsigned)          \
+    X(rssi_avg, int32_t, signed)                  \
+    X(rssi_spread, int32_t, signed)               \
+    X(rtt_avg, int64_t, signed)                   \
+    X(rtt_variance, uint64_t, unsigned)           \
+    X(rtt_spread, uint64_t, unsigned)             \
+    X(dist_avg, int64_t, signed)                  \
+    X(dist_variance, uint64_t, unsigned)          \
+    X(dist_spread, uint64_t, unsigned)            \
+    X(rtt_correct, int64_t, signed)
+
+/**
+ * enum archive_mode - How the values of a column are encoded
+ * 
+ * @ARCHIVE_RAW: each value
+ * @ARCHIVE_DELTA: the difference with the previous value
+ * @ARCHIVE_DELTA2: the difference between consecutive differences, for
+ * values growing at a steady pace like timestamps
+ * @ARCHIVE_CONST: a single value shared by the whole block
+ */
+enum archive_mode {
+    ARCHIVE_RAW,
+    ARCHIVE_DELTA,
+    ARCHIVE_DELTA2,
+    ARCHIVE_CONST,
+
+    /* keep last */
+    ARCHIVE_MODE_MAX
+};
+
+/**
+ * struct archive_block_header - Start of a block
+ * 
+ * @magic: ARCHIVE_BLOCK_MAGIC
+ * @size: bytes of payload following the header
+ * @count: number of records
+ * @mac_addr: peer of the records
+ * @crc: crc32 of the payload
+ */
+struct archive_block_header {
+    uint32_t magic;
+    uint32_t size;
+    uint16_t count;
+    uint8_t mac_addr[6];
+    uint32_t crc;
+} __attribute__((packed));
+
+/*
+ * upper bound of the size of a block, with every value taking 10 bytes,
+ * dist_truth and dist being the 2 columns after ARCHIVE_COLUMNS
+ */
+#define __ARCHIVE_COLUMN_COUNT(name, type, sign) + 1
+#define ARCHIVE_BLOCK_MAX                                              \
+    (sizeof(struct archive_block_header) +                             \
+     (0 ARCHIVE_COLUMNS(__ARCHIVE_COLUMN_COUNT) + 2) *                 \
+     (1 + 10 * ARCHIVE_BLOCK_RECORDS))
+
+/**
+ * archive_crc32 - crc32 (IEEE 802.3) of a buffer
+ */
+uint32_t archive_crc32(const void *buf, size_t len);
+
+/**
+ * archive_encode_block - Encode records of a peer into a block
+ * 
+ * @param records   records with the same mac_addr
+ * @param count     number of @records, at most ARCHIVE_BLOCK_RECORDS
+ * @param buf       room for ARCHIVE_BLOCK_MAX bytes
+ * 
+ * @return size of the block
+ */
+size_t archive_encode_block(const struct ftm_output_bin_record *records,
+                            int count, uint8_t *buf);
+
+/**
+ * archive_block_size - Size of the block starting a buffer
+ * 
+ * @param buf    start of the block
+ * @param size   bytes available in @buf
+ * 
+ * @return size of the block including its header, 0 if @buf does not
+ * start with a block header or the block is cut
+ */
+size_t archive_block_size(const uint8_t *buf, size_t size);
+
+/**
+ * archive_decode_block - Decode a block
+ * 
+ * @param buf       a block of archive_block_size() bytes
+ * @param records   room for ARCHIVE_BLOCK_RECORDS records
+ * 
+ * @return number of records, -1 if the block is damaged
+ */
+int archive_decode_block(const uint8_t *buf,
+                         struct ftm_output_bin_record *records);
+
+/**
+ * struct archive_writer - Streaming encoder
+ * 
+ * @fd: where the archive is written
+ * @index_fd: where its index is written, -1 for none
+ * @peers: records waiting for their block to fill, per peer
+ * @peer_count: number of @peers
+ * @buf: a block being written
+ * @blocks: blocks written
+ * @bytes: bytes written, including the header, which is the offset of the
+ * next block if @fd was empty
+ */
+struct archive_writer {
+    int fd;
+    int index_fd;
+    struct archive_pending *peers;
+    int peer_count;
+    uint8_t *buf;
+    uint64_t blocks;
+    uint64_t bytes;
+};
+
+/**
+ * alloc_archive_writer - Start an archive, writing its header
+ * 
+ * @param fd         where the archive is written, empty, left open by
+ *                   free_archive_writer()
+ * @param index_fd   where its index is written, empty, -1 for none, left
+ *                   open as well
+ * 
+ * @return a valid archive_writer pointer on success, NULL on failure
+ */
+struct archive_writer *alloc_archive_writer(int fd, int index_fd);
+
+/**
+ * archive_write - Add a record
+ * 
+ * @note
+ * The block of the peer is written once it holds ARCHIVE_BLOCK_RECORDS
+ * records, so the records of a peer sit in memory until then, or until
+ * archive_flush().
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int archive_write(struct archive_writer *writer,
+                  const struct ftm_output_bin_record *record);
+
+/**
+ * archive_flush - Write the pending records of every peer
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int archive_flush(struct archive_writer *writer);
+
+/**
+ * free_archive_writer - Flush and free a writer
+ * 
+ * @param writer   the writer, or NULL
+ * @param error    buffer of FTM_ERROR_MAX bytes receiving the reason if the
+ *                 pending records could not be written, see
+ *                 ftm_report_error()
+ */
+void free_archive_writer(struct archive_writer *writer, char *error);
+
+/**
+ * struct archive_reader - Streaming decoder
+ * 
+ * @fd: where the archive is read
+ * @buf: a block being read
+ * @damaged: blocks skipped because their crc did not match
+ */
+struct archive_reader {
+    int fd;
+    uint8_t *buf;
+    uint64_t damaged;
+};
+
+/**
+ * alloc_archive_reader - Open an archive, reading its header
+ * 
+ * @return a valid archive_reader pointer on success, NULL if @fd is not an
+ * archive or on failure
+ */
+struct archive_reader *alloc_archive_reader(int fd);
+
+/**
+ * archive_read - Read the next block
+ * 
+ * @param records   room for ARCHIVE_BLOCK_RECORDS records
+ * 
+ * @note
+ * Damaged blocks are skipped and counted in @damaged.
+ * 
+ * @return number of records, 0 at the end, -1 on failure
+ */
+int archive_read(struct archive_reader *reader,
+                 struct ftm_output_bin_record *records);
+
+void free_archive_reader(struct archive_reader *reader);
+
+/**
+ * struct archive_index_entry - A block in the index
+ * 
+ * @offset: offset of the block in the archive
+ * @first_ns: earliest timestamp_ns of its records
+ * @last_ns: latest timestamp_ns of its records
+ * @size: size of the block including its header
+ * @mac_addr: peer of its records
+ * @count: number of records
+ */
+struct archive_index_entry {
+    uint64_t offset;
+    uint64_t first_ns;
+    uint64_t last_ns;
+    uint32_t size;
+    uint8_t mac_addr[6];
+    uint16_t count;
+} __attribute__((packed));
+
+/**
+ * struct archive_index - A loaded index
+ * 
+ * @entries: the blocks, in file order
+ * @count: number of @entries
+ * @max_last_ns: largest last_ns of @entries up to each one
+ * @min_first_ns: smallest first_ns of @entries from each one to the end
+ * @end: offset past the last block
+ * @appended: entries indexed from the archive, missing from the sidecar
+ * @damaged: blocks past the sidecar left out because their crc did not
+ * match
+ * @ignored: bytes of a cut block left out at the end of the archive
+ */
+struct archive_index {
+    struct archive_index_entry *entries;
+    int count;
+    uint64_t *max_last_ns;
+    uint64_t *min_first_ns;
+    uint64_t end;
+    int appended;
+    int damaged;
+    uint64_t ignored;
+};
+
+/**
+ * load_archive_index - Load the index of an archive
+ * 
+ * @param fd         the archive
+ * @param index_fd   its sidecar index, -1 to index the whole archive
+ * @param index      filled with the blocks, free with free_archive_index()
+ * @param error      buffer of FTM_ERROR_MAX bytes, see ftm_report_error()
+ * 
+ * @note
+ * An index that does not match the archive fails, blocks past the end of
+ * the index are appended to it. Damaged and cut blocks are left out and
+ * counted in @index.
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int load_archive_index(int fd, int index_fd, struct archive_index *index,
+                       char *error);
+
+/**
+ * write_archive_index - Write a loaded index as a sidecar
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int write_archive_index(int index_fd, const struct archive_index *index);
+
+void free_archive_index(struct archive_index *index);
+
+typedef int (*archive_record_handler)(
+    const struct ftm_output_bin_record *record, void *arg);
+
+/**
+ * archive_query - Read the records of some peers within a time range
+ * 
+ * @param fd           the archive
+ * @param index        its index
+ * @param from_ns      start of the range, inclusive
+ * @param to_ns        end of the range, exclusive
+ * @param peers        mac addresses of the peers, 6 bytes each
+ * @param peer_count   number of @peers, 0 for all peers
+ * @param handler      called with each record in the range, in the order
+ *                     of the blocks, the query stops if it returns nonzero
+ * @param arg          passed to @handler
+ * @param damaged      receives the number of damaged blocks skipped
+ * @param error        buffer of FTM_ERROR_MAX bytes, see ftm_report_error()
+ * 
+ * @return number of blocks decoded, -1 on failure
+ */
+int archive_query(int fd, const struct archive_index *index,
+                  uint64_t from_ns, uint64_t to_ns, const uint8_t *peers,
+                  int peer_count, archive_record_handler handler, void *arg,
+                  int *damaged, char *error);
+
+/**
+ * ftm_archive_main - Entry of "ftm archive [--unpack] <input> <output>",
+ * "ftm archive --index <archive>" and "ftm archive --query [options]
+ * <archive>"
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int ftm_archive_main(int argc, char **argv);
+#endif
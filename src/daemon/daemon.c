@@ -0,0 +1,699 @@
+#include "daemon.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DAEMON_MAX_CLIENTS 256
+#define DAEMON_RETRY_SEC 1
+
+static struct ftm_daemon *running_daemon;
+
+static void stop_on_signal(int sig) {
+    if (running_daemon)
+        running_daemon->stop = 1;
+}
+
+static void format_addr(char *str, const uint8_t *addr) {
+    sprintf(str, "%02x:%02x:%02x:%02x:%02x:%02x",
+            addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
+}
+
+static int parse_addr(uint8_t *addr, const char *str) {
+    int consumed;
+    int res = sscanf(str, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx%n",
+                     &addr[0], &addr[1], &addr[2], &addr[3], &addr[4],
+                     &addr[5], &consumed);
+    return res != 6 || str[consumed];
+}
+
+/*
+ * Never blocks: a line that does not fit in the socket buffer is dropped,
+ * and a client that only took part of a line is disconnected, since its
+ * stream can no longer be parsed.
+ */
+static void client_send(struct daemon_client *client, const char *line,
+                        int len) {
+    if (client->closed)
+        return;
+    int n = send(client->fd, line, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n == len)
+        return;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        client->dropped++;
+        return;
+    }
+    client->closed = true;
+}
+
+static void client_printf(struct daemon_client *client, const char *fmt,
+                          ...) {
+    char line[DAEMON_LINE_MAX];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (len >= sizeof(line))
+        len = sizeof(line) - 1;
+    client_send(client, line, len);
+}
+
+static struct daemon_peer *find_peer(struct daemon_radio *radio,
+                                     const uint8_t *addr) {
+    for (struct daemon_peer *peer = radio->peers; peer; peer = peer->next) {
+        if (memcmp(peer->attr.mac_addr, addr, 6) == 0)
+            return peer;
+    }
+    return NULL;
+}
+
+static void remove_sub(struct daemon_peer *peer, struct daemon_client *client) {
+    struct daemon_sub **pos = &peer->subs;
+    while (*pos) {
+        struct daemon_sub *sub = *pos;
+        if (sub->client == client) {
+            *pos = sub->next;
+            free(sub);
+        } else {
+            pos = &sub->next;
+        }
+    }
+}
+
+/* drop peers no client is interested in anymore */
+static void prune_peers(struct daemon_radio *radio) {
+    struct daemon_peer **pos = &radio->peers;
+    while (*pos) {
+        struct daemon_peer *peer = *pos;
+        if (!peer->subs) {
+            *pos = peer->next;
+            free(peer);
+            radio->peer_count--;
+        } else {
+            pos = &peer->next;
+        }
+    }
+}
+
+/* copy the peers so that clients can change them during the session */
+static struct ftm_config *snapshot_config(struct daemon_radio *radio) {
+    struct ftm_config *config = malloc(sizeof(struct ftm_config));
+    if (!config)
+        return NULL;
+    config->interface_index = radio->if_index;
+    config->peer_count = 0;
+    config->peers = malloc(radio->peer_count * sizeof(struct ftm_peer_attr *));
+    if (!config->peers) {
+        free(config);
+        return NULL;
+    }
+    for (struct daemon_peer *peer = radio->peers; peer; peer = peer->next) {
+        struct ftm_peer_attr *attr = alloc_ftm_peer();
+        if (!attr) {
+            free_ftm_config(config);
+            return NULL;
+        }
+        memcpy(attr, &peer->attr, sizeof(struct ftm_peer_attr));
+        config->peers[config->peer_count++] = attr;
+    }
+    return config;
+}
+
+static int format_result(char *line, int size, struct daemon_radio *radio,
+                         struct ftm_resp_attr *resp) {
+    char addr[18], reason[12] = "-";
+    format_addr(addr, resp->mac_addr);
+    if (FTM_RESP_HAS(resp, fail_reason))
+        sprintf(reason, "%u", resp->fail_reason);
+
+#define __VALUE(name) (FTM_RESP_HAS(resp, name) ? resp->name : 0)
+
+    int64_t rtt = __VALUE(rtt_avg) + __VALUE(rtt_correct);
+    int len = snprintf(line, size,
+                       "RESULT %s %s fail_reason=%s rtt_avg=%ld "
+                       "rtt_variance=%lu rtt_spread=%lu rssi_avg=%d "
+                       "dist=%.3f rx_time_ns=%lu\n",
+                       radio->if_name, addr, reason, (int64_t)__VALUE(rtt_avg),
+                       (uint64_t)__VALUE(rtt_variance),
+                       (uint64_t)__VALUE(rtt_spread),
+                       (int32_t)__VALUE(rssi_avg),
+                       FTM_RESP_HAS(resp, rtt_avg) ?
+                       RTT_TO_DIST(rtt) : 0,
+                       (uint64_t)__VALUE(rx_time_ns));
+    return len < size ? len : size - 1;
+}
+
+/* fan the results out, called with the lock held */
+static void dispatch_results(struct daemon_radio *radio,
+                             struct ftm_results_wrap *results) {
+    char line[DAEMON_LINE_MAX];
+    for (int i = 0; i < results->count; i++) {
+        struct ftm_resp_attr *resp = results->results[i];
+        struct daemon_peer *peer = find_peer(radio, resp->mac_addr);
+        if (!peer)
+            continue;
+        peer->sessions++;
+        int len = format_result(line, sizeof(line), radio, resp);
+
+        struct daemon_sub **pos = &peer->subs;
+        while (*pos) {
+            struct daemon_sub *sub = *pos;
+            client_send(sub->client, line, len);
+            if (sub->remaining > 0 && --sub->remaining == 0) {
+                char addr[18];
+                format_addr(addr, resp->mac_addr);
+                client_printf(sub->client, "DONE %s %s\n", radio->if_name,
+                              addr);
+                *pos = sub->next;
+                free(sub);
+            } else {
+                pos = &sub->next;
+            }
+        }
+    }
+    prune_peers(radio);
+}
+
+static void notify_failure(struct daemon_radio *radio) {
+    for (struct daemon_peer *peer = radio->peers; peer; peer = peer->next) {
+        for (struct daemon_sub *sub = peer->subs; sub; sub = sub->next) {
+            client_printf(sub->client,
+                          "ERR %s session failed, retrying: %s\n",
+                          radio->if_name, ftm_ctx_error(radio->ctx));
+        }
+    }
+}
+
+static void wait_radio(struct daemon_radio *radio, int sec) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += sec;
+    pthread_cond_timedwait(&radio->cond, &radio->daemon->lock, &deadline);
+}
+
+static void *radio_thread(void *arg) {
+    struct daemon_radio *radio = arg;
+    struct ftm_daemon *daemon = radio->daemon;
+
+    pthread_mutex_lock(&daemon->lock);
+    while (!daemon->stop) {
+        if (!radio->peer_count) {
+            wait_radio(radio, DAEMON_RETRY_SEC);
+            continue;
+        }
+        struct ftm_config *config = snapshot_config(radio);
+        radio->busy = true;
+        pthread_mutex_unlock(&daemon->lock);
+
+        struct ftm_results_wrap *results = NULL;
+        if (config)
+            results = ftm_ctx_session(radio->ctx, config);
+
+        pthread_mutex_lock(&daemon->lock);
+        radio->busy = false;
+        if (!results) {
+            notify_failure(radio);
+            wait_radio(radio, DAEMON_RETRY_SEC);
+        } else {
+            radio->sessions++;
+            dispatch_results(radio, results);
+        }
+        if (config)
+            free_ftm_config(config);
+    }
+    pthread_mutex_unlock(&daemon->lock);
+    return NULL;
+}
+
+static struct daemon_radio *find_radio(struct ftm_daemon *daemon,
+                                       char **pos, char **save_ptr) {
+    if (!*pos || **pos != '@')
+        return &daemon->radios[0];
+    for (int i = 0; i < daemon->radio_count; i++) {
+        if (strcmp(daemon->radios[i].if_name, *pos + 1) == 0) {
+            *pos = strtok_r(NULL, " \t", save_ptr);
+            return &daemon->radios[i];
+        }
+    }
+    return NULL;
+}
+
+static void add_request(struct ftm_daemon *daemon,
+                        struct daemon_client *client,
+                        struct daemon_radio *radio, char *peer_config,
+                        int remaining) {
+    struct ftm_peer_attr *attr = alloc_ftm_peer();
+    if (!attr) {
+        client_printf(client, "ERR out of memory\n");
+        return;
+    }
+    char error[FTM_ERROR_MAX];
+    if (!peer_config) {
+        client_printf(client, "ERR missing peer config\n");
+        free(attr);
+        return;
+    }
+    if (parse_peer_config(attr, peer_config, error)) {
+        client_printf(client, "ERR invalid peer config: %s\n", error);
+        free(attr);
+        return;
+    }
+
+    char addr[18];
+    format_addr(addr, attr->mac_addr);
+    struct daemon_peer *peer = find_peer(radio, attr->mac_addr);
+    bool shared = peer != NULL;
+    if (peer && !ftm_peer_attr_equal(&peer->attr, attr)) {
+        /* the attributes can only change under the client alone on it */
+        for (struct daemon_sub *sub = peer->subs; sub; sub = sub->next) {
+            if (sub->client != client) {
+                client_printf(client, "ERR peer %s measured with other "
+                                      "attributes\n", addr);
+                free(attr);
+                return;
+            }
+        }
+        memcpy(&peer->attr, attr, sizeof(struct ftm_peer_attr));
+        shared = false;
+    }
+    if (!peer) {
+        peer = malloc(sizeof(struct daemon_peer));
+        if (!peer) {
+            client_printf(client, "ERR out of memory\n");
+            free(attr);
+            return;
+        }
+        memcpy(&peer->attr, attr, sizeof(struct ftm_peer_attr));
+        peer->subs = NULL;
+        peer->sessions = 0;
+        peer->next = radio->peers;
+        radio->peers = peer;
+        radio->peer_count++;
+    }
+    free(attr);
+
+    /* a client asking again for the same peer replaces its request */
+    remove_sub(peer, client);
+    struct daemon_sub *sub = malloc(sizeof(struct daemon_sub));
+    if (!sub) {
+        client_printf(client, "ERR out of memory\n");
+        prune_peers(radio);
+        return;
+    }
+    sub->client = client;
+    sub->remaining = remaining;
+    sub->next = peer->subs;
+    peer->subs = sub;
+
+    client_printf(client, "OK %s %s%s\n", radio->if_name, addr,
+                  shared ? " shared" : "");
+    pthread_cond_signal(&radio->cond);
+}
+
+static void list_peers(struct ftm_daemon *daemon,
+                       struct daemon_client *client) {
+    int count = 0;
+    for (int i = 0; i < daemon->radio_count; i++)
+        count += daemon->radios[i].peer_count;
+    client_printf(client, "OK %d\n", count);
+    for (int i = 0; i < daemon->radio_count; i++) {
+        struct daemon_radio *radio = &daemon->radios[i];
+        for (struct daemon_peer *peer = radio->peers; peer;
+             peer = peer->next) {
+            int subs = 0;
+            for (struct daemon_sub *sub = peer->subs; sub; sub = sub->next)
+                subs++;
+            char addr[18];
+            format_addr(addr, peer->attr.mac_addr);
+            client_printf(client, "PEER %s %s clients=%d sessions=%lu\n",
+                          radio->if_name, addr, subs, peer->sessions);
+        }
+    }
+}
+
+/* called with the lock held */
+static void handle_command(struct ftm_daemon *daemon,
+                           struct daemon_client *client, char *line) {
+    char *save_ptr;
+    char *cmd = strtok_r(line, " \t", &save_ptr);
+    if (!cmd)
+        return;
+    if (strcasecmp(cmd, "PEERS") == 0) {
+        list_peers(daemon, client);
+        return;
+    }
+
+    char *pos = strtok_r(NULL, " \t", &save_ptr);
+    struct daemon_radio *radio = find_radio(daemon, &pos, &save_ptr);
+    if (!radio) {
+        client_printf(client, "ERR unknown interface %s\n", pos + 1);
+        return;
+    }
+
+    if (strcasecmp(cmd, "SUBSCRIBE") == 0) {
+        /* give the rest of the line, untokenized, to the config parser */
+        if (pos && save_ptr && *save_ptr)
+            pos[strlen(pos)] = ' ';
+        add_request(daemon, client, radio, pos, FTM_ATTEMPTS_INF);
+    } else if (strcasecmp(cmd, "MEASURE") == 0) {
+        char *tmp;
+        int attempts = pos ? strtol(pos, &tmp, 0) : 0;
+        if (!pos || *tmp || attempts <= 0) {
+            client_printf(client, "ERR invalid attempts\n");
+            return;
+        }
+        add_request(daemon, client, radio, save_ptr, attempts);
+    } else if (strcasecmp(cmd, "UNSUBSCRIBE") == 0) {
+        uint8_t addr[6];
+        struct daemon_peer *peer;
+        if (!pos || parse_addr(addr, pos) ||
+            !(peer = find_peer(radio, addr))) {
+            client_printf(client, "ERR unknown peer\n");
+            return;
+        }
+        remove_sub(peer, client);
+        prune_peers(radio);
+        client_printf(client, "OK %s %s\n", radio->if_name, pos);
+    } else {
+        client_printf(client, "ERR unknown command %s\n", cmd);
+    }
+}
+
+static void accept_client(struct ftm_daemon *daemon, int count) {
+    int fd = accept(daemon->listen_fd, NULL, NULL);
+    if (fd < 0)
+        return;
+    if (count >= DAEMON_MAX_CLIENTS) {
+        close(fd);
+        return;
+    }
+    struct daemon_client *client = calloc(1, sizeof(struct daemon_client));
+    if (!client) {
+        close(fd);
+        return;
+    }
+    client->fd = fd;
+    pthread_mutex_lock(&daemon->lock);
+    client->next = daemon->clients;
+    daemon->clients = client;
+    pthread_mutex_unlock(&daemon->lock);
+}
+
+static void read_client(struct ftm_daemon *daemon,
+                        struct daemon_client *client) {
+    int n = read(client->fd, client->buf + client->buf_len,
+                 sizeof(client->buf) - client->buf_len - 1);
+    if (n <= 0) {
+        if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+            pthread_mutex_lock(&daemon->lock);
+            client->closed = true;
+            pthread_mutex_unlock(&daemon->lock);
+        }
+        return;
+    }
+    client->buf_len += n;
+    client->buf[client->buf_len] = '\0';
+
+    pthread_mutex_lock(&daemon->lock);
+    char *line = client->buf, *end;
+    while ((end = strchr(line, '\n'))) {
+        *end = '\0';
+        if (end > line && end[-1] == '\r')
+            end[-1] = '\0';
+        handle_command(daemon, client, line);
+        line = end + 1;
+    }
+    client->buf_len -= line - client->buf;
+    memmove(client->buf, line, client->buf_len);
+    if (client->buf_len == sizeof(client->buf) - 1)
+        client->closed = true;
+    pthread_mutex_unlock(&daemon->lock);
+}
+
+static void remove_closed_clients(struct ftm_daemon *daemon) {
+    pthread_mutex_lock(&daemon->lock);
+    struct daemon_client **pos = &daemon->clients;
+    while (*pos) {
+        struct daemon_client *client = *pos;
+        if (!client->closed) {
+            pos = &client->next;
+            continue;
+        }
+        for (int i = 0; i < daemon->radio_count; i++) {
+            struct daemon_radio *radio = &daemon->radios[i];
+            for (struct daemon_peer *peer = radio->peers; peer;
+                 peer = peer->next) {
+                remove_sub(peer, client);
+            }
+            prune_peers(radio);
+        }
+        *pos = client->next;
+        close(client->fd);
+        free(client);
+    }
+    pthread_mutex_unlock(&daemon->lock);
+}
+
+static int serve_clients(struct ftm_daemon *daemon) {
+    struct pollfd fds[DAEMON_MAX_CLIENTS + 1];
+    struct daemon_client *clients[DAEMON_MAX_CLIENTS];
+
+    while (!daemon->stop) {
+        /* only this thread adds or removes clients */
+        int count = 0;
+        fds[0].fd = daemon->listen_fd;
+        fds[0].events = POLLIN;
+        for (struct daemon_client *client = daemon->clients;
+             client && count < DAEMON_MAX_CLIENTS; client = client->next) {
+            clients[count] = client;
+            fds[count + 1].fd = client->fd;
+            fds[count + 1].events = POLLIN;
+            count++;
+        }
+
+        int ready = poll(fds, count + 1, 500);
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Fail to poll clients: %s\n", strerror(errno));
+            return 1;
+        }
+        for (int i = 0; i < count; i++) {
+            if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))
+                read_client(daemon, clients[i]);
+        }
+        if (fds[0].revents & POLLIN)
+            accept_client(daemon, count);
+        remove_closed_clients(daemon);
+    }
+    return 0;
+}
+
+static int open_socket(struct ftm_daemon *daemon) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(daemon->path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long!\n", daemon->path);
+        return 1;
+    }
+    strcpy(addr.sun_path, daemon->path);
+
+    daemon->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (daemon->listen_fd < 0) {
+        fprintf(stderr, "Fail to create socket: %s\n", strerror(errno));
+        return 1;
+    }
+    unlink(daemon->path);
+    if (bind(daemon->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        listen(daemon->listen_fd, 16)) {
+        fprintf(stderr, "Fail to listen on %s: %s\n", daemon->path,
+                strerror(errno));
+        close(daemon->listen_fd);
+        return 1;
+    }
+    return 0;
+}
+
+static int init_radio(struct ftm_daemon *daemon, struct daemon_radio *radio,
+                      const char *if_name) {
+    radio->daemon = daemon;
+    snprintf(radio->if_name, sizeof(radio->if_name), "%s", if_name);
+    radio->if_index = if_nametoindex(if_name);
+    if (!radio->if_index) {
+        fprintf(stderr, "Fail to find device interface %s!\n", if_name);
+        return 1;
+    }
+    radio->ctx = ftm_ctx_new(NULL);
+    if (!radio->ctx)
+        return 1;
+    /* subscriptions outlive the interface going down and up */
+    if (ftm_ctx_set_event_watch(radio->ctx, true)) {
+        fprintf(stderr, "Fail to watch radio events of %s: %s\n", if_name,
+                ftm_ctx_error(radio->ctx));
+        ftm_ctx_free(radio->ctx);
+        radio->ctx = NULL;
+        return 1;
+    }
+    pthread_cond_init(&radio->cond, NULL);
+    return 0;
+}
+
+int ftm_daemon_main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("Invalid arguments!\n");
+        printf("Valid args: <socket_path> <if_name> [<if_name>...]\n");
+        return 1;
+    }
+    struct ftm_daemon daemon = {0};
+    daemon.path = argv[1];
+    daemon.radio_count = argc - 2;
+    daemon.radios = calloc(daemon.radio_count, sizeof(struct daemon_radio));
+    if (!daemon.radios)
+        return 1;
+    pthread_mutex_init(&daemon.lock, NULL);
+
+    int err = 0, started = 0;
+    for (int i = 0; i < daemon.radio_count; i++) {
+        if (init_radio(&daemon, &daemon.radios[i], argv[i + 2])) {
+            err = 1;
+            goto clean_up;
+        }
+        started++;
+    }
+    if (open_socket(&daemon)) {
+        err = 1;
+        goto clean_up;
+    }
+
+    running_daemon = &daemon;
+    signal(SIGINT, stop_on_signal);
+    signal(SIGTERM, stop_on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    int threads = 0;
+    for (; threads < daemon.radio_count; threads++) {
+        struct daemon_radio *radio = &daemon.radios[threads];
+        if (pthread_create(&radio->thread, NULL, radio_thread, radio)) {
+            fprintf(stderr, "Fail to start thread for %s!\n", radio->if_name);
+            daemon.stop = 1;
+            err = 1;
+            break;
+        }
+    }
+    printf("Listening on %s\n", daemon.path);
+    fflush(stdout);
+    if (!err)
+        err = serve_clients(&daemon);
+
+    /*
+     * A thread in the middle of a session may wait a long time for the
+     * kernel. Leave it to the process exit rather than blocking shutdown.
+     */
+    daemon.stop = 1;
+    bool busy = false;
+    pthread_mutex_lock(&daemon.lock);
+    for (int i = 0; i < threads; i++) {
+        pthread_cond_signal(&daemon.radios[i].cond);
+        busy |= daemon.radios[i].busy;
+    }
+    pthread_mutex_unlock(&daemon.lock);
+    close(daemon.listen_fd);
+    unlink(daemon.path);
+    if (busy)
+        return err;
+    for (int i = 0; i < threads; i++)
+        pthread_join(daemon.radios[i].thread, NULL);
+    running_daemon = NULL;
+
+    while (daemon.clients) {
+        daemon.clients->closed = true;
+        remove_closed_clients(&daemon);
+    }
+
+clean_up:
+    for (int i = 0; i < started; i++) {
+        ftm_ctx_free(daemon.radios[i].ctx);
+        pthread_cond_destroy(&daemon.radios[i].cond);
+    }
+    free(daemon.radios);
+    pthread_mutex_destroy(&daemon.lock);
+    return err;
+}
+
+int ftm_client_main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("Invalid arguments!\n");
+        printf("Valid args: <socket_path> <command> [<args>...]\n");
+        return 1;
+    }
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(argv[1]) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long!\n", argv[1]);
+        return 1;
+    }
+    strcpy(addr.sun_path, argv[1]);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        fprintf(stderr, "Fail to connect to %s: %s\n", argv[1],
+                strerror(errno));
+        return 1;
+    }
+
+    char line[DAEMON_LINE_MAX];
+    int len = 0;
+    for (int i = 2; i < argc; i++) {
+        len += snprintf(line + len, sizeof(line) - len, "%s%s", argv[i],
+                        i == argc - 1 ? "\n" : " ");
+        if (len >= sizeof(line)) {
+            fprintf(stderr, "Command too long!\n");
+            close(fd);
+            return 1;
+        }
+    }
+    if (write(fd, line, len) != len) {
+        fprintf(stderr, "Fail to send command!\n");
+        close(fd);
+        return 1;
+    }
+
+    /* PEERS: "OK <n>" then n lines; MEASURE: until DONE; others: one line */
+    const char *cmd = argv[2];
+    bool subscribe = strcasecmp(cmd, "SUBSCRIBE") == 0;
+    bool measure = strcasecmp(cmd, "MEASURE") == 0;
+    bool peers = strcasecmp(cmd, "PEERS") == 0;
+    int lines_left = -1;
+    int err = 0;
+    bool replied = false;
+    FILE *stream = fdopen(fd, "r");
+    while (stream && fgets(line, sizeof(line), stream)) {
+        fputs(line, stdout);
+        fflush(stdout);
+        /* later ERR lines of a measurement are failed sessions */
+        if (strncmp(line, "ERR", 3) == 0 &&
+            (!replied || (!subscribe && !measure))) {
+            err = 1;
+            break;
+        }
+        replied = true;
+        if (peers && lines_left < 0) {
+            lines_left = atoi(line + 3);
+        } else if (peers) {
+            lines_left--;
+        }
+        if (peers && lines_left == 0)
+            break;
+        if (measure && strncmp(line, "DONE", 4) == 0)
+            break;
+        if (!peers && !measure && !subscribe)
+            break;
+    }
+    if (stream)
+        fclose(stream);
+    else
+        close(fd);
+    return err;
+}
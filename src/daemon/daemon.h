@@ -0,0 +1,155 @@
+#ifndef _FTM_DAEMON_H
+#define _FTM_DAEMON_H
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include "../initiator/initiator_config.h"
+#include "../initiator/initiator_start.h"
+
+/**
+ * DOC: ftmd, a long-running measurement daemon
+ * 
+ * The daemon opens one nl80211 socket per radio at startup and keeps it for
+ * its whole lifetime. Local clients connect to a Unix domain socket and send
+ * line-based commands:
+ * 
+ * SUBSCRIBE [@<if_name>] <peer config>
+ *     measure the peer continuously and stream its results
+ * MEASURE [@<if_name>] <attempts> <peer config>
+ *     measure the peer for the given number of sessions, then send DONE
+ * UNSUBSCRIBE [@<if_name>] <mac_addr>
+ *     stop receiving results of the peer
+ * PEERS
+ *     list the peers being measured
+ * 
+ * <peer config> uses the syntax of a line of the config file. @<if_name>
+ * selects the radio, the first one by default.
+ * 
+ * Requests for the same mac address and attributes on a radio are merged
+ * into a single peer of the shared session, and every result is sent to all
+ * clients interested in the peer. A request with other attributes for a peer
+ * that other clients are measuring is refused with ERR; a client alone on a
+ * peer reconfigures it by asking again:
+ * 
+ * RESULT <if_name> <mac_addr> fail_reason=<reason|-> rtt_avg=<ps>
+ *     rtt_variance=<ps^2> rtt_spread=<ps> rssi_avg=<dbm> dist=<m>
+ *     rx_time_ns=<ns>
+ * 
+ * Each command is answered with a line starting with OK or ERR. Clients
+ * that do not read fast enough lose result lines instead of slowing the
+ * measurement down.
+ */
+
+#define DAEMON_LINE_MAX 512
+
+/**
+ * struct daemon_client - A connected client
+ * 
+ * @fd: connection, written with MSG_DONTWAIT
+ * @buf: partial command line
+ * @buf_len: length of @buf
+ * @dropped: result lines lost because the client was not reading
+ * @closed: set when the connection is to be closed, under the lock of
+ * the daemon
+ */
+struct daemon_client {
+    int fd;
+    char buf[DAEMON_LINE_MAX];
+    int buf_len;
+    uint64_t dropped;
+    bool closed;
+    struct daemon_client *next;
+};
+
+/**
+ * struct daemon_sub - Interest of a client in a peer
+ * 
+ * @client: the client
+ * @remaining: sessions left, FTM_ATTEMPTS_INF for a subscription
+ */
+struct daemon_sub {
+    struct daemon_client *client;
+    int remaining;
+    struct daemon_sub *next;
+};
+
+/**
+ * struct daemon_peer - A peer in the shared session of a radio
+ * 
+ * @attr: attributes, set by the first request
+ * @subs: interested clients
+ * @sessions: sessions the peer was measured in
+ */
+struct daemon_peer {
+    struct ftm_peer_attr attr;
+    struct daemon_sub *subs;
+    uint64_t sessions;
+    struct daemon_peer *next;
+};
+
+/**
+ * struct daemon_radio - A wireless interface owned by the daemon
+ * 
+ * @if_name: interface name
+ * @if_index: interface index
+ * @ctx: measurement context, its socket is kept for the lifetime of the
+ * daemon
+ * @peers: peers of the shared session
+ * @peer_count: number of peers
+ * @sessions: completed sessions
+ * @busy: a session is running without the lock held
+ * @cond: signaled when peers are added or the daemon stops
+ * @thread: measurement thread
+ */
+struct daemon_radio {
+    char if_name[IF_NAMESIZE];
+    uint64_t if_index;
+    struct ftm_ctx *ctx;
+    struct daemon_peer *peers;
+    int peer_count;
+    uint64_t sessions;
+    bool busy;
+    pthread_cond_t cond;
+    pthread_t thread;
+    struct ftm_daemon *daemon;
+};
+
+/**
+ * struct ftm_daemon - Daemon state
+ * 
+ * @lock: protects the peers of every radio and the clients
+ * @listen_fd: listening Unix socket
+ * @path: path of the socket
+ * @radio_count: number of radios
+ * @radios: radios
+ * @clients: connected clients
+ * @stop: set to stop the daemon
+ */
+struct ftm_daemon {
+    pthread_mutex_t lock;
+    int listen_fd;
+    const char *path;
+    int radio_count;
+    struct daemon_radio *radios;
+    struct daemon_client *clients;
+    volatile sig_atomic_t stop;
+};
+
+/**
+ * ftm_daemon_main - Entry of "ftm daemon <socket_path> <if_name>..."
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int ftm_daemon_main(int argc, char **argv);
+
+/**
+ * ftm_client_main - Entry of "ftm client <socket_path> <command>..."
+ * 
+ * Sends one command to a daemon and prints the replies, until the command
+ * is finished (or forever for SUBSCRIBE).
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int ftm_client_main(int argc, char **argv);
+#endif
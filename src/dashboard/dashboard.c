@@ -0,0 +1,295 @@
+#include "dashboard.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../initiator/initiator_start.h"
+
+struct frame {
+    char *buf;
+    int size;
+    int len;
+    int lines;
+    bool tty;
+};
+
+static void append(struct frame *out, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int room = out->len < out->size ? out->size - out->len : 0;
+    int n = vsnprintf(room ? out->buf + out->len : NULL, room, fmt, args);
+    va_end(args);
+    if (n > 0)
+        out->len += n;
+}
+
+/* end a line, clearing what is left of the previous frame on it */
+static void end_line(struct frame *out) {
+    append(out, out->tty ? "\033[K\n" : "\n");
+    out->lines++;
+}
+
+#define __LINE(out, ...)          \
+    do {                          \
+        append(out, __VA_ARGS__); \
+        end_line(out);            \
+    } while (0)
+
+#define __DASH_PRINT(out, resp, attr_name, specifier)                      \
+    do {                                                                   \
+        if (FTM_RESP_HAS(resp, attr_name))                                 \
+            __LINE(out, "%-19s%" #specifier, #attr_name, resp->attr_name); \
+        else                                                               \
+            __LINE(out, "%-19snon-exist", #attr_name);                     \
+    } while (0)
+
+static void render_peer(struct frame *out, int idx,
+                        struct dashboard_peer *peer) {
+    struct ftm_resp_attr *resp = &peer->resp;
+    __LINE(out, "");
+    __LINE(out, "MEASUREMENT RESULT FOR TARGET #%d", idx);
+    if (!peer->has_resp) {
+        __LINE(out, "waiting for results");
+        return;
+    }
+    if (FTM_RESP_HAS(resp, mac_addr)) {
+        uint8_t *addr = resp->mac_addr;
+        __LINE(out, "%-19s%02hhx:%02hhx:%02hhx:%02hhx:%02hhx:%02hhx",
+               "mac_addr", addr[0], addr[1], addr[2], addr[3], addr[4],
+               addr[5]);
+    }
+    __DASH_PRINT(out, resp, fail_reason, u);
+    __DASH_PRINT(out, resp, burst_index, u);
+    __DASH_PRINT(out, resp, num_ftmr_attempts, u);
+    __DASH_PRINT(out, resp, num_ftmr_successes, u);
+    __DASH_PRINT(out, resp, busy_retry_time, u);
+    __DASH_PRINT(out, resp, num_bursts_exp, u);
+    __DASH_PRINT(out, resp, burst_duration, u);
+    __DASH_PRINT(out, resp, ftms_per_burst, u);
+    __DASH_PRINT(out, resp, rssi_avg, d);
+    __DASH_PRINT(out, resp, rssi_spread, d);
+    __DASH_PRINT(out, resp, rtt_avg, ld);
+    __DASH_PRINT(out, resp, rtt_variance, lu);
+    __DASH_PRINT(out, resp, rtt_spread, lu);
+    __DASH_PRINT(out, resp, dist_avg, ld);
+    __DASH_PRINT(out, resp, dist_variance, lu);
+    __DASH_PRINT(out, resp, dist_spread, lu);
+
+    __LINE(out, "");
+    __LINE(out, "----Processed data----");
+    float dist = 0;
+    float corrected_dist = 0;
+    int64_t rtt_corrected_value = 0;
+    bool rtt_correct = FTM_RESP_HAS(resp, rtt_correct);
+    if (FTM_RESP_HAS(resp, rtt_avg)) {
+        dist = RTT_TO_DIST(resp->rtt_avg);
+        if (rtt_correct)
+            corrected_dist = RTT_TO_DIST(resp->rtt_avg + resp->rtt_correct);
+        if (FTM_RESP_HAS(resp, dist_truth))
+            rtt_corrected_value = DIST_TO_RTT(dist - resp->dist_truth);
+    }
+    __LINE(out, "%-19s%.3f", "dist", dist);
+    if (peer->rtt_count) {
+        __LINE(out, "%-19s%ld", "rtt_avg", peer->rtt_avg);
+        __LINE(out, "%-19s%-7.3f", "dist_avg", RTT_TO_DIST(peer->rtt_avg));
+    }
+    if (rtt_correct)
+        __LINE(out, "%-19s%.3f", "corrected_dist", corrected_dist);
+    if (rtt_correct && peer->rtt_count) {
+        int64_t corrected_rtt = peer->rtt_avg + resp->rtt_correct;
+        __LINE(out, "%-19s%ld", "corrected_rtt_avg", corrected_rtt);
+        __LINE(out, "%-19s%-7.3f", "corrected_dist_avg",
+               RTT_TO_DIST(corrected_rtt));
+    }
+    if (FTM_RESP_HAS(resp, dist_truth))
+        __LINE(out, "%-19s%ld", "rtt_corrected_val", rtt_corrected_value);
+}
+
+static void render(struct dashboard *dashboard, struct frame *out,
+                   int attempt_idx, int peer_count) {
+    out->len = 0;
+    out->lines = 0;
+    /* draw over the previous frame */
+    if (out->tty && dashboard->last_lines)
+        append(out, "\033[%dA\r", dashboard->last_lines);
+    if (dashboard->attempts == FTM_ATTEMPTS_INF)
+        __LINE(out, "SESSION %d", attempt_idx + 1);
+    else
+        __LINE(out, "SESSION %d/%d", attempt_idx + 1, dashboard->attempts);
+    for (int i = 0; i < peer_count; i++)
+        render_peer(out, i, &dashboard->snapshot[i]);
+    if (out->tty)
+        append(out, "\033[J");
+}
+
+static int write_all(int fd, const char *buf, int len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void draw_frame(struct dashboard *dashboard) {
+    pthread_mutex_lock(&dashboard->lock);
+    if (dashboard->version == dashboard->rendered) {
+        pthread_mutex_unlock(&dashboard->lock);
+        return;
+    }
+    /* the peers may have grown with a reload */
+    if (dashboard->snapshot_size < dashboard->peer_count) {
+        struct dashboard_peer *snapshot = realloc(
+            dashboard->snapshot,
+            dashboard->peer_count * sizeof(struct dashboard_peer));
+        if (!snapshot) {
+            pthread_mutex_unlock(&dashboard->lock);
+            return;
+        }
+        dashboard->snapshot = snapshot;
+        dashboard->snapshot_size = dashboard->peer_count;
+    }
+    memcpy(dashboard->snapshot, dashboard->peers,
+           dashboard->peer_count * sizeof(struct dashboard_peer));
+    int peer_count = dashboard->peer_count;
+    int attempt_idx = dashboard->attempt_idx;
+    dashboard->rendered = dashboard->version;
+    pthread_mutex_unlock(&dashboard->lock);
+
+    struct frame out = {dashboard->buf, dashboard->buf_size, 0, 0,
+                        dashboard->tty};
+    render(dashboard, &out, attempt_idx, peer_count);
+    if (out.len >= out.size) {
+        char *buf = realloc(dashboard->buf, out.len + 1);
+        if (!buf)
+            return;
+        dashboard->buf = out.buf = buf;
+        dashboard->buf_size = out.size = out.len + 1;
+        render(dashboard, &out, attempt_idx, peer_count);
+    }
+    if (write_all(dashboard->fd, out.buf, out.len))
+        return;
+    dashboard->last_lines = out.lines;
+    dashboard->frames++;
+}
+
+static void *render_thread(void *arg) {
+    struct dashboard *dashboard = arg;
+    long period = 1000000000L / dashboard->fps;
+    struct timespec next, now;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (!__atomic_load_n(&dashboard->stop, __ATOMIC_RELAXED)) {
+        next.tv_nsec += period;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        /* after a slow frame, skip the missed ticks instead of catching up */
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > next.tv_sec ||
+            (now.tv_sec == next.tv_sec && now.tv_nsec > next.tv_nsec))
+            next = now;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        draw_frame(dashboard);
+    }
+    return NULL;
+}
+
+struct dashboard *alloc_dashboard(struct ftm_config *config, int attempts,
+                                  int fd, int fps) {
+    struct dashboard *dashboard = calloc(1, sizeof(struct dashboard));
+    if (!dashboard)
+        return NULL;
+    dashboard->peer_count = config->peer_count;
+    dashboard->attempts = attempts;
+    dashboard->fd = fd;
+    dashboard->tty = isatty(fd);
+    dashboard->fps = fps > 0 ? fps : DASHBOARD_DEFAULT_FPS;
+    /* frames are appended to a pipe or a file, keep them few */
+    if (!dashboard->tty && dashboard->fps > DASHBOARD_PIPE_FPS)
+        dashboard->fps = DASHBOARD_PIPE_FPS;
+    dashboard->peers = calloc(config->peer_count,
+                              sizeof(struct dashboard_peer));
+    dashboard->snapshot = calloc(config->peer_count,
+                                 sizeof(struct dashboard_peer));
+    dashboard->snapshot_size = config->peer_count;
+    /* about 30 lines per peer, grown by draw_frame() if needed */
+    dashboard->buf_size = 64 + config->peer_count * 2048;
+    dashboard->buf = malloc(dashboard->buf_size);
+    if (!dashboard->peers || !dashboard->snapshot || !dashboard->buf)
+        goto handle_free;
+    pthread_mutex_init(&dashboard->lock, NULL);
+
+    /* keep what was printed with stdio above the dashboard */
+    fflush(stdout);
+    if (pthread_create(&dashboard->thread, NULL, render_thread, dashboard)) {
+        fprintf(stderr, "Fail to start dashboard thread!\n");
+        pthread_mutex_destroy(&dashboard->lock);
+        goto handle_free;
+    }
+    return dashboard;
+handle_free:
+    free(dashboard->peers);
+    free(dashboard->snapshot);
+    free(dashboard->buf);
+    free(dashboard);
+    return NULL;
+}
+
+void free_dashboard(struct dashboard *dashboard) {
+    if (!dashboard)
+        return;
+    __atomic_store_n(&dashboard->stop, true, __ATOMIC_RELAXED);
+    pthread_join(dashboard->thread, NULL);
+    draw_frame(dashboard);
+    pthread_mutex_destroy(&dashboard->lock);
+    free(dashboard->peers);
+    free(dashboard->snapshot);
+    free(dashboard->buf);
+    free(dashboard);
+}
+
+void dashboard_update(struct dashboard *dashboard, int idx, int attempt_idx,
+                      struct ftm_resp_attr *resp, int64_t rtt_avg,
+                      int rtt_count) {
+    if (idx < 0 || idx >= dashboard->peer_count)
+        return;
+    struct dashboard_peer *peer = &dashboard->peers[idx];
+    pthread_mutex_lock(&dashboard->lock);
+    memcpy(&peer->resp, resp, sizeof(struct ftm_resp_attr));
+    peer->has_resp = true;
+    peer->rtt_avg = rtt_avg;
+    peer->rtt_count = rtt_count;
+    dashboard->attempt_idx = attempt_idx;
+    dashboard->version++;
+    pthread_mutex_unlock(&dashboard->lock);
+}
+
+int dashboard_remap_peers(struct dashboard *dashboard,
+                          struct ftm_config *config, const int *map) {
+    struct dashboard_peer *peers =
+        calloc(config->peer_count ? config->peer_count : 1,
+               sizeof(struct dashboard_peer));
+    if (!peers)
+        return 1;
+    pthread_mutex_lock(&dashboard->lock);
+    for (int i = 0; i < config->peer_count; i++) {
+        if (map[i] >= 0 && map[i] < dashboard->peer_count)
+            peers[i] = dashboard->peers[map[i]];
+    }
+    struct dashboard_peer *old = dashboard->peers;
+    dashboard->peers = peers;
+    dashboard->peer_count = config->peer_count;
+    dashboard->version++;
+    pthread_mutex_unlock(&dashboard->lock);
+    free(old);
+    return 0;
+}
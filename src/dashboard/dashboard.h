@@ -0,0 +1,133 @@
+#ifndef _FTM_DASHBOARD_H
+#define _FTM_DASHBOARD_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "../initiator/initiator_types.h"
+
+/**
+ * DOC: Terminal dashboard
+ * 
+ * The measurement thread only copies the latest result of each peer into
+ * the dashboard with dashboard_update(). A render thread wakes up at most
+ * @fps times per second, takes a snapshot of the peers if anything
+ * changed, formats the whole frame into one buffer and draws it with a
+ * single write(). A slow terminal therefore drops frames instead of
+ * slowing the measurement down.
+ * 
+ * If the output is not a terminal, such as a pipe or a file, frames are
+ * appended one after another without cursor escapes, at most
+ * @DASHBOARD_PIPE_FPS times per second, and the final frame is written by
+ * free_dashboard().
+ */
+
+#define DASHBOARD_DEFAULT_FPS 10
+#define DASHBOARD_PIPE_FPS 1
+
+/**
+ * struct dashboard_peer - Latest state of a peer
+ * 
+ * @resp: latest result
+ * @has_resp: whether @resp is set
+ * @rtt_avg: average of the non-zero rtt of all sessions so far
+ * @rtt_count: number of sessions in @rtt_avg
+ */
+struct dashboard_peer {
+    struct ftm_resp_attr resp;
+    bool has_resp;
+    int64_t rtt_avg;
+    int rtt_count;
+};
+
+/**
+ * struct dashboard - Dashboard state
+ * 
+ * @lock: protects @peers, @peer_count, @attempt_idx and @version
+ * @peers: state written by the measurement thread
+ * @attempt_idx: index of the latest session
+ * @version: bumped by every update
+ * @snapshot: copy of @peers taken by the render thread
+ * @snapshot_size: capacity of @snapshot
+ * @rendered: @version of the last frame
+ * @peer_count: number of peers
+ * @attempts: total sessions, FTM_ATTEMPTS_INF if endless
+ * @fd: output, usually stdout
+ * @tty: whether @fd is a terminal
+ * @fps: maximum frames per second, at most @DASHBOARD_PIPE_FPS if not @tty
+ * @buf: frame buffer
+ * @buf_size: size of @buf
+ * @last_lines: lines of the previous frame, to draw over it
+ * @frames: frames drawn
+ * @stop: set to stop the render thread
+ * @thread: render thread
+ */
+struct dashboard {
+    pthread_mutex_t lock;
+    struct dashboard_peer *peers;
+    int attempt_idx;
+    uint64_t version;
+
+    struct dashboard_peer *snapshot;
+    int snapshot_size;
+    uint64_t rendered;
+    int peer_count;
+    int attempts;
+    int fd;
+    bool tty;
+    int fps;
+    char *buf;
+    int buf_size;
+    int last_lines;
+    uint64_t frames;
+
+    bool stop;
+    pthread_t thread;
+};
+
+/**
+ * alloc_dashboard - Allocate a dashboard and start its render thread
+ * 
+ * @param config     config of the measurement
+ * @param attempts   total sessions, shown in the header
+ * @param fd         output, usually STDOUT_FILENO
+ * @param fps        maximum frames per second, 0 for the default
+ * 
+ * @return a valid dashboard pointer on success, NULL on failure
+ */
+struct dashboard *alloc_dashboard(struct ftm_config *config, int attempts,
+                                  int fd, int fps);
+
+/**
+ * free_dashboard - Draw the final frame, stop the thread and free
+ * 
+ * @note
+ * Accepts NULL.
+ */
+void free_dashboard(struct dashboard *dashboard);
+
+/**
+ * dashboard_update - Record the latest result of a peer
+ * 
+ * @param dashboard     the dashboard
+ * @param idx           index of the peer in the config
+ * @param attempt_idx   index of the session
+ * @param resp          the result
+ * @param rtt_avg       average rtt of the peer so far
+ * @param rtt_count     number of sessions in @rtt_avg, 0 if none
+ */
+void dashboard_update(struct dashboard *dashboard, int idx, int attempt_idx,
+                      struct ftm_resp_attr *resp, int64_t rtt_avg,
+                      int rtt_count);
+
+/**
+ * dashboard_remap_peers - Follow the peers of a reloaded config
+ * 
+ * @param config   the new config
+ * @param map      see ftm_config_peer_map()
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int dashboard_remap_peers(struct dashboard *dashboard,
+                          struct ftm_config *config, const int *map);
+#endif
@@ -0,0 +1,659 @@
+#include "discover.h"
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../initiator/initiator_config.h"
+
+/* element ids, IEEE 802.11-2020 9.4.2 */
+#define IE_SSID 0
+#define IE_HT_OPERATION 61
+#define IE_EXT_CAPABILITIES 127
+#define IE_VHT_OPERATION 192
+#define IE_EXTENSION 255
+#define IE_EXT_HE_OPERATION 36
+
+/* HE Operation Parameters */
+#define HE_OP_VHT_INFO_PRESENT (1 << 14)
+#define HE_OP_COHOSTED_BSS (1 << 15)
+#define HE_OP_6GHZ_INFO_PRESENT (1 << 17)
+
+/**
+ * struct discover_cache_header - Header of a discover cache file
+ *
+ * @magic: DISCOVER_CACHE_MAGIC
+ * @version: DISCOVER_CACHE_VERSION
+ * @bss_size: sizeof(struct discover_bss) of the writer
+ * @if_index: interface the results belong to
+ * @timestamp: struct discover_result.timestamp
+ * @count: number of struct discover_bss following the header
+ */
+struct discover_cache_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t bss_size;
+    uint64_t if_index;
+    int64_t timestamp;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+#define DISCOVER_CACHE_MAGIC 0x43445446 /* "FTDC" */
+#define DISCOVER_CACHE_VERSION 1
+
+static uint32_t channel_to_freq(uint32_t primary_freq, int channel) {
+    if (primary_freq > 5950)
+        return 5950 + channel * 5;
+    if (primary_freq > 4900)
+        return 5000 + channel * 5;
+    return channel == 14 ? 2484 : 2407 + channel * 5;
+}
+
+/* 80, 160 or 80+80 from the center channels of two segments */
+static void set_wide_channel(struct discover_bss *bss, int seg0, int seg1) {
+    if (!seg1) {
+        bss->chan_width = NL80211_CHAN_WIDTH_80;
+        bss->center_freq_1 = channel_to_freq(bss->center_freq, seg0);
+    } else if (abs(seg1 - seg0) == 8) {
+        bss->chan_width = NL80211_CHAN_WIDTH_160;
+        bss->center_freq_1 = channel_to_freq(bss->center_freq, seg1);
+    } else {
+        bss->chan_width = NL80211_CHAN_WIDTH_80P80;
+        bss->center_freq_1 = channel_to_freq(bss->center_freq, seg0);
+        bss->center_freq_2 = channel_to_freq(bss->center_freq, seg1);
+    }
+}
+
+static void parse_ht_operation(struct discover_bss *bss, const uint8_t *ht,
+                               int len) {
+    bss->preamble = NL80211_PREAMBLE_HT;
+    bss->chan_width = NL80211_CHAN_WIDTH_20;
+    /* secondary channel offset, if any width is allowed */
+    if (len < 2 || !(ht[1] & 0x04))
+        return;
+    if ((ht[1] & 0x03) == 1) {
+        bss->chan_width = NL80211_CHAN_WIDTH_40;
+        bss->center_freq_1 = bss->center_freq + 10;
+    } else if ((ht[1] & 0x03) == 3) {
+        bss->chan_width = NL80211_CHAN_WIDTH_40;
+        bss->center_freq_1 = bss->center_freq - 10;
+    }
+}
+
+static void parse_vht_operation(struct discover_bss *bss,
+                                const uint8_t *vht, int len) {
+    if (len < 3)
+        return;
+    bss->preamble = NL80211_PREAMBLE_VHT;
+    switch (vht[0]) {
+        case 1:
+            set_wide_channel(bss, vht[1], vht[2]);
+            break;
+        /* deprecated encodings of 160 and 80+80 */
+        case 2:
+            bss->chan_width = NL80211_CHAN_WIDTH_160;
+            bss->center_freq_1 = channel_to_freq(bss->center_freq, vht[1]);
+            break;
+        case 3:
+            bss->chan_width = NL80211_CHAN_WIDTH_80P80;
+            bss->center_freq_1 = channel_to_freq(bss->center_freq, vht[1]);
+            bss->center_freq_2 = channel_to_freq(bss->center_freq, vht[2]);
+            break;
+        /* 20 or 40, given by the HT Operation */
+        default:
+            break;
+    }
+}
+
+static void parse_he_operation(struct discover_bss *bss, const uint8_t *he,
+                               int len) {
+    if (len < 6)
+        return;
+    bss->preamble = NL80211_PREAMBLE_HE;
+    uint32_t params = he[0] | he[1] << 8 | he[2] << 16;
+    /* parameters, BSS color and basic HE-MCS set come first */
+    int pos = 6;
+    if (params & HE_OP_VHT_INFO_PRESENT)
+        pos += 3;
+    if (params & HE_OP_COHOSTED_BSS)
+        pos += 1;
+    /* 6 GHz has neither HT nor VHT Operation */
+    if (!(params & HE_OP_6GHZ_INFO_PRESENT) || len < pos + 5)
+        return;
+    const uint8_t *info = he + pos;
+    bss->center_freq_1 = 0;
+    bss->center_freq_2 = 0;
+    switch (info[1] & 0x03) {
+        case 0:
+            bss->chan_width = NL80211_CHAN_WIDTH_20;
+            break;
+        case 1:
+            bss->chan_width = NL80211_CHAN_WIDTH_40;
+            bss->center_freq_1 = channel_to_freq(bss->center_freq, info[2]);
+            break;
+        case 2:
+            bss->chan_width = NL80211_CHAN_WIDTH_80;
+            bss->center_freq_1 = channel_to_freq(bss->center_freq, info[2]);
+            break;
+        case 3:
+            set_wide_channel(bss, info[2], info[3]);
+            break;
+    }
+}
+
+static void parse_ies(struct discover_bss *bss, const uint8_t *ie, int len) {
+    const uint8_t *ht = NULL, *vht = NULL, *he = NULL;
+    int ht_len = 0, vht_len = 0, he_len = 0;
+    while (len >= 2 && ie[1] + 2 <= len) {
+        int id = ie[0], elen = ie[1];
+        const uint8_t *data = ie + 2;
+        switch (id) {
+            case IE_SSID:
+                if (elen <= 32) {
+                    memcpy(bss->ssid, data, elen);
+                    bss->ssid[elen] = '\0';
+                }
+                break;
+            case IE_EXT_CAPABILITIES:
+                if (elen > DISCOVER_EXT_CAPA_FTM_RESPONDER / 8)
+                    bss->ftm_responder =
+                        data[DISCOVER_EXT_CAPA_FTM_RESPONDER / 8] &
+                        (1 << (DISCOVER_EXT_CAPA_FTM_RESPONDER % 8));
+                break;
+            case IE_HT_OPERATION:
+                ht = data;
+                ht_len = elen;
+                break;
+            case IE_VHT_OPERATION:
+                vht = data;
+                vht_len = elen;
+                break;
+            case IE_EXTENSION:
+                if (elen >= 1 && data[0] == IE_EXT_HE_OPERATION) {
+                    he = data + 1;
+                    he_len = elen - 1;
+                }
+                break;
+        }
+        ie += elen + 2;
+        len -= elen + 2;
+    }
+
+    /* a BSS without any of them is a legacy 20 MHz one */
+    bss->preamble = NL80211_PREAMBLE_LEGACY;
+    bss->chan_width = NL80211_CHAN_WIDTH_20_NOHT;
+    if (ht)
+        parse_ht_operation(bss, ht, ht_len);
+    if (vht)
+        parse_vht_operation(bss, vht, vht_len);
+    if (he)
+        parse_he_operation(bss, he, he_len);
+}
+
+/**
+ * struct discover_dump - State of the scan dump
+ *
+ * @result: BSSs so far
+ * @size: capacity of @result->bss
+ */
+struct discover_dump {
+    struct discover_result *result;
+    int size;
+};
+
+static int bss_handler(struct nl_msg *msg, void *arg) {
+    struct discover_dump *dump = ((struct nl_cb_arg *)arg)->arg;
+    struct discover_result *result = dump->result;
+    struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+    struct nlattr *tb[NL80211_ATTR_MAX + 1];
+    struct nlattr *bss_tb[NL80211_BSS_MAX + 1];
+
+    nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+              genlmsg_attrlen(gnlh, 0), NULL);
+    if (!tb[NL80211_ATTR_BSS] ||
+        nla_parse_nested(bss_tb, NL80211_BSS_MAX, tb[NL80211_ATTR_BSS], NULL) ||
+        !bss_tb[NL80211_BSS_BSSID] || !bss_tb[NL80211_BSS_FREQUENCY])
+        return NL_SKIP;
+
+    if (result->count == dump->size) {
+        int size = dump->size ? dump->size * 2 : 32;
+        struct discover_bss *bss =
+            realloc(result->bss, size * sizeof(struct discover_bss));
+        if (!bss)
+            return NL_SKIP;
+        result->bss = bss;
+        dump->size = size;
+    }
+    struct discover_bss *bss = &result->bss[result->count++];
+    memset(bss, 0, sizeof(struct discover_bss));
+    nla_memcpy(bss->bssid, bss_tb[NL80211_BSS_BSSID], 6);
+    bss->center_freq = nla_get_u32(bss_tb[NL80211_BSS_FREQUENCY]);
+    if (bss_tb[NL80211_BSS_SIGNAL_MBM])
+        bss->signal_mbm = (int32_t)nla_get_u32(bss_tb[NL80211_BSS_SIGNAL_MBM]);
+    if (bss_tb[NL80211_BSS_STATUS])
+        bss->associated = nla_get_u32(bss_tb[NL80211_BSS_STATUS]) ==
+                          NL80211_BSS_STATUS_ASSOCIATED;
+
+    /* elements of the probe response, or of the beacon if none */
+    struct nlattr *ies = bss_tb[NL80211_BSS_INFORMATION_ELEMENTS];
+    if (!ies)
+        ies = bss_tb[NL80211_BSS_BEACON_IES];
+    if (ies)
+        parse_ies(bss, nla_data(ies), nla_len(ies));
+    else
+        parse_ies(bss, NULL, 0);
+    return NL_SKIP;
+}
+
+static int dump_scan(struct nl80211_state *state, uint64_t if_index,
+                     struct discover_result *result) {
+    struct nl_msg *msg = nlmsg_alloc();
+    if (!msg) {
+        ftm_report_error(state->error, "Fail to allocate message!");
+        return 1;
+    }
+    if (!genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, state->nl80211_id, 0,
+                     NLM_F_DUMP, NL80211_CMD_GET_SCAN, 0) ||
+        nla_put_u32(msg, NL80211_ATTR_IFINDEX, if_index)) {
+        ftm_report_error(state->error, "Fail to build scan dump!");
+        nlmsg_free(msg);
+        return 1;
+    }
+    struct discover_dump dump = {result, 0};
+    struct nl_cb_arg arg = alloc_nl_cb_arg(&dump);
+    int err = nl_sock_handle(state, msg, bss_handler, &arg);
+    nlmsg_free(msg);
+    return err;
+}
+
+/**
+ * struct scan_wait - Waiting for the end of a triggered scan
+ *
+ * @if_index: interface scanning
+ * @done: 1 when the results are ready, -1 if the scan was aborted
+ */
+struct scan_wait {
+    uint64_t if_index;
+    int done;
+};
+
+static int scan_event_handler(struct nl_msg *msg, void *arg) {
+    struct scan_wait *wait = arg;
+    struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+    struct nlattr *tb[NL80211_ATTR_MAX + 1];
+    nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+              genlmsg_attrlen(gnlh, 0), NULL);
+    if (!tb[NL80211_ATTR_IFINDEX] ||
+        nla_get_u32(tb[NL80211_ATTR_IFINDEX]) != wait->if_index)
+        return NL_SKIP;
+    if (gnlh->cmd == NL80211_CMD_NEW_SCAN_RESULTS)
+        wait->done = 1;
+    else if (gnlh->cmd == NL80211_CMD_SCAN_ABORTED)
+        wait->done = -1;
+    return NL_SKIP;
+}
+
+static int64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* trigger a scan and wait until its results are ready */
+static int trigger_scan(struct nl80211_state *state, uint64_t if_index) {
+    /* listen before triggering, not to miss a quick scan */
+    struct nl80211_state events = {0};
+    events.error = state->error;
+    if (nl80211_init(&events))
+        return 1;
+    struct nl_msg *msg = nlmsg_alloc();
+    int err = 1;
+    int group = genl_ctrl_resolve_grp(events.nl_sock, "nl80211", "scan");
+    if (!msg || group < 0 ||
+        nl_socket_add_membership(events.nl_sock, group)) {
+        ftm_report_error(state->error, "Fail to listen to scan events!");
+        goto out;
+    }
+
+    if (!genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, state->nl80211_id, 0,
+                     0, NL80211_CMD_TRIGGER_SCAN, 0) ||
+        nla_put_u32(msg, NL80211_ATTR_IFINDEX, if_index)) {
+        ftm_report_error(state->error, "Fail to build scan request!");
+        goto out;
+    }
+    if (nl_sock_handle(state, msg, NULL, NULL))
+        goto out;
+
+    struct scan_wait wait = {if_index, 0};
+    struct nl_rx_cb cb = {
+        .valid = scan_event_handler,
+        .valid_arg = &wait,
+    };
+    nl_socket_set_nonblocking(events.nl_sock);
+    struct pollfd pfd = {nl_socket_get_fd(events.nl_sock), POLLIN, 0};
+    int64_t deadline = now_ms() + DISCOVER_SCAN_TIMEOUT_MS;
+    while (!wait.done) {
+        int64_t left = deadline - now_ms();
+        if (left <= 0) {
+            ftm_report_error(state->error, "Scan timed out!");
+            goto out;
+        }
+        if (poll(&pfd, 1, left) < 0 && errno != EINTR) {
+            ftm_report_error(state->error, "Fail to wait for the scan: %s",
+                             strerror(errno));
+            goto out;
+        }
+        int res = nl_sock_recv(&events, &cb, false);
+        if (res < 0 && res != -NLE_AGAIN) {
+            ftm_report_error(state->error, "Fail to receive scan events: %s",
+                             nl_geterror(res));
+            goto out;
+        }
+    }
+    if (wait.done < 0)
+        ftm_report_error(state->error, "Scan aborted!");
+    else
+        err = 0;
+out:
+    if (msg)
+        nlmsg_free(msg);
+    nl80211_free(&events);
+    return err;
+}
+
+int discover_scan(struct nl80211_state *state, uint64_t if_index,
+                  bool trigger, struct discover_result *result) {
+    memset(result, 0, sizeof(struct discover_result));
+    /* the error of the trigger stays in state->error for the caller */
+    if (trigger && trigger_scan(state, if_index))
+        result->stale = true;
+    if (dump_scan(state, if_index, result)) {
+        free_discover_result(result);
+        return 1;
+    }
+    result->timestamp = time(NULL);
+    return 0;
+}
+
+void free_discover_result(struct discover_result *result) {
+    free(result->bss);
+    result->bss = NULL;
+    result->count = 0;
+}
+
+int discover_cache_load(const char *path, uint64_t if_index, int ttl,
+                        struct discover_result *result) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 1;
+    struct discover_cache_header header;
+    int err = 1;
+    int64_t now = time(NULL);
+    memset(result, 0, sizeof(struct discover_result));
+    if (read(fd, &header, sizeof(header)) != sizeof(header) ||
+        header.magic != DISCOVER_CACHE_MAGIC ||
+        header.version != DISCOVER_CACHE_VERSION ||
+        header.bss_size != sizeof(struct discover_bss) ||
+        header.if_index != if_index || header.timestamp > now ||
+        now - header.timestamp > ttl)
+        goto out;
+
+    size_t size = (size_t)header.count * sizeof(struct discover_bss);
+    result->bss = malloc(size ? size : 1);
+    if (!result->bss || read(fd, result->bss, size) != size) {
+        free_discover_result(result);
+        goto out;
+    }
+    result->count = header.count;
+    result->timestamp = header.timestamp;
+    err = 0;
+out:
+    close(fd);
+    return err;
+}
+
+int discover_cache_save(const char *path, uint64_t if_index,
+                        struct discover_result *result) {
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >=
+        sizeof(tmp_path))
+        return 1;
+    FILE *file = fopen(tmp_path, "w");
+    if (!file)
+        return 1;
+    struct discover_cache_header header = {
+        .magic = DISCOVER_CACHE_MAGIC,
+        .version = DISCOVER_CACHE_VERSION,
+        .bss_size = sizeof(struct discover_bss),
+        .if_index = if_index,
+        .timestamp = result->timestamp,
+        .count = result->count,
+    };
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(result->bss, sizeof(struct discover_bss), result->count,
+                     file) == result->count;
+    ok &= fclose(file) == 0;
+    if (!ok || rename(tmp_path, path)) {
+        unlink(tmp_path);
+        return 1;
+    }
+    return 0;
+}
+
+static const char *bw_to_str(uint32_t chan_width) {
+    switch (chan_width) {
+        case NL80211_CHAN_WIDTH_40:
+            return "40";
+        case NL80211_CHAN_WIDTH_80:
+            return "80";
+        case NL80211_CHAN_WIDTH_80P80:
+            return "80+80";
+        case NL80211_CHAN_WIDTH_160:
+            return "160";
+        default:
+            return "20";
+    }
+}
+
+/* primary channel and the width @preamble can measure with */
+static void cap_preamble(struct discover_bss *bss, uint32_t preamble) {
+    if (bss->preamble <= preamble)
+        return;
+    bss->preamble = preamble;
+    if (preamble == NL80211_PREAMBLE_LEGACY) {
+        bss->chan_width = NL80211_CHAN_WIDTH_20_NOHT;
+        bss->center_freq_1 = 0;
+        bss->center_freq_2 = 0;
+        return;
+    }
+    if (preamble != NL80211_PREAMBLE_HT)
+        return;
+    /* the 40 MHz half of the 80 MHz segment holding the primary channel */
+    uint32_t cf80 = bss->center_freq_1;
+    switch (bss->chan_width) {
+        case NL80211_CHAN_WIDTH_160:
+            cf80 = bss->center_freq < cf80 ? cf80 - 40 : cf80 + 40;
+            break;
+        case NL80211_CHAN_WIDTH_80:
+        case NL80211_CHAN_WIDTH_80P80:
+            break;
+        default:
+            return;
+    }
+    bss->chan_width = NL80211_CHAN_WIDTH_40;
+    bss->center_freq_1 = bss->center_freq < cf80 ? cf80 - 20 : cf80 + 20;
+    bss->center_freq_2 = 0;
+}
+
+static int compare_signal(const void *a, const void *b) {
+    const struct discover_bss *ba = *(struct discover_bss *const *)a;
+    const struct discover_bss *bb = *(struct discover_bss *const *)b;
+    return bb->signal_mbm - ba->signal_mbm;
+}
+
+int discover_write_config(FILE *file, struct discover_result *result,
+                          int32_t min_mbm) {
+    struct discover_bss **sorted =
+        malloc((result->count ? result->count : 1) *
+               sizeof(struct discover_bss *));
+    if (!sorted)
+        return 0;
+    int count = 0;
+    for (int i = 0; i < result->count; i++) {
+        struct discover_bss *bss = &result->bss[i];
+        if (bss->ftm_responder && bss->signal_mbm >= min_mbm)
+            sorted[count++] = bss;
+    }
+    /* strongest first */
+    qsort(sorted, count, sizeof(struct discover_bss *), compare_signal);
+
+    char time_str[32];
+    struct tm tm_info;
+    time_t timestamp = result->timestamp;
+    localtime_r(&timestamp, &tm_info);
+    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &tm_info);
+    fprintf(file, "# %d FTM responders of %d BSSs, scanned at %s\n", count,
+            result->count, time_str);
+    for (int i = 0; i < count; i++) {
+        struct discover_bss *bss = sorted[i];
+        uint8_t *addr = bss->bssid;
+        fprintf(file, "# %s, %.2f dBm%s\n",
+                bss->ssid[0] ? bss->ssid : "<hidden>",
+                bss->signal_mbm / 100.0,
+                bss->associated ? ", associated" : "");
+        fprintf(file, "%02x:%02x:%02x:%02x:%02x:%02x cf=%u bw=%s",
+                addr[0], addr[1], addr[2], addr[3], addr[4], addr[5],
+                bss->center_freq, bw_to_str(bss->chan_width));
+        if (bss->center_freq_1)
+            fprintf(file, " cf1=%u", bss->center_freq_1);
+        if (bss->center_freq_2)
+            fprintf(file, " cf2=%u", bss->center_freq_2);
+        fprintf(file, " preamble=%s\n", preamble_to_str(bss->preamble));
+    }
+    free(sorted);
+    return count;
+}
+
+static void print_usage() {
+    printf("Valid args: [--scan] [--passive] [--ttl=<seconds>] "
+           "[--cache=<path>] [--min-signal=<dBm>] "
+           "[--max-preamble=legacy|ht|vht|he] <if_name> [<config_path>]\n");
+}
+
+int ftm_discover_main(int argc, char **argv) {
+    static struct option long_options[] = {
+        {"scan", no_argument, NULL, 's'},
+        {"passive", no_argument, NULL, 'p'},
+        {"ttl", required_argument, NULL, 't'},
+        {"cache", required_argument, NULL, 'c'},
+        {"min-signal", required_argument, NULL, 'm'},
+        {"max-preamble", required_argument, NULL, 'x'},
+        {NULL, 0, NULL, 0}
+    };
+    bool force_scan = false, trigger = true;
+    int ttl = DISCOVER_DEFAULT_TTL;
+    const char *cache_path = NULL;
+    int32_t min_mbm = INT32_MIN;
+    uint32_t max_preamble = NL80211_PREAMBLE_HE;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 's':
+                force_scan = true;
+                break;
+            case 'p':
+                trigger = false;
+                break;
+            case 't':
+                ttl = atoi(optarg);
+                break;
+            case 'c':
+                cache_path = optarg;
+                break;
+            case 'm':
+                min_mbm = atof(optarg) * 100;
+                break;
+            case 'x':
+                for (max_preamble = 0; preamble_to_str(max_preamble) &&
+                     strcmp(preamble_to_str(max_preamble), optarg);
+                     max_preamble++)
+                    ;
+                /* DMG is 60 GHz only, not an upgrade of VHT */
+                if (!preamble_to_str(max_preamble) ||
+                    max_preamble == NL80211_PREAMBLE_DMG) {
+                    print_usage();
+                    return 1;
+                }
+                break;
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if (argc != 2 && argc != 3) {
+        printf("Invalid arguments!\n");
+        print_usage();
+        return 1;
+    }
+    const char *if_name = argv[1];
+    uint64_t if_index = if_nametoindex(if_name);
+    if (!if_index) {
+        fprintf(stderr, "Fail to find device interface %s!\n", if_name);
+        return 1;
+    }
+    char default_cache[PATH_MAX];
+    if (!cache_path) {
+        snprintf(default_cache, sizeof(default_cache),
+                 "/tmp/ftm-discover-%s.cache", if_name);
+        cache_path = default_cache;
+    }
+
+    /* scan only if the cached results are too old */
+    struct discover_result result;
+    bool cached = !force_scan && ttl > 0 &&
+                  !discover_cache_load(cache_path, if_index, ttl, &result);
+    if (!cached) {
+        char error[FTM_ERROR_MAX] = "";
+        struct nl80211_state state = {0};
+        state.error = error;
+        if (nl80211_init(&state)) {
+            fprintf(stderr, "Fail to allocate socket: %s\n", error);
+            return 1;
+        }
+        int err = discover_scan(&state, if_index, trigger, &result);
+        nl80211_free(&state);
+        if (err) {
+            fprintf(stderr, "Fail to read scan results: %s\n", error);
+            return 1;
+        }
+        if (result.stale)
+            fprintf(stderr, "Fail to scan (%s), using the last scan "
+                    "results\n", error);
+        if (ttl > 0 && discover_cache_save(cache_path, if_index, &result))
+            fprintf(stderr, "Fail to save %s\n", cache_path);
+    }
+
+    /* not every initiator can measure with the newest preambles */
+    for (int i = 0; i < result.count; i++)
+        cap_preamble(&result.bss[i], max_preamble);
+
+    FILE *file = argc == 3 ? fopen(argv[2], "w") : stdout;
+    if (!file) {
+        fprintf(stderr, "Fail to open file %s\n", argv[2]);
+        free_discover_result(&result);
+        return 1;
+    }
+    int count = discover_write_config(file, &result, min_mbm);
+    if (file != stdout)
+        fclose(file);
+    fprintf(stderr, "%d FTM responders found%s\n", count,
+            cached ? " (cached)" : "");
+    free_discover_result(&result);
+    return 0;
+}
@@ -0,0 +1,135 @@
+#ifndef _FTM_DISCOVER_H
+#define _FTM_DISCOVER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "../nl/nl.h"
+
+/**
+ * DOC: Discover FTM responders with a scan
+ * 
+ * Scan results of nl80211 carry the information elements of each BSS:
+ * 
+ * - Extended Capabilities, whose bit 70 is set by FTM responders
+ * - HT, VHT and HE Operation, giving the width and center frequencies of
+ *   the channel the BSS operates on, and the preamble it supports
+ * 
+ * discover_scan() triggers a scan (or reads the results of the last one)
+ * and turns every BSS into a struct discover_bss. The results can be kept
+ * in a cache file so that running again within a TTL skips the scan, and
+ * written out as lines of a config file.
+ */
+
+#define DISCOVER_DEFAULT_TTL 300
+#define DISCOVER_SCAN_TIMEOUT_MS 15000
+
+/* bit of the Extended Capabilities element set by FTM responders */
+#define DISCOVER_EXT_CAPA_FTM_RESPONDER 70
+
+/**
+ * struct discover_bss - A BSS found by the scan
+ * 
+ * @bssid: mac address of the BSS
+ * @ssid: SSID, NUL-terminated
+ * @signal_mbm: signal strength in mBm (100 * dBm)
+ * @center_freq: frequency of the primary channel in MHz
+ * @chan_width: @enum nl80211_chan_width
+ * @center_freq_1: center frequency of the channel, 0 for 20 MHz
+ * @center_freq_2: center frequency of the second segment of 80+80
+ * @preamble: best @enum nl80211_preamble the BSS supports
+ * @ftm_responder: whether the BSS advertises an FTM responder
+ * @associated: whether the interface is associated with the BSS
+ */
+struct discover_bss {
+    uint8_t bssid[6];
+    char ssid[33];
+    int32_t signal_mbm;
+    uint32_t center_freq;
+    uint32_t chan_width;
+    uint32_t center_freq_1;
+    uint32_t center_freq_2;
+    uint32_t preamble;
+    bool ftm_responder;
+    bool associated;
+};
+
+/**
+ * struct discover_result - BSSs found on an interface
+ * 
+ * @timestamp: when the scan results were read, seconds since the epoch
+ * @count: number of @bss
+ * @bss: the BSSs, in the order of the kernel
+ * @stale: the scan could not be triggered, and these are the results the
+ * kernel already had
+ */
+struct discover_result {
+    int64_t timestamp;
+    int count;
+    struct discover_bss *bss;
+    bool stale;
+};
+
+/**
+ * discover_scan - Find the BSSs around an interface
+ * 
+ * @param state      nl80211 socket
+ * @param if_index   interface index
+ * @param trigger    trigger a scan and wait for it, otherwise read the
+ *                   results the kernel already has
+ * @param result     filled with the BSSs, free with free_discover_result()
+ * 
+ * @note
+ * If the scan cannot be triggered (no permission, the interface is busy),
+ * the results the kernel already has are read instead: @result->stale is
+ * set and the error of the trigger is left in @state->error.
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int discover_scan(struct nl80211_state *state, uint64_t if_index,
+                  bool trigger, struct discover_result *result);
+
+/**
+ * discover_cache_load - Read the results saved by discover_cache_save()
+ * 
+ * @param path       cache file
+ * @param if_index   interface the results must belong to
+ * @param ttl        maximum age of the results in seconds
+ * @param result     filled with the BSSs on success
+ * 
+ * @return 0 on success, 1 if the cache is missing, stale or invalid
+ */
+int discover_cache_load(const char *path, uint64_t if_index, int ttl,
+                        struct discover_result *result);
+
+/**
+ * discover_cache_save - Save results for discover_cache_load()
+ * 
+ * @note
+ * The file is replaced atomically.
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int discover_cache_save(const char *path, uint64_t if_index,
+                        struct discover_result *result);
+
+/**
+ * discover_write_config - Write the FTM responders as a config file
+ * 
+ * @param file       output
+ * @param result     BSSs found
+ * @param min_mbm    BSSs weaker than this are skipped
+ * 
+ * @return number of peers written
+ */
+int discover_write_config(FILE *file, struct discover_result *result,
+                          int32_t min_mbm);
+
+void free_discover_result(struct discover_result *result);
+
+/**
+ * ftm_discover_main - Entry of "ftm discover [options] <if_name>"
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int ftm_discover_main(int argc, char **argv);
+#endif
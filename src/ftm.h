@@ -0,0 +1,29 @@
+#ifndef _FTM_H
+#define _FTM_H
+
+/**
+ * DOC: libftm
+ * 
+ * Public header of libftm, installed into /usr/local/include/ftm by
+ * "make install-lib". Build with the include path of libnl and link with
+ * "-lftm -lnl-3 -lnl-genl-3 -lpthread -lrt -lm".
+ * 
+ * See initiator/initiator_start.h for the measurement API, starting from
+ * ftm_ctx_new().
+ */
+
+#include "initiator/initiator_start.h"
+#include "initiator/initiator_config.h"
+#include "initiator/initiator_types.h"
+#include "initiator/initiator_output.h"
+#include "initiator/initiator_watch.h"
+#include "initiator/initiator_events.h"
+#include "responder/responder.h"
+#include "ap/ap.h"
+#include "discover/discover.h"
+#include "analyze/analyze.h"
+#include "archive/archive.h"
+#include "realtime/realtime.h"
+#include "simulate/simulate.h"
+
+#endif /* _FTM_H */
@@ -0,0 +1,101 @@
+#include "hist.h"
+#include <stdbool.h>
+#include <string.h>
+
+#define __LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_RELAXED)
+#define __ADD(ptr, val) __atomic_fetch_add(ptr, val, __ATOMIC_RELAXED)
+
+void hist_init(struct hist *hist) {
+    memset(hist, 0, sizeof(struct hist));
+    hist->min = UINT64_MAX;
+}
+
+int hist_bucket_index(uint64_t value) {
+    if (value < HIST_SUB_COUNT)
+        return value;
+    int msb = 63 - __builtin_clzll(value);
+    if (msb >= HIST_MAX_BITS)
+        return HIST_BUCKETS - 1;
+    int shift = msb - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB_COUNT +
+           ((value >> shift) & (HIST_SUB_COUNT - 1));
+}
+
+uint64_t hist_bucket_upper(int index) {
+    if (index < HIST_SUB_COUNT)
+        return index;
+    int shift = index / HIST_SUB_COUNT - 1;
+    uint64_t sub = index % HIST_SUB_COUNT + HIST_SUB_COUNT;
+    return ((sub + 1) << shift) - 1;
+}
+
+void hist_record(struct hist *hist, uint64_t value) {
+    __ADD(&hist->counts[hist_bucket_index(value)], 1);
+    __ADD(&hist->total, 1);
+    __ADD(&hist->sum, value);
+
+    uint64_t cur = __LOAD(&hist->min);
+    while (value < cur &&
+           !__atomic_compare_exchange_n(&hist->min, &cur, value, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    cur = __LOAD(&hist->max);
+    while (value > cur &&
+           !__atomic_compare_exchange_n(&hist->max, &cur, value, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void hist_merge(struct hist *dst, const struct hist *src) {
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        uint64_t count = __LOAD(&src->counts[i]);
+        if (count)
+            __ADD(&dst->counts[i], count);
+    }
+    __ADD(&dst->total, __LOAD(&src->total));
+    __ADD(&dst->sum, __LOAD(&src->sum));
+    if (__LOAD(&src->min) < __LOAD(&dst->min))
+        dst->min = src->min;
+    if (__LOAD(&src->max) > __LOAD(&dst->max))
+        dst->max = src->max;
+}
+
+uint64_t hist_quantile(const struct hist *hist, double q) {
+    uint64_t total = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        total += __LOAD(&hist->counts[i]);
+    if (!total)
+        return 0;
+
+    uint64_t rank = q * total;
+    if (rank >= total)
+        rank = total - 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += __LOAD(&hist->counts[i]);
+        if (seen > rank) {
+            uint64_t upper = hist_bucket_upper(i);
+            uint64_t max = __LOAD(&hist->max);
+            return upper < max ? upper : max;
+        }
+    }
+    return __LOAD(&hist->max);
+}
+
+void hist_print_header(FILE *file, const char *title) {
+    fprintf(file, "%-24s%10s%12s%12s%12s%12s%12s%12s%12s\n", title,
+            "count", "min", "p50", "p90", "p99", "p99.9", "max", "mean");
+}
+
+void hist_print(FILE *file, const char *name, const struct hist *hist) {
+    uint64_t total = __LOAD(&hist->total);
+    if (!total) {
+        fprintf(file, "%-24s%10d\n", name, 0);
+        return;
+    }
+    fprintf(file, "%-24s%10lu%12lu%12lu%12lu%12lu%12lu%12lu%12lu\n", name,
+            total, __LOAD(&hist->min),
+            hist_quantile(hist, 0.5), hist_quantile(hist, 0.9),
+            hist_quantile(hist, 0.99), hist_quantile(hist, 0.999),
+            __LOAD(&hist->max), __LOAD(&hist->sum) / total);
+}
@@ -0,0 +1,95 @@
+#ifndef _FTM_HIST_H
+#define _FTM_HIST_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * DOC: Log-linear latency histogram
+ * 
+ * A fixed-size, HDR-style histogram for nanosecond values. Values below
+ * 2^HIST_SUB_BITS are counted exactly; above that, every power of two is
+ * split into 2^HIST_SUB_BITS linear sub-buckets, which bounds the relative
+ * error to about 3%. Values above 2^HIST_MAX_BITS are clamped into the last
+ * bucket.
+ * 
+ * Recording only touches counters with relaxed atomic adds, so a histogram
+ * can be read (e.g. by a metrics scraper) while it is being written.
+ */
+
+#define HIST_SUB_BITS 5
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 40
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+/**
+ * struct hist - Log-linear histogram
+ * 
+ * @counts: count of values per bucket
+ * @total: number of recorded values
+ * @sum: sum of recorded values, used for the mean
+ * @min: smallest recorded value
+ * @max: largest recorded value
+ */
+struct hist {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+};
+
+/**
+ * hist_init - Reset a histogram
+ * 
+ * @param hist   histogram to reset
+ */
+void hist_init(struct hist *hist);
+
+/**
+ * hist_record - Add a value to a histogram
+ * 
+ * @param hist    histogram
+ * @param value   value to record
+ */
+void hist_record(struct hist *hist, uint64_t value);
+
+/**
+ * hist_merge - Add all values of @src into @dst
+ */
+void hist_merge(struct hist *dst, const struct hist *src);
+
+/**
+ * hist_bucket_index - Bucket index for a value
+ */
+int hist_bucket_index(uint64_t value);
+
+/**
+ * hist_bucket_upper - Largest value counted in the given bucket
+ */
+uint64_t hist_bucket_upper(int index);
+
+/**
+ * hist_quantile - Estimate a quantile
+ * 
+ * @param hist   histogram
+ * @param q      quantile in [0, 1]
+ * 
+ * @return upper bound of the bucket holding the quantile, 0 if empty
+ */
+uint64_t hist_quantile(const struct hist *hist, double q);
+
+/**
+ * hist_print_header - Print the column header used by hist_print()
+ */
+void hist_print_header(FILE *file, const char *title);
+
+/**
+ * hist_print - Print one summary row: count, min, quantiles, max and mean
+ * 
+ * @param file   output stream
+ * @param name   row label
+ * @param hist   histogram to summarize
+ */
+void hist_print(FILE *file, const char *name, const struct hist *hist);
+#endif
@@ -1,127 +1,303 @@
 #include "initiator.h"
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
 #include <time.h>
+#include <unistd.h>
 
-#define SOL 299492458
-#define RTT_TO_DIST(rtt) ((float)(rtt) * SOL / 1000000000000)
-#define DIST_TO_RTT(dist) (dist * 1000000000000 / SOL)
 #define RELATIVE_DIFF(ori, new) (abs((float)(new - ori) / ori))
 
+/* when the session was sampled: its latest result, or now without one */
+static uint64_t session_time(struct ftm_results_wrap *results) {
+    uint64_t time = 0;
+    for (int i = 0; i < results->count; i++) {
+        struct ftm_resp_attr *resp = results->results[i];
+        if (resp && FTM_RESP_HAS(resp, rx_time_ns) && resp->rx_time_ns > time)
+            time = resp->rx_time_ns;
+    }
+    if (!time) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        time = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+    return time;
+}
+
+static void publish_result(struct shm_ring *ring, struct ftm_resp_attr *resp,
+                           struct ftm_results_stat *stat, int attempt_idx) {
+    struct shm_record record;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    record.timestamp_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    record.session = attempt_idx;
+
+    int64_t correct = FTM_RESP_HAS(resp, rtt_correct) ?
+                      resp->rtt_correct : 0;
+    record.dist = FTM_RESP_HAS(resp, rtt_avg) ?
+                  RTT_TO_DIST(resp->rtt_avg + correct) : 0;
+    record.dist_avg = stat->rtt_measure_count ?
+                      RTT_TO_DIST(stat->rtt_avg_stat / stat->rtt_measure_count +
+                                  correct) : 0;
+    record.resp = *resp;
+    shm_ring_publish(ring, &record);
+}
+
 static void custom_result_handler(struct ftm_results_wrap *results,
                                   int attempts, int attempt_idx, void *arg) {
-    struct ftm_results_stat **stats = arg;
-    int line_count = 0;
+    struct my_ftm_data *data = arg;
+    struct ftm_results_stat **stats = data->stats;
+
+    if (data->realtime)
+        realtime_mark(data->realtime, session_time(results));
+
+    /* the library keeps the old config, tell why */
+    if (data->watch && data->watch->failures != data->reload_failures) {
+        data->reload_failures = data->watch->failures;
+        fprintf(stderr, "Fail to reload config, keeping the old one: %s\n",
+                data->watch->error);
+    }
+
+    if (data->metrics) {
+        metrics_record_results(data->metrics, results);
+        metrics_set_gauge(data->metrics, data->rx_queue_gauge,
+                          results->rx_queued);
+        data->overruns += results->overruns;
+        metrics_set_gauge(data->metrics, data->overrun_counter,
+                          data->overruns);
+        data->timeouts += results->timeouts;
+        metrics_set_gauge(data->metrics, data->timeout_counter,
+                          data->timeouts);
+        if (results->count) {
+            metrics_set_gauge(data->metrics, data->rx_syscall_gauge,
+                              results->rx_syscalls * 1000 / results->count);
+            metrics_set_gauge(data->metrics, data->rx_copied_gauge,
+                              results->rx_copied * 1000 / results->count);
+        }
+    }
+
     for (int i = 0; i < results->count; i++) {
         struct ftm_resp_attr *resp = results->results[i];
         if (!resp) {
             fprintf(stderr, "Response %d does not exist!", i);
             return;
         }
-#define __RECORD_RESULT(name)                                 \
-    do {                                                      \
-        if (resp->flags[FTM_RESP_FLAG_##name]) {              \
-            stats[i]->results[attempt_idx].name = resp->name; \
-        } else {                                              \
-            stats[i]->results[attempt_idx].name = 0;          \
-        }                                                     \
+#define __RECORD_RESULT(name)                       \
+    do {                                            \
+        if (FTM_RESP_HAS(resp, name)) {             \
+            recorded->name = resp->name;            \
+        } else {                                    \
+            recorded->name = 0;                     \
+        }                                           \
     } while (0)
     
         /* fill output data */
+        struct recorded_result *recorded =
+            &stats[i]->results[attempt_idx % stats[i]->capacity];
         __RECORD_RESULT(rtt_avg);
         __RECORD_RESULT(rtt_variance);
         __RECORD_RESULT(rtt_spread);
         __RECORD_RESULT(rssi_avg);
+        __RECORD_RESULT(rx_time_ns);
 
         /* calculate average rtt, filtering out 0 */
-        if (resp->flags[FTM_RESP_FLAG_rtt_avg] && resp->rtt_avg) {
+        if (FTM_RESP_HAS(resp, rtt_avg) && resp->rtt_avg) {
             stats[i]->rtt_avg_stat += resp->rtt_avg;
             stats[i]->rtt_measure_count++;
         }
 
-        /* print original result */
-        printf("\nMEASUREMENT RESULT FOR TARGET #%d\n", i);
-        line_count += 2;
-#define __FTM_PRINT(attr_name, specifier)      \
-    do {                                       \
-        FTM_PRINT(resp, attr_name, specifier); \
-        line_count++;                          \
-    } while (0)
+        /* publish to local consumers */
+        if (data->ring)
+            publish_result(data->ring, resp, stats[i], attempt_idx);
+
+        /* hand the result to the dashboard thread */
+        if (data->dashboard) {
+            int64_t rtt_avg = stats[i]->rtt_measure_count ?
+                stats[i]->rtt_avg_stat / stats[i]->rtt_measure_count : 0;
+            dashboard_update(data->dashboard, i, attempt_idx, resp, rtt_avg,
+                             stats[i]->rtt_measure_count);
+        }
+    }
+
+    data->sessions = attempt_idx + 1;
 
-        FTM_PRINT_ADDR(resp);
-        line_count++;
-        __FTM_PRINT(fail_reason, u);
-        __FTM_PRINT(burst_index, u);
-        __FTM_PRINT(num_ftmr_attempts, u);
-        __FTM_PRINT(num_ftmr_successes, u);
-        __FTM_PRINT(busy_retry_time, u);
-        __FTM_PRINT(num_bursts_exp, u);
-        __FTM_PRINT(burst_duration, u);
-        __FTM_PRINT(ftms_per_burst, u);
-        __FTM_PRINT(rssi_avg, d);
-        __FTM_PRINT(rssi_spread, d);
-        __FTM_PRINT(rtt_avg, ld);
-        __FTM_PRINT(rtt_variance, lu);
-        __FTM_PRINT(rtt_spread, lu);
-        __FTM_PRINT(dist_avg, ld);
-        __FTM_PRINT(dist_variance, lu);
-        __FTM_PRINT(dist_spread, lu);
-
-        /* print processed result */
-        printf("\n----Processed data----\n");
-        float dist = 0;
-        float corrected_dist = 0;
-        int64_t rtt_corrected_value = 0;
-        if (resp->flags[FTM_RESP_FLAG_rtt_avg]) {
-            dist = RTT_TO_DIST(resp->rtt_avg);
-            if (resp->flags[FTM_RESP_FLAG_rtt_correct]) {
-                corrected_dist = RTT_TO_DIST(resp->rtt_avg + resp->rtt_correct);
-            }
-            if (resp->flags[FTM_RESP_FLAG_dist_truth]) {
-                rtt_corrected_value = DIST_TO_RTT(dist - resp->dist_truth);
-            }
-        }
-        printf("%-19s%.3f\n", "dist", dist);
-        line_count += 3;
-        if (stats[i]->rtt_measure_count) {
-            int64_t rtt =
-                stats[i]->rtt_avg_stat / stats[i]->rtt_measure_count;
-            printf("%-19s%ld\n", "rtt_avg", rtt);
-            printf("%-19s%-7.3f\n", "dist_avg", RTT_TO_DIST(rtt));
-            line_count += 2;
-        }
-        
-        if (resp->flags[FTM_RESP_FLAG_rtt_correct]) {
-            printf("%-19s%.3f\n", "corrected_dist", corrected_dist);
-            line_count++;
-        }
-        if (resp->flags[FTM_RESP_FLAG_rtt_correct] &&
-            stats[i]->rtt_measure_count) {
-            int64_t corrected_rtt =
-                stats[i]->rtt_avg_stat / stats[i]->rtt_measure_count +
-                resp->rtt_correct;
-            printf("%-19s%ld\n", "corrected_rtt_avg", corrected_rtt);
-            printf("%-19s%-7.3f\n", "corrected_dist_avg",
-                   RTT_TO_DIST(corrected_rtt));
-            line_count += 2;
-        }
-        if (resp->flags[FTM_RESP_FLAG_dist_truth]) {
-            printf("%-19s%ld\n", "rtt_corrected_val", rtt_corrected_value);
-            line_count += 1;
-        }
-    }
-    if (attempt_idx == attempts - 1)
+    /* machine-readable records of the whole session in one write */
+    if (data->output) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        if (ftm_output_write(data->output, results, attempt_idx,
+                             (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec))
+            fprintf(stderr, "Fail to write output!\n");
+    }
+}
+
+static struct ftm_results_stat *alloc_stat(int attempts) {
+    struct ftm_results_stat *stat = calloc(1, sizeof(struct ftm_results_stat));
+    if (!stat)
+        return NULL;
+    stat->capacity = attempts == FTM_ATTEMPTS_INF ? RECORDED_RESULTS_MAX :
+                     attempts > 0 ? attempts : 1;
+    stat->results = calloc(stat->capacity, sizeof(struct recorded_result));
+    if (!stat->results) {
+        free(stat);
+        return NULL;
+    }
+    return stat;
+}
+
+static void free_stat(struct ftm_results_stat *stat) {
+    if (!stat)
         return;
+    free(stat->results);
+    free(stat);
+}
 
-    /* refresh for next output */
-    for (int i = 0; i < line_count; i++) {
-        printf("\033[A\033[2K");
+/* carry the state of the peers kept by a reloaded config over */
+static int reload_config(struct ftm_config *old, struct ftm_config *new,
+                         const int *map, void *arg) {
+    struct my_ftm_data *data = arg;
+    struct ftm_results_stat **stats =
+        calloc(new->peer_count ? new->peer_count : 1,
+               sizeof(struct ftm_results_stat *));
+    if (!stats)
+        goto handle_free;
+    for (int i = 0; i < new->peer_count; i++) {
+        stats[i] = map[i] >= 0 ? data->stats[map[i]] :
+                                 alloc_stat(data->attempts);
+        if (!stats[i])
+            goto handle_free;
+    }
+    if ((data->output && ftm_output_resize(data->output, new->peer_count)) ||
+        (data->metrics && metrics_remap_peers(data->metrics, new, map)) ||
+        (data->dashboard && dashboard_remap_peers(data->dashboard, new, map)))
+        goto handle_free;
+
+    /* free the stats of the removed peers */
+    for (int i = 0; i < new->peer_count; i++) {
+        if (map[i] >= 0)
+            data->stats[map[i]] = NULL;
+    }
+    for (int i = 0; i < old->peer_count; i++)
+        free_stat(data->stats[i]);
+    free(data->stats);
+    data->stats = stats;
+    fprintf(stderr, "Config reloaded, %d peers\n", new->peer_count);
+    return 0;
+handle_free:
+    for (int i = 0; stats && i < new->peer_count; i++) {
+        if (map[i] < 0)
+            free_stat(stats[i]);
     }
+    free(stats);
+    return 1;
+}
+
+static struct ftm_trace *signal_trace;
+
+static void dump_trace_on_signal(int sig) {
+    if (signal_trace)
+        ftm_trace_request_dump(signal_trace);
+}
+
+static struct ftm_ctx *signal_ctx;
+
+/* the results so far are still logged */
+static void stop_on_signal(int sig) {
+    if (signal_ctx)
+        ftm_ctx_stop(signal_ctx);
+}
+
+static void print_usage() {
+    printf("Valid args: [--trace] [--metrics=<socket_path>] "
+           "[--shm=<name>] [--fps=<frames>] "
+           "[--output=csv|ndjson|bin|archive] [--config-cache=<path>] "
+           "[--watch] [--no-channel-groups] [--event-watch] "
+           "[--realtime=<cpu>[:<priority>][,probe]] "
+           "<if_name> <file_path> [<attemps>]\n");
 }
 
 int my_start_ftm(int argc, char **argv) {
+    /* parse the options */
+    static struct option long_options[] = {
+        {"trace", no_argument, NULL, 't'},
+        {"metrics", required_argument, NULL, 'm'},
+        {"shm", required_argument, NULL, 's'},
+        {"fps", required_argument, NULL, 'f'},
+        {"output", required_argument, NULL, 'o'},
+        {"config-cache", required_argument, NULL, 'c'},
+        {"watch", no_argument, NULL, 'w'},
+        {"no-channel-groups", no_argument, NULL, 'g'},
+        {"event-watch", no_argument, NULL, 'e'},
+        {"realtime", required_argument, NULL, 'r'},
+        {NULL, 0, NULL, 0}
+    };
+    bool trace = false;
+    const char *metrics_path = NULL;
+    const char *shm_name = NULL;
+    int fps = DASHBOARD_DEFAULT_FPS;
+    int output_format = -1;
+    const char *cache_path = NULL;
+    bool watch_config = false;
+    bool channel_groups = true;
+    bool event_watch = false;
+    struct realtime realtime;
+    bool use_realtime = false;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 't':
+                trace = true;
+                break;
+            case 'm':
+                metrics_path = optarg;
+                break;
+            case 's':
+                shm_name = optarg;
+                break;
+            case 'f':
+                fps = atoi(optarg);
+                if (fps <= 0) {
+                    print_usage();
+                    return 1;
+                }
+                break;
+            case 'o':
+                output_format = ftm_output_format_from_str(optarg);
+                if (output_format < 0) {
+                    print_usage();
+                    return 1;
+                }
+                break;
+            case 'c':
+                cache_path = optarg;
+                break;
+            case 'w':
+                watch_config = true;
+                break;
+            case 'g':
+                channel_groups = false;
+                break;
+            case 'e':
+                event_watch = true;
+                break;
+            case 'r':
+                if (realtime_parse(optarg, &realtime)) {
+                    print_usage();
+                    return 1;
+                }
+                use_realtime = true;
+                break;
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
     /* parse the arguments */
     if (argc != 4 && argc != 3) {
         printf("Invalid arguments!\n");
-        printf("Valid args: <if_name> <file_path> [<attemps>]\n");
+        print_usage();
         return 1;
     }
     const char *if_name = argv[1];
@@ -130,31 +306,192 @@ int my_start_ftm(int argc, char **argv) {
     if (argc == 4)
         attempts = atoi(argv[3]);
 
-    /* generate config from config file */
-    struct ftm_config *config = parse_config_file(file_name, if_name);
+    /* socket and buffers used by the measurement */
+    struct ftm_ctx *ctx = ftm_ctx_new(NULL);
+    if (!ctx)
+        return 1;
+    ftm_ctx_set_channel_groups(ctx, channel_groups);
+    if (event_watch && ftm_ctx_set_event_watch(ctx, true)) {
+        fprintf(stderr, "Fail to watch radio events: %s\n",
+                ftm_ctx_error(ctx));
+        ftm_ctx_free(ctx);
+        return 1;
+    }
+
+    /* 
+     * generate config from config file, every invalid line is reported.
+     * A watched config belongs to the watch and is replaced when the file
+     * changes.
+     */
+    struct ftm_config_watch *watch = NULL;
+    struct ftm_config *config;
+    if (watch_config) {
+        watch = alloc_ftm_config_watch(file_name, if_name, cache_path, NULL);
+        config = watch ? watch->config : NULL;
+    } else {
+        config = load_config_file(file_name, if_name, cache_path, NULL);
+    }
     if (!config) {
-        fprintf(stderr, "Fail to parse config!\n");
+        ftm_ctx_free(ctx);
         return 1;
     }
-    print_config(config);
+    /* stdout carries the records in output mode */
+    if (output_format < 0)
+        print_config(config);
+
+    /* latency histograms, dumped on SIGUSR1 and at exit */
+    if (trace) {
+        if (ftm_trace_enable(ftm_ctx_trace(ctx), config)) {
+            if (watch)
+                free_ftm_config_watch(watch);
+            else
+                free_ftm_config(config);
+            ftm_ctx_free(ctx);
+            return 1;
+        }
+        signal_trace = ftm_ctx_trace(ctx);
+        signal(SIGUSR1, dump_trace_on_signal);
+    }
     
     /* initialize our data */
     struct ftm_results_stat **stats =
-        malloc(config->peer_count * sizeof(struct ftm_results_stat *));
+        calloc(config->peer_count ? config->peer_count : 1,
+               sizeof(struct ftm_results_stat *));
+    for (int i = 0; stats && i < config->peer_count; i++)
+        stats[i] = alloc_stat(attempts);
+    struct my_ftm_data data = {
+        .stats = stats,
+        .attempts = attempts,
+        .rx_queue_gauge = -1,
+        .overrun_counter = -1,
+        .timeout_counter = -1,
+        .rx_syscall_gauge = -1,
+        .rx_copied_gauge = -1,
+    };
+    int err = 0;
     for (int i = 0; i < config->peer_count; i++) {
-        stats[i] = malloc(sizeof(struct ftm_results_stat));
-        stats[i]->rtt_avg_stat = 0;
-        stats[i]->rtt_measure_count = 0;
-        stats[i]->results = malloc(attempts * sizeof(struct recorded_result));
+        if (!stats || !stats[i]) {
+            fprintf(stderr, "Fail to allocate stats!\n");
+            err = 1;
+            goto clean_up;
+        }
+    }
+
+    /* the helper threads created below run on the other cores */
+    if (use_realtime && realtime_isolate(&realtime, NULL)) {
+        err = 1;
+        goto clean_up;
+    }
+
+    /* result ring in /dev/shm */
+    if (shm_name) {
+        data.ring = shm_ring_create(shm_name, SHM_RING_DEFAULT_CAPACITY,
+                                    NULL);
+        if (!data.ring) {
+            err = 1;
+            goto clean_up;
+        }
+    }
+
+    /* metrics served on a Unix socket */
+    if (metrics_path) {
+        data.metrics = alloc_metrics(config);
+        if (!data.metrics) {
+            fprintf(stderr, "Fail to allocate metrics!\n");
+            err = 1;
+            goto clean_up;
+        }
+        data.rx_queue_gauge = metrics_add_gauge(
+            data.metrics, "ftm_netlink_rx_queue_bytes",
+            "Bytes queued on the netlink socket after the last session");
+        data.overrun_counter = metrics_add_value(
+            data.metrics, "ftm_netlink_overruns_total", "counter",
+            "Sessions started again after a netlink receive buffer overrun",
+            0);
+        data.timeout_counter = metrics_add_value(
+            data.metrics, "ftm_session_timeouts_total", "counter",
+            "Requests issued again after their COMPLETE did not come", 0);
+        data.rx_syscall_gauge = metrics_add_value(
+            data.metrics, "ftm_netlink_rx_syscalls_per_result", "gauge",
+            "Receive system calls per result in the last session", 3);
+        data.rx_copied_gauge = metrics_add_value(
+            data.metrics, "ftm_netlink_rx_copied_bytes_per_result", "gauge",
+            "Netlink bytes copied per result in the last session", 3);
+        for (int i = 0; trace && i < FTM_TRACE_STAGE_MAX; i++) {
+            metrics_add_hist(data.metrics, "ftm_stage_latency_seconds",
+                             "stage", ftm_trace_stage_name(i),
+                             &ftm_ctx_trace(ctx)->stages[i]);
+        }
+        if (use_realtime && realtime.use_probe) {
+            metrics_add_hist(data.metrics, "ftm_realtime_seconds",
+                             "kind", "wakeup", &realtime.wakeup);
+        }
+        if (use_realtime) {
+            metrics_add_hist(data.metrics, "ftm_realtime_seconds",
+                             "kind", "interval", &realtime.interval);
+        }
+        if (metrics_start_server(data.metrics, metrics_path, NULL)) {
+            err = 1;
+            goto clean_up;
+        }
+    }
+
+    if (output_format >= 0) {
+        data.output = alloc_ftm_output(output_format, STDOUT_FILENO,
+                                       config->peer_count);
+        if (!data.output) {
+            fprintf(stderr, "Fail to allocate output!\n");
+            err = 1;
+            goto clean_up;
+        }
+    } else {
+        /* results are drawn by a separate thread at a capped frame rate */
+        data.dashboard = alloc_dashboard(config, attempts, STDOUT_FILENO,
+                                         fps);
+        if (!data.dashboard) {
+            fprintf(stderr, "Fail to allocate dashboard!\n");
+            err = 1;
+            goto clean_up;
+        }
     }
 
+    /* everything the sessions use is allocated, lock it in memory */
+    if (use_realtime) {
+        if (realtime_enter(&realtime, NULL)) {
+            err = 1;
+            goto clean_up;
+        }
+        data.realtime = &realtime;
+    }
+
+    /* an endless measurement ends on ctrl+C */
+    signal_ctx = ctx;
+    signal(SIGINT, stop_on_signal);
+    signal(SIGTERM, stop_on_signal);
+
     /* 
      * start FTM using the config we created, our custom handler,
      * the attempt number we designated, and the pointer to our data
      */
-    int err = ftm(config, custom_result_handler, attempts, stats);
+    if (watch) {
+        data.watch = watch;
+        err = ftm_ctx_run_watch(ctx, watch, custom_result_handler,
+                                reload_config, attempts, &data);
+        config = watch->config;
+        stats = data.stats;
+    } else {
+        err = ftm_ctx_run(ctx, config, custom_result_handler, attempts,
+                          &data);
+    }
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal_ctx = NULL;
+    free_dashboard(data.dashboard);
+    data.dashboard = NULL;
     if (err) {
-        fprintf(stderr, "FTM measurement failed!\n");
+        fprintf(stderr, "FTM measurement failed: %s\n", ftm_ctx_error(ctx));
+        if (data.metrics)
+            metrics_record_failure(data.metrics);
         goto clean_up;
     }
 
@@ -164,30 +501,215 @@ int my_start_ftm(int argc, char **argv) {
         sprintf(addr_str, "%02x:%02x:%02x:%02x:%02x:%02x",
                 addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
         time_t timer = time(NULL);
-        struct tm *tm_info;
+        struct tm tm_info;
         char logfile_name[120];
-        tm_info = localtime(&timer);
-        strftime(logfile_name, 60, "%Y-%m-%d-%H:%M:%S", tm_info);
+        localtime_r(&timer, &tm_info);
+        strftime(logfile_name, 60, "%Y-%m-%d-%H:%M:%S", &tm_info);
         strcat(logfile_name, "-");
         strcat(logfile_name, addr_str);
         strcat(logfile_name, "-log.txt");
 
         FILE *output = fopen(logfile_name, "w");
-        for (int j = 0; j < attempts; j++) {
-            fprintf(output, "%ld %lu %lu %d\n",
-                    stats[i]->results[j].rtt_avg,
-                    stats[i]->results[j].rtt_variance,
-                    stats[i]->results[j].rtt_spread,
-                    stats[i]->results[j].rssi_avg);
+        if (!output) {
+            fprintf(stderr, "Fail to open %s: %s!\n", logfile_name,
+                    strerror(errno));
+            err = 1;
+            continue;
+        }
+        /* the sessions still kept, oldest first */
+        int first = data.sessions > stats[i]->capacity ?
+                    data.sessions - stats[i]->capacity : 0;
+        for (int j = first; j < data.sessions; j++) {
+            struct recorded_result *recorded =
+                &stats[i]->results[j % stats[i]->capacity];
+            fprintf(output, "%ld %lu %lu %d %lu\n", recorded->rtt_avg,
+                    recorded->rtt_variance, recorded->rtt_spread,
+                    recorded->rssi_avg, recorded->rx_time_ns);
+        }
+        if (fclose(output)) {
+            fprintf(stderr, "Fail to write %s!\n", logfile_name);
+            err = 1;
         }
     }
 
 clean_up:
+    if (data.realtime)
+        realtime_stop(data.realtime);
+    free_dashboard(data.dashboard);
+    free_ftm_output(data.output);
+    free_metrics(data.metrics);
+    shm_ring_close(data.ring);
+    if (trace) {
+        signal(SIGUSR1, SIG_DFL);
+        signal_trace = NULL;
+        ftm_trace_dump(ftm_ctx_trace(ctx), stderr);
+    }
+    if (data.realtime)
+        realtime_print(stderr, data.realtime);
+
     /* clean up */
+    for (int i = 0; stats && i < config->peer_count; i++)
+        free_stat(stats[i]);
+    free(stats);
+    if (watch)
+        free_ftm_config_watch(watch);
+    else
+        free_ftm_config(config);
+    ftm_ctx_free(ctx);
+    return err;
+}
+
+static void print_simulate_usage() {
+    printf("Valid args: [--speedup=<factor>] [--netlink] [--seed=<n>] "
+           "[--metrics=<socket_path>] [--shm=<name>] "
+           "[--output=csv|ndjson|bin|archive] <scenario_path> "
+           "[<sessions>]\n");
+}
+
+int my_simulate_ftm(int argc, char **argv) {
+    static struct option long_options[] = {
+        {"speedup", required_argument, NULL, 'x'},
+        {"netlink", no_argument, NULL, 'n'},
+        {"seed", required_argument, NULL, 'r'},
+        {"metrics", required_argument, NULL, 'm'},
+        {"shm", required_argument, NULL, 's'},
+        {"output", required_argument, NULL, 'o'},
+        {NULL, 0, NULL, 0}
+    };
+    struct simulate_options options = {1, 1, false, 1};
+    const char *metrics_path = NULL;
+    const char *shm_name = NULL;
+    int output_format = -1;
+    char *end;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'x':
+                options.speedup = strtod(optarg, &end);
+                if (end == optarg || *end || options.speedup < 0) {
+                    print_simulate_usage();
+                    return 1;
+                }
+                break;
+            case 'n':
+                options.netlink = true;
+                break;
+            case 'r':
+                options.seed = strtoull(optarg, &end, 10);
+                if (end == optarg || *end) {
+                    print_simulate_usage();
+                    return 1;
+                }
+                break;
+            case 'm':
+                metrics_path = optarg;
+                break;
+            case 's':
+                shm_name = optarg;
+                break;
+            case 'o':
+                output_format = ftm_output_format_from_str(optarg);
+                if (output_format < 0) {
+                    print_simulate_usage();
+                    return 1;
+                }
+                break;
+            default:
+                print_simulate_usage();
+                return 1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if (argc != 2 && argc != 3) {
+        printf("Invalid arguments!\n");
+        print_simulate_usage();
+        return 1;
+    }
+    if (argc == 3)
+        options.sessions = atoi(argv[2]);
+    if (options.sessions <= 0) {
+        print_simulate_usage();
+        return 1;
+    }
+
+    struct simulate_scenario *scenario = load_scenario(argv[1], NULL);
+    if (!scenario)
+        return 1;
+    struct ftm_config *config = simulate_config(scenario);
+    if (!config) {
+        fprintf(stderr, "Fail to allocate config!\n");
+        free_scenario(scenario);
+        return 1;
+    }
+
+    /* the same handler and stages as start_measurement */
+    struct ftm_results_stat **stats =
+        calloc(config->peer_count, sizeof(struct ftm_results_stat *));
+    for (int i = 0; stats && i < config->peer_count; i++)
+        stats[i] = alloc_stat(options.sessions);
+    struct my_ftm_data data = {
+        .stats = stats,
+        .attempts = options.sessions,
+        .rx_queue_gauge = -1,
+        .overrun_counter = -1,
+        .timeout_counter = -1,
+        .rx_syscall_gauge = -1,
+        .rx_copied_gauge = -1,
+    };
+    struct simulate_stats sim_stats;
+    int err = 0;
     for (int i = 0; i < config->peer_count; i++) {
-        free(stats[i]);
+        if (!stats || !stats[i]) {
+            fprintf(stderr, "Fail to allocate stats!\n");
+            err = 1;
+            goto clean_up;
+        }
+    }
+    if (shm_name) {
+        data.ring = shm_ring_create(shm_name, SHM_RING_DEFAULT_CAPACITY,
+                                    NULL);
+        if (!data.ring) {
+            err = 1;
+            goto clean_up;
+        }
+    }
+    if (metrics_path) {
+        data.metrics = alloc_metrics(config);
+        if (!data.metrics) {
+            fprintf(stderr, "Fail to allocate metrics!\n");
+            err = 1;
+            goto clean_up;
+        }
+        if (metrics_start_server(data.metrics, metrics_path, NULL)) {
+            err = 1;
+            goto clean_up;
+        }
+    }
+    if (output_format >= 0) {
+        data.output = alloc_ftm_output(output_format, STDOUT_FILENO,
+                                       config->peer_count);
+        if (!data.output) {
+            fprintf(stderr, "Fail to allocate output!\n");
+            err = 1;
+            goto clean_up;
+        }
     }
+
+    err = simulate_run(scenario, config, &options, custom_result_handler,
+                       &data, &sim_stats, NULL);
+    /* the report goes to stderr, stdout may carry the records */
+    if (!err)
+        simulate_print(stderr, &sim_stats);
+
+clean_up:
+    free_ftm_output(data.output);
+    free_metrics(data.metrics);
+    shm_ring_close(data.ring);
+    for (int i = 0; stats && i < config->peer_count; i++)
+        free_stat(stats[i]);
     free(stats);
     free_ftm_config(config);
+    free_scenario(scenario);
     return err;
 }
@@ -2,6 +2,13 @@
 #define _FTM_INITIATOR_H
 #include "initiator_config.h"
 #include "initiator_start.h"
+#include "initiator_output.h"
+#include "initiator_watch.h"
+#include "../metrics/metrics.h"
+#include "../shm/shm.h"
+#include "../dashboard/dashboard.h"
+#include "../realtime/realtime.h"
+#include "../simulate/simulate.h"
 
 /**
  * DOC: Define your own data types and functions to start FTM and handle
@@ -24,14 +31,67 @@ struct recorded_result {
     uint64_t rtt_variance;
     uint64_t rtt_spread;
     int32_t rssi_avg;
+    uint64_t rx_time_ns;
 };
 
+/* sessions kept per peer for the logs when measuring endlessly */
+#define RECORDED_RESULTS_MAX 4096
+
+/*
+ * The result of session n is in results[n % capacity], so an endless
+ * measurement keeps its last capacity sessions.
+ */
 struct ftm_results_stat {
     struct recorded_result *results;
+    int capacity;
     int64_t *rtt_values;
     int64_t rtt_avg_stat;
     int rtt_measure_count;
 };
 
+/**
+ * struct my_ftm_data - Data passed to our result handler
+ * 
+ * @stats: per-peer statistics, in config order, moved along with the peers
+ * when the config is reloaded
+ * @attempts: sessions requested, to allocate the stats of added peers
+ * @metrics: metrics exported on a Unix socket, NULL if disabled
+ * @rx_queue_gauge: gauge id of the netlink receive queue
+ * @overrun_counter: counter id of the receive buffer overruns
+ * @overruns: receive buffer overruns so far
+ * @timeout_counter: counter id of the requests issued again after their
+ * deadline
+ * @timeouts: requests issued again after their deadline so far
+ * @rx_syscall_gauge: gauge id of the receive system calls per result
+ * @rx_copied_gauge: gauge id of the bytes copied per result
+ * @ring: shared-memory ring results are published to, NULL if disabled
+ * @dashboard: terminal dashboard, NULL in output mode
+ * @output: machine-readable output on stdout, NULL if disabled
+ * @realtime: real-time mode, NULL if disabled
+ * @sessions: sessions handled so far
+ * @watch: watch of the config file, NULL if not watched
+ * @reload_failures: failed reloads of @watch reported so far
+ */
+struct my_ftm_data {
+    struct ftm_results_stat **stats;
+    int attempts;
+    struct metrics *metrics;
+    int rx_queue_gauge;
+    int overrun_counter;
+    int64_t overruns;
+    int timeout_counter;
+    int64_t timeouts;
+    int rx_syscall_gauge;
+    int rx_copied_gauge;
+    struct shm_ring *ring;
+    struct dashboard *dashboard;
+    struct ftm_output *output;
+    struct realtime *realtime;
+    int sessions;
+    struct ftm_config_watch *watch;
+    uint64_t reload_failures;
+};
+
 int my_start_ftm(int argc, char **argv);
+int my_simulate_ftm(int argc, char **argv);
 #endif
\ No newline at end of file
@@ -1,4 +1,104 @@
 #include "initiator_config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <net/if.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * DOC: Config keys
+ * 
+ * Keys are looked up in a table indexed by CONFIG_KEY_HASH(), which is
+ * collision-free for the keys below. init_key_slots() checks this once, so
+ * a key added with a colliding hash fails every parse until the constants
+ * of CONFIG_KEY_HASH() are changed.
+ */
+
+/*
+ * key, attribute of ftm_peer_attr, type of the value, and the range of an
+ * INT value: what the attribute holds, or what nl80211 accepts if less
+ */
+#define CONFIG_KEYS(X)                                                    \
+    X(cf, center_freq, INT, 0, UINT32_MAX)                                \
+    X(cf1, center_freq_1, INT, 0, UINT32_MAX)                             \
+    X(cf2, center_freq_2, INT, 0, UINT32_MAX)                             \
+    X(bw, chan_width, BW, 0, 0)                                           \
+    X(bursts_exp, num_bursts_exp, INT, 0, 15)                             \
+    X(burst_period, burst_period, INT, 0, UINT16_MAX)                     \
+    X(retries, num_ftmr_retries, INT, 0, 31)                              \
+    X(burst_duration, burst_duration, INT, 0, 15)                         \
+    X(ftms_per_burst, ftms_per_burst, INT, 0, 31)                         \
+    X(rtt_correct, rtt_correct, INT, INT64_MIN, INT64_MAX)                \
+    X(dist_truth, dist_truth, FLOAT, 0, 0)                                \
+    X(asap, asap, FLAG, 0, 0)                                             \
+    X(tb, trigger_based, FLAG, 0, 0)                                      \
+    X(preamble, preamble, PREAMBLE, 0, 0)
+
+enum config_key_id {
+#define __KEY_ID(key, attr_name, type, min, max) CONFIG_KEY_##key,
+    CONFIG_KEYS(__KEY_ID)
+
+    /* keep last */
+    CONFIG_KEY_MAX
+};
+
+enum config_key_type {
+    CONFIG_KEY_INT,
+    CONFIG_KEY_FLOAT,
+    CONFIG_KEY_BW,
+    CONFIG_KEY_PREAMBLE,
+    CONFIG_KEY_FLAG,
+};
+
+struct config_key {
+    const char *name;
+    int len;
+    enum config_key_type type;
+    int64_t min;
+    int64_t max;
+};
+
+static const struct config_key config_keys[CONFIG_KEY_MAX] = {
+#define __KEY_ENTRY(key, attr_name, type, min, max)                    \
+    [CONFIG_KEY_##key] = {#key, sizeof(#key) - 1, CONFIG_KEY_##type, \
+                          min, max},
+    CONFIG_KEYS(__KEY_ENTRY)
+};
+
+#define CONFIG_KEY_SLOTS 32
+#define CONFIG_KEY_HASH(str, len) \
+    (((uint8_t)(str)[0] * 3 + (uint8_t)(str)[(len) - 1] * 16 + (len)) & \
+     (CONFIG_KEY_SLOTS - 1))
+
+static signed char key_slots[CONFIG_KEY_SLOTS];
+static bool key_slots_valid;
+static pthread_once_t key_slots_once = PTHREAD_ONCE_INIT;
+
+static void init_key_slots() {
+    memset(key_slots, -1, sizeof(key_slots));
+    key_slots_valid = true;
+    for (int i = 0; i < CONFIG_KEY_MAX; i++) {
+        int slot = CONFIG_KEY_HASH(config_keys[i].name, config_keys[i].len);
+        if (key_slots[slot] >= 0)
+            key_slots_valid = false;
+        key_slots[slot] = i;
+    }
+}
+
+static int find_key(const char *str, int len) {
+    if (len <= 0)
+        return -1;
+    int id = key_slots[CONFIG_KEY_HASH(str, len)];
+    if (id < 0 || config_keys[id].len != len ||
+        memcmp(config_keys[id].name, str, len) != 0)
+        return -1;
+    return id;
+}
+
 enum nl80211_chan_width str_to_bw(const char *str) {
 #define BW_FROM_STR(des)                 \
     if (strcasecmp(str, #des) == 0) {    \
@@ -10,137 +110,588 @@ enum nl80211_chan_width str_to_bw(const char *str) {
     BW_FROM_STR(40);
     BW_FROM_STR(80);
     BW_FROM_STR(160);
-    if (strcasecmp(str, "80+80")) {
+    if (strcasecmp(str, "80+80") == 0) {
         return NL80211_CHAN_WIDTH_80P80;
     }
     return NL80211_CHAN_WIDTH_20_NOHT;
 }
 
-static int parse_peer_config(struct ftm_peer_attr *attr, char *str) {
-    unsigned char addr[6];
-    int res, consumed;
-    char *bw = NULL, *pos, *tmp, *save_ptr, *delims = " \t\n";
-    bool report_ap_tsf = false, preamble = false;
-    unsigned int freq = 0, cf1 = 0, cf2 = 0;
-    res = sscanf(str, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx%n",
-                 &addr[0], &addr[1], &addr[2], &addr[3], &addr[4], &addr[5],
-                 &consumed);
+/**
+ * struct config_parser - State of a parse
+ * 
+ * @file_name: name used in messages, NULL for a single line
+ * @error: caller's buffer, NULL to print every error on stderr
+ * @messages: errors collected for @error
+ * @messages_len: length of @messages
+ * @error_count: errors so far
+ * @defaults: attributes of the current site
+ * @peers: parsed peers
+ * @peer_count: number of @peers
+ * @peer_cap: capacity of @peers
+ */
+struct config_parser {
+    const char *file_name;
+    char *error;
+    char messages[FTM_ERROR_MAX];
+    int messages_len;
+    int error_count;
+    struct ftm_peer_attr defaults;
+    struct ftm_peer_attr **peers;
+    int peer_count;
+    int peer_cap;
+};
+
+static void config_error(struct config_parser *parser, int line_num,
+                         const char *fmt, ...) {
+    char message[FTM_ERROR_MAX];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(message, sizeof(message), fmt, args);
+    va_end(args);
+    parser->error_count++;
+
+    if (!parser->error) {
+        if (parser->file_name)
+            fprintf(stderr, "%s:%d: %s\n", parser->file_name, line_num,
+                    message);
+        else
+            fprintf(stderr, "%s\n", message);
+        return;
+    }
+    int room = sizeof(parser->messages) - parser->messages_len;
+    if (room <= 1)
+        return;
+    int n;
+    if (parser->file_name)
+        n = snprintf(parser->messages + parser->messages_len, room,
+                     "%sline %d: %s", parser->messages_len ? "; " : "",
+                     line_num, message);
+    else
+        n = snprintf(parser->messages + parser->messages_len, room, "%s%s",
+                     parser->messages_len ? "; " : "", message);
+    parser->messages_len += n < room ? n : room - 1;
+}
+
+static inline bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
 
-    if (res != 6) {
-        printf("Invalid MAC address\n");
+/* "xx:xx:xx:xx:xx:xx", one or two hex digits per byte */
+static bool parse_mac(const char *str, int len, uint8_t *addr) {
+    const char *end = str + len;
+    for (int i = 0; i < 6; i++) {
+        int digits = 0, value = 0;
+        while (str < end && hex_digit(*str) >= 0 && digits < 2) {
+            value = value * 16 + hex_digit(*str++);
+            digits++;
+        }
+        if (!digits)
+            return false;
+        addr[i] = value;
+        if (i < 5 && (str == end || *str++ != ':'))
+            return false;
+    }
+    return str == end;
+}
+
+/* like strtoll() with base 0 on exactly len bytes, false on overflow */
+static bool parse_int(const char *str, int len, int64_t *value) {
+    const char *end = str + len;
+    bool negative = false;
+    int base = 10;
+    uint64_t result = 0;
+    if (str < end && (*str == '-' || *str == '+'))
+        negative = *str++ == '-';
+    if (end - str > 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+        base = 16;
+        str += 2;
+    } else if (end - str > 1 && str[0] == '0') {
+        base = 8;
+        str++;
+    }
+    if (str == end)
+        return false;
+    for (; str < end; str++) {
+        int digit = hex_digit(*str);
+        if (digit < 0 || digit >= base ||
+            result > (UINT64_MAX - digit) / base)
+            return false;
+        result = result * base + digit;
+    }
+    if (result > (uint64_t)INT64_MAX + negative)
+        return false;
+    *value = negative ? -(int64_t)result : (int64_t)result;
+    return true;
+}
+
+static bool parse_float(const char *str, int len, float *value) {
+    char buf[64];
+    char *tmp;
+    if (len <= 0 || len >= sizeof(buf))
+        return false;
+    memcpy(buf, str, len);
+    buf[len] = '\0';
+    *value = strtof(buf, &tmp);
+    return *tmp == '\0';
+}
+
+static bool parse_bw(const char *str, int len, uint32_t *bw) {
+    char buf[8];
+    if (len <= 0 || len >= sizeof(buf))
+        return false;
+    memcpy(buf, str, len);
+    buf[len] = '\0';
+    *bw = str_to_bw(buf);
+    return *bw != NL80211_CHAN_WIDTH_20_NOHT;
+}
+
+static const char *preamble_names[] = {
+    [NL80211_PREAMBLE_LEGACY] = "legacy",
+    [NL80211_PREAMBLE_HT] = "ht",
+    [NL80211_PREAMBLE_VHT] = "vht",
+    [NL80211_PREAMBLE_DMG] = "dmg",
+    [NL80211_PREAMBLE_HE] = "he",
+};
+
+const char *preamble_to_str(enum nl80211_preamble preamble) {
+    if (preamble >= sizeof(preamble_names) / sizeof(preamble_names[0]) ||
+        !preamble_names[preamble])
+        return NULL;
+    return preamble_names[preamble];
+}
+
+static bool parse_preamble(const char *str, int len, uint32_t *preamble) {
+    for (int i = 0; i < sizeof(preamble_names) / sizeof(preamble_names[0]);
+         i++) {
+        if (preamble_names[i] && strlen(preamble_names[i]) == len &&
+            strncasecmp(preamble_names[i], str, len) == 0) {
+            *preamble = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* apply a "key=value" or flag token */
+static int apply_token(struct config_parser *parser, int line_num,
+                       struct ftm_peer_attr *attr, const char *token,
+                       int len) {
+    const char *eq = memchr(token, '=', len);
+    int key_len = eq ? eq - token : len;
+    const char *value = eq ? eq + 1 : NULL;
+    int value_len = eq ? len - key_len - 1 : 0;
+    int id = find_key(token, key_len);
+    if (id < 0) {
+        config_error(parser, line_num, "Unknown parameter %.*s", len, token);
         return 1;
     }
 
+    int64_t int_value = 0;
+    float float_value = 0;
+    uint32_t bw = 0, preamble = 0;
+    bool valid;
+    switch (config_keys[id].type) {
+        case CONFIG_KEY_INT:
+            valid = value && parse_int(value, value_len, &int_value);
+            break;
+        case CONFIG_KEY_FLOAT:
+            valid = value && parse_float(value, value_len, &float_value);
+            break;
+        case CONFIG_KEY_BW:
+            valid = value && parse_bw(value, value_len, &bw);
+            break;
+        case CONFIG_KEY_PREAMBLE:
+            valid = value && parse_preamble(value, value_len, &preamble);
+            break;
+        case CONFIG_KEY_FLAG:
+            valid = !value;
+            break;
+        default:
+            valid = false;
+            break;
+    }
+    if (!valid) {
+        config_error(parser, line_num, "Invalid %s value!",
+                     config_keys[id].name);
+        return 1;
+    }
+    if (config_keys[id].type == CONFIG_KEY_INT &&
+        (int_value < config_keys[id].min ||
+         int_value > config_keys[id].max)) {
+        config_error(parser, line_num, "%s=%.*s is out of range [%ld, %ld]!",
+                     config_keys[id].name, value_len, value,
+                     config_keys[id].min, config_keys[id].max);
+        return 1;
+    }
+
+#define __VALUE_INT int_value
+#define __VALUE_FLOAT float_value
+#define __VALUE_BW bw
+#define __VALUE_PREAMBLE preamble
+#define __VALUE_FLAG 1
+    switch (id) {
+#define __SET_KEY(key, attr_name, type, min, max)                     \
+        case CONFIG_KEY_##key:                                        \
+            FTM_PEER_SET_ATTR(attr, attr_name, __VALUE_##type);       \
+            break;
+        CONFIG_KEYS(__SET_KEY)
+    }
+    if (id == CONFIG_KEY_tb)
+        FTM_PEER_SET_ATTR(attr, preamble, NL80211_PREAMBLE_HE);
+    return 0;
+}
+
+/* apply every token of [pos, end), stopping at a comment */
+static int apply_tokens(struct config_parser *parser, int line_num,
+                        struct ftm_peer_attr *attr, const char *pos,
+                        const char *end) {
+    int err = 0;
+    while (pos < end) {
+        while (pos < end && is_blank(*pos))
+            pos++;
+        if (pos == end || *pos == '#')
+            break;
+        const char *token = pos;
+        while (pos < end && !is_blank(*pos))
+            pos++;
+        err |= apply_token(parser, line_num, attr, token, pos - token);
+    }
+    return err;
+}
+
+static int set_preamble(struct config_parser *parser, int line_num,
+                        struct ftm_peer_attr *attr) {
+    if (FTM_PEER_HAS(attr, preamble) ||
+        !FTM_PEER_HAS(attr, chan_width))
+        return 0;
+    int preamble = -1;
+    switch (attr->chan_width) {
+        case NL80211_CHAN_WIDTH_20_NOHT:
+        case NL80211_CHAN_WIDTH_5:
+        case NL80211_CHAN_WIDTH_10:
+            preamble = NL80211_PREAMBLE_LEGACY;
+            break;
+        case NL80211_CHAN_WIDTH_20:
+        case NL80211_CHAN_WIDTH_40:
+            preamble = NL80211_PREAMBLE_HT;
+            break;
+        case NL80211_CHAN_WIDTH_80:
+        case NL80211_CHAN_WIDTH_80P80:
+        case NL80211_CHAN_WIDTH_160:
+            preamble = NL80211_PREAMBLE_VHT;
+            break;
+        default:
+            config_error(parser, line_num, "No preamble for bandwidth %u",
+                         attr->chan_width);
+            return 1;
+    }
+    FTM_PEER_SET_ATTR(attr, preamble, preamble);
+    return 0;
+}
+
+/* parse a peer line starting with its mac address into attr */
+static int parse_peer_line(struct config_parser *parser, int line_num,
+                           struct ftm_peer_attr *attr, const char *pos,
+                           const char *end) {
+    const char *token = pos;
+    uint8_t addr[6];
+    while (pos < end && !is_blank(*pos))
+        pos++;
+    if (!parse_mac(token, pos - token, addr)) {
+        config_error(parser, line_num, "Invalid MAC address %.*s",
+                     (int)(pos - token), token);
+        return 1;
+    }
+    memcpy(attr, &parser->defaults, sizeof(struct ftm_peer_attr));
     FTM_PEER_SET_ATTR_ADDR(attr, addr);
+    if (apply_tokens(parser, line_num, attr, pos, end))
+        return 1;
+    return set_preamble(parser, line_num, attr);
+}
 
-    str += consumed;
-    pos = strtok_r(str, delims, &save_ptr);
-
-#define __SET_ATTR(entry, length, attr_name)                  \
-    if (strncmp(pos, #entry "=", length + 1) == 0) {          \
-        FTM_PEER_SET_ATTR(attr, attr_name,                    \
-                          strtol(pos + length + 1, &tmp, 0)); \
-        if (*tmp) {                                           \
-            printf("Invalid " #attr_name " value!\n");        \
-            goto return_err;                                  \
-        }                                                     \
-        pos = strtok_r(NULL, delims, &save_ptr);              \
-        continue;                                             \
-    }
-
-    while (pos) {
-        __SET_ATTR(cf, 2, center_freq);
-        __SET_ATTR(cf1, 3, center_freq_1);
-        __SET_ATTR(cf2, 3, center_freq_2);
-        __SET_ATTR(bursts_exp, 10, num_bursts_exp);
-        __SET_ATTR(burst_period, 12, burst_period);
-        __SET_ATTR(retries, 7, num_ftmr_retries);
-        __SET_ATTR(burst_duration, 14, burst_duration);
-        __SET_ATTR(ftms_per_burst, 14, ftms_per_burst);
-        __SET_ATTR(rtt_correct, 11, rtt_correct);
-        __SET_ATTR(dist_truth, 10, dist_truth);
-
-        if (strcmp(pos, "asap") == 0) {
-            FTM_PEER_SET_ATTR(attr, asap, 1);
-        } else if (strncmp(pos, "tb", 2) == 0) {
-            FTM_PEER_SET_ATTR(attr, trigger_based, 1);
-            FTM_PEER_SET_ATTR(attr, preamble, NL80211_PREAMBLE_HE);
-            preamble = true;
-        } else if (strncmp(pos, "bw=", 3) == 0) {
-            bw = pos + 3;
-            FTM_PEER_SET_ATTR(attr, chan_width, str_to_bw(bw));
-        } else {
-            printf("Unknown parameter %s\n", pos);
+static int add_peer(struct config_parser *parser,
+                    struct ftm_peer_attr *attr) {
+    if (parser->peer_count == parser->peer_cap) {
+        int cap = parser->peer_cap ? parser->peer_cap * 2 : 16;
+        struct ftm_peer_attr **peers =
+            realloc(parser->peers, cap * sizeof(struct ftm_peer_attr *));
+        if (!peers)
             return 1;
-        }
+        parser->peers = peers;
+        parser->peer_cap = cap;
+    }
+    parser->peers[parser->peer_count++] = attr;
+    return 0;
+}
 
-        pos = strtok_r(NULL, delims, &save_ptr);
-    }
-
-    if (!preamble && bw) {
-        int preamble = -1;
-        switch (str_to_bw(bw)) {
-            case NL80211_CHAN_WIDTH_20_NOHT:
-            case NL80211_CHAN_WIDTH_5:
-            case NL80211_CHAN_WIDTH_10:
-                preamble = NL80211_PREAMBLE_LEGACY;
-                break;
-            case NL80211_CHAN_WIDTH_20:
-            case NL80211_CHAN_WIDTH_40:
-                preamble = NL80211_PREAMBLE_HT;
-                break;
-            case NL80211_CHAN_WIDTH_80:
-            case NL80211_CHAN_WIDTH_80P80:
-            case NL80211_CHAN_WIDTH_160:
-                preamble = NL80211_PREAMBLE_VHT;
-                break;
-            default:
-                return 1;
-        }
-        FTM_PEER_SET_ATTR(attr, preamble, preamble);
+/* a peer, a "site" line, a comment or a blank line */
+static void parse_line(struct config_parser *parser, int line_num,
+                       const char *pos, const char *end) {
+    while (pos < end && is_blank(*pos))
+        pos++;
+    if (pos == end || *pos == '#')
+        return;
+
+    if (end - pos >= 4 && memcmp(pos, "site", 4) == 0 &&
+        (end - pos == 4 || is_blank(pos[4]))) {
+        /* "site [<name>] [attributes]": defaults of the following peers */
+        pos += 4;
+        while (pos < end && is_blank(*pos))
+            pos++;
+        const char *name_end = pos;
+        while (name_end < end && !is_blank(*name_end))
+            name_end++;
+        if (pos < end && *pos != '#' && !memchr(pos, '=', name_end - pos) &&
+            find_key(pos, name_end - pos) < 0)
+            pos = name_end;
+        memset(&parser->defaults, 0, sizeof(struct ftm_peer_attr));
+        apply_tokens(parser, line_num, &parser->defaults, pos, end);
+        return;
+    }
+
+    struct ftm_peer_attr *attr = alloc_ftm_peer();
+    if (!attr || parse_peer_line(parser, line_num, attr, pos, end) ||
+        add_peer(parser, attr)) {
+        if (!attr)
+            config_error(parser, line_num, "Fail to allocate peer!");
+        free(attr);
+    }
+}
+
+static void free_peers(struct ftm_peer_attr **peers, int count) {
+    for (int i = 0; i < count; i++)
+        free(peers[i]);
+    free(peers);
+}
+
+static void init_parser(struct config_parser *parser, const char *file_name,
+                        char *error) {
+    memset(parser, 0, sizeof(struct config_parser));
+    parser->file_name = file_name;
+    parser->error = error;
+    pthread_once(&key_slots_once, init_key_slots);
+}
+
+int parse_peer_config(struct ftm_peer_attr *attr, char *str, char *error) {
+    struct config_parser parser;
+    init_parser(&parser, NULL, error);
+    if (!key_slots_valid) {
+        ftm_report_error(error, "Config key table has collisions!");
+        return 1;
+    }
+    char *end = str + strcspn(str, "\n");
+    while (str < end && is_blank(*str))
+        str++;
+    if (parse_peer_line(&parser, 1, attr, str, end)) {
+        if (error)
+            snprintf(error, FTM_ERROR_MAX, "%s", parser.messages);
+        return 1;
     }
     return 0;
-return_err:
-    return 1;
 }
 
-struct ftm_config *parse_config_file(const char *file_name,
-                                     const char *if_name) {
-    FILE *file = fopen(file_name, "r");
-    if (!file) {
-        fprintf(stderr, "Fail to open file %s\n", file_name);
+/**
+ * struct config_cache_header - Header of a compiled config
+ * 
+ * @magic: CONFIG_CACHE_MAGIC
+ * @version: CONFIG_CACHE_VERSION
+ * @peer_size: sizeof(struct ftm_peer_attr) of the writer
+ * @peer_count: number of peers following the header
+ * @source_size: size of the config file it was compiled from
+ * @source_mtime_ns: modification time of that file
+ */
+struct config_cache_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t peer_size;
+    uint32_t peer_count;
+    uint32_t reserved;
+    uint64_t source_size;
+    int64_t source_mtime_ns;
+};
+
+#define CONFIG_CACHE_MAGIC 0x43435446 /* "FTCC" */
+#define CONFIG_CACHE_VERSION 1
+
+static int64_t mtime_ns(struct stat *st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+/* peers of a cache matching the source, NULL if stale or absent */
+static struct ftm_peer_attr **read_cache(const char *cache_path,
+                                         struct stat *source, int *count) {
+    int fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
         return NULL;
+    struct ftm_peer_attr **peers = NULL;
+    const struct config_cache_header *header = MAP_FAILED;
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < sizeof(*header))
+        goto out;
+    /* one mapping for the whole payload instead of a read() per peer */
+    header = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (header == MAP_FAILED ||
+        header->magic != CONFIG_CACHE_MAGIC ||
+        header->version != CONFIG_CACHE_VERSION ||
+        header->peer_size != sizeof(struct ftm_peer_attr) ||
+        header->source_size != source->st_size ||
+        header->source_mtime_ns != mtime_ns(source) ||
+        st.st_size != sizeof(*header) + (off_t)header->peer_count *
+                                        sizeof(struct ftm_peer_attr))
+        goto out;
+
+    const struct ftm_peer_attr *payload =
+        (const struct ftm_peer_attr *)(header + 1);
+    peers = malloc((header->peer_count ? header->peer_count : 1) *
+                   sizeof(struct ftm_peer_attr *));
+    if (!peers)
+        goto out;
+    for (int i = 0; i < header->peer_count; i++) {
+        peers[i] = alloc_ftm_peer();
+        if (!peers[i]) {
+            free_peers(peers, i);
+            peers = NULL;
+            goto out;
+        }
+        memcpy(peers[i], &payload[i], sizeof(struct ftm_peer_attr));
     }
-    /* placeholder here */
-    unsigned int max_peer_count = 16;
-    struct ftm_peer_attr **peers =
-        malloc(max_peer_count * sizeof(struct ftm_peer_attr *));
-
-    char line[255];
-    int line_num;
-    for (line_num = 1; fgets(line, sizeof(line), file); line_num++) {
-        if (line_num > max_peer_count) {
-            fprintf(stderr, "Peer count over %u, the rest will be ignored!\n",
-                    max_peer_count);
-            line_num--;
-            break;
+    *count = header->peer_count;
+out:
+    if (header != MAP_FAILED)
+        munmap((void *)header, st.st_size);
+    close(fd);
+    return peers;
+}
+
+/* write to a temporary file renamed over the cache, errors are ignored */
+static void write_cache(const char *cache_path, struct stat *source,
+                        struct ftm_peer_attr **peers, int count) {
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache_path) >=
+        sizeof(tmp_path))
+        return;
+    FILE *file = fopen(tmp_path, "w");
+    if (!file)
+        return;
+    struct config_cache_header header = {
+        .magic = CONFIG_CACHE_MAGIC,
+        .version = CONFIG_CACHE_VERSION,
+        .peer_size = sizeof(struct ftm_peer_attr),
+        .peer_count = count,
+        .source_size = source->st_size,
+        .source_mtime_ns = mtime_ns(source),
+    };
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (int i = 0; ok && i < count; i++)
+        ok = fwrite(peers[i], sizeof(struct ftm_peer_attr), 1, file) == 1;
+    ok &= fclose(file) == 0;
+    if (!ok || rename(tmp_path, cache_path))
+        unlink(tmp_path);
+}
+
+struct ftm_config *load_config_file(const char *file_name,
+                                    const char *if_name,
+                                    const char *cache_path, char *error) {
+    struct config_parser parser;
+    init_parser(&parser, file_name, error);
+    if (!key_slots_valid) {
+        ftm_report_error(error, "Config key table has collisions!");
+        return NULL;
+    }
+    if (!if_nametoindex(if_name)) {
+        ftm_report_error(error, "Fail to find device interface %s!",
+                         if_name);
+        return NULL;
+    }
+    int fd = open(file_name, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st)) {
+        ftm_report_error(error, "Fail to open file %s: %s", file_name,
+                         strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+
+    if (cache_path) {
+        int count;
+        struct ftm_peer_attr **peers = read_cache(cache_path, &st, &count);
+        if (peers) {
+            close(fd);
+            struct ftm_config *config =
+                alloc_ftm_config(if_name, peers, count);
+            if (!config)
+                free_peers(peers, count);
+            return config;
         }
-        struct ftm_peer_attr *attr = alloc_ftm_peer();
-        peers[line_num - 1] = attr;
-        if (parse_peer_config(attr, line)) {
-            printf("Invalid FTM configuration at line %d!\n",
-                   line_num);
+    }
+
+    const char *data = NULL;
+    if (st.st_size) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            ftm_report_error(error, "Fail to map file %s: %s", file_name,
+                             strerror(errno));
+            close(fd);
             return NULL;
         }
+        madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    const char *pos = data, *end = data + st.st_size;
+    for (int line_num = 1; pos < end; line_num++) {
+        const char *line_end = memchr(pos, '\n', end - pos);
+        if (!line_end)
+            line_end = end;
+        parse_line(&parser, line_num, pos, line_end);
+        pos = line_end + 1;
+    }
+    if (data)
+        munmap((void *)data, st.st_size);
+
+    if (parser.error_count) {
+        if (error)
+            ftm_report_error(error, "%d error%s in %s: %s",
+                             parser.error_count,
+                             parser.error_count > 1 ? "s" : "", file_name,
+                             parser.messages);
+        else
+            fprintf(stderr, "%d error%s in %s\n", parser.error_count,
+                    parser.error_count > 1 ? "s" : "", file_name);
+        free_peers(parser.peers, parser.peer_count);
+        return NULL;
     }
-    struct ftm_config *config = alloc_ftm_config(if_name, peers, line_num - 1);
+
+    if (cache_path)
+        write_cache(cache_path, &st, parser.peers, parser.peer_count);
+    struct ftm_config *config =
+        alloc_ftm_config(if_name, parser.peers, parser.peer_count);
     if (!config) {
-        fprintf(stderr, "Fail to allocate config!\n");
+        ftm_report_error(error, "Fail to allocate config!");
+        free_peers(parser.peers, parser.peer_count);
     }
     return config;
-return_err:
-    fclose(file);
-    return NULL;
+}
+
+struct ftm_config *parse_config_file(const char *file_name,
+                                     const char *if_name) {
+    return load_config_file(file_name, if_name, NULL, NULL);
+}
+
+struct ftm_config *parse_config_file_r(const char *file_name,
+                                       const char *if_name, char *error) {
+    return load_config_file(file_name, if_name, NULL, error);
 }
 
 void print_config(struct ftm_config *config) {
@@ -156,20 +707,9 @@ void print_config(struct ftm_config *config) {
         printf("\nTarget #%d - %02hhx:%02hhx:%02hhx:%02hhx:%02hhx:%02hhx\n",
                i + 1, peer->mac_addr[0], peer->mac_addr[1], peer->mac_addr[2], peer->mac_addr[3],
                peer->mac_addr[4], peer->mac_addr[5]);
-        CONFIG_PRINT(peer, chan_width, u);
-        CONFIG_PRINT(peer, center_freq, u);
-        CONFIG_PRINT(peer, center_freq_1, u);
-        CONFIG_PRINT(peer, center_freq_2, u);
-        CONFIG_PRINT(peer, asap, d);
-        CONFIG_PRINT(peer, preamble, u);
-        CONFIG_PRINT(peer, num_bursts_exp, u);
-        CONFIG_PRINT(peer, burst_period, u);
-        CONFIG_PRINT(peer, burst_duration, d);
-        CONFIG_PRINT(peer, ftms_per_burst, d);
-        CONFIG_PRINT(peer, num_ftmr_retries, u);
-        CONFIG_PRINT(peer, trigger_based, u);
-        CONFIG_PRINT(peer, rtt_correct, ld);
-        CONFIG_PRINT(peer, dist_truth, ld);
+#define __CONFIG_PRINT(name, type, spec, nest, attr, put) \
+    CONFIG_PRINT(peer, name, spec);
+        FTM_PEER_FIELDS(__CONFIG_PRINT)
     }
     printf("\n--------------\n");
 }
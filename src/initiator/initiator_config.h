@@ -20,12 +20,25 @@
  * [retries=<num of retries>] 
  * [burst_duration=<burst duration>] 
  * [tb]
+ * [preamble=<legacy|ht|vht|he>]
  * [rtt_correct=<rtt to be compensated>]
+ * [dist_truth=<true distance in m>]
+ * 
+ * A line of the form
+ * site [<name>] [<attributes>]
+ * sets the default attributes of the peers following it, until the next
+ * site line. Attributes given on a peer line override the defaults.
+ * Without preamble (or tb, which implies he), the preamble is derived from
+ * the bandwidth.
+ * Everything after a "#" starting a token is a comment. There is no limit
+ * on the length of a line or on the number of peers. Integers out of the
+ * range of their attribute (bursts_exp and burst_duration up to 15,
+ * retries and ftms_per_burst up to 31) are errors, not truncated.
  * 
  * @note
  * Each peer must take only one line, although the doc above seperates the 
  * attributes into different lines. Append more configuration options by 
- * modifing parse_peer_config() in config.c.
+ * adding them to CONFIG_KEYS in initiator_config.c.
  */
 
 /**
@@ -35,14 +48,80 @@
  * @param if_name     interface name
  * 
  * @return a valid ftm_config pointer on success, NULL on failure.
+ * 
+ * @note
+ * Errors are printed on stderr. Use parse_config_file_r() or
+ * ftm_ctx_parse_config() to get them as a string instead.
  */
 struct ftm_config *parse_config_file(const char *file_name,
                                      const char *if_name);
 
+/**
+ * parse_config_file_r - Parse ftm config file, reporting errors into
+ * a buffer
+ * 
+ * @param file_name   relative or absolute path of the config file
+ * @param if_name     interface name
+ * @param error       buffer of FTM_ERROR_MAX bytes, see ftm_report_error()
+ * 
+ * @return a valid ftm_config pointer on success, NULL on failure.
+ */
+struct ftm_config *parse_config_file_r(const char *file_name,
+                                       const char *if_name, char *error);
+
+/**
+ * load_config_file - Parse ftm config file, reusing a compiled copy of it
+ * 
+ * @param file_name    relative or absolute path of the config file
+ * @param if_name      interface name
+ * @param cache_path   compiled config, NULL to always parse the file
+ * @param error        buffer of FTM_ERROR_MAX bytes, see ftm_report_error()
+ * 
+ * @return a valid ftm_config pointer on success, NULL on failure.
+ * 
+ * @note
+ * The whole file is checked and every invalid line is reported, as
+ * "<file>:<line>: <message>" on stderr if @error is NULL, or as a list
+ * truncated to the size of @error otherwise. The config fails to load if
+ * any line is invalid.
+ * 
+ * The peers in @cache_path are used if it was compiled from a file of the
+ * same size and modification time. Otherwise the file is parsed and the
+ * cache is rewritten; failing to write it is not an error.
+ */
+struct ftm_config *load_config_file(const char *file_name,
+                                    const char *if_name,
+                                    const char *cache_path, char *error);
+
+/**
+ * parse_peer_config - Parse a single line of the config file
+ * 
+ * @param attr   peer allocated with alloc_ftm_peer() to be filled
+ * @param str    the line, up to a newline or the end of the string
+ * @param error  buffer of FTM_ERROR_MAX bytes, see ftm_report_error()
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int parse_peer_config(struct ftm_peer_attr *attr, char *str, char *error);
+
+/**
+ * preamble_to_str - Name of a preamble in the config file, like "vht"
+ * 
+ * @return the name, NULL if unknown
+ */
+const char *preamble_to_str(enum nl80211_preamble preamble);
+
+/**
+ * str_to_bw - Parse a bandwidth of the config file, like "80" or "80+80"
+ * 
+ * @return the width, NL80211_CHAN_WIDTH_20_NOHT if unknown
+ */
+enum nl80211_chan_width str_to_bw(const char *str);
+
 #define CONFIG_PRINT(peer, name, spec)         \
     do {                                         \
         printf("%-19s", #name);                  \
-        if (peer->flags[FTM_PEER_FLAG_##name]) { \
+        if (FTM_PEER_HAS(peer, name)) {          \
             printf("%" #spec "\n", peer->name);  \
         } else {                                 \
             printf("default\n");                 \
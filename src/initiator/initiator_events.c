@@ -0,0 +1,200 @@
+#include "initiator_events.h"
+#include <errno.h>
+#include <linux/rtnetlink.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+/* what a handler of the sockets reports to */
+struct event_dispatch {
+    struct ftm_event_watch *watch;
+    ftm_radio_event_handler handler;
+    void *arg;
+};
+
+static void report_event(struct event_dispatch *dispatch,
+                         enum ftm_radio_event_type type, uint32_t if_index,
+                         const char *if_name) {
+    struct ftm_radio_event event = {type, if_index, ""};
+    if (if_name)
+        snprintf(event.if_name, IF_NAMESIZE, "%s", if_name);
+    dispatch->watch->events++;
+    dispatch->handler(&event, dispatch->arg);
+}
+
+static int nl80211_event_handler(struct nl_msg *msg, void *arg) {
+    struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+    struct nlattr *tb[NL80211_ATTR_MAX + 1];
+    enum ftm_radio_event_type type;
+
+    switch (gnlh->cmd) {
+    case NL80211_CMD_NEW_INTERFACE:
+        type = FTM_RADIO_UP;
+        break;
+    case NL80211_CMD_DEL_INTERFACE:
+        type = FTM_RADIO_DOWN;
+        break;
+    case NL80211_CMD_SET_INTERFACE:
+    case NL80211_CMD_CH_SWITCH_NOTIFY:
+    case NL80211_CMD_CONNECT:
+    case NL80211_CMD_ROAM:
+    case NL80211_CMD_DISCONNECT:
+        type = FTM_RADIO_CHANGED;
+        break;
+    default:
+        return NL_SKIP;
+    }
+    nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+              genlmsg_attrlen(gnlh, 0), NULL);
+    if (!tb[NL80211_ATTR_IFINDEX])
+        return NL_SKIP;
+    report_event(arg, type, nla_get_u32(tb[NL80211_ATTR_IFINDEX]),
+                 tb[NL80211_ATTR_IFNAME] ?
+                 nla_get_string(tb[NL80211_ATTR_IFNAME]) : NULL);
+    return NL_OK;
+}
+
+static int link_event_handler(struct nl_msg *msg, void *arg) {
+    struct nlmsghdr *nlh = nlmsg_hdr(msg);
+    if (nlh->nlmsg_type != RTM_NEWLINK && nlh->nlmsg_type != RTM_DELLINK)
+        return NL_SKIP;
+    struct ifinfomsg *ifi = nlmsg_data(nlh);
+    struct nlattr *tb[IFLA_MAX + 1];
+    if (nlmsg_parse(nlh, sizeof(struct ifinfomsg), tb, IFLA_MAX, NULL))
+        return NL_SKIP;
+    bool up = nlh->nlmsg_type == RTM_NEWLINK && (ifi->ifi_flags & IFF_UP);
+    report_event(arg, up ? FTM_RADIO_UP : FTM_RADIO_DOWN, ifi->ifi_index,
+                 tb[IFLA_IFNAME] ? nla_get_string(tb[IFLA_IFNAME]) : NULL);
+    return NL_OK;
+}
+
+static int join_group(struct ftm_event_watch *watch, const char *name) {
+    int group = genl_ctrl_resolve_grp(watch->nl80211.nl_sock, "nl80211",
+                                      name);
+    if (group < 0 || nl_socket_add_membership(watch->nl80211.nl_sock,
+                                              group)) {
+        ftm_report_error(watch->nl80211.error,
+                         "Fail to join the %s events of nl80211!", name);
+        return 1;
+    }
+    return 0;
+}
+
+static int watch_sock(struct ftm_event_watch *watch,
+                      struct nl80211_state *state) {
+    struct epoll_event event = {
+        .events = EPOLLIN,
+        .data.ptr = state,
+    };
+    nl_socket_set_nonblocking(state->nl_sock);
+    if (epoll_ctl(watch->fd, EPOLL_CTL_ADD, nl_socket_get_fd(state->nl_sock),
+                  &event)) {
+        ftm_report_error(state->error, "Fail to watch events: %s",
+                         strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+struct ftm_event_watch *alloc_ftm_event_watch(char *error) {
+    struct ftm_event_watch *watch = calloc(1, sizeof(struct ftm_event_watch));
+    if (!watch) {
+        ftm_report_error(error, "Fail to allocate event watch!");
+        return NULL;
+    }
+    watch->nl80211.error = error;
+    watch->route.error = error;
+    watch->fd = epoll_create1(EPOLL_CLOEXEC);
+    if (watch->fd < 0) {
+        ftm_report_error(error, "Fail to create epoll: %s", strerror(errno));
+        goto handle_free;
+    }
+    if (nl80211_init(&watch->nl80211) || nl_route_init(&watch->route))
+        goto handle_free;
+    if (join_group(watch, "config") || join_group(watch, "mlme") ||
+        nl_socket_add_membership(watch->route.nl_sock, RTNLGRP_LINK)) {
+        if (!error || !*error)
+            ftm_report_error(error, "Fail to join the link events!");
+        goto handle_free;
+    }
+    if (watch_sock(watch, &watch->nl80211) ||
+        watch_sock(watch, &watch->route))
+        goto handle_free;
+    return watch;
+handle_free:
+    free_ftm_event_watch(watch);
+    return NULL;
+}
+
+void free_ftm_event_watch(struct ftm_event_watch *watch) {
+    if (!watch)
+        return;
+    nl80211_free(&watch->nl80211);
+    nl80211_free(&watch->route);
+    if (watch->fd >= 0)
+        close(watch->fd);
+    free(watch);
+}
+
+/* drain a socket, 0 when empty */
+static int drain_sock(struct nl80211_state *state, nl_recvmsg_msg_cb_t handler,
+                      struct event_dispatch *dispatch) {
+    struct nl_rx_cb cb = {
+        .valid = handler,
+        .valid_arg = dispatch,
+    };
+    while (1) {
+        int err = nl_sock_recv(state, &cb, false);
+        if (err == 0 || err == -NLE_AGAIN)
+            return 0;
+        if (err == 1)
+            continue;
+        /* events were lost, which only delays noticing the next ones */
+        if (nl_sock_is_overrun(err)) {
+            state->overruns++;
+            continue;
+        }
+        ftm_report_error(state->error, "Fail to receive events: %s",
+                         nl_geterror(err));
+        return 1;
+    }
+}
+
+int ftm_event_watch_process(struct ftm_event_watch *watch,
+                            ftm_radio_event_handler handler, void *arg) {
+    struct event_dispatch dispatch = {watch, handler, arg};
+    uint64_t events = watch->events;
+    if (drain_sock(&watch->nl80211, nl80211_event_handler, &dispatch) ||
+        drain_sock(&watch->route, link_event_handler, &dispatch))
+        return -1;
+    return watch->events - events;
+}
+
+int ftm_event_watch_wait(struct ftm_event_watch *watch, int timeout_ms) {
+    struct epoll_event event;
+    while (1) {
+        int count = epoll_wait(watch->fd, &event, 1, timeout_ms);
+        if (count >= 0)
+            return count > 0;
+        if (errno != EINTR) {
+            ftm_report_error(watch->nl80211.error,
+                             "Fail to wait for events: %s", strerror(errno));
+            return -1;
+        }
+    }
+}
+
+bool ftm_link_is_up(uint32_t if_index) {
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    if (!if_indextoname(if_index, ifr.ifr_name))
+        return false;
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+    int err = ioctl(fd, SIOCGIFFLAGS, &ifr);
+    close(fd);
+    return !err && (ifr.ifr_flags & IFF_UP);
+}
@@ -0,0 +1,103 @@
+#ifndef _FTM_INITIATOR_EVENTS_H
+#define _FTM_INITIATOR_EVENTS_H
+
+#include <net/if.h>
+#include <stdint.h>
+#include "../nl/nl.h"
+
+/**
+ * DOC: Radio events
+ * 
+ * While a long run goes on, the interface it measures on may go down, be
+ * deleted and created again, roam or switch channel. None of this shows
+ * on the socket of the measurement: the request in flight is dropped
+ * without a word, or the next one fails. An event watch listens to the
+ * "config" and "mlme" multicast groups of nl80211 and to the link events
+ * of rtnetlink, so that the context pauses while the interface is down
+ * and starts the attempt again once it is back or has moved.
+ */
+
+/**
+ * enum ftm_radio_event_type - What happened to an interface
+ * 
+ * @FTM_RADIO_DOWN: the link went down or the interface was deleted
+ * @FTM_RADIO_UP: the link went up or the interface was created
+ * @FTM_RADIO_CHANGED: the interface changed its type or channel,
+ * connected, roamed or disconnected
+ */
+enum ftm_radio_event_type {
+    FTM_RADIO_DOWN,
+    FTM_RADIO_UP,
+    FTM_RADIO_CHANGED,
+};
+
+/**
+ * struct ftm_radio_event - An event of an interface
+ * 
+ * @type: @enum ftm_radio_event_type
+ * @if_index: index of the interface
+ * @if_name: name of the interface, empty if the event does not carry it
+ */
+struct ftm_radio_event {
+    enum ftm_radio_event_type type;
+    uint32_t if_index;
+    char if_name[IF_NAMESIZE];
+};
+
+typedef void (*ftm_radio_event_handler)(const struct ftm_radio_event *event,
+                                        void *arg);
+
+/**
+ * struct ftm_event_watch - Sockets listening to radio events
+ * 
+ * @nl80211: nl80211 socket in the "config" and "mlme" groups
+ * @route: rtnetlink socket in the link group
+ * @fd: epoll of both sockets, readable when events are queued
+ * @events: events reported so far
+ */
+struct ftm_event_watch {
+    struct nl80211_state nl80211;
+    struct nl80211_state route;
+    int fd;
+    uint64_t events;
+};
+
+/**
+ * alloc_ftm_event_watch - Open the sockets and join the groups
+ * 
+ * @param error   where errors are reported, see ftm_report_error()
+ * 
+ * @return a valid ftm_event_watch pointer on success, NULL on failure
+ */
+struct ftm_event_watch *alloc_ftm_event_watch(char *error);
+
+void free_ftm_event_watch(struct ftm_event_watch *watch);
+
+/**
+ * ftm_event_watch_process - Report the queued events
+ * 
+ * @param handler   called with each event
+ * 
+ * @note
+ * Does not block. Events of other kinds (scans, frames, stations) are
+ * skipped.
+ * 
+ * @return number of events reported, -1 on failure
+ */
+int ftm_event_watch_process(struct ftm_event_watch *watch,
+                            ftm_radio_event_handler handler, void *arg);
+
+/**
+ * ftm_event_watch_wait - Wait for events
+ * 
+ * @param timeout_ms   -1 to wait forever
+ * 
+ * @return 1 if events are queued, 0 on timeout, -1 on failure
+ */
+int ftm_event_watch_wait(struct ftm_event_watch *watch, int timeout_ms);
+
+/**
+ * ftm_link_is_up - Whether an interface exists and is up
+ */
+bool ftm_link_is_up(uint32_t if_index);
+#endif
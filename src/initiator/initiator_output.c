@@ -0,0 +1,405 @@
+#include "initiator_output.h"
+#include "../archive/archive.h"
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+/* upper bound of a text record, the longest being NDJSON */
+#define RECORD_MAX 1024
+
+/*
+ * Integer attributes of struct ftm_resp_attr in output order, with 'u' for
+ * unsigned and 's' for signed values.
+ */
+#define FTM_OUTPUT_FIELDS(X) \
+    X(fail_reason, u)        \
+    X(burst_index, u)        \
+    X(num_ftmr_attempts, u)  \
+    X(num_ftmr_successes, u) \
+    X(busy_retry_time, u)    \
+    X(num_bursts_exp, u)     \
+    X(burst_duration, u)     \
+    X(ftms_per_burst, u)     \
+    X(rssi_avg, s)           \
+    X(rssi_spread, s)        \
+    X(rtt_avg, s)            \
+    X(rtt_variance, u)       \
+    X(rtt_spread, u)         \
+    X(dist_avg, s)           \
+    X(dist_variance, u)      \
+    X(dist_spread, u)        \
+    X(rtt_correct, s)
+
+static const char *format_names[FTM_OUTPUT_MAX] = {
+    [FTM_OUTPUT_CSV] = "csv",
+    [FTM_OUTPUT_NDJSON] = "ndjson",
+    [FTM_OUTPUT_BIN] = "bin",
+    [FTM_OUTPUT_ARCHIVE] = "archive",
+};
+
+static char *put_str(char *pos, const char *str) {
+    while (*str)
+        *pos++ = *str++;
+    return pos;
+}
+
+static char *put_u64(char *pos, uint64_t value) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (n)
+        *pos++ = digits[--n];
+    return pos;
+}
+
+static char *put_s64(char *pos, int64_t value) {
+    if (value < 0) {
+        *pos++ = '-';
+        return put_u64(pos, -(uint64_t)value);
+    }
+    return put_u64(pos, value);
+}
+
+/* fixed point with 3 decimals, like "%.3f" */
+static char *put_float(char *pos, float value) {
+    double abs_value = value;
+    if (abs_value < 0) {
+        *pos++ = '-';
+        abs_value = -abs_value;
+    }
+    uint64_t milli = abs_value * 1000 + 0.5;
+    pos = put_u64(pos, milli / 1000);
+    *pos++ = '.';
+    *pos++ = '0' + milli / 100 % 10;
+    *pos++ = '0' + milli / 10 % 10;
+    *pos++ = '0' + milli % 10;
+    return pos;
+}
+
+static char *put_mac(char *pos, const uint8_t *addr) {
+    static const char hex[] = "0123456789abcdef";
+    for (int i = 0; i < 6; i++) {
+        if (i)
+            *pos++ = ':';
+        *pos++ = hex[addr[i] >> 4];
+        *pos++ = hex[addr[i] & 0xf];
+    }
+    return pos;
+}
+
+#define __PUT_u(pos, value) put_u64(pos, value)
+#define __PUT_s(pos, value) put_s64(pos, (int64_t)(value))
+
+/* distance from rtt_avg corrected by rtt_correct, like the dashboard */
+static bool resp_dist(struct ftm_resp_attr *resp, float *dist) {
+    if (!FTM_RESP_HAS(resp, rtt_avg))
+        return false;
+    int64_t correct = FTM_RESP_HAS(resp, rtt_correct) ?
+                      (int64_t)resp->rtt_correct : 0;
+    *dist = RTT_TO_DIST(resp->rtt_avg + correct);
+    return true;
+}
+
+static char *put_csv_header(char *pos) {
+    pos = put_str(pos, "timestamp_ns,session,mac_addr");
+#define __CSV_NAME(name, kind) pos = put_str(pos, "," #name);
+    FTM_OUTPUT_FIELDS(__CSV_NAME)
+    return put_str(pos, ",dist_truth,dist\n");
+}
+
+static char *put_csv(char *pos, struct ftm_resp_attr *resp, int session,
+                     uint64_t timestamp_ns) {
+    float dist;
+    pos = put_u64(pos, timestamp_ns);
+    *pos++ = ',';
+    pos = put_u64(pos, session);
+    *pos++ = ',';
+    if (FTM_RESP_HAS(resp, mac_addr))
+        pos = put_mac(pos, resp->mac_addr);
+#define __CSV_FIELD(name, kind)            \
+    *pos++ = ',';                          \
+    if (FTM_RESP_HAS(resp, name))          \
+        pos = __PUT_##kind(pos, resp->name);
+    FTM_OUTPUT_FIELDS(__CSV_FIELD)
+    *pos++ = ',';
+    if (FTM_RESP_HAS(resp, dist_truth))
+        pos = put_float(pos, resp->dist_truth);
+    *pos++ = ',';
+    if (resp_dist(resp, &dist))
+        pos = put_float(pos, dist);
+    *pos++ = '\n';
+    return pos;
+}
+
+static char *put_ndjson(char *pos, struct ftm_resp_attr *resp, int session,
+                        uint64_t timestamp_ns) {
+    float dist;
+    pos = put_str(pos, "{\"timestamp_ns\":");
+    pos = put_u64(pos, timestamp_ns);
+    pos = put_str(pos, ",\"session\":");
+    pos = put_u64(pos, session);
+    if (FTM_RESP_HAS(resp, mac_addr)) {
+        pos = put_str(pos, ",\"mac_addr\":\"");
+        pos = put_mac(pos, resp->mac_addr);
+        *pos++ = '"';
+    }
+#define __JSON_FIELD(name, kind)               \
+    if (FTM_RESP_HAS(resp, name)) {            \
+        pos = put_str(pos, ",\"" #name "\":"); \
+        pos = __PUT_##kind(pos, resp->name);   \
+    }
+    FTM_OUTPUT_FIELDS(__JSON_FIELD)
+    if (FTM_RESP_HAS(resp, dist_truth)) {
+        pos = put_str(pos, ",\"dist_truth\":");
+        pos = put_float(pos, resp->dist_truth);
+    }
+    if (resp_dist(resp, &dist)) {
+        pos = put_str(pos, ",\"dist\":");
+        pos = put_float(pos, dist);
+    }
+    return put_str(pos, "}\n");
+}
+
+static void fill_bin(struct ftm_output_bin_record *record,
+                     struct ftm_resp_attr *resp, int session,
+                     uint64_t timestamp_ns) {
+    memset(record, 0, sizeof(*record));
+    record->timestamp_ns = timestamp_ns;
+    record->session = session;
+    record->present = resp->present;
+    memcpy(record->mac_addr, resp->mac_addr, 6);
+#define __BIN_FIELD(name, kind) record->name = resp->name;
+    FTM_OUTPUT_FIELDS(__BIN_FIELD)
+    record->dist_truth = resp->dist_truth;
+    float dist;
+    record->dist = resp_dist(resp, &dist) ? dist : NAN;
+}
+
+static char *put_bin(char *pos, struct ftm_resp_attr *resp, int session,
+                     uint64_t timestamp_ns) {
+    struct ftm_output_bin_record record;
+    fill_bin(&record, resp, session, timestamp_ns);
+    memcpy(pos, &record, sizeof(record));
+    return pos + sizeof(record);
+}
+
+int ftm_output_format_from_str(const char *str) {
+    for (int i = 0; i < FTM_OUTPUT_MAX; i++) {
+        if (strcasecmp(str, format_names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+struct ftm_output *alloc_ftm_output(enum ftm_output_format format, int fd,
+                                    int peer_count) {
+    struct ftm_output *output = malloc(sizeof(struct ftm_output));
+    if (!output)
+        return NULL;
+    output->format = format;
+    output->fd = fd;
+    output->started = false;
+    output->archive = NULL;
+    /* room for the header and one record per peer */
+    output->size = RECORD_MAX * (peer_count + 1);
+    output->buf = malloc(output->size);
+    if (!output->buf) {
+        free(output);
+        return NULL;
+    }
+    if (format == FTM_OUTPUT_ARCHIVE) {
+        output->archive = alloc_archive_writer(fd, -1);
+        if (!output->archive) {
+            free_ftm_output(output);
+            return NULL;
+        }
+    }
+    return output;
+}
+
+void free_ftm_output(struct ftm_output *output) {
+    if (!output)
+        return;
+    free_archive_writer(output->archive, NULL);
+    free(output->buf);
+    free(output);
+}
+
+int ftm_output_resize(struct ftm_output *output, int peer_count) {
+    int size = RECORD_MAX * (peer_count + 1);
+    if (size <= output->size)
+        return 0;
+    char *buf = realloc(output->buf, size);
+    if (!buf)
+        return 1;
+    output->buf = buf;
+    output->size = size;
+    return 0;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* when the result was received, or the session completed without it */
+static uint64_t result_time(const struct ftm_resp_attr *resp,
+                            uint64_t timestamp_ns) {
+    return FTM_RESP_HAS(resp, rx_time_ns) ? resp->rx_time_ns : timestamp_ns;
+}
+
+int ftm_output_write(struct ftm_output *output,
+                     struct ftm_results_wrap *results, int session,
+                     uint64_t timestamp_ns) {
+    if (output->format == FTM_OUTPUT_ARCHIVE) {
+        struct ftm_output_bin_record record;
+        for (int i = 0; i < results->count; i++) {
+            struct ftm_resp_attr *resp = results->results[i];
+            fill_bin(&record, resp, session, result_time(resp, timestamp_ns));
+            if (archive_write(output->archive, &record))
+                return 1;
+        }
+        return 0;
+    }
+    if (RECORD_MAX * (results->count + 1) > output->size)
+        return 1;
+    char *pos = output->buf;
+    if (!output->started) {
+        if (output->format == FTM_OUTPUT_CSV) {
+            pos = put_csv_header(pos);
+        } else if (output->format == FTM_OUTPUT_BIN) {
+            struct ftm_output_bin_header header = {
+                FTM_OUTPUT_BIN_MAGIC, FTM_OUTPUT_BIN_VERSION,
+                sizeof(struct ftm_output_bin_record)
+            };
+            memcpy(pos, &header, sizeof(header));
+            pos += sizeof(header);
+        }
+        output->started = true;
+    }
+
+    for (int i = 0; i < results->count; i++) {
+        struct ftm_resp_attr *resp = results->results[i];
+        uint64_t time = result_time(resp, timestamp_ns);
+        switch (output->format) {
+            case FTM_OUTPUT_CSV:
+                pos = put_csv(pos, resp, session, time);
+                break;
+            case FTM_OUTPUT_NDJSON:
+                pos = put_ndjson(pos, resp, session, time);
+                break;
+            case FTM_OUTPUT_BIN:
+                pos = put_bin(pos, resp, session, time);
+                break;
+            default:
+                return 1;
+        }
+    }
+    return write_all(output->fd, output->buf, pos - output->buf);
+}
+
+static char *put_responder_csv_header(char *pos) {
+    pos = put_str(pos, "timestamp_ns");
+#define __RESPONDER_CSV_NAME(name, attr, type) pos = put_str(pos, "," #name);
+    FTM_RESPONDER_STATS_FIELDS(__RESPONDER_CSV_NAME)
+#define __RESPONDER_CSV_RATE_NAME(name, attr, type) \
+    pos = put_str(pos, "," #name "_per_sec");
+    FTM_RESPONDER_STATS_FIELDS(__RESPONDER_CSV_RATE_NAME)
+    *pos++ = '\n';
+    return pos;
+}
+
+static char *put_responder_csv(char *pos,
+                               const struct ftm_responder_stats *stats,
+                               const struct ftm_responder_rates *rates,
+                               uint64_t timestamp_ns) {
+    pos = put_u64(pos, timestamp_ns);
+#define __RESPONDER_CSV_FIELD(name, attr, type)             \
+    *pos++ = ',';                                          \
+    if (stats->present & (1u << FTM_RESPONDER_STAT_##name)) \
+        pos = put_u64(pos, stats->name);
+    FTM_RESPONDER_STATS_FIELDS(__RESPONDER_CSV_FIELD)
+#define __RESPONDER_CSV_RATE(name, attr, type)                         \
+    *pos++ = ',';                                                     \
+    if (rates && rates->present & (1u << FTM_RESPONDER_STAT_##name)) \
+        pos = put_float(pos, rates->name);
+    FTM_RESPONDER_STATS_FIELDS(__RESPONDER_CSV_RATE)
+    *pos++ = '\n';
+    return pos;
+}
+
+static char *put_responder_ndjson(char *pos,
+                                  const struct ftm_responder_stats *stats,
+                                  const struct ftm_responder_rates *rates,
+                                  uint64_t timestamp_ns) {
+    pos = put_str(pos, "{\"timestamp_ns\":");
+    pos = put_u64(pos, timestamp_ns);
+#define __RESPONDER_JSON_FIELD(name, attr, type)              \
+    if (stats->present & (1u << FTM_RESPONDER_STAT_##name)) { \
+        pos = put_str(pos, ",\"" #name "\":");                \
+        pos = put_u64(pos, stats->name);                      \
+    }
+    FTM_RESPONDER_STATS_FIELDS(__RESPONDER_JSON_FIELD)
+#define __RESPONDER_JSON_RATE(name, attr, type)                          \
+    if (rates && rates->present & (1u << FTM_RESPONDER_STAT_##name)) { \
+        pos = put_str(pos, ",\"" #name "_per_sec\":");                   \
+        pos = put_float(pos, rates->name);                               \
+    }
+    FTM_RESPONDER_STATS_FIELDS(__RESPONDER_JSON_RATE)
+    return put_str(pos, "}\n");
+}
+
+int ftm_output_write_responder(struct ftm_output *output,
+                               const struct ftm_responder_stats *stats,
+                               const struct ftm_responder_rates *rates,
+                               uint64_t timestamp_ns) {
+    char *pos = output->buf;
+    if (!output->started) {
+        if (output->format == FTM_OUTPUT_CSV) {
+            pos = put_responder_csv_header(pos);
+        } else if (output->format == FTM_OUTPUT_BIN) {
+            struct ftm_output_bin_header header = {
+                FTM_OUTPUT_RESPONDER_MAGIC, FTM_OUTPUT_BIN_VERSION,
+                sizeof(struct ftm_output_responder_record)
+            };
+            memcpy(pos, &header, sizeof(header));
+            pos += sizeof(header);
+        }
+        output->started = true;
+    }
+
+    struct ftm_output_responder_record record;
+    switch (output->format) {
+        case FTM_OUTPUT_CSV:
+            pos = put_responder_csv(pos, stats, rates, timestamp_ns);
+            break;
+        case FTM_OUTPUT_NDJSON:
+            pos = put_responder_ndjson(pos, stats, rates, timestamp_ns);
+            break;
+        case FTM_OUTPUT_BIN:
+            record.timestamp_ns = timestamp_ns;
+            record.present = stats->present;
+#define __RESPONDER_BIN_FIELD(name, attr, type) record.name = stats->name;
+            FTM_RESPONDER_STATS_FIELDS(__RESPONDER_BIN_FIELD)
+            memcpy(pos, &record, sizeof(record));
+            pos += sizeof(record);
+            break;
+        default:
+            return 1;
+    }
+    return write_all(output->fd, output->buf, pos - output->buf);
+}
@@ -0,0 +1,209 @@
+#ifndef _FTM_INITIATOR_OUTPUT_H
+#define _FTM_INITIATOR_OUTPUT_H
+
+#include <stdint.h>
+#include "initiator_types.h"
+#include "../responder/responder.h"
+
+struct archive_writer;
+
+/**
+ * DOC: Machine-readable output
+ * 
+ * Writes one record per peer per session, in one of the formats of
+ * @enum ftm_output_format. Numbers are formatted by hand instead of with
+ * printf(), and all the records of a session are written with a single
+ * write() call.
+ * 
+ * Each record holds the time the session completed, the session index,
+ * every attribute of @struct ftm_resp_attr that is present, and the
+ * distance in m computed from rtt_avg corrected by rtt_correct.
+ * 
+ * The same stream can carry responder statistics instead, one record per
+ * reading, see ftm_output_write_responder().
+ */
+
+/**
+ * enum ftm_output_format - Output formats
+ * 
+ * @FTM_OUTPUT_CSV: comma-separated values with a header line, absent
+ * attributes are left empty
+ * @FTM_OUTPUT_NDJSON: one JSON object per line, absent attributes are
+ * omitted
+ * @FTM_OUTPUT_BIN: a @struct ftm_output_bin_header followed by
+ * @struct ftm_output_bin_record records, in host byte order
+ * @FTM_OUTPUT_ARCHIVE: the binary records compressed into blocks of a
+ * peer, see archive.h
+ */
+enum ftm_output_format {
+    FTM_OUTPUT_CSV,
+    FTM_OUTPUT_NDJSON,
+    FTM_OUTPUT_BIN,
+    FTM_OUTPUT_ARCHIVE,
+
+    /* keep last */
+    FTM_OUTPUT_MAX
+};
+
+#define FTM_OUTPUT_BIN_MAGIC 0x4f4d5446 /* "FTMO" */
+#define FTM_OUTPUT_BIN_VERSION 1
+
+/**
+ * struct ftm_output_bin_header - Start of a binary stream
+ * 
+ * @magic: FTM_OUTPUT_BIN_MAGIC
+ * @version: FTM_OUTPUT_BIN_VERSION
+ * @record_size: size of each record
+ */
+struct ftm_output_bin_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+} __attribute__((packed));
+
+/**
+ * struct ftm_output_bin_record - A binary record
+ * 
+ * @timestamp_ns: CLOCK_REALTIME when the result was received from the
+ * kernel, or when the session completed if unknown, see
+ * @struct ftm_resp_attr rx_time_ns
+ * @session: index of the session
+ * @present: bit n is set if the attribute with flag n of
+ * @enum ftm_resp_attr_flags is present, its field is 0 otherwise
+ * @dist: distance in m, NaN if rtt_avg is absent
+ * other fields: see @struct ftm_resp_attr
+ */
+struct ftm_output_bin_record {
+    uint64_t timestamp_ns;
+    uint32_t session;
+    uint32_t present;
+    uint8_t mac_addr[6];
+    uint8_t num_bursts_exp;
+    uint8_t burst_duration;
+    uint8_t ftms_per_burst;
+    uint32_t fail_reason;
+    uint32_t burst_index;
+    uint32_t num_ftmr_attempts;
+    uint32_t num_ftmr_successes;
+    uint32_t busy_retry_time;
+    int32_t rssi_avg;
+    int32_t rssi_spread;
+    int64_t rtt_avg;
+    uint64_t rtt_variance;
+    uint64_t rtt_spread;
+    int64_t dist_avg;
+    uint64_t dist_variance;
+    uint64_t dist_spread;
+    int64_t rtt_correct;
+    float dist_truth;
+    float dist;
+} __attribute__((packed));
+
+#define FTM_OUTPUT_RESPONDER_MAGIC 0x52525446 /* "FTRR" */
+
+/**
+ * struct ftm_output_responder_record - A binary responder record
+ * 
+ * Follows a @struct ftm_output_bin_header with FTM_OUTPUT_RESPONDER_MAGIC.
+ * Rates are left to the reader, from the timestamps of two records.
+ * 
+ * @timestamp_ns: CLOCK_REALTIME of the reading
+ * @present: see @struct ftm_responder_stats
+ * other fields: see @struct ftm_responder_stats
+ */
+struct ftm_output_responder_record {
+    uint64_t timestamp_ns;
+    uint32_t present;
+#define __OUTPUT_RESPONDER_FIELD(name, attr, type) uint64_t name;
+    FTM_RESPONDER_STATS_FIELDS(__OUTPUT_RESPONDER_FIELD)
+} __attribute__((packed));
+
+/**
+ * struct ftm_output - An output stream
+ * 
+ * @format: @enum ftm_output_format
+ * @fd: where the records are written
+ * @buf: records of the session being written
+ * @size: size of @buf
+ * @started: whether the header has been written
+ * @archive: encoder of FTM_OUTPUT_ARCHIVE
+ */
+struct ftm_output {
+    enum ftm_output_format format;
+    int fd;
+    char *buf;
+    int size;
+    bool started;
+    struct archive_writer *archive;
+};
+
+/**
+ * ftm_output_format_from_str - Parse "csv", "ndjson", "bin" or "archive"
+ * 
+ * @return the format, or -1 if unknown
+ */
+int ftm_output_format_from_str(const char *str);
+
+/**
+ * alloc_ftm_output - Allocate an output stream
+ * 
+ * @param format       @enum ftm_output_format
+ * @param fd           where the records are written, usually STDOUT_FILENO
+ * @param peer_count   peers per session, to size the buffer
+ * 
+ * @return a valid ftm_output pointer on success, NULL on failure
+ */
+struct ftm_output *alloc_ftm_output(enum ftm_output_format format, int fd,
+                                    int peer_count);
+
+/**
+ * free_ftm_output - Free an output stream, does not close the fd
+ * 
+ * @note
+ * An archive is written up to its last records here, see archive_write().
+ */
+void free_ftm_output(struct ftm_output *output);
+
+/**
+ * ftm_output_resize - Make room for a new number of peers per session
+ * 
+ * @return 0 on success, 1 on failure with the buffer left as it was
+ */
+int ftm_output_resize(struct ftm_output *output, int peer_count);
+
+/**
+ * ftm_output_write - Write the records of a session
+ * 
+ * @param output         the stream
+ * @param results        results of the session
+ * @param session        index of the session
+ * @param timestamp_ns   CLOCK_REALTIME when the session completed, the time
+ *                       of the results without a receive time
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int ftm_output_write(struct ftm_output *output,
+                     struct ftm_results_wrap *results, int session,
+                     uint64_t timestamp_ns);
+
+/**
+ * ftm_output_write_responder - Write a reading of responder statistics
+ * 
+ * @param output         the stream, only used for responder records
+ * @param stats          the counters
+ * @param rates          rates since the previous reading, NULL for the
+ *                       first one
+ * @param timestamp_ns   CLOCK_REALTIME of the reading
+ * 
+ * @note
+ * Archives only hold results, 1 is returned for FTM_OUTPUT_ARCHIVE.
+ * CSV and NDJSON records carry both the counters and the rates (named
+ * <counter>_per_sec), absent values are left empty or omitted.
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int ftm_output_write_responder(struct ftm_output *output,
+                               const struct ftm_responder_stats *stats,
+                               const struct ftm_responder_rates *rates,
+                               uint64_t timestamp_ns);
+#endif /* _FTM_INITIATOR_OUTPUT_H */
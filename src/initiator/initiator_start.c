@@ -1,11 +1,222 @@
 #include "initiator_start.h"
+#include "initiator_config.h"
+#include "initiator_events.h"
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
 
-static int set_ftm_peer(struct nl_msg *msg, struct ftm_peer_attr *attr, int index) {
+/*
+ * cfg80211 allocates each result with NLMSG_DEFAULT_SIZE, so every message
+ * is charged about a page plus the skb overhead to the receive buffer,
+ * whatever its length. The buffer is sized to hold all the results of a
+ * session, one per burst of each peer.
+ */
+#define RESULT_RCVBUF_COST 8192
+#define RESULT_BURSTS_EXP_MAX 4
+/* sessions started again after overruns before giving up */
+#define OVERRUN_RETRIES 2
+
+/*
+ * A request whose COMPLETE has not come after twice the time its bursts
+ * take, plus a second, is taken as lost: it is aborted and issued again,
+ * a few times before the session fails.
+ */
+#define DEADLINE_BASE_MS 1000
+#define DEADLINE_SLACK 2
+#define DEADLINE_RETRIES 2
+/* burst duration assumed when left to the responder */
+#define BURST_DURATION_MAX_US 128000
+
+/**
+ * struct ftm_channel - Channel a peer is measured on
+ */
+struct ftm_channel {
+    uint32_t center_freq;
+    uint32_t chan_width;
+    uint32_t center_freq_1;
+    uint32_t center_freq_2;
+};
+
+/**
+ * struct ftm_channel_groups - Peers of a config grouped by channel
+ * 
+ * @order: indexes of the peers in the config, group after group
+ * @bounds: group i is @order[@bounds[i]] to @order[@bounds[i + 1] - 1]
+ * @count: number of groups, 0 to measure all the peers in one request
+ * 
+ * @note
+ * The group on the operating channel of the interface comes first, the
+ * others follow in order of frequency, so the radio leaves its channel
+ * once per session and moves between neighbouring channels.
+ */
+struct ftm_channel_groups {
+    int *order;
+    int *bounds;
+    int count;
+};
+
+/**
+ * struct ftm_ctx - Everything a measurement needs, see ftm_ctx_new()
+ * 
+ * @nlstate: socket, kept for the lifetime of the context
+ * @results: results of the last session, reused by the next one
+ * @trace: latency instrumentation
+ * @error: message of the last error
+ * @epoll_fd: readable when a submitted session has events, -1 until the
+ * first ftm_submit() or ftm_get_fd()
+ * @sessions: submitted sessions
+ * @processing: ftm_process() is running, sessions are freed after it
+ * @prepared: peer attributes of the last request, in config order
+ * @prepared_count: number of @prepared
+ * @rebuilt_peers: peer attributes built so far, the others were reused
+ * @channel_groups: measure the peers of each channel in their own request
+ * @groups: channel groups of the current synchronous session
+ * @overruns: sessions started again after a receive buffer overrun
+ * @events: radio events, NULL if not watched
+ * @run_config: config of the current synchronous session
+ * @if_name: name of the interface of @run_config
+ * @interrupted: a radio event interrupted the synchronous session
+ * @interruptions: attempts started again after a radio event
+ * @deadline_ns: when the COMPLETE of the current synchronous request is
+ * overdue, CLOCK_MONOTONIC
+ * @timed_out: the synchronous request passed its deadline
+ * @timeouts: requests issued again after passing their deadline
+ * @watchdog_fd: timerfd expiring at the earliest deadline of the
+ * submitted sessions, -1 until the first ftm_submit() or ftm_get_fd()
+ * @watchdog_ns: when @watchdog_fd expires, 0 if disarmed
+ */
+struct ftm_ctx {
+    struct nl80211_state nlstate;
+    struct ftm_results_wrap *results;
+    struct ftm_trace trace;
+    char error[FTM_ERROR_MAX];
+    int epoll_fd;
+    struct ftm_session *sessions;
+    bool processing;
+    struct ftm_prepared_peer *prepared;
+    int prepared_count;
+    uint64_t rebuilt_peers;
+    bool channel_groups;
+    struct ftm_channel_groups groups;
+    uint64_t overruns;
+    struct ftm_event_watch *events;
+    struct ftm_config *run_config;
+    char if_name[IF_NAMESIZE];
+    bool interrupted;
+    uint64_t interruptions;
+    int64_t deadline_ns;
+    bool timed_out;
+    uint64_t timeouts;
+    int watchdog_fd;
+    int64_t watchdog_ns;
+    volatile sig_atomic_t stop;
+};
+
+/**
+ * struct ftm_prepared_peer - Request attributes of a peer, kept across
+ * sessions
+ * 
+ * @attr: attributes @blob was built from
+ * @blob: the peer's entry of NL80211_PMSR_ATTR_PEERS, header included
+ * @len: length of @blob
+ * 
+ * @note
+ * Only the peers whose attributes changed are built again, the others are
+ * copied into the request as they are. The type of the entry is its index
+ * in the config and is patched if the peer moved.
+ */
+struct ftm_prepared_peer {
+    struct ftm_peer_attr attr;
+    void *blob;
+    int len;
+};
+
+/**
+ * enum ftm_session_state - Progress of a submitted session
+ * 
+ * @FTM_SESSION_QUERYING: asked for the operating channel of the interface,
+ * to group the peers by channel, waiting for the reply
+ * @FTM_SESSION_QUERIED: the reply came, or failed to, the peers are to be
+ * grouped and the attempt started
+ * @FTM_SESSION_STARTING: request sent, waiting for the ACK
+ * @FTM_SESSION_RUNNING: ACK received, waiting for the results
+ * @FTM_SESSION_PAUSED: the interface is down, waiting for it to come back
+ * @FTM_SESSION_COMPLETE: all the results of the attempt received
+ * @FTM_SESSION_FAILED: the kernel or the socket reported an error
+ * @FTM_SESSION_DEAD: finished or cancelled, to be freed
+ */
+enum ftm_session_state {
+    FTM_SESSION_QUERYING,
+    FTM_SESSION_QUERIED,
+    FTM_SESSION_STARTING,
+    FTM_SESSION_RUNNING,
+    FTM_SESSION_PAUSED,
+    FTM_SESSION_COMPLETE,
+    FTM_SESSION_FAILED,
+    FTM_SESSION_DEAD,
+};
+
+/**
+ * struct ftm_session - A measurement submitted with ftm_submit()
+ * 
+ * @ctx: owning context
+ * @nlstate: socket of the session, closing it cancels the measurement
+ * @cb: callbacks of the socket
+ * @rx_start: receive counters of @nlstate when the attempt started
+ * @config: config of the measurement
+ * @results: results of the current attempt
+ * @handler: called with the results of each attempt
+ * @done: called when the session ends
+ * @arg: passed to @handler and @done
+ * @attempts: attempts requested
+ * @attempt_idx: index of the current attempt
+ * @groups: channel groups of @config, measured one after another
+ * @operating: operating channel of the interface, from the reply to the
+ * query, center_freq 0 if unknown
+ * @group_idx: group of the current request
+ * @overruns: overruns recovered from in the current attempt
+ * @if_name: name of the interface of @config
+ * @interrupted: a radio event interrupted the current attempt
+ * @deadline_ns: when the COMPLETE of the current request is overdue
+ * @timeouts: requests of the current attempt that passed their deadline
+ * @state: @enum ftm_session_state
+ */
+struct ftm_session {
+    struct ftm_ctx *ctx;
+    struct nl80211_state nlstate;
+    struct nl_rx_cb cb;
+    struct nl_rx_stats rx_start;
+    struct ftm_config *config;
+    struct ftm_results_wrap *results;
+    ftm_result_handler handler;
+    ftm_done_handler done;
+    void *arg;
+    int attempts;
+    int attempt_idx;
+    struct ftm_channel_groups groups;
+    struct ftm_channel operating;
+    int group_idx;
+    int overruns;
+    char if_name[IF_NAMESIZE];
+    bool interrupted;
+    int64_t deadline_ns;
+    int timeouts;
+    enum ftm_session_state state;
+    struct ftm_session *next;
+};
+
+/* submitted sessions run concurrently and are not traced */
+static struct ftm_trace untraced;
+
+static int set_ftm_peer(struct ftm_ctx *ctx, struct nl_msg *msg,
+                        struct ftm_peer_attr *attr, int index) {
     struct nlattr *peer = nla_nest_start(msg, index);
     if (!peer)
         goto nla_put_failure;
-    if (!attr->mac_addr) {
-        fprintf(stderr, "No mac address data!\n");
+    if (!FTM_PEER_HAS(attr, mac_addr)) {
+        ftm_report_error(ctx->error, "No mac address data!");
         return 1;
     }
     NLA_PUT(msg, NL80211_PMSR_PEER_ATTR_ADDR, 6, attr->mac_addr);
@@ -20,22 +231,33 @@ static int set_ftm_peer(struct nl_msg *msg, struct ftm_peer_attr *attr, int inde
     if (!ftm)
         goto nla_put_failure;
 
-#define __FTM_PUT(prefix, attr_idx, attr_name, type) \
-    FTM_PUT(msg, attr, prefix, attr_idx, attr_name, type)
-#define __FTM_PEER_PUT(attr_idx, attr_name, type) \
-    FTM_PEER_PUT(msg, attr, attr_idx, attr_name, type)
-#define __FTM_PEER_PUT_FLAG(attr_idx, attr_name) \
-    FTM_PEER_PUT_FLAG(msg, attr, attr_idx, attr_name)
-
-    __FTM_PEER_PUT(PREAMBLE, preamble, U32);
-    __FTM_PEER_PUT(NUM_BURSTS_EXP, num_bursts_exp, U8);
-    __FTM_PEER_PUT(BURST_PERIOD, burst_period, U16);
-    __FTM_PEER_PUT(BURST_DURATION, burst_duration, U8);
-    __FTM_PEER_PUT(FTMS_PER_BURST, ftms_per_burst, U8);
-    __FTM_PEER_PUT(NUM_FTMR_RETRIES, num_ftmr_retries, U8);
+/*
+ * The fields of FTM_PEER_FIELDS in the nest being built:
+ * __PUT_<nest built>_<nest of the field> only puts the fields of the nest
+ * being built, with the NLA_PUT_*() type of the field.
+ */
+#define __PUT_U8(prefix, suffix, name) \
+    FTM_PUT(msg, attr, prefix, suffix, name, U8)
+#define __PUT_U16(prefix, suffix, name) \
+    FTM_PUT(msg, attr, prefix, suffix, name, U16)
+#define __PUT_U32(prefix, suffix, name) \
+    FTM_PUT(msg, attr, prefix, suffix, name, U32)
+#define __PUT_FLAG(prefix, suffix, name) \
+    FTM_PUT_FLAG(msg, attr, prefix, suffix, name)
+#define __PUT_FTM_FTM(name, suffix, put) \
+    __PUT_##put(NL80211_PMSR_FTM_REQ_ATTR_, suffix, name)
+#define __PUT_FTM_CHAN(name, suffix, put)
+#define __PUT_FTM_NONE(name, suffix, put)
+#define __PUT_CHAN_CHAN(name, suffix, put) \
+    __PUT_##put(NL80211_ATTR_, suffix, name)
+#define __PUT_CHAN_FTM(name, suffix, put)
+#define __PUT_CHAN_NONE(name, suffix, put)
+#define __PUT_FTM_FIELD(name, type, spec, nest, suffix, put) \
+    __PUT_FTM_##nest(name, suffix, put)
+#define __PUT_CHAN_FIELD(name, type, spec, nest, suffix, put) \
+    __PUT_CHAN_##nest(name, suffix, put)
 
-    __FTM_PEER_PUT_FLAG(ASAP, asap);
-    __FTM_PEER_PUT_FLAG(TRIGGER_BASED, trigger_based);
+    FTM_PEER_FIELDS(__PUT_FTM_FIELD)
 
     nla_nest_end(msg, ftm);
     nla_nest_end(msg, req_data);
@@ -45,43 +267,136 @@ static int set_ftm_peer(struct nl_msg *msg, struct ftm_peer_attr *attr, int inde
     if (!chan)
         goto nla_put_failure;
 
-    __FTM_PUT(NL80211_ATTR_, CHANNEL_WIDTH, chan_width, U32);
-    __FTM_PUT(NL80211_ATTR_, WIPHY_FREQ, center_freq, U32);
-    __FTM_PUT(NL80211_ATTR_, CENTER_FREQ1, center_freq_1, U32);
-    __FTM_PUT(NL80211_ATTR_, CENTER_FREQ2, center_freq_2, U32);
+    FTM_PEER_FIELDS(__PUT_CHAN_FIELD)
 
     nla_nest_end(msg, chan);
     nla_nest_end(msg, peer);
     return 0;
 nla_put_failure:
-    fprintf(stderr, "put failed!\n");
+    ftm_report_error(ctx->error, "put failed!");
     return -1;
 }
 
-static int set_ftm_config(struct nl_msg *msg, struct ftm_config *config) {
+/* build the attributes of a peer on their own */
+static int prepare_peer(struct ftm_ctx *ctx, struct ftm_prepared_peer *prepared,
+                        struct ftm_peer_attr *attr, int index) {
+    struct nl_msg *msg = nlmsg_alloc();
+    if (!msg) {
+        ftm_report_error(ctx->error, "Fail to allocate message!");
+        return 1;
+    }
+    int err = 1;
+    if (set_ftm_peer(ctx, msg, attr, index))
+        goto out;
+    struct nlmsghdr *hdr = nlmsg_hdr(msg);
+    prepared->len = nlmsg_datalen(hdr);
+    prepared->blob = malloc(prepared->len);
+    if (!prepared->blob) {
+        ftm_report_error(ctx->error, "Fail to allocate peer attributes!");
+        goto out;
+    }
+    memcpy(prepared->blob, nlmsg_data(hdr), prepared->len);
+    memcpy(&prepared->attr, attr, sizeof(struct ftm_peer_attr));
+    ctx->rebuilt_peers++;
+    err = 0;
+out:
+    nlmsg_free(msg);
+    return err;
+}
+
+static void free_prepared(struct ftm_prepared_peer *prepared, int count) {
+    for (int i = 0; i < count; i++)
+        free(prepared[i].blob);
+    free(prepared);
+}
+
+/* bring the prepared peers in line with the config, reusing what we can */
+static int prepare_peers(struct ftm_ctx *ctx, struct ftm_config *config) {
+    struct ftm_prepared_peer *old = ctx->prepared;
+    int old_count = ctx->prepared_count;
+
+    /* same config as last time */
+    bool same = old_count == config->peer_count;
+    for (int i = 0; same && i < old_count; i++)
+        same = ftm_peer_attr_equal(&old[i].attr, config->peers[i]);
+    if (same)
+        return 0;
+
+    struct ftm_prepared_peer *prepared =
+        calloc(config->peer_count ? config->peer_count : 1,
+               sizeof(struct ftm_prepared_peer));
+    if (!prepared) {
+        ftm_report_error(ctx->error, "Fail to allocate peer attributes!");
+        return 1;
+    }
+    for (int i = 0; i < config->peer_count; i++) {
+        struct ftm_peer_attr *attr = config->peers[i];
+        int j = -1;
+        if (i < old_count && old[i].blob &&
+            !memcmp(old[i].attr.mac_addr, attr->mac_addr, 6))
+            j = i;
+        for (int k = 0; j < 0 && k < old_count; k++) {
+            if (old[k].blob && !memcmp(old[k].attr.mac_addr,
+                                       attr->mac_addr, 6))
+                j = k;
+        }
+        if (j >= 0 && ftm_peer_attr_equal(&old[j].attr, attr)) {
+            prepared[i] = old[j];
+            old[j].blob = NULL;
+            continue;
+        }
+        if (prepare_peer(ctx, &prepared[i], attr, i)) {
+            free_prepared(prepared, config->peer_count);
+            return 1;
+        }
+    }
+    free_prepared(old, old_count);
+    ctx->prepared = prepared;
+    ctx->prepared_count = config->peer_count;
+    return 0;
+}
+
+/* put the peers of a group, or all the peers if group is negative */
+static int set_ftm_config(struct ftm_ctx *ctx, struct nl_msg *msg,
+                          struct ftm_config *config,
+                          struct ftm_channel_groups *groups, int group) {
+    if (prepare_peers(ctx, config))
+        return 1;
     struct nlattr *pmsr = nla_nest_start(msg, NL80211_ATTR_PEER_MEASUREMENTS);
     if (!pmsr)
         return 1;
     struct nlattr *peers = nla_nest_start(msg, NL80211_PMSR_ATTR_PEERS);
     if (!peers)
         return 1;
-    int peer_count = config->peer_count;
-    for (int i = 0; i < peer_count; i++) {
-        if (set_ftm_peer(msg, config->peers[i], i))
+    int first = 0, count = ctx->prepared_count;
+    if (groups && group >= 0 && groups->count) {
+        first = groups->bounds[group];
+        count = groups->bounds[group + 1] - first;
+    }
+    for (int i = 0; i < count; i++) {
+        int idx = groups && group >= 0 && groups->count ?
+                  groups->order[first + i] : i;
+        struct ftm_prepared_peer *prepared = &ctx->prepared[idx];
+        struct nlattr *peer = nlmsg_reserve(msg, prepared->len, NLA_ALIGNTO);
+        if (!peer)
             return 1;
+        memcpy(peer, prepared->blob, prepared->len);
+        peer->nla_type = (peer->nla_type & ~NLA_TYPE_MASK) | i;
     }
     nla_nest_end(msg, peers);
     nla_nest_end(msg, pmsr);
     return 0;
 }
 
-static int start_ftm(struct nl80211_state *state,
-                     struct ftm_config *config) {
-    int err;
+static struct nl_msg *build_ftm_request(struct ftm_ctx *ctx,
+                                        struct nl80211_state *state,
+                                        struct ftm_config *config,
+                                        struct ftm_channel_groups *groups,
+                                        int group) {
     struct nl_msg *msg = nlmsg_alloc();
     if (!msg) {
-        fprintf(stderr, "Fail to allocate message!");
-        return 1;
+        ftm_report_error(ctx->error, "Fail to allocate message!");
+        return NULL;
     }
 
     genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, state->nl80211_id, 0, 0,
@@ -89,28 +404,312 @@ static int start_ftm(struct nl80211_state *state,
 
     NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, config->interface_index);
 
-    err = set_ftm_config(msg, config);
-    if (err)
-        return 1;
-    err = nl_sock_handle(state, msg, NULL, NULL);
-    return err;
+    if (set_ftm_config(ctx, msg, config, groups, group))
+        goto nla_put_failure;
+    return msg;
 nla_put_failure:
     nlmsg_free(msg);
-    return 1;
+    return NULL;
 }
 
-static int handle_ftm_result(struct nl_msg *msg, void *arg) {
+static void get_channel(struct ftm_peer_attr *attr, struct ftm_channel *chan) {
+#define __CHANNEL_GET(attr_name) \
+    chan->attr_name = FTM_PEER_HAS(attr, attr_name) ? \
+                      attr->attr_name : 0
+    __CHANNEL_GET(center_freq);
+    __CHANNEL_GET(chan_width);
+    __CHANNEL_GET(center_freq_1);
+    __CHANNEL_GET(center_freq_2);
+}
+
+static int compare_channel(const struct ftm_channel *a,
+                           const struct ftm_channel *b) {
+#define __CHANNEL_CMP(attr_name)                   \
+    if (a->attr_name != b->attr_name)              \
+        return a->attr_name < b->attr_name ? -1 : 1
+    __CHANNEL_CMP(center_freq);
+    __CHANNEL_CMP(chan_width);
+    __CHANNEL_CMP(center_freq_1);
+    __CHANNEL_CMP(center_freq_2);
+    return 0;
+}
+
+/* channel of a NL80211_CMD_NEW_INTERFACE message */
+static void parse_interface_channel(struct nl_msg *msg,
+                                    struct ftm_channel *chan) {
+    struct nlattr *tb[NL80211_ATTR_MAX + 1];
     struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
-    /* fetch pointer from nl_cb_arg */
-    struct nl_cb_arg *cb_arg = arg;
-    struct ftm_results_wrap *results_wrap = cb_arg->arg;
-    if (gnlh->cmd == NL80211_CMD_PEER_MEASUREMENT_COMPLETE) {
-        *cb_arg->state = 0;
-        return NL_OK;
+    nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+              genlmsg_attrlen(gnlh, 0), NULL);
+#define __CHANNEL_ATTR(attr_idx, attr_name) \
+    if (tb[NL80211_ATTR_##attr_idx])         \
+        chan->attr_name = nla_get_u32(tb[NL80211_ATTR_##attr_idx])
+    __CHANNEL_ATTR(WIPHY_FREQ, center_freq);
+    __CHANNEL_ATTR(CHANNEL_WIDTH, chan_width);
+    __CHANNEL_ATTR(CENTER_FREQ1, center_freq_1);
+    __CHANNEL_ATTR(CENTER_FREQ2, center_freq_2);
+}
+
+static int get_interface_handler(struct nl_msg *msg, void *arg) {
+    parse_interface_channel(msg, ((struct nl_cb_arg *)arg)->arg);
+    return NL_OK;
+}
+
+static struct nl_msg *build_interface_query(struct nl80211_state *state,
+                                            uint64_t if_index) {
+    struct nl_msg *msg = nlmsg_alloc();
+    if (!msg)
+        return NULL;
+    if (!genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, state->nl80211_id,
+                     0, 0, NL80211_CMD_GET_INTERFACE, 0) ||
+        nla_put_u32(msg, NL80211_ATTR_IFINDEX, if_index)) {
+        nlmsg_free(msg);
+        return NULL;
     }
-    if (gnlh->cmd != NL80211_CMD_PEER_MEASUREMENT_RESULT)
-        return NL_SKIP;
+    return msg;
+}
+
+/*
+ * Channel the interface operates on, 1 if it has none (not connected).
+ * Blocks for the reply, for synchronous sessions only.
+ */
+static int get_operating_channel(struct ftm_ctx *ctx, uint64_t if_index,
+                                 struct ftm_channel *chan) {
+    memset(chan, 0, sizeof(struct ftm_channel));
+    struct nl_msg *msg = build_interface_query(&ctx->nlstate, if_index);
+    if (!msg)
+        return 1;
+    struct nl_cb_arg arg = alloc_nl_cb_arg(chan);
+    int err = nl_sock_handle(&ctx->nlstate, msg, get_interface_handler, &arg);
+    nlmsg_free(msg);
+    /* not worth failing the measurement for */
+    ctx->error[0] = '\0';
+    return err || !chan->center_freq;
+}
 
+/* sort key of a peer */
+struct group_key {
+    struct ftm_channel chan;
+    bool operating;
+    int idx;
+};
+
+static int compare_group_key(const void *a, const void *b) {
+    const struct group_key *ka = a, *kb = b;
+    if (ka->operating != kb->operating)
+        return ka->operating ? -1 : 1;
+    int diff = compare_channel(&ka->chan, &kb->chan);
+    return diff ? diff : ka->idx - kb->idx;
+}
+
+static void free_groups(struct ftm_channel_groups *groups) {
+    free(groups->order);
+    free(groups->bounds);
+    memset(groups, 0, sizeof(struct ftm_channel_groups));
+}
+
+/* whether the peers of the config are on more than one channel */
+static bool multi_channel(struct ftm_config *config) {
+    struct ftm_channel first, chan;
+    for (int i = 0; i < config->peer_count; i++) {
+        get_channel(config->peers[i], i ? &chan : &first);
+        if (i && compare_channel(&chan, &first))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Group the peers of the config by channel, no groups if there is one.
+ * The group on @operating comes first, NULL if unknown.
+ */
+static int group_peers(struct ftm_ctx *ctx, struct ftm_config *config,
+                       struct ftm_channel_groups *groups,
+                       const struct ftm_channel *operating) {
+    free_groups(groups);
+    int count = config->peer_count;
+    if (count < 2)
+        return 0;
+    struct group_key *keys = malloc(count * sizeof(struct group_key));
+    if (!keys) {
+        ftm_report_error(ctx->error, "Fail to allocate channel groups!");
+        return 1;
+    }
+    bool single = true;
+    for (int i = 0; i < count; i++) {
+        get_channel(config->peers[i], &keys[i].chan);
+        keys[i].idx = i;
+        single &= compare_channel(&keys[i].chan, &keys[0].chan) == 0;
+    }
+    if (single) {
+        free(keys);
+        return 0;
+    }
+
+    groups->order = malloc(count * sizeof(int));
+    groups->bounds = malloc((count + 1) * sizeof(int));
+    if (!groups->order || !groups->bounds) {
+        ftm_report_error(ctx->error, "Fail to allocate channel groups!");
+        free(keys);
+        free_groups(groups);
+        return 1;
+    }
+    for (int i = 0; i < count; i++) {
+        keys[i].operating = operating &&
+                            !compare_channel(&keys[i].chan, operating);
+    }
+    qsort(keys, count, sizeof(struct group_key), compare_group_key);
+
+    for (int i = 0; i < count; i++) {
+        groups->order[i] = keys[i].idx;
+        if (i == 0 || compare_channel(&keys[i].chan, &keys[i - 1].chan))
+            groups->bounds[groups->count++] = i;
+    }
+    groups->bounds[groups->count] = count;
+    free(keys);
+    return 0;
+}
+
+/* channel groups of the synchronous session */
+static int group_run_peers(struct ftm_ctx *ctx, struct ftm_config *config) {
+    struct ftm_channel operating;
+    bool connected = multi_channel(config) &&
+                     !get_operating_channel(ctx, config->interface_index,
+                                            &operating);
+    return group_peers(ctx, config, &ctx->groups,
+                       connected ? &operating : NULL);
+}
+
+static int64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* time the bursts of a peer take */
+static int64_t peer_bursts_ms(struct ftm_peer_attr *peer) {
+    int64_t bursts = 1;
+    if (FTM_PEER_HAS(peer, num_bursts_exp))
+        bursts <<= peer->num_bursts_exp < 15 ? peer->num_bursts_exp : 15;
+    /* 2 to 11 stand for 250 us to 128 ms, the others for no preference */
+    int64_t duration_us = BURST_DURATION_MAX_US;
+    if (FTM_PEER_HAS(peer, burst_duration) &&
+        peer->burst_duration >= 2 && peer->burst_duration <= 11)
+        duration_us = 250 << (peer->burst_duration - 2);
+    /* in units of 100 ms, 0 for no preference */
+    int64_t period_us = FTM_PEER_HAS(peer, burst_period) ?
+                        (int64_t)peer->burst_period * 100000 : 0;
+    return bursts * (period_us > duration_us ? period_us : duration_us) /
+           1000;
+}
+
+/* when the COMPLETE of a request of a group is overdue, from now */
+static int64_t request_deadline(struct ftm_config *config,
+                                struct ftm_channel_groups *groups,
+                                int group) {
+    int first = 0, count = config->peer_count;
+    bool grouped = groups && group >= 0 && groups->count;
+    if (grouped) {
+        first = groups->bounds[group];
+        count = groups->bounds[group + 1] - first;
+    }
+    /* drivers may measure the peers one after another */
+    int64_t total_ms = 0;
+    for (int i = 0; i < count; i++) {
+        int idx = grouped ? groups->order[first + i] : i;
+        total_ms += peer_bursts_ms(config->peers[idx]);
+    }
+    return monotonic_ns() +
+           (DEADLINE_BASE_MS + DEADLINE_SLACK * total_ms) * 1000000;
+}
+
+/* does @event concern the interface of @config, named @if_name */
+static bool event_matches(const struct ftm_radio_event *event,
+                          struct ftm_config *config, const char *if_name) {
+    if (event->if_index == config->interface_index)
+        return true;
+    /* deleted and created again under the same name */
+    if (event->type == FTM_RADIO_UP && event->if_name[0] &&
+        !strcmp(event->if_name, if_name)) {
+        config->interface_index = event->if_index;
+        return true;
+    }
+    return false;
+}
+
+static void handle_radio_event(const struct ftm_radio_event *event,
+                               void *arg) {
+    struct ftm_ctx *ctx = arg;
+    bool interrupts = event->type != FTM_RADIO_UP;
+    if (ctx->run_config &&
+        event_matches(event, ctx->run_config, ctx->if_name))
+        ctx->interrupted |= interrupts;
+    for (struct ftm_session *session = ctx->sessions; session;
+         session = session->next) {
+        if (session->state != FTM_SESSION_DEAD &&
+            event_matches(event, session->config, session->if_name))
+            session->interrupted |= interrupts;
+    }
+}
+
+/* take the queued radio events into account */
+static int process_events(struct ftm_ctx *ctx) {
+    if (!ctx->events)
+        return 0;
+    return ftm_event_watch_process(ctx->events, handle_radio_event, ctx) < 0;
+}
+
+/* wait on the socket of the context until done or a radio event */
+static int ctx_wait(struct ftm_ctx *ctx, nl_recvmsg_msg_cb_t handler,
+                    struct nl_cb_arg *arg) {
+    int wake_fd = ctx->events ? ctx->events->fd : -1;
+    while (1) {
+        int64_t left_ms = (ctx->deadline_ns - monotonic_ns()) / 1000000;
+        int err = nl_sock_wait(&ctx->nlstate, handler, arg, wake_fd,
+                               left_ms > 0 ? left_ms : 0);
+        if (err == NL_SOCK_TIMEOUT) {
+            ctx->timed_out = true;
+            ftm_report_error(ctx->error, "No COMPLETE before the deadline");
+            return 1;
+        }
+        if (err != NL_SOCK_WOKEN)
+            return err;
+        if (process_events(ctx))
+            return 1;
+        if (ctx->interrupted) {
+            ftm_report_error(ctx->error, "Interrupted by a change of the "
+                             "interface");
+            return 1;
+        }
+    }
+}
+
+static int start_ftm(struct ftm_ctx *ctx, struct ftm_config *config,
+                     int group) {
+    struct nl80211_state *state = &ctx->nlstate;
+    int err;
+    FTM_TRACE_MARK(&ctx->trace, BUILD);
+    struct nl_msg *msg = build_ftm_request(ctx, state, config, &ctx->groups,
+                                           group);
+    if (!msg)
+        return 1;
+    FTM_TRACE_MARK(&ctx->trace, BUILT);
+
+    ctx->deadline_ns = request_deadline(config, &ctx->groups, group);
+    err = nl_sock_send(state, msg);
+    if (err)
+        return 1;
+    FTM_TRACE_MARK(&ctx->trace, SENT);
+
+    err = ctx_wait(ctx, NULL, NULL);
+    FTM_TRACE_MARK(&ctx->trace, ACKED);
+    return err;
+}
+
+static int parse_ftm_result(char *error,
+                            struct ftm_results_wrap *results_wrap,
+                            struct ftm_trace *trace,
+                            struct genlmsghdr *gnlh, uint64_t rx_time_ns) {
     struct nlattr *tb[NL80211_ATTR_MAX + 1];
     int err;
 
@@ -118,12 +717,13 @@ static int handle_ftm_result(struct nl_msg *msg, void *arg) {
               genlmsg_attrlen(gnlh, 0), NULL);
 
     if (!tb[NL80211_ATTR_COOKIE]) {
-        printf("Peer measurements: no cookie!\n");
+        ftm_report_error(error, "Peer measurements: no cookie!");
         return NL_SKIP;
     }
 
     if (!tb[NL80211_ATTR_PEER_MEASUREMENTS]) {
-        printf("Peer measurements: no measurement data!\n");
+        ftm_report_error(error,
+                         "Peer measurements: no measurement data!");
         return NL_SKIP;
     }
 
@@ -135,11 +735,11 @@ static int handle_ftm_result(struct nl_msg *msg, void *arg) {
         return NL_SKIP;
 
     if (!pmsr[NL80211_PMSR_ATTR_PEERS]) {
-        printf("Peer measurements: no peer data!\n");
+        ftm_report_error(error, "Peer measurements: no peer data!");
         return NL_SKIP;
     }
 
-    struct nlattr *peer, **resp;
+    struct nlattr *peer;
     int i;
     int index = 0;
     nla_for_each_nested(peer, pmsr[NL80211_PMSR_ATTR_PEERS], i) {
@@ -151,23 +751,23 @@ static int handle_ftm_result(struct nl_msg *msg, void *arg) {
         err = nla_parse_nested(peer_tb, NL80211_PMSR_PEER_ATTR_MAX,
                                peer, NULL);
         if (err) {
-            fprintf(stderr, "Peer: failed to parse!\n");
+            ftm_report_error(error, "Peer: failed to parse!");
             return NL_SKIP;
         }
         if (!peer_tb[NL80211_PMSR_PEER_ATTR_ADDR]) {
-            fprintf(stderr, "Peer: no MAC address\n");
+            ftm_report_error(error, "Peer: no MAC address");
             return NL_SKIP;
         }
 
         if (!peer_tb[NL80211_PMSR_PEER_ATTR_RESP]) {
-            fprintf(stderr, "No response!\n");
+            ftm_report_error(error, "No response!");
             return NL_SKIP;
         }
 
         err = nla_parse_nested(resp, NL80211_PMSR_RESP_ATTR_MAX,
                                peer_tb[NL80211_PMSR_PEER_ATTR_RESP], NULL);
         if (err) {
-            fprintf(stderr, "Failed to parse response!\n");
+            ftm_report_error(error, "Failed to parse response!");
             return NL_SKIP;
         }
 
@@ -182,69 +782,79 @@ static int handle_ftm_result(struct nl_msg *msg, void *arg) {
         if (err)
             return NL_SKIP;
 
-        struct ftm_resp_attr *resp_attr = results_wrap->results[index];
+        int peer_idx = index;
 
         /* 
-         * Find the correct ftm_result if the mac_addr does not match.
-         * This seems not quite possible (because the peers are set in 
-         * given order), but we do this just in case.
+         * Find the correct ftm_result if the mac_addr does not match,
+         * as when the peers of a request are a channel group of the
+         * config, through the index of the results.
          */
-        if (nla_memcmp(peer_tb[NL80211_PMSR_PEER_ATTR_ADDR],
-                       resp_attr->mac_addr, 6) != 0) {
+        if (peer_idx >= results_wrap->count ||
+            nla_memcmp(peer_tb[NL80211_PMSR_PEER_ATTR_ADDR],
+                       results_wrap->results[peer_idx]->mac_addr, 6) != 0) {
             uint8_t addr[6];
             nla_memcpy(addr, peer_tb[NL80211_PMSR_PEER_ATTR_ADDR], 6);
-            bool found = false;
-            for (int i = 0; i < results_wrap->count; i++) {
-                resp_attr = results_wrap->results[i];
-                if (memcmp(addr, resp_attr->mac_addr, 6) == 0) {
-                    found = true;
-                    break;
-                }
-            }
-            if (!found) {
-                fprintf(stderr,
-                        "Result for target"
-                        "%02hhx:%02hhx:%02hhx:%02hhx:%02hhx:%02hhx"
-                        "does not exist!\n",
-                        addr[0], addr[1], addr[2],
-                        addr[3], addr[4], addr[5]);
+            peer_idx = mac_map_get(&results_wrap->index, addr);
+            if (peer_idx < 0) {
+                ftm_report_error(error,
+                                 "Result for target "
+                                 "%02hhx:%02hhx:%02hhx:%02hhx:%02hhx:%02hhx "
+                                 "does not exist!",
+                                 addr[0], addr[1], addr[2],
+                                 addr[3], addr[4], addr[5]);
                 continue;
             }
         }
+        struct ftm_resp_attr *resp_attr = results_wrap->results[peer_idx];
+
+#define __FTM_GET(attr_name, attr_idx, type, nla_type, spec) \
+    FTM_GET(ftm, resp_attr, attr_idx, attr_name, nla_type)
 
-#define __FTM_GET(attr_idx, attr_name, type) \
-    FTM_GET(ftm, resp_attr, attr_idx, attr_name, type)
-
-        __FTM_GET(FAIL_REASON, fail_reason, u32);
-        __FTM_GET(BURST_INDEX, burst_index, u32);
-        __FTM_GET(NUM_FTMR_ATTEMPTS, num_ftmr_attempts, u32);
-        __FTM_GET(NUM_FTMR_SUCCESSES, num_ftmr_successes, u32);
-        __FTM_GET(BUSY_RETRY_TIME, busy_retry_time, u32);
-        __FTM_GET(NUM_BURSTS_EXP, num_bursts_exp, u8);
-        __FTM_GET(BURST_DURATION, burst_duration, u8);
-        __FTM_GET(FTMS_PER_BURST, ftms_per_burst, u8);
-        __FTM_GET(RSSI_AVG, rssi_avg, s32);
-        __FTM_GET(RSSI_SPREAD, rssi_spread, s32);
-        __FTM_GET(RTT_AVG, rtt_avg, s64);
-        __FTM_GET(RTT_VARIANCE, rtt_variance, u64);
-        __FTM_GET(RTT_SPREAD, rtt_spread, u32);
-        __FTM_GET(DIST_AVG, dist_avg, s64);
-        __FTM_GET(DIST_VARIANCE, dist_variance, u64);
-        __FTM_GET(DIST_SPREAD, dist_spread, u64);
+        FTM_RESP_FIELDS(__FTM_GET)
+        resp_attr->rx_time_ns = rx_time_ns;
+        FTM_RESP_SET_FLAG(resp_attr, rx_time_ns);
+        FTM_TRACE_PEER(trace, peer_idx);
 
         index++;
     };
-    return 0;
+    return NL_OK;
 }
 
-static int listen_ftm_result(struct nl80211_state *state,
-                             struct ftm_results_wrap *results_wrap) {
-    struct nl_cb_arg arg = alloc_nl_cb_arg(results_wrap);
-    int err = nl_sock_handle(state, NULL, handle_ftm_result,
-                             &arg);
+int ftm_parse_result(struct ftm_results_wrap *results, struct nl_msg *msg,
+                     uint64_t rx_time_ns, char *error) {
+    struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+    if (gnlh->cmd != NL80211_CMD_PEER_MEASUREMENT_RESULT)
+        return NL_SKIP;
+    return parse_ftm_result(error, results, &untraced, gnlh, rx_time_ns);
+}
+
+static int handle_ftm_result(struct nl_msg *msg, void *arg) {
+    struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+    /* fetch pointer from nl_cb_arg */
+    struct nl_cb_arg *cb_arg = arg;
+    struct ftm_ctx *ctx = cb_arg->arg;
+    if (gnlh->cmd == NL80211_CMD_PEER_MEASUREMENT_COMPLETE) {
+        FTM_TRACE_MARK(&ctx->trace, COMPLETE);
+        *cb_arg->state = 0;
+        return NL_OK;
+    }
+    if (gnlh->cmd != NL80211_CMD_PEER_MEASUREMENT_RESULT)
+        return NL_SKIP;
+
+    int err;
+
+    FTM_TRACE_PARSE_BEGIN(&ctx->trace);
+    err = parse_ftm_result(ctx->error, ctx->results, &ctx->trace, gnlh,
+                           ctx->nlstate.rx_time_ns);
+    FTM_TRACE_PARSE_END(&ctx->trace);
     return err;
 }
 
+static int listen_ftm_result(struct ftm_ctx *ctx) {
+    struct nl_cb_arg arg = alloc_nl_cb_arg(ctx);
+    return ctx_wait(ctx, handle_ftm_result, &arg);
+}
+
 static void print_ftm_results(struct ftm_results_wrap *results,
                               uint attempts, uint attemp_idx, void *arg) {
     for (int i = 0; i < results->count; i++) {
@@ -255,67 +865,859 @@ static void print_ftm_results(struct ftm_results_wrap *results,
         }
         printf("\nMEASUREMENT RESULT FOR TARGET #%d\n", i);
 
-#define __FTM_PRINT(attr_name, specifier) \
-    FTM_PRINT(resp, attr_name, specifier)
+#define __FTM_PRINT(attr_name, attr_idx, type, nla_type, specifier) \
+    FTM_PRINT(resp, attr_name, specifier);
 
         FTM_PRINT_ADDR(resp);
-        __FTM_PRINT(fail_reason, u);
-        __FTM_PRINT(burst_index, u);
-        __FTM_PRINT(num_ftmr_attempts, u);
-        __FTM_PRINT(num_ftmr_successes, u);
-        __FTM_PRINT(busy_retry_time, u);
-        __FTM_PRINT(num_bursts_exp, u);
-        __FTM_PRINT(burst_duration, u);
-        __FTM_PRINT(ftms_per_burst, u);
-        __FTM_PRINT(rssi_avg, d);
-        __FTM_PRINT(rssi_spread, d);
-        __FTM_PRINT(rtt_avg, ld);
-        __FTM_PRINT(rtt_variance, lu);
-        __FTM_PRINT(rtt_spread, lu);
-        __FTM_PRINT(dist_avg, ld);
-        __FTM_PRINT(dist_variance, lu);
-        __FTM_PRINT(dist_spread, lu);
+        FTM_RESP_FIELDS(__FTM_PRINT)
+        FTM_PRINT(resp, rx_time_ns, lu);
     }
 }
 
-int ftm(struct ftm_config *config, ftm_result_handler handler,
-        int attempts, void *arg) {
-    struct nl80211_state nlstate;
-    int err = nl80211_init(&nlstate);
-    if (err) {
-        fprintf(stderr, "Fail to allocate socket!\n");
+/* receive buffer holding every result of a session of @config */
+static int results_rcvbuf(struct ftm_config *config) {
+    int64_t messages = 2;
+    for (int i = 0; i < config->peer_count; i++) {
+        struct ftm_peer_attr *peer = config->peers[i];
+        int exp = 0;
+        if (FTM_PEER_HAS(peer, num_bursts_exp))
+            exp = peer->num_bursts_exp < RESULT_BURSTS_EXP_MAX ?
+                  peer->num_bursts_exp : RESULT_BURSTS_EXP_MAX;
+        messages += 1 << exp;
+    }
+    int64_t bytes = messages * RESULT_RCVBUF_COST;
+    return bytes < NL_RCVBUF_MAX ? bytes : NL_RCVBUF_MAX;
+}
+
+/* grow the receive buffer for @config, never shrink it */
+static void fit_rcvbuf(struct nl80211_state *state,
+                       struct ftm_config *config) {
+    int bytes = results_rcvbuf(config);
+    if (bytes > state->rcvbuf)
+        nl_sock_set_rcvbuf(state, bytes);
+}
+
+/* receive work of an attempt, from the counters before and after it */
+static void set_rx_work(struct ftm_results_wrap *results,
+                        const struct nl_rx_stats *start,
+                        const struct nl_rx_stats *end) {
+    results->rx_syscalls = end->syscalls - start->syscalls;
+    results->rx_copied = end->copied - start->copied;
+}
+
+struct ftm_ctx *ftm_ctx_new(char *error) {
+    struct ftm_ctx *ctx = calloc(1, sizeof(struct ftm_ctx));
+    if (!ctx) {
+        ftm_report_error(error, "Fail to allocate context!");
+        return NULL;
+    }
+    ctx->nlstate.error = ctx->error;
+    ctx->epoll_fd = -1;
+    ctx->watchdog_fd = -1;
+    ctx->channel_groups = true;
+    if (nl80211_init(&ctx->nlstate)) {
+        ftm_report_error(error, "Fail to allocate socket: %s", ctx->error);
+        free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+void ftm_ctx_free(struct ftm_ctx *ctx) {
+    if (!ctx)
+        return;
+    while (ctx->sessions)
+        ftm_cancel(ctx, ctx->sessions);
+    if (ctx->epoll_fd >= 0)
+        close(ctx->epoll_fd);
+    if (ctx->watchdog_fd >= 0)
+        close(ctx->watchdog_fd);
+    free_ftm_event_watch(ctx->events);
+    ftm_trace_disable(&ctx->trace);
+    free_prepared(ctx->prepared, ctx->prepared_count);
+    free_groups(&ctx->groups);
+    if (ctx->results)
+        free_ftm_results_wrap(ctx->results);
+    nl80211_free(&ctx->nlstate);
+    free(ctx);
+}
+
+const char *ftm_ctx_error(struct ftm_ctx *ctx) {
+    return ctx->error;
+}
+
+struct ftm_trace *ftm_ctx_trace(struct ftm_ctx *ctx) {
+    return &ctx->trace;
+}
+
+void ftm_ctx_stop(struct ftm_ctx *ctx) {
+    ctx->stop = 1;
+}
+
+bool ftm_ctx_stopped(struct ftm_ctx *ctx) {
+    return ctx->stop;
+}
+
+struct nl80211_state *ftm_ctx_nlstate(struct ftm_ctx *ctx) {
+    return &ctx->nlstate;
+}
+
+uint64_t ftm_ctx_rebuilt_peers(struct ftm_ctx *ctx) {
+    return ctx->rebuilt_peers;
+}
+
+uint64_t ftm_ctx_overruns(struct ftm_ctx *ctx) {
+    return ctx->overruns;
+}
+
+uint64_t ftm_ctx_timeouts(struct ftm_ctx *ctx) {
+    return ctx->timeouts;
+}
+
+uint64_t ftm_ctx_interruptions(struct ftm_ctx *ctx) {
+    return ctx->interruptions;
+}
+
+void ftm_ctx_set_channel_groups(struct ftm_ctx *ctx, bool enable) {
+    ctx->channel_groups = enable;
+    if (!enable)
+        free_groups(&ctx->groups);
+}
+
+struct ftm_config *ftm_ctx_parse_config(struct ftm_ctx *ctx,
+                                        const char *file_name,
+                                        const char *if_name) {
+    ctx->error[0] = '\0';
+    return parse_config_file_r(file_name, if_name, ctx->error);
+}
+
+/*
+ * The interface of the synchronous session went down or moved: abort what
+ * the kernel still measures and wait until the interface is up.
+ */
+static int pause_run(struct ftm_ctx *ctx, struct ftm_config *config) {
+    /* closing the socket makes the kernel abort the measurement */
+    if (nl_sock_reopen(&ctx->nlstate))
         return 1;
+    while (!ftm_link_is_up(config->interface_index)) {
+        if (ftm_event_watch_wait(ctx->events, -1) < 0 ||
+            process_events(ctx))
+            return 1;
     }
+    ctx->interrupted = false;
+    ctx->error[0] = '\0';
+    return 0;
+}
+
+/* reuse the results of the last session if the peer count is the same */
+static struct ftm_results_wrap *get_results(struct ftm_ctx *ctx,
+                                            struct ftm_config *config) {
+    if (ctx->results && ctx->results->count == config->peer_count &&
+        !reset_ftm_results_wrap(ctx->results, config))
+        return ctx->results;
+    if (ctx->results)
+        free_ftm_results_wrap(ctx->results);
+    ctx->results = alloc_ftm_results_wrap(config);
+    return ctx->results;
+}
 
-    for (long long i = 0; i < attempts; i++) {
-        struct ftm_results_wrap *results_wrap =
-            alloc_ftm_results_wrap(config);
-        if (!results_wrap) {
-            fprintf(stderr, "Fail to allocate results_wrap!\n");
+/* send the request of each channel group and receive its results */
+static int run_groups(struct ftm_ctx *ctx, struct ftm_config *config) {
+    /* one request per channel, or a single one with all the peers */
+    int group_count = ctx->groups.count ? ctx->groups.count : 1;
+    for (int i = 0; i < group_count; i++) {
+        if (start_ftm(ctx, config, i)) {
+            if (!ctx->error[0])
+                ftm_report_error(ctx->error, "Fail to start ftm!");
             return 1;
         }
-        err = start_ftm(&nlstate, config);
-        if (err) {
-            fprintf(stderr, "Fail to start ftm!\n");
-            goto handle_free;
+
+        if (listen_ftm_result(ctx)) {
+            if (!ctx->error[0])
+                ftm_report_error(ctx->error, "Fail to listen!");
+            return 1;
         }
+        /* the session completes with the last group */
+        if (i + 1 < group_count)
+            ctx->trace.points[FTM_TRACE_POINT_COMPLETE] = 0;
+    }
+    return 0;
+}
 
-        err = listen_ftm_result(&nlstate, results_wrap);
-        if (err) {
-            fprintf(stderr, "Fail to listen!\n");
-            goto handle_free;
+static struct ftm_results_wrap *run_session(struct ftm_ctx *ctx,
+                                            struct ftm_config *config) {
+    ctx->error[0] = '\0';
+    if (!get_results(ctx, config)) {
+        ftm_report_error(ctx->error, "Fail to allocate results_wrap!");
+        return NULL;
+    }
+
+    if (ctx->events) {
+        if_indextoname(config->interface_index, ctx->if_name);
+        /* what happened before the session is no news to it */
+        if (process_events(ctx))
+            return NULL;
+        ctx->interrupted = !ftm_link_is_up(config->interface_index);
+        if (ctx->interrupted && pause_run(ctx, config))
+            return NULL;
+    }
+
+    if (ctx->channel_groups && group_run_peers(ctx, config))
+        return NULL;
+
+    fit_rcvbuf(&ctx->nlstate, config);
+    struct nl_rx_stats rx_start = ctx->nlstate.rx_stats;
+    int overruns = 0, timeouts = 0;
+    ctx->timed_out = false;
+    while (1) {
+        uint64_t last_overruns = ctx->nlstate.overruns;
+        if (!run_groups(ctx, config))
+            break;
+        /* the failure may come before the event explaining it */
+        if (ctx->events && !process_events(ctx) &&
+            (ctx->interrupted ||
+             !ftm_link_is_up(config->interface_index))) {
+            ctx->interruptions++;
+            if (pause_run(ctx, config) ||
+                reset_ftm_results_wrap(ctx->results, config) ||
+                (ctx->channel_groups && group_run_peers(ctx, config)))
+                return NULL;
+            ctx->trace.points[FTM_TRACE_POINT_COMPLETE] = 0;
+            continue;
+        }
+        /* the COMPLETE was lost, abort the request and issue it again */
+        if (ctx->timed_out) {
+            ctx->timed_out = false;
+            ctx->timeouts++;
+            if (timeouts++ == DEADLINE_RETRIES) {
+                ftm_report_error(ctx->error, "No COMPLETE from the driver "
+                                 "in %d tries", DEADLINE_RETRIES + 1);
+                return NULL;
+            }
+            if (nl_sock_reopen(&ctx->nlstate) ||
+                reset_ftm_results_wrap(ctx->results, config))
+                return NULL;
+            ctx->error[0] = '\0';
+            ctx->trace.points[FTM_TRACE_POINT_COMPLETE] = 0;
+            continue;
+        }
+        if (ctx->nlstate.overruns == last_overruns)
+            return NULL;
+        /* results were dropped, start again on a larger buffer */
+        if (overruns++ == OVERRUN_RETRIES) {
+            ftm_report_error(ctx->error, "Results lost to receive buffer "
+                             "overruns (%d bytes), raise net.core.rmem_max "
+                             "or run with CAP_NET_ADMIN",
+                             ctx->nlstate.rcvbuf);
+            return NULL;
         }
+        ctx->overruns++;
+        if (nl_sock_resync(&ctx->nlstate) ||
+            reset_ftm_results_wrap(ctx->results, config))
+            return NULL;
+        ctx->error[0] = '\0';
+        ctx->trace.points[FTM_TRACE_POINT_COMPLETE] = 0;
+    }
+    ctx->results->rx_queued = nl_sock_rx_queued(&ctx->nlstate);
+    ctx->results->overruns = overruns;
+    ctx->results->timeouts = timeouts;
+    set_rx_work(ctx->results, &rx_start, &ctx->nlstate.rx_stats);
+    return ctx->results;
+}
+
+struct ftm_results_wrap *ftm_ctx_session(struct ftm_ctx *ctx,
+                                         struct ftm_config *config) {
+    /* radio events of the interface interrupt the session */
+    ctx->run_config = config;
+    struct ftm_results_wrap *results = run_session(ctx, config);
+    ctx->run_config = NULL;
+    return results;
+}
+
+int ftm_ctx_run(struct ftm_ctx *ctx, struct ftm_config *config,
+                ftm_result_handler handler, int attempts, void *arg) {
+    for (int i = 0; (attempts == FTM_ATTEMPTS_INF || i < attempts) &&
+                    !ctx->stop; i++) {
+        struct ftm_results_wrap *results_wrap = ftm_ctx_session(ctx, config);
+        if (!results_wrap)
+            return 1;
 
         if (handler)
             handler(results_wrap, attempts, i, arg);
         else
             print_ftm_results(results_wrap, attempts, i, NULL);
+        FTM_TRACE_SESSION_END(&ctx->trace);
+    }
+    return 0;
+}
 
-        free_ftm_results_wrap(results_wrap);
-        continue;
-    handle_free:
-        free_ftm_results_wrap(results_wrap);
+/* radio events wake up ftm_process() like the sessions do */
+static int watch_events(struct ftm_ctx *ctx) {
+    struct epoll_event event = {
+        .events = EPOLLIN,
+        .data.ptr = ctx->events,
+    };
+    if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, ctx->events->fd, &event)) {
+        ftm_report_error(ctx->error, "Fail to watch radio events: %s",
+                         strerror(errno));
         return 1;
     }
     return 0;
-}
\ No newline at end of file
+}
+
+/* the watchdog wakes up ftm_process() when a deadline passes */
+static int create_watchdog(struct ftm_ctx *ctx) {
+    ctx->watchdog_fd = timerfd_create(CLOCK_MONOTONIC,
+                                      TFD_NONBLOCK | TFD_CLOEXEC);
+    struct epoll_event event = {
+        .events = EPOLLIN,
+        .data.ptr = &ctx->watchdog_fd,
+    };
+    if (ctx->watchdog_fd < 0 ||
+        epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, ctx->watchdog_fd, &event)) {
+        ftm_report_error(ctx->error, "Fail to create watchdog: %s",
+                         strerror(errno));
+        if (ctx->watchdog_fd >= 0)
+            close(ctx->watchdog_fd);
+        ctx->watchdog_fd = -1;
+        return 1;
+    }
+    return 0;
+}
+
+static void set_watchdog(struct ftm_ctx *ctx, int64_t when_ns) {
+    struct itimerspec spec = {0};
+    spec.it_value.tv_sec = when_ns / 1000000000;
+    spec.it_value.tv_nsec = when_ns % 1000000000;
+    timerfd_settime(ctx->watchdog_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+    ctx->watchdog_ns = when_ns;
+}
+
+static int get_epoll_fd(struct ftm_ctx *ctx) {
+    if (ctx->epoll_fd < 0) {
+        ctx->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (ctx->epoll_fd < 0) {
+            ftm_report_error(ctx->error, "Fail to create epoll: %s",
+                             strerror(errno));
+        } else if (create_watchdog(ctx) ||
+                   (ctx->events && watch_events(ctx))) {
+            close(ctx->epoll_fd);
+            ctx->epoll_fd = -1;
+            if (ctx->watchdog_fd >= 0)
+                close(ctx->watchdog_fd);
+            ctx->watchdog_fd = -1;
+        }
+    }
+    return ctx->epoll_fd;
+}
+
+int ftm_get_fd(struct ftm_ctx *ctx) {
+    return get_epoll_fd(ctx);
+}
+
+static int session_handle_msg(struct nl_msg *msg, void *arg) {
+    struct ftm_session *session = arg;
+    struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+    if (gnlh->cmd == NL80211_CMD_NEW_INTERFACE) {
+        if (session->state == FTM_SESSION_QUERYING)
+            parse_interface_channel(msg, &session->operating);
+        return NL_SKIP;
+    }
+    if (gnlh->cmd == NL80211_CMD_PEER_MEASUREMENT_COMPLETE) {
+        session->state = FTM_SESSION_COMPLETE;
+        return NL_STOP;
+    }
+    if (gnlh->cmd != NL80211_CMD_PEER_MEASUREMENT_RESULT)
+        return NL_SKIP;
+    return parse_ftm_result(session->ctx->error, session->results, &untraced,
+                            gnlh, session->nlstate.rx_time_ns);
+}
+
+static int session_handle_ack(struct nl_msg *msg, void *arg) {
+    struct ftm_session *session = arg;
+    if (session->state == FTM_SESSION_QUERYING) {
+        session->state = FTM_SESSION_QUERIED;
+        return NL_STOP;
+    }
+    if (session->state == FTM_SESSION_STARTING)
+        session->state = FTM_SESSION_RUNNING;
+    return NL_OK;
+}
+
+static int session_handle_error(struct sockaddr_nl *nla,
+                                struct nlmsgerr *err, void *arg) {
+    struct ftm_session *session = arg;
+    /* not worth failing the measurement for */
+    if (session->state == FTM_SESSION_QUERYING) {
+        memset(&session->operating, 0, sizeof(struct ftm_channel));
+        session->state = FTM_SESSION_QUERIED;
+        return NL_STOP;
+    }
+    ftm_report_error(session->ctx->error, "Session failed: %s (%d)",
+                     strerror(-err->error), err->error);
+    session->state = FTM_SESSION_FAILED;
+    return NL_STOP;
+}
+
+/* send the request of the current channel group */
+static int start_group(struct ftm_session *session) {
+    struct nl_msg *msg = build_ftm_request(session->ctx, &session->nlstate,
+                                           session->config, &session->groups,
+                                           session->group_idx);
+    if (!msg)
+        return 1;
+    session->state = FTM_SESSION_STARTING;
+    session->deadline_ns = request_deadline(session->config,
+                                            &session->groups,
+                                            session->group_idx);
+    struct ftm_ctx *ctx = session->ctx;
+    if (!ctx->watchdog_ns || session->deadline_ns < ctx->watchdog_ns)
+        set_watchdog(ctx, session->deadline_ns);
+    return nl_sock_send(&session->nlstate, msg);
+}
+
+/* send the request of the next attempt */
+static int start_session(struct ftm_session *session) {
+    if (reset_ftm_results_wrap(session->results, session->config))
+        return 1;
+    session->group_idx = 0;
+    session->overruns = 0;
+    session->timeouts = 0;
+    session->rx_start = session->nlstate.rx_stats;
+    return start_group(session);
+}
+
+/*
+ * Ask for the operating channel on the socket of the session, the peers are
+ * grouped once the reply comes, see begin_attempt()
+ */
+static int query_channel(struct ftm_session *session) {
+    struct ftm_ctx *ctx = session->ctx;
+    memset(&session->operating, 0, sizeof(struct ftm_channel));
+    if (!ctx->channel_groups || !multi_channel(session->config)) {
+        free_groups(&session->groups);
+        return start_session(session);
+    }
+    struct nl_msg *msg = build_interface_query(
+        &session->nlstate, session->config->interface_index);
+    if (!msg) {
+        ftm_report_error(ctx->error, "Fail to allocate message!");
+        return 1;
+    }
+    session->state = FTM_SESSION_QUERYING;
+    session->deadline_ns = monotonic_ns() + DEADLINE_BASE_MS * 1000000;
+    if (!ctx->watchdog_ns || session->deadline_ns < ctx->watchdog_ns)
+        set_watchdog(ctx, session->deadline_ns);
+    return nl_sock_send(&session->nlstate, msg);
+}
+
+/* group the peers with what the query found and start the attempt */
+static int begin_attempt(struct ftm_session *session) {
+    bool known = session->operating.center_freq != 0;
+    if (group_peers(session->ctx, session->config, &session->groups,
+                    known ? &session->operating : NULL))
+        return 1;
+    return start_session(session);
+}
+
+static void free_session(struct ftm_session *session) {
+    nl80211_free(&session->nlstate);
+    if (session->results)
+        free_ftm_results_wrap(session->results);
+    free_groups(&session->groups);
+    free(session);
+}
+
+struct ftm_session *ftm_submit(struct ftm_ctx *ctx, struct ftm_config *config,
+                               ftm_result_handler handler,
+                               ftm_done_handler done, int attempts,
+                               void *arg) {
+    ctx->error[0] = '\0';
+    if (get_epoll_fd(ctx) < 0)
+        return NULL;
+
+    struct ftm_session *session = calloc(1, sizeof(struct ftm_session));
+    if (!session) {
+        ftm_report_error(ctx->error, "Fail to allocate session!");
+        return NULL;
+    }
+    session->ctx = ctx;
+    session->config = config;
+    session->handler = handler;
+    session->done = done;
+    session->arg = arg;
+    session->attempts = attempts;
+    session->nlstate.error = ctx->error;
+    if_indextoname(config->interface_index, session->if_name);
+
+    session->results = alloc_ftm_results_wrap(config);
+    if (!session->results) {
+        ftm_report_error(ctx->error, "Fail to allocate session!");
+        goto handle_free;
+    }
+    if (nl80211_init(&session->nlstate))
+        goto handle_free;
+    fit_rcvbuf(&session->nlstate, config);
+    nl_socket_set_nonblocking(session->nlstate.nl_sock);
+    session->cb.valid = session_handle_msg;
+    session->cb.valid_arg = session;
+    session->cb.ack = session_handle_ack;
+    session->cb.ack_arg = session;
+    session->cb.error = session_handle_error;
+    session->cb.error_arg = session;
+
+    if (query_channel(session))
+        goto handle_free;
+
+    struct epoll_event event = {
+        .events = EPOLLIN,
+        .data.ptr = session,
+    };
+    if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD,
+                  nl_socket_get_fd(session->nlstate.nl_sock), &event)) {
+        ftm_report_error(ctx->error, "Fail to watch session: %s",
+                         strerror(errno));
+        goto handle_free;
+    }
+    session->next = ctx->sessions;
+    ctx->sessions = session;
+    return session;
+handle_free:
+    free_session(session);
+    return NULL;
+}
+
+/* stop receiving, the session is freed once no event refers to it */
+static void end_session(struct ftm_session *session) {
+    struct ftm_ctx *ctx = session->ctx;
+    epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL,
+              nl_socket_get_fd(session->nlstate.nl_sock), NULL);
+    /* closing the socket makes the kernel abort the measurement */
+    nl_socket_free(session->nlstate.nl_sock);
+    session->nlstate.nl_sock = NULL;
+    session->state = FTM_SESSION_DEAD;
+}
+
+static void reap_sessions(struct ftm_ctx *ctx) {
+    struct ftm_session **pos = &ctx->sessions;
+    while (*pos) {
+        struct ftm_session *session = *pos;
+        if (session->state == FTM_SESSION_DEAD) {
+            *pos = session->next;
+            free_session(session);
+        } else {
+            pos = &session->next;
+        }
+    }
+}
+
+void ftm_cancel(struct ftm_ctx *ctx, struct ftm_session *session) {
+    if (session->state != FTM_SESSION_DEAD)
+        end_session(session);
+    if (!ctx->processing)
+        reap_sessions(ctx);
+}
+
+/*
+ * Give the session a new socket, larger if @grow, which aborts the
+ * measurement of the old one.
+ */
+static int replace_session_sock(struct ftm_session *session, bool grow) {
+    struct ftm_ctx *ctx = session->ctx;
+    int old_fd = nl_socket_get_fd(session->nlstate.nl_sock);
+    epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, old_fd, NULL);
+    if (grow ? nl_sock_resync(&session->nlstate) :
+               nl_sock_reopen(&session->nlstate))
+        return 1;
+    nl_socket_set_nonblocking(session->nlstate.nl_sock);
+    struct epoll_event event = {
+        .events = EPOLLIN,
+        .data.ptr = session,
+    };
+    if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD,
+                  nl_socket_get_fd(session->nlstate.nl_sock), &event)) {
+        ftm_report_error(ctx->error, "Fail to watch session: %s",
+                         strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+/* start the current attempt again, keeping what it went through */
+static int retry_attempt(struct ftm_session *session) {
+    int overruns = session->overruns;
+    int timeouts = session->timeouts;
+    struct nl_rx_stats rx_start = session->rx_start;
+    if (start_session(session))
+        return 1;
+    session->overruns = overruns;
+    session->timeouts = timeouts;
+    session->rx_start = rx_start;
+    return 0;
+}
+
+/*
+ * Results were dropped: move to a socket with a larger buffer, which
+ * aborts the measurement of the old one, and start the attempt again.
+ */
+static int resync_session(struct ftm_session *session) {
+    struct ftm_ctx *ctx = session->ctx;
+    if (session->overruns++ == OVERRUN_RETRIES) {
+        ftm_report_error(ctx->error, "Results lost to receive buffer "
+                         "overruns (%d bytes)", session->nlstate.rcvbuf);
+        return 1;
+    }
+    if (replace_session_sock(session, true))
+        return 1;
+    ctx->overruns++;
+    /* the reply to the query was lost with the results */
+    if (session->state <= FTM_SESSION_QUERIED)
+        return query_channel(session);
+    return retry_attempt(session);
+}
+
+static void finish_session(struct ftm_session *session, int err) {
+    end_session(session);
+    if (session->done)
+        session->done(session, err, session->arg);
+}
+
+/*
+ * A radio event interrupted the session, or its interface is down: abort
+ * the attempt and start it again once the interface is up.
+ */
+static void restart_session(struct ftm_session *session) {
+    struct ftm_ctx *ctx = session->ctx;
+    if (session->state != FTM_SESSION_PAUSED) {
+        ctx->interruptions++;
+        if (replace_session_sock(session, false)) {
+            finish_session(session, 1);
+            return;
+        }
+    }
+    session->interrupted = false;
+    if (!ftm_link_is_up(session->config->interface_index)) {
+        session->state = FTM_SESSION_PAUSED;
+        return;
+    }
+    ctx->error[0] = '\0';
+    /* the operating channel may have changed */
+    if (query_channel(session))
+        finish_session(session, 1);
+}
+
+/* the COMPLETE of the session is overdue: abort the request, retry */
+static void expire_session(struct ftm_session *session) {
+    struct ftm_ctx *ctx = session->ctx;
+    /* no reply to the query, go on without the operating channel */
+    if (session->state == FTM_SESSION_QUERYING) {
+        memset(&session->operating, 0, sizeof(struct ftm_channel));
+        if (replace_session_sock(session, false) || begin_attempt(session))
+            finish_session(session, 1);
+        return;
+    }
+    ctx->timeouts++;
+    if (session->timeouts++ == DEADLINE_RETRIES) {
+        ftm_report_error(ctx->error, "No COMPLETE from the driver in %d "
+                         "tries", DEADLINE_RETRIES + 1);
+        finish_session(session, 1);
+        return;
+    }
+    /* closing the socket makes the kernel abort the request */
+    if (replace_session_sock(session, false) || retry_attempt(session))
+        finish_session(session, 1);
+}
+
+/* expire the sessions past their deadline and rearm the watchdog */
+static void process_watchdog(struct ftm_ctx *ctx) {
+    uint64_t expirations;
+    if (read(ctx->watchdog_fd, &expirations, sizeof(expirations)) < 0 &&
+        errno == EAGAIN)
+        return;
+    ctx->watchdog_ns = 0;
+    int64_t now = monotonic_ns();
+    for (struct ftm_session *session = ctx->sessions; session;
+         session = session->next) {
+        if (session->state <= FTM_SESSION_RUNNING &&
+            session->deadline_ns <= now)
+            expire_session(session);
+    }
+    int64_t earliest = 0;
+    for (struct ftm_session *session = ctx->sessions; session;
+         session = session->next) {
+        if (session->state <= FTM_SESSION_RUNNING &&
+            (!earliest || session->deadline_ns < earliest))
+            earliest = session->deadline_ns;
+    }
+    if (earliest && (!ctx->watchdog_ns || earliest < ctx->watchdog_ns))
+        set_watchdog(ctx, earliest);
+}
+
+/* apply the radio events to the submitted sessions */
+static void process_radio(struct ftm_ctx *ctx) {
+    if (process_events(ctx))
+        return;
+    for (struct ftm_session *session = ctx->sessions; session;
+         session = session->next) {
+        if (session->state == FTM_SESSION_DEAD)
+            continue;
+        if (session->interrupted || session->state == FTM_SESSION_PAUSED)
+            restart_session(session);
+    }
+}
+
+static void process_session(struct ftm_session *session) {
+    struct ftm_ctx *ctx = session->ctx;
+    while (session->state != FTM_SESSION_DEAD) {
+        int err = nl_sock_recv(&session->nlstate, &session->cb, false);
+        /* the queue is empty, wait for the next event */
+        if ((err == 0 || err == -NLE_AGAIN) &&
+            session->state < FTM_SESSION_COMPLETE)
+            return;
+        if (nl_sock_is_overrun(err) &&
+            session->state < FTM_SESSION_COMPLETE) {
+            session->nlstate.overruns++;
+            if (resync_session(session)) {
+                finish_session(session, 1);
+                return;
+            }
+            continue;
+        }
+        if (err < 0 && session->state < FTM_SESSION_COMPLETE) {
+            ftm_report_error(ctx->error, "Fail to receive: %s",
+                             nl_geterror(err));
+            session->state = FTM_SESSION_FAILED;
+        }
+        if (session->state == FTM_SESSION_QUERIED) {
+            if (begin_attempt(session)) {
+                finish_session(session, 1);
+                return;
+            }
+            continue;
+        }
+        if (session->state == FTM_SESSION_FAILED) {
+            /* failing because the interface went down pauses instead */
+            if (ctx->events &&
+                !ftm_link_is_up(session->config->interface_index))
+                restart_session(session);
+            else
+                finish_session(session, 1);
+            return;
+        }
+        if (session->state != FTM_SESSION_COMPLETE)
+            continue;
+
+        /* the attempt goes on with the next channel */
+        if (session->group_idx + 1 < session->groups.count) {
+            session->group_idx++;
+            if (start_group(session)) {
+                finish_session(session, 1);
+                return;
+            }
+            continue;
+        }
+
+        session->results->rx_queued = nl_sock_rx_queued(&session->nlstate);
+        session->results->overruns = session->overruns;
+        session->results->timeouts = session->timeouts;
+        set_rx_work(session->results, &session->rx_start,
+                    &session->nlstate.rx_stats);
+        if (session->handler)
+            session->handler(session->results, session->attempts,
+                             session->attempt_idx, session->arg);
+        else
+            print_ftm_results(session->results, session->attempts,
+                              session->attempt_idx, NULL);
+        /* the handler may have cancelled the session */
+        if (session->state == FTM_SESSION_DEAD)
+            return;
+
+        session->attempt_idx++;
+        if (session->attempts != FTM_ATTEMPTS_INF &&
+            session->attempt_idx >= session->attempts) {
+            finish_session(session, 0);
+            return;
+        }
+        if (start_session(session)) {
+            finish_session(session, 1);
+            return;
+        }
+    }
+}
+
+int ftm_process(struct ftm_ctx *ctx) {
+    struct epoll_event events[FTM_PROCESS_BATCH];
+    int total = 0, count;
+    if (get_epoll_fd(ctx) < 0)
+        return -1;
+
+    ctx->processing = true;
+    do {
+        count = epoll_wait(ctx->epoll_fd, events, FTM_PROCESS_BATCH, 0);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            ftm_report_error(ctx->error, "Fail to wait for events: %s",
+                             strerror(errno));
+            total = -1;
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == ctx->events)
+                process_radio(ctx);
+            else if (events[i].data.ptr == &ctx->watchdog_fd)
+                process_watchdog(ctx);
+            else
+                process_session(events[i].data.ptr);
+        }
+        total += count;
+    } while (count == FTM_PROCESS_BATCH);
+    ctx->processing = false;
+
+    reap_sessions(ctx);
+    return total;
+}
+
+int ftm_ctx_set_event_watch(struct ftm_ctx *ctx, bool enable) {
+    if (enable == (ctx->events != NULL))
+        return 0;
+    if (enable) {
+        ctx->events = alloc_ftm_event_watch(ctx->error);
+        if (!ctx->events)
+            return 1;
+        if (ctx->epoll_fd >= 0 && watch_events(ctx)) {
+            free_ftm_event_watch(ctx->events);
+            ctx->events = NULL;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (ctx->epoll_fd >= 0)
+        epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, ctx->events->fd, NULL);
+    free_ftm_event_watch(ctx->events);
+    ctx->events = NULL;
+    /* nothing would resume the paused sessions */
+    for (struct ftm_session *session = ctx->sessions; session;
+         session = session->next) {
+        session->interrupted = false;
+        if (session->state == FTM_SESSION_PAUSED && start_session(session))
+            finish_session(session, 1);
+    }
+    if (!ctx->processing)
+        reap_sessions(ctx);
+    return 0;
+}
+
+int ftm(struct ftm_config *config, ftm_result_handler handler,
+        int attempts, void *arg) {
+    struct ftm_ctx *ctx = ftm_ctx_new(NULL);
+    if (!ctx)
+        return 1;
+
+    int err = ftm_ctx_run(ctx, config, handler, attempts, arg);
+    if (err)
+        fprintf(stderr, "%s\n", ctx->error);
+    ftm_ctx_free(ctx);
+    return err;
+}
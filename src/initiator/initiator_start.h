@@ -3,6 +3,7 @@
 
 #include "../nl/nl.h"
 #include "initiator_types.h"
+#include "initiator_trace.h"
 
 /**
  * DOC: Start a fine timing measurement
@@ -40,11 +41,176 @@ typedef void (*ftm_result_handler)(struct ftm_results_wrap *results,
  *                  to continuously measure until exit with ctrl+C.
  * @param arg       Any pointer you want to pass to the handler
  * 
+ * @note
+ * A shorthand for ftm_ctx_run() on a temporary context. Errors are printed
+ * on stderr.
+ * 
  * @return 0 on success, 1 on failure
  */
 int ftm(struct ftm_config *config, ftm_result_handler handler,
         int attempts, void *arg);
 
+/**
+ * DOC: Measurement context
+ * 
+ * An ftm_ctx owns a netlink socket, the buffers of the results and the
+ * latency instrumentation, and records the message of the last error
+ * instead of printing it. Nothing is shared between contexts, so threads
+ * may measure concurrently as long as each uses its own context. A single
+ * context must not be used by two threads at the same time.
+ */
+struct ftm_ctx;
+
+/**
+ * ftm_ctx_new - Create a context and open its socket
+ * 
+ * @param error   buffer of FTM_ERROR_MAX bytes receiving the reason of a
+ *                failure, or NULL to print it on stderr
+ * 
+ * @return a valid ftm_ctx pointer on success, NULL on failure
+ */
+struct ftm_ctx *ftm_ctx_new(char *error);
+
+/**
+ * ftm_ctx_free - Close the socket and free the context
+ * 
+ * @note
+ * Submitted sessions are cancelled.
+ */
+void ftm_ctx_free(struct ftm_ctx *ctx);
+
+/**
+ * ftm_ctx_error - Message of the last error, empty if none
+ */
+const char *ftm_ctx_error(struct ftm_ctx *ctx);
+
+/**
+ * ftm_ctx_trace - Latency instrumentation of the context
+ * 
+ * @note
+ * Disabled by default, see ftm_trace_enable().
+ */
+struct ftm_trace *ftm_ctx_trace(struct ftm_ctx *ctx);
+
+/**
+ * ftm_ctx_parse_config - Parse ftm config file
+ * 
+ * @see parse_config_file
+ * 
+ * @return a valid ftm_config pointer on success, NULL on failure with the
+ * reason in ftm_ctx_error()
+ */
+struct ftm_config *ftm_ctx_parse_config(struct ftm_ctx *ctx,
+                                        const char *file_name,
+                                        const char *if_name);
+
+/**
+ * ftm_ctx_run - Start FTM on the socket of a context
+ * 
+ * @param ctx       context created by ftm_ctx_new()
+ * 
+ * @see ftm for the other parameters
+ * 
+ * @return 0 on success, 1 on failure with the reason in ftm_ctx_error()
+ */
+int ftm_ctx_run(struct ftm_ctx *ctx, struct ftm_config *config,
+                ftm_result_handler handler, int attempts, void *arg);
+
+/**
+ * ftm_ctx_stop - Make ftm_ctx_run() return 0 after the session in progress
+ * 
+ * @note
+ * Only sets a flag, so it may be called from a signal handler, like the
+ * one stopping an endless measurement on ctrl+C. The context stays stopped.
+ */
+void ftm_ctx_stop(struct ftm_ctx *ctx);
+
+/**
+ * ftm_ctx_stopped - Whether ftm_ctx_stop() was called
+ */
+bool ftm_ctx_stopped(struct ftm_ctx *ctx);
+
+/**
+ * DOC: Asynchronous API
+ * 
+ * ftm_submit() starts a measurement and returns at once. Each submitted
+ * session has its own socket, registered in an epoll instance of the
+ * context: poll the fd returned by ftm_get_fd() in your event loop, and
+ * call ftm_process() when it is readable. The handlers of the sessions run
+ * inside ftm_process().
+ * 
+ * Submitted sessions may run concurrently on one context, but are not
+ * traced. As with the rest of the context, all calls must come from one
+ * thread at a time.
+ */
+struct ftm_session;
+
+/**
+ * typedef ftm_done_handler - Function type called when a session ends
+ * 
+ * @session: the session, freed after the call
+ * @err: 0 if all attempts finished, 1 on failure with the reason in
+ * ftm_ctx_error()
+ * @arg: pointer passed to ftm_submit()
+ * 
+ * @note
+ * Not called for sessions stopped by ftm_cancel().
+ */
+typedef void (*ftm_done_handler)(struct ftm_session *session, int err,
+                                 void *arg);
+
+/* sessions handled per epoll_wait() in ftm_process() */
+#define FTM_PROCESS_BATCH 16
+
+/**
+ * ftm_submit - Start FTM without waiting for the results
+ * 
+ * @param ctx        context created by ftm_ctx_new()
+ * @param config     The config used to start FTM, must stay valid until
+ *                   the session ends
+ * @param handler    Called with the results of each attempt, can be NULL
+ * @param done       Called when the session ends, can be NULL
+ * @param attempts   How many times to measure distance, or FTM_ATTEMPTS_INF
+ * @param arg        Any pointer you want to pass to the handlers
+ * 
+ * @note
+ * Peers on several channels are grouped once the operating channel of the
+ * interface is known: the query is sent on the socket of the session and
+ * its reply handled by ftm_process(), like the results.
+ * 
+ * @return session handle on success, NULL on failure with the reason in
+ * ftm_ctx_error()
+ */
+struct ftm_session *ftm_submit(struct ftm_ctx *ctx, struct ftm_config *config,
+                               ftm_result_handler handler,
+                               ftm_done_handler done, int attempts,
+                               void *arg);
+
+/**
+ * ftm_get_fd - File descriptor to poll for readability
+ * 
+ * @return the fd on success, -1 on failure
+ */
+int ftm_get_fd(struct ftm_ctx *ctx);
+
+/**
+ * ftm_process - Handle the events of the submitted sessions, without
+ * blocking
+ * 
+ * @return number of sessions with events, -1 on failure
+ */
+int ftm_process(struct ftm_ctx *ctx);
+
+/**
+ * ftm_cancel - Stop a submitted session
+ * 
+ * @note
+ * The kernel aborts the measurement when the socket of the session is
+ * closed. The handle is invalid after the call. Can be called from the
+ * handlers.
+ */
+void ftm_cancel(struct ftm_ctx *ctx, struct ftm_session *session);
+
 /**
  * DOC: Lower-level APIs
  * 
@@ -54,6 +220,127 @@ int ftm(struct ftm_config *config, ftm_result_handler handler,
  * provided in the following section.
  */
 
+/**
+ * ftm_ctx_session - Run a single measurement
+ * 
+ * @param ctx      context created by ftm_ctx_new()
+ * @param config   The config used to start FTM
+ * 
+ * @note
+ * This is what ftm_ctx_run() does for each attempt. The results belong to
+ * the context and are overwritten by the next session.
+ * 
+ * @return results on success, NULL on failure with the reason in
+ * ftm_ctx_error()
+ */
+struct ftm_results_wrap *ftm_ctx_session(struct ftm_ctx *ctx,
+                                         struct ftm_config *config);
+
+/**
+ * ftm_ctx_nlstate - Socket of the context, to send your own messages
+ */
+struct nl80211_state *ftm_ctx_nlstate(struct ftm_ctx *ctx);
+
+/**
+ * ftm_ctx_rebuilt_peers - Number of peer attributes built for requests so
+ * far
+ * 
+ * @note
+ * The attributes of each peer are kept between sessions and only built
+ * again when the peer is added or its config changes.
+ */
+uint64_t ftm_ctx_rebuilt_peers(struct ftm_ctx *ctx);
+
+/**
+ * ftm_ctx_overruns - Number of attempts started again after a receive
+ * buffer overrun
+ * 
+ * @note
+ * The receive buffer of each socket is sized for the results of a whole
+ * attempt. If it still overflows (ENOBUFS), results were dropped by the
+ * kernel: the socket is replaced by one with a larger buffer and the
+ * attempt starts again, up to a few times before the session fails, so
+ * that results are never lost silently.
+ */
+uint64_t ftm_ctx_overruns(struct ftm_ctx *ctx);
+
+/**
+ * ftm_ctx_timeouts - Number of requests issued again after their COMPLETE
+ * did not come
+ * 
+ * @note
+ * Each request gets a deadline from the bursts it asks for: twice the
+ * time of the bursts of its peers (2^num_bursts_exp times the burst period,
+ * or the burst duration if longer), plus a second. Drivers sometimes drop
+ * a request without a COMPLETE; once the deadline passes, the request is
+ * aborted by closing its socket and issued again, up to a few times before
+ * the session fails. Submitted sessions are watched by a timer on the
+ * descriptor of ftm_get_fd(), so the other sessions are not held up.
+ */
+uint64_t ftm_ctx_timeouts(struct ftm_ctx *ctx);
+
+/**
+ * ftm_ctx_set_event_watch - Pause the measurements while their interface
+ * is down
+ * 
+ * @param enable   false by default
+ * 
+ * @note
+ * Once enabled, the context listens to the radio events of nl80211 and rtnetlink, see
+ * initiator_events.h. When the interface of a measurement goes down or is
+ * deleted, the attempt in flight is aborted and the measurement waits
+ * until the interface is up again, possibly under a new index: ftm_ctx_run()
+ * and ftm_ctx_session() block meanwhile, submitted sessions are held until
+ * ftm_process() sees the interface come back. When the interface switches
+ * channel, roams or changes its type, the attempt starts again with the
+ * channel groups built anew. A request failing because the interface went
+ * down pauses in the same way instead of failing the run.
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int ftm_ctx_set_event_watch(struct ftm_ctx *ctx, bool enable);
+
+/**
+ * ftm_ctx_interruptions - Number of attempts started again after a radio
+ * event, see ftm_ctx_set_event_watch()
+ */
+uint64_t ftm_ctx_interruptions(struct ftm_ctx *ctx);
+
+/**
+ * ftm_ctx_set_channel_groups - Measure the peers of each channel in their
+ * own request
+ * 
+ * @param enable   true by default
+ * 
+ * @note
+ * When the peers of a config are on different channels, each attempt sends
+ * one request per channel and waits for it to complete before the next, so
+ * the driver does not hop back and forth between channels within a
+ * request. The peers on the channel the interface operates on go first,
+ * the other channels follow in order of frequency. The results are still
+ * delivered once per attempt, in config order.
+ */
+void ftm_ctx_set_channel_groups(struct ftm_ctx *ctx, bool enable);
+
+/**
+ * ftm_parse_result - Parse a NL80211_CMD_PEER_MEASUREMENT_RESULT message
+ * the way the results of a measurement are parsed
+ * 
+ * @param results      receives the results of the peers in @msg, found by
+ *                     mac address, see reset_ftm_results_wrap()
+ * @param msg          the message
+ * @param rx_time_ns   receive time given to the results
+ * @param error        where errors are reported, see ftm_report_error()
+ * 
+ * @note
+ * For messages that did not come from the kernel, like the ones of
+ * simulate.h.
+ * 
+ * @return NL_OK if parsed, NL_SKIP if malformed or of another command
+ */
+int ftm_parse_result(struct ftm_results_wrap *results, struct nl_msg *msg,
+                     uint64_t rx_time_ns, char *error);
+
 /**
  * FTM_PUT - Set attribute from ftm_peer_attr
  * 
@@ -70,7 +357,7 @@ int ftm(struct ftm_config *config, ftm_result_handler handler,
  * Be sure that msg is in the correct hierarchy of nested attributes.
  */
 #define FTM_PUT(msg, attr, prefix, attr_idx, attr_name, type)   \
-    if (attr->flags[FTM_PEER_FLAG_##attr_name]) {               \
+    if (FTM_PEER_HAS(attr, attr_name)) {                        \
         NLA_PUT_##type(msg, prefix##attr_idx, attr->attr_name); \
     }
 
@@ -100,7 +387,7 @@ int ftm(struct ftm_config *config, ftm_result_handler handler,
  * Flag attributes are defined in nl80211.h.
  */
 #define FTM_PUT_FLAG(msg, attr, prefix, attr_idx, attr_name)         \
-    if (attr->flags[FTM_PEER_FLAG_##attr_name] && attr->attr_name) { \
+    if (FTM_PEER_HAS(attr, attr_name) && attr->attr_name) {          \
         NLA_PUT_FLAG(msg, prefix##attr_idx);                         \
     }
 
@@ -121,7 +408,7 @@ int ftm(struct ftm_config *config, ftm_result_handler handler,
  * Internal use only.
  */
 #define FTM_RESP_SET_FLAG(attr, attr_name) \
-    attr->flags[FTM_RESP_FLAG_##attr_name] = 1
+    attr->present |= 1u << FTM_RESP_FLAG_##attr_name
 
 /**
  * FTM_GET - Get attributes from given nlattr pointer and store in 
@@ -169,7 +456,7 @@ int ftm(struct ftm_config *config, ftm_result_handler handler,
 #define FTM_PRINT(resp, attr_name, specifier)             \
     do {                                                  \
         printf("%-19s", #attr_name);                      \
-        if (resp->flags[FTM_RESP_FLAG_##attr_name]) {     \
+        if (FTM_RESP_HAS(resp, attr_name)) {              \
             printf("%" #specifier "\n", resp->attr_name); \
         } else {                                          \
             printf("non-exist\n");                        \
@@ -182,7 +469,7 @@ int ftm(struct ftm_config *config, ftm_result_handler handler,
  * @param resp   ftm_resp_attr pointer
  */
 #define FTM_PRINT_ADDR(resp)                                       \
-    if (resp->flags[FTM_RESP_FLAG_mac_addr]) {                     \
+    if (FTM_RESP_HAS(resp, mac_addr)) {                            \
         uint8_t *addr = resp->mac_addr;                            \
         printf("%-19s%02hhx:%02hhx:%02hhx:%02hhx:%02hhx:%02hhx\n", \
                "mac_addr", addr[0], addr[1], addr[2], addr[3],     \
@@ -0,0 +1,170 @@
+#include "initiator_trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *stage_names[FTM_TRACE_STAGE_MAX] = {
+#define __STAGE_NAME(name) [FTM_TRACE_STAGE_##name] = #name
+    __STAGE_NAME(build),
+    __STAGE_NAME(send),
+    __STAGE_NAME(ack),
+    __STAGE_NAME(first_result),
+    __STAGE_NAME(complete),
+    __STAGE_NAME(parse),
+    __STAGE_NAME(handler),
+    __STAGE_NAME(session),
+};
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int ftm_trace_enable(struct ftm_trace *trace, struct ftm_config *config) {
+    ftm_trace_disable(trace);
+    trace->peers = malloc(config->peer_count * sizeof(struct hist));
+    trace->peer_addrs = malloc(config->peer_count * 6);
+    if (!trace->peers || !trace->peer_addrs) {
+        fprintf(stderr, "Fail to allocate trace histograms!\n");
+        ftm_trace_disable(trace);
+        return 1;
+    }
+    trace->peer_count = config->peer_count;
+    for (int i = 0; i < config->peer_count; i++) {
+        hist_init(&trace->peers[i]);
+        memcpy(trace->peer_addrs[i], config->peers[i]->mac_addr, 6);
+    }
+    for (int i = 0; i < FTM_TRACE_STAGE_MAX; i++)
+        hist_init(&trace->stages[i]);
+    memset(trace->points, 0, sizeof(trace->points));
+    trace->parse_ns = 0;
+    trace->enabled = true;
+    return 0;
+}
+
+int ftm_trace_remap_peers(struct ftm_trace *trace, struct ftm_config *config,
+                          const int *map) {
+    if (!trace->enabled)
+        return 0;
+    struct hist *peers = malloc(config->peer_count * sizeof(struct hist));
+    uint8_t (*peer_addrs)[6] = malloc(config->peer_count * 6);
+    if (!peers || !peer_addrs) {
+        fprintf(stderr, "Fail to allocate trace histograms!\n");
+        free(peers);
+        free(peer_addrs);
+        return 1;
+    }
+    for (int i = 0; i < config->peer_count; i++) {
+        if (map[i] >= 0 && map[i] < trace->peer_count)
+            peers[i] = trace->peers[map[i]];
+        else
+            hist_init(&peers[i]);
+        memcpy(peer_addrs[i], config->peers[i]->mac_addr, 6);
+    }
+    free(trace->peers);
+    free(trace->peer_addrs);
+    trace->peers = peers;
+    trace->peer_addrs = peer_addrs;
+    trace->peer_count = config->peer_count;
+    return 0;
+}
+
+void ftm_trace_disable(struct ftm_trace *trace) {
+    trace->enabled = false;
+    free(trace->peers);
+    free(trace->peer_addrs);
+    trace->peers = NULL;
+    trace->peer_addrs = NULL;
+    trace->peer_count = 0;
+}
+
+const char *ftm_trace_stage_name(enum ftm_trace_stage stage) {
+    return stage_names[stage];
+}
+
+const struct hist *ftm_trace_peer_hist(struct ftm_trace *trace, int idx) {
+    if (idx < 0 || idx >= trace->peer_count)
+        return NULL;
+    return &trace->peers[idx];
+}
+
+void ftm_trace_request_dump(struct ftm_trace *trace) {
+    trace->dump_requested = 1;
+}
+
+void ftm_trace_mark(struct ftm_trace *trace, enum ftm_trace_point point) {
+    if (!trace->points[point])
+        trace->points[point] = now_ns();
+}
+
+void ftm_trace_parse_begin(struct ftm_trace *trace) {
+    trace->parse_start = now_ns();
+    ftm_trace_mark(trace, FTM_TRACE_POINT_FIRST_RESULT);
+}
+
+void ftm_trace_parse_end(struct ftm_trace *trace) {
+    trace->parse_ns += now_ns() - trace->parse_start;
+}
+
+void ftm_trace_peer(struct ftm_trace *trace, int idx) {
+    uint64_t sent = trace->points[FTM_TRACE_POINT_SENT];
+    if (idx < 0 || idx >= trace->peer_count || !sent)
+        return;
+    hist_record(&trace->peers[idx], trace->parse_start - sent);
+}
+
+static void record_interval(struct ftm_trace *trace,
+                            enum ftm_trace_stage stage,
+                            enum ftm_trace_point from,
+                            enum ftm_trace_point to) {
+    uint64_t start = trace->points[from], end = trace->points[to];
+    if (start && end && end >= start)
+        hist_record(&trace->stages[stage], end - start);
+}
+
+void ftm_trace_session_end(struct ftm_trace *trace) {
+    ftm_trace_mark(trace, FTM_TRACE_POINT_HANDLED);
+
+#define __RECORD(stage, from, to) \
+    record_interval(trace, FTM_TRACE_STAGE_##stage, FTM_TRACE_POINT_##from, \
+                    FTM_TRACE_POINT_##to)
+
+    __RECORD(build, BUILD, BUILT);
+    __RECORD(send, BUILT, SENT);
+    __RECORD(ack, SENT, ACKED);
+    __RECORD(first_result, ACKED, FIRST_RESULT);
+    __RECORD(complete, FIRST_RESULT, COMPLETE);
+    __RECORD(handler, COMPLETE, HANDLED);
+    __RECORD(session, BUILD, HANDLED);
+    if (trace->points[FTM_TRACE_POINT_FIRST_RESULT])
+        hist_record(&trace->stages[FTM_TRACE_STAGE_parse],
+                    trace->parse_ns);
+
+    memset(trace->points, 0, sizeof(trace->points));
+    trace->parse_ns = 0;
+
+    if (trace->dump_requested) {
+        trace->dump_requested = 0;
+        ftm_trace_dump(trace, stderr);
+    }
+}
+
+void ftm_trace_dump(struct ftm_trace *trace, FILE *file) {
+    fprintf(file, "\n----LATENCY (ns)----\n");
+    hist_print_header(file, "stage");
+    for (int i = 0; i < FTM_TRACE_STAGE_MAX; i++)
+        hist_print(file, stage_names[i], &trace->stages[i]);
+
+    fprintf(file, "\n");
+    hist_print_header(file, "peer");
+    for (int i = 0; i < trace->peer_count; i++) {
+        uint8_t *addr = trace->peer_addrs[i];
+        char name[18];
+        snprintf(name, sizeof(name), "%02x:%02x:%02x:%02x:%02x:%02x",
+                 addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
+        hist_print(file, name, &trace->peers[i]);
+    }
+    fprintf(file, "--------------------\n");
+    fflush(file);
+}
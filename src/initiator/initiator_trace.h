@@ -0,0 +1,216 @@
+#ifndef _FTM_INITIATOR_TRACE_H
+#define _FTM_INITIATOR_TRACE_H
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "../hist/hist.h"
+#include "initiator_types.h"
+
+/**
+ * DOC: Hot-path latency instrumentation
+ * 
+ * When enabled with ftm_trace_enable(), every session is timestamped at
+ * the points listed in @enum ftm_trace_point. When the result handler
+ * returns, the intervals between consecutive points are recorded into one
+ * histogram per stage (@enum ftm_trace_stage), and the time from sending
+ * the request to receiving each peer's result into one histogram per peer.
+ * 
+ * Each ftm_ctx owns its own instance, see ftm_ctx_trace(). All hooks are
+ * wrapped in macros testing the flag of that instance, so the cost while
+ * disabled is one predictable branch per hook.
+ */
+
+/**
+ * enum ftm_trace_point - Timestamps taken in a session
+ * 
+ * @FTM_TRACE_POINT_BUILD: start building PEER_MEASUREMENT_START
+ * @FTM_TRACE_POINT_BUILT: message built
+ * @FTM_TRACE_POINT_SENT: nl_send_auto() returned
+ * @FTM_TRACE_POINT_ACKED: kernel ACK received
+ * @FTM_TRACE_POINT_FIRST_RESULT: first PEER_MEASUREMENT_RESULT received
+ * @FTM_TRACE_POINT_COMPLETE: PEER_MEASUREMENT_COMPLETE received
+ * @FTM_TRACE_POINT_HANDLED: result handler returned
+ */
+enum ftm_trace_point {
+    FTM_TRACE_POINT_BUILD,
+    FTM_TRACE_POINT_BUILT,
+    FTM_TRACE_POINT_SENT,
+    FTM_TRACE_POINT_ACKED,
+    FTM_TRACE_POINT_FIRST_RESULT,
+    FTM_TRACE_POINT_COMPLETE,
+    FTM_TRACE_POINT_HANDLED,
+
+    /* keep last */
+    FTM_TRACE_POINT_MAX
+};
+
+/**
+ * enum ftm_trace_stage - Histograms kept for each session
+ * 
+ * @FTM_TRACE_STAGE_build: BUILD -> BUILT
+ * @FTM_TRACE_STAGE_send: BUILT -> SENT
+ * @FTM_TRACE_STAGE_ack: SENT -> ACKED
+ * @FTM_TRACE_STAGE_first_result: ACKED -> FIRST_RESULT
+ * @FTM_TRACE_STAGE_complete: FIRST_RESULT -> COMPLETE
+ * @FTM_TRACE_STAGE_parse: total time spent parsing results
+ * @FTM_TRACE_STAGE_handler: COMPLETE -> HANDLED
+ * @FTM_TRACE_STAGE_session: BUILD -> HANDLED
+ */
+enum ftm_trace_stage {
+    FTM_TRACE_STAGE_build,
+    FTM_TRACE_STAGE_send,
+    FTM_TRACE_STAGE_ack,
+    FTM_TRACE_STAGE_first_result,
+    FTM_TRACE_STAGE_complete,
+    FTM_TRACE_STAGE_parse,
+    FTM_TRACE_STAGE_handler,
+    FTM_TRACE_STAGE_session,
+
+    /* keep last */
+    FTM_TRACE_STAGE_MAX
+};
+
+/**
+ * struct ftm_trace - Instrumentation state
+ * 
+ * @enabled: whether the hooks record anything
+ * @dump_requested: set from a signal handler, see ftm_trace_request_dump()
+ * @points: timestamps of the current session, 0 if not reached
+ * @parse_start: start of the result being parsed
+ * @parse_ns: time spent parsing in the current session
+ * @stages: one histogram per @enum ftm_trace_stage
+ * @peer_count: number of peers
+ * @peer_addrs: mac addresses of the peers, for the dump
+ * @peers: one histogram per peer, SENT -> result of the peer
+ */
+struct ftm_trace {
+    bool enabled;
+    volatile sig_atomic_t dump_requested;
+    uint64_t points[FTM_TRACE_POINT_MAX];
+    uint64_t parse_start;
+    uint64_t parse_ns;
+    struct hist stages[FTM_TRACE_STAGE_MAX];
+    int peer_count;
+    uint8_t (*peer_addrs)[6];
+    struct hist *peers;
+};
+
+#define FTM_TRACE_ENABLED(trace) __builtin_expect((trace)->enabled, 0)
+
+/**
+ * FTM_TRACE_MARK - Timestamp a point of the current session
+ * 
+ * @param trace   ftm_trace pointer
+ * @param point   suffix of @enum ftm_trace_point, like SENT
+ * 
+ * @note
+ * Only the first mark of a point in a session is kept.
+ */
+#define FTM_TRACE_MARK(trace, point)                        \
+    do {                                                    \
+        if (FTM_TRACE_ENABLED(trace))                       \
+            ftm_trace_mark(trace, FTM_TRACE_POINT_##point); \
+    } while (0)
+
+/**
+ * FTM_TRACE_PARSE_BEGIN - Mark the start of parsing a result message
+ */
+#define FTM_TRACE_PARSE_BEGIN(trace)                \
+    do {                                            \
+        if (FTM_TRACE_ENABLED(trace))               \
+            ftm_trace_parse_begin(trace);           \
+    } while (0)
+
+/**
+ * FTM_TRACE_PARSE_END - Mark the end of parsing a result message
+ */
+#define FTM_TRACE_PARSE_END(trace)                  \
+    do {                                            \
+        if (FTM_TRACE_ENABLED(trace))               \
+            ftm_trace_parse_end(trace);             \
+    } while (0)
+
+/**
+ * FTM_TRACE_PEER - Record the arrival of the result of a peer
+ * 
+ * @param trace   ftm_trace pointer
+ * @param idx     index of the peer in the config
+ */
+#define FTM_TRACE_PEER(trace, idx)                  \
+    do {                                            \
+        if (FTM_TRACE_ENABLED(trace))               \
+            ftm_trace_peer(trace, idx);             \
+    } while (0)
+
+/**
+ * FTM_TRACE_SESSION_END - Fold the current session into the histograms
+ */
+#define FTM_TRACE_SESSION_END(trace)                \
+    do {                                            \
+        if (FTM_TRACE_ENABLED(trace))               \
+            ftm_trace_session_end(trace);           \
+    } while (0)
+
+/**
+ * ftm_trace_enable - Allocate histograms and start recording
+ * 
+ * @param trace    instance, zero-initialized before the first call
+ * @param config   config of the measurement, used for per-peer histograms
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int ftm_trace_enable(struct ftm_trace *trace, struct ftm_config *config);
+
+/**
+ * ftm_trace_remap_peers - Follow the peers of a new config
+ * 
+ * @param config   the new config
+ * @param map      see ftm_config_peer_map()
+ * 
+ * @note
+ * Histograms of the peers kept by @config are kept, the others start
+ * empty. Does nothing if the trace is disabled.
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int ftm_trace_remap_peers(struct ftm_trace *trace, struct ftm_config *config,
+                          const int *map);
+
+/**
+ * ftm_trace_disable - Stop recording and free the histograms
+ */
+void ftm_trace_disable(struct ftm_trace *trace);
+
+/**
+ * ftm_trace_request_dump - Ask for a dump at the end of the current session
+ * 
+ * @note
+ * Async-signal-safe, meant to be called from a SIGUSR1 handler.
+ */
+void ftm_trace_request_dump(struct ftm_trace *trace);
+
+/**
+ * ftm_trace_dump - Print all histograms
+ * 
+ * @param file   output stream
+ */
+void ftm_trace_dump(struct ftm_trace *trace, FILE *file);
+
+/**
+ * ftm_trace_stage_name - Name of a stage, like "ack"
+ */
+const char *ftm_trace_stage_name(enum ftm_trace_stage stage);
+
+/**
+ * ftm_trace_peer_hist - Histogram of a peer, NULL if out of range
+ */
+const struct hist *ftm_trace_peer_hist(struct ftm_trace *trace, int idx);
+
+void ftm_trace_mark(struct ftm_trace *trace, enum ftm_trace_point point);
+void ftm_trace_parse_begin(struct ftm_trace *trace);
+void ftm_trace_parse_end(struct ftm_trace *trace);
+void ftm_trace_peer(struct ftm_trace *trace, int idx);
+void ftm_trace_session_end(struct ftm_trace *trace);
+#endif /* _FTM_INITIATOR_TRACE_H */
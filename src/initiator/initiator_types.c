@@ -25,48 +25,94 @@ void free_ftm_config(struct ftm_config *config) {
             free(config->peers[i]);
         }
     }
+    free(config->peers);
     free(config);
     config = NULL;
 }
 
 struct ftm_peer_attr *alloc_ftm_peer() {
     struct ftm_peer_attr *peer = malloc(sizeof(struct ftm_peer_attr));
-    memset(peer->flags, 0, sizeof(peer->flags));
+    if (peer)
+        peer->present = 0;
     return peer;
 }
 
 struct ftm_results_wrap *alloc_ftm_results_wrap(struct ftm_config *config) {
     struct ftm_results_wrap *results_wrap =
         malloc(sizeof(struct ftm_results_wrap));
+    if (!results_wrap)
+        return NULL;
     results_wrap->results =
         malloc(config->peer_count * sizeof(struct ftm_resp_attr *));
+    results_wrap->count = 0;
+    memset(&results_wrap->index, 0, sizeof(struct mac_map));
+    if (!results_wrap->results) {
+        free(results_wrap);
+        return NULL;
+    }
     for (int i = 0; i < config->peer_count; i++) {
         results_wrap->results[i] = alloc_ftm_resp_attr();
+        results_wrap->count++;
+        if (!results_wrap->results[i])
+            goto handle_free;
+    }
+    if (mac_map_init(&results_wrap->index, config->peer_count) ||
+        reset_ftm_results_wrap(results_wrap, config))
+        goto handle_free;
+    return results_wrap;
+handle_free:
+    free_ftm_results_wrap(results_wrap);
+    return NULL;
+};
+
+int reset_ftm_results_wrap(struct ftm_results_wrap *results_wrap,
+                           struct ftm_config *config) {
+    if (results_wrap->count != config->peer_count)
+        return 1;
+    /* the index is built again only when the peers have moved */
+    struct mac_map *index = &results_wrap->index;
+    bool moved = index->count != config->peer_count;
+    for (int i = 0; i < config->peer_count; i++) {
+        struct ftm_resp_attr *resp = results_wrap->results[i];
+        struct ftm_peer_attr *peer = config->peers[i];
+        resp->present = 0;
         /* set mac_addr to the result */
-        if (config->peers[i]->flags[FTM_PEER_FLAG_mac_addr]) {
-            results_wrap->results[i]->flags[FTM_RESP_FLAG_mac_addr] = 1;
-            memcpy(results_wrap->results[i]->mac_addr,
-                   config->peers[i]->mac_addr, 6);
+        if (FTM_PEER_HAS(peer, mac_addr)) {
+            moved = moved || memcmp(resp->mac_addr, peer->mac_addr, 6);
+            resp->present |= 1u << FTM_RESP_FLAG_mac_addr;
+            memcpy(resp->mac_addr, peer->mac_addr, 6);
         } else {
             fprintf(stderr,
                     "No mac address info for target #%d in config!\n", i);
-            return NULL;
+            return 1;
         }
         /* set rtt_correct to the result, identified by mac_addr */
-        if (config->peers[i]->flags[FTM_PEER_FLAG_rtt_correct]) {
-            results_wrap->results[i]->flags[FTM_RESP_FLAG_rtt_correct] = 1;
-            results_wrap->results[i]->rtt_correct =
-                config->peers[i]->rtt_correct;
+        if (FTM_PEER_HAS(peer, rtt_correct)) {
+            resp->present |= 1u << FTM_RESP_FLAG_rtt_correct;
+            resp->rtt_correct = peer->rtt_correct;
         }
-        if (config->peers[i]->flags[FTM_PEER_FLAG_dist_truth]) {
-            results_wrap->results[i]->flags[FTM_RESP_FLAG_dist_truth] = 1;
-            results_wrap->results[i]->dist_truth =
-                config->peers[i]->dist_truth;
+        if (FTM_PEER_HAS(peer, dist_truth)) {
+            resp->present |= 1u << FTM_RESP_FLAG_dist_truth;
+            resp->dist_truth = peer->dist_truth;
         }
     }
-    results_wrap->count = config->peer_count;
-    return results_wrap;
-};
+    if (moved) {
+        mac_map_clear(index);
+        for (int i = 0; i < config->peer_count; i++) {
+            const uint8_t *mac_addr = results_wrap->results[i]->mac_addr;
+            /* the first of peers sharing an address gets the results */
+            if (mac_map_get(index, mac_addr) < 0 &&
+                mac_map_put(index, mac_addr, i))
+                return 1;
+        }
+    }
+    results_wrap->rx_queued = 0;
+    results_wrap->overruns = 0;
+    results_wrap->timeouts = 0;
+    results_wrap->rx_syscalls = 0;
+    results_wrap->rx_copied = 0;
+    return 0;
+}
 
 void free_ftm_results_wrap(struct ftm_results_wrap * result_wrap) {
     for (int i = 0; i < result_wrap->count; i++) {
@@ -74,12 +120,84 @@ void free_ftm_results_wrap(struct ftm_results_wrap * result_wrap) {
             free(result_wrap->results[i]);
     }
     free(result_wrap->results);
+    mac_map_free(&result_wrap->index);
     free(result_wrap);
     result_wrap = NULL;
 }
 
 struct ftm_resp_attr *alloc_ftm_resp_attr() {
     struct ftm_resp_attr *resp_attr = malloc(sizeof(struct ftm_resp_attr));
-    memset(resp_attr->flags, 0, sizeof(resp_attr->flags));
+    if (!resp_attr)
+        return NULL;
+    resp_attr->present = 0;
     return resp_attr;
-};
\ No newline at end of file
+};
+bool ftm_peer_attr_equal(const struct ftm_peer_attr *a,
+                         const struct ftm_peer_attr *b) {
+    if (a->present != b->present)
+        return false;
+#define __SAME(attr_name, type, spec, nest, attr, put) \
+    && (!FTM_PEER_HAS(a, attr_name) || a->attr_name == b->attr_name)
+    return (!FTM_PEER_HAS(a, mac_addr) ||
+            !memcmp(a->mac_addr, b->mac_addr, 6))
+           FTM_PEER_FIELDS(__SAME);
+}
+
+int ftm_config_find_peer(struct ftm_config *config, const uint8_t *mac_addr,
+                         int hint) {
+    if (hint >= 0 && hint < config->peer_count &&
+        !memcmp(config->peers[hint]->mac_addr, mac_addr, 6))
+        return hint;
+    for (int i = 0; i < config->peer_count; i++) {
+        if (!memcmp(config->peers[i]->mac_addr, mac_addr, 6))
+            return i;
+    }
+    return -1;
+}
+
+int *ftm_config_peer_map(struct ftm_config *old, struct ftm_config *new) {
+    int *map = malloc((new->peer_count ? new->peer_count : 1) * sizeof(int));
+    /* old peers sharing an address, chained from the first one */
+    int *next = malloc((old->peer_count ? old->peer_count : 1) * sizeof(int));
+    int *cursor = malloc((old->peer_count ? old->peer_count : 1) *
+                         sizeof(int));
+    struct mac_map first = {0};
+    if (!map || !next || !cursor ||
+        mac_map_init(&first, old->peer_count))
+        goto handle_free;
+    for (int j = 0; j < old->peer_count; j++) {
+        const uint8_t *mac_addr = old->peers[j]->mac_addr;
+        int f = mac_map_get(&first, mac_addr);
+        next[j] = -1;
+        if (f < 0) {
+            if (mac_map_put(&first, mac_addr, j))
+                goto handle_free;
+            cursor[j] = j;
+        } else {
+            /* cursor of the first one holds the last one meanwhile */
+            next[cursor[f]] = j;
+            cursor[f] = j;
+        }
+    }
+    for (int j = 0; j < old->peer_count; j++) {
+        if (mac_map_get(&first, old->peers[j]->mac_addr) == j)
+            cursor[j] = j;
+    }
+    /* hand each old peer out once, in order */
+    for (int i = 0; i < new->peer_count; i++) {
+        int f = mac_map_get(&first, new->peers[i]->mac_addr);
+        map[i] = f >= 0 ? cursor[f] : -1;
+        if (map[i] >= 0)
+            cursor[f] = next[map[i]];
+    }
+    free(next);
+    free(cursor);
+    mac_map_free(&first);
+    return map;
+handle_free:
+    free(map);
+    free(next);
+    free(cursor);
+    mac_map_free(&first);
+    return NULL;
+}
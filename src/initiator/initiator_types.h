@@ -3,6 +3,14 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "../macmap/macmap.h"
+
+/**
+ * RTT_TO_DIST - Convert a round trip time in ps into a one-way distance in m
+ */
+#define SOL 299492458
+#define RTT_TO_DIST(rtt) ((float)(rtt) * SOL / 1000000000000)
+#define DIST_TO_RTT(dist) (dist * 1000000000000 / SOL)
 
 /**
  * struct ftm_config - Config used to start FTM
@@ -21,32 +29,44 @@ struct ftm_config {
     struct ftm_peer_attr **peers;
 };
 
+/*
+ * Attributes of a peer besides mac_addr, in flag order: field name, C type,
+ * printf conversion, the nest of the request holding it, the suffix of its
+ * attribute and its NLA_PUT_*() type. The nest is CHAN for
+ * NL80211_PMSR_PEER_ATTR_CHAN, with suffixes of NL80211_ATTR_*, FTM for
+ * the FTM request, with suffixes of NL80211_PMSR_FTM_REQ_ATTR_*, and NONE
+ * for the attributes we add. FLAG attributes are put when true. The enum
+ * of flags, print_config(), ftm_peer_attr_equal() and the request
+ * attributes of a peer are generated from it.
+ */
+#define FTM_PEER_FIELDS(X)                                          \
+    X(chan_width, uint32_t, u, CHAN, CHANNEL_WIDTH, U32)            \
+    X(center_freq, uint32_t, u, CHAN, WIPHY_FREQ, U32)              \
+    X(center_freq_1, uint32_t, u, CHAN, CENTER_FREQ1, U32)          \
+    X(center_freq_2, uint32_t, u, CHAN, CENTER_FREQ2, U32)          \
+    X(asap, bool, d, FTM, ASAP, FLAG)                               \
+    X(preamble, uint32_t, u, FTM, PREAMBLE, U32)                    \
+    X(num_bursts_exp, uint8_t, u, FTM, NUM_BURSTS_EXP, U8)          \
+    X(burst_period, uint16_t, u, FTM, BURST_PERIOD, U16)            \
+    X(burst_duration, uint8_t, u, FTM, BURST_DURATION, U8)          \
+    X(ftms_per_burst, uint8_t, u, FTM, FTMS_PER_BURST, U8)          \
+    X(num_ftmr_retries, uint8_t, u, FTM, NUM_FTMR_RETRIES, U8)      \
+    X(trigger_based, bool, u, FTM, TRIGGER_BASED, FLAG)             \
+    /* extra attributes */                                          \
+    X(rtt_correct, int64_t, ld, NONE, NONE, NONE)                   \
+    X(dist_truth, float, f, NONE, NONE, NONE)
+
 /**
- * enum ftm_peer_attr_flags - Record what attributes are set
+ * enum ftm_peer_attr_flags - Bits of struct ftm_peer_attr.present
  * 
  * @note
- * Internal use only. Modification is needed if you add additional attribute
- * into @struct ftm_peer_attr. Please keep the suffix the same as the variable
- * name in struct ftm_peer_attr.
+ * Internal use only. Generated from FTM_PEER_FIELDS.
  */
 enum ftm_peer_attr_flags {
     FTM_PEER_FLAG_mac_addr,
-    FTM_PEER_FLAG_chan_width,
-    FTM_PEER_FLAG_center_freq,
-    FTM_PEER_FLAG_center_freq_1,
-    FTM_PEER_FLAG_center_freq_2,
-    FTM_PEER_FLAG_asap,
-    FTM_PEER_FLAG_preamble,
-    FTM_PEER_FLAG_num_bursts_exp,
-    FTM_PEER_FLAG_burst_period,
-    FTM_PEER_FLAG_burst_duration,
-    FTM_PEER_FLAG_ftms_per_burst,
-    FTM_PEER_FLAG_num_ftmr_retries,
-    FTM_PEER_FLAG_trigger_based,
-
-    /* extra attributes */
-    FTM_PEER_FLAG_rtt_correct,
-    FTM_PEER_FLAG_dist_truth,
+#define __PEER_FLAG_ENUM(name, type, spec, nest, attr, put) \
+    FTM_PEER_FLAG_##name,
+    FTM_PEER_FIELDS(__PEER_FLAG_ENUM)
 
     /* keep last */
     FTM_PEER_FLAG_MAX
@@ -59,70 +79,75 @@ enum ftm_peer_attr_flags {
  * @chan_width: defined by @NL80211_ATTR_CHANNEL_WIDTH
  * @center_freq: defined by @NL80211_ATTR_WIPHY_FREQ
  * other attrs: defined in @enum nl80211_peer_measurement_ftm_req
- * @flags: whether an attribute is set. Identifiers are defined 
- * in @enum ftm_peer_attr_flags.
+ * @present: bit n is set if the attribute with flag n of
+ * @enum ftm_peer_attr_flags is set, see FTM_PEER_HAS
  * @rtt_correct: compensation of rtt, not a netlink attribute, just
  * an extra attr we define
  * 
  * @note
- * Append additional attrs by adding members in
- * @struct ftm_peer_attr (attr_name) and flags in
- * @enum ftm_peer_attr_flags (FTM_PEER_FLAG_##attr_name),
- * then set via FTM_PEER_SET_ATTR(attr, attr_name, value).
+ * Members are ordered by size so that the struct has no padding. Append
+ * additional attrs by adding them to FTM_PEER_FIELDS and here, then set
+ * via FTM_PEER_SET_ATTR(attr, attr_name, value).
  */
 struct ftm_peer_attr {
-    uint8_t mac_addr[6];
+    int64_t rtt_correct;
+    uint32_t present;
     uint32_t chan_width;
     uint32_t center_freq;
     uint32_t center_freq_1;
     uint32_t center_freq_2;
-    bool asap;
     uint32_t preamble;
-    uint8_t num_bursts_exp;
+    float dist_truth;
     uint16_t burst_period;
+    uint8_t mac_addr[6];
+    uint8_t num_bursts_exp;
     uint8_t burst_duration;
     uint8_t ftms_per_burst;
     uint8_t num_ftmr_retries;
+    bool asap;
     bool trigger_based;
-
-    /* extra attributes */
-    int64_t rtt_correct;
-    float dist_truth;
-
-    /* internal use */
-    uint8_t flags[FTM_PEER_FLAG_MAX];
 };
 
+/*
+ * Attributes of a response with a netlink attribute, in flag order: field
+ * name, suffix of NL80211_PMSR_FTM_RESP_ATTR_*, C type, nla_get_*() suffix
+ * and printf conversion. The enum of flags, the parsing and the printing
+ * of results are generated from it.
+ */
+#define FTM_RESP_FIELDS(X)                                          \
+    X(fail_reason, FAIL_REASON, uint32_t, u32, u)                   \
+    X(burst_index, BURST_INDEX, uint32_t, u32, u)                   \
+    X(num_ftmr_attempts, NUM_FTMR_ATTEMPTS, uint32_t, u32, u)       \
+    X(num_ftmr_successes, NUM_FTMR_SUCCESSES, uint32_t, u32, u)     \
+    X(busy_retry_time, BUSY_RETRY_TIME, uint32_t, u32, u)           \
+    X(num_bursts_exp, NUM_BURSTS_EXP, uint8_t, u8, u)               \
+    X(burst_duration, BURST_DURATION, uint8_t, u8, u)               \
+    X(ftms_per_burst, FTMS_PER_BURST, uint8_t, u8, u)               \
+    X(rssi_avg, RSSI_AVG, int32_t, s32, d)                          \
+    X(rssi_spread, RSSI_SPREAD, int32_t, s32, d)                    \
+    X(rtt_avg, RTT_AVG, int64_t, s64, ld)                           \
+    X(rtt_variance, RTT_VARIANCE, uint64_t, u64, lu)                \
+    X(rtt_spread, RTT_SPREAD, uint64_t, u64, lu)                    \
+    X(dist_avg, DIST_AVG, int64_t, s64, ld)                         \
+    X(dist_variance, DIST_VARIANCE, uint64_t, u64, lu)              \
+    X(dist_spread, DIST_SPREAD, uint64_t, u64, lu)
+
 /**
- * enum ftm_resp_attr_flags - Record what attributes exist
+ * enum ftm_resp_attr_flags - Bits of struct ftm_resp_attr.present
  * 
  * @note
- * Internal use only. Modification is needed if you add additional attribute
- * into @struct ftm_resp_attr. Please keep the suffix the same as the variable
- * name in struct ftm_resp_attr.
+ * Internal use only. Generated from FTM_RESP_FIELDS, followed by the extra
+ * attributes.
  */
 enum ftm_resp_attr_flags {
     FTM_RESP_FLAG_mac_addr,
-    FTM_RESP_FLAG_fail_reason,
-    FTM_RESP_FLAG_burst_index,
-    FTM_RESP_FLAG_num_ftmr_attempts,
-    FTM_RESP_FLAG_num_ftmr_successes,
-    FTM_RESP_FLAG_busy_retry_time,
-    FTM_RESP_FLAG_num_bursts_exp,
-    FTM_RESP_FLAG_burst_duration,
-    FTM_RESP_FLAG_ftms_per_burst,
-    FTM_RESP_FLAG_rssi_avg,
-    FTM_RESP_FLAG_rssi_spread,
-    FTM_RESP_FLAG_rtt_avg,
-    FTM_RESP_FLAG_rtt_variance,
-    FTM_RESP_FLAG_rtt_spread,
-    FTM_RESP_FLAG_dist_avg,
-    FTM_RESP_FLAG_dist_variance,
-    FTM_RESP_FLAG_dist_spread,
+#define __RESP_FLAG_ENUM(name, attr, type, nla, spec) FTM_RESP_FLAG_##name,
+    FTM_RESP_FIELDS(__RESP_FLAG_ENUM)
 
     /* extra attributes */
     FTM_RESP_FLAG_rtt_correct,
     FTM_RESP_FLAG_dist_truth,
+    FTM_RESP_FLAG_rx_time_ns,
     /* keep last */
     FTM_RESP_FLAG_MAX
 };
@@ -132,49 +157,99 @@ enum ftm_resp_attr_flags {
  * 
  * @mac_addr: mac address of the target 
  * other variables are defined in @enum nl80211_peer_measurement_ftm_resp
+ * @present: bit n is set if the attribute with flag n of
+ * @enum ftm_resp_attr_flags exists, see FTM_RESP_HAS
  * @rtt_correct: compensation of rtt, not a netlink attribute, just
  * an extra attr we define
+ * @rx_time_ns: when the result was received from the kernel, CLOCK_REALTIME,
+ * see nl80211_state.rx_time_ns
  * 
  * @note
- * Append other attrs by adding members in @struct ftm_resp_attr (attr_name)
- * and flags in @enum ftm_resp_attr_flags (FTM_RESP_FLAG_##attr_name),
- * then access via FTM_GET as defined in ftm.h
+ * Members are ordered by size so that the struct has no padding, it is
+ * copied as is into the shared-memory ring. Append other attrs by adding
+ * them to FTM_RESP_FIELDS and here, then access via FTM_RESP_HAS.
  */
 struct ftm_resp_attr {
-    uint8_t mac_addr[6];
-    uint32_t fail_reason;
-    uint32_t burst_index;
-    uint32_t num_ftmr_attempts;
-    uint32_t num_ftmr_successes;
-    uint32_t busy_retry_time;
-    uint8_t num_bursts_exp;
-    uint8_t burst_duration;
-    uint8_t ftms_per_burst;
-    int32_t rssi_avg;
-    int32_t rssi_spread;
     int64_t rtt_avg;
     uint64_t rtt_variance;
     uint64_t rtt_spread;
     int64_t dist_avg;
     uint64_t dist_variance;
     uint64_t dist_spread;
-
-    /* extra attributes */
     uint64_t rtt_correct;
+    uint64_t rx_time_ns;
+    uint32_t present;
+    uint32_t fail_reason;
+    uint32_t burst_index;
+    uint32_t num_ftmr_attempts;
+    uint32_t num_ftmr_successes;
+    uint32_t busy_retry_time;
+    int32_t rssi_avg;
+    int32_t rssi_spread;
     float dist_truth;
-    /* internal use */
-    uint8_t flags[FTM_RESP_FLAG_MAX];
+    uint8_t mac_addr[6];
+    uint8_t num_bursts_exp;
+    uint8_t burst_duration;
+    uint8_t ftms_per_burst;
 };
 
+/* present, mac_addr and the fields, padded to 8 bytes at most */
+#define __PEER_FIELD_SIZE(name, type, spec, nest, attr, put) + sizeof(type)
+_Static_assert(FTM_PEER_FLAG_MAX <= 32 &&
+               sizeof(struct ftm_peer_attr) < sizeof(uint32_t) + 6
+               FTM_PEER_FIELDS(__PEER_FIELD_SIZE) + 8,
+               "struct ftm_peer_attr has padding");
+#define __RESP_FIELD_SIZE(name, attr, type, nla, spec) + sizeof(type)
+_Static_assert(FTM_RESP_FLAG_MAX <= 32 &&
+               sizeof(struct ftm_resp_attr) < sizeof(uint32_t) + 6
+               FTM_RESP_FIELDS(__RESP_FIELD_SIZE) + 2 * sizeof(uint64_t) +
+               sizeof(float) + 8,
+               "struct ftm_resp_attr has padding");
+
+/**
+ * FTM_PEER_HAS - Whether an attribute of a peer is set
+ * 
+ * @param attr        ftm_peer_attr pointer
+ * @param attr_name   variable name of the attribute
+ */
+#define FTM_PEER_HAS(attr, attr_name) \
+    (((attr)->present >> FTM_PEER_FLAG_##attr_name) & 1)
+
+/**
+ * FTM_RESP_HAS - Whether an attribute of a response exists
+ * 
+ * @param resp        ftm_resp_attr pointer
+ * @param attr_name   variable name of the attribute
+ */
+#define FTM_RESP_HAS(resp, attr_name) \
+    (((resp)->present >> FTM_RESP_FLAG_##attr_name) & 1)
+
 /**
  * struct ftm_results_wrap - Wrapper for a responses in a single attempt
  * 
  * @results: array of response attributes
  * @count: number of responses (equal to the number of peers)
+ * @rx_queued: bytes left in the socket receive queue when the attempt
+ * completed
+ * @overruns: times the attempt started again after a receive buffer
+ * overrun, see ftm_ctx_overruns()
+ * @timeouts: times a request of the attempt was issued again after its
+ * COMPLETE did not come, see ftm_ctx_timeouts()
+ * @rx_syscalls: receive system calls made for the attempt
+ * @rx_copied: bytes of the netlink messages of the attempt copied before
+ * they were parsed
+ * @index: index of @results by mac address, for results that do not come
+ * in config order
  */
 struct ftm_results_wrap {
     struct ftm_resp_attr ** results;
     int count;
+    int rx_queued;
+    int overruns;
+    int timeouts;
+    uint64_t rx_syscalls;
+    uint64_t rx_copied;
+    struct mac_map index;
 };
 
 /**
@@ -187,10 +262,10 @@ struct ftm_results_wrap {
  * @note
  * Do not set mac_addr via this macro. Use FTM_PEER_SET_ATTR_ADDR instead.
  */
-#define FTM_PEER_SET_ATTR(attr, attr_name, value)   \
-    do {                                            \
-        attr->attr_name = value;                    \
-        attr->flags[FTM_PEER_FLAG_##attr_name] = 1; \
+#define FTM_PEER_SET_ATTR(attr, attr_name, value)         \
+    do {                                                  \
+        attr->attr_name = value;                          \
+        attr->present |= 1u << FTM_PEER_FLAG_##attr_name; \
     } while (0)
 
 /**
@@ -202,10 +277,10 @@ struct ftm_results_wrap {
  * @note
  * This is the only legal way to set a peer's mac address.
  */
-#define FTM_PEER_SET_ATTR_ADDR(attr, addr)       \
-    do {                                         \
-        memcpy(attr->mac_addr, addr, 6);         \
-        attr->flags[FTM_PEER_FLAG_mac_addr] = 1; \
+#define FTM_PEER_SET_ATTR_ADDR(attr, addr)             \
+    do {                                               \
+        memcpy(attr->mac_addr, addr, 6);               \
+        attr->present |= 1u << FTM_PEER_FLAG_mac_addr; \
     } while (0)
 
 /**
@@ -230,7 +305,8 @@ struct ftm_config *alloc_ftm_config(const char *interface_name,
  * @param config   ftm config to be freed
  * 
  * @note
- * Call this function only when the config is no longer used.
+ * Call this function only when the config is no longer used. The peers
+ * and the array holding them are freed as well.
  */
 void free_ftm_config(struct ftm_config *config);
 
@@ -271,6 +347,18 @@ struct ftm_resp_attr *alloc_ftm_resp_attr();
  */
 struct ftm_results_wrap *alloc_ftm_results_wrap(struct ftm_config *config);
 
+/**
+ * reset_ftm_results_wrap - Clear the results of a previous attempt so the
+ * container can be reused for the next one
+ * 
+ * @param wrap     results wrap allocated for the same peer count
+ * @param config   config used to start FTM
+ * 
+ * @return 0 on success, 1 if the wrap does not fit the config
+ */
+int reset_ftm_results_wrap(struct ftm_results_wrap *wrap,
+                           struct ftm_config *config);
+
 /**
  * free_ftm_results_wrap - Free the allocated results wrap
  * 
@@ -280,4 +368,43 @@ struct ftm_results_wrap *alloc_ftm_results_wrap(struct ftm_config *config);
  * You don't need to free on your own.
  */
 void free_ftm_results_wrap(struct ftm_results_wrap *wrap);
+
+/**
+ * ftm_peer_attr_equal - Whether two peers have the same attributes
+ * 
+ * @note
+ * Only the attributes that are set are compared, together with which of
+ * them are set.
+ */
+bool ftm_peer_attr_equal(const struct ftm_peer_attr *a,
+                         const struct ftm_peer_attr *b);
+
+/**
+ * ftm_config_find_peer - Find a peer of a config by its mac address
+ * 
+ * @param config     the config
+ * @param mac_addr   mac address of the peer
+ * @param hint       index to check first, like the index of the peer in
+ *                   another config
+ * 
+ * @return index of the peer, -1 if not found
+ */
+int ftm_config_find_peer(struct ftm_config *config, const uint8_t *mac_addr,
+                         int hint);
+
+/**
+ * ftm_config_peer_map - Match the peers of a new config with an old one
+ * 
+ * @param old   previous config
+ * @param new   config replacing it
+ * 
+ * @return array of new->peer_count indexes, the i-th being the index in
+ * @old of the peer with the mac address of the i-th peer of @new, or -1 for
+ * an added peer. NULL on failure. Free it with free().
+ * 
+ * @note
+ * Each peer of @old is matched at most once: the k-th peer of @new with an
+ * address gets the k-th peer of @old with it, later ones are added peers.
+ */
+int *ftm_config_peer_map(struct ftm_config *old, struct ftm_config *new);
 #endif /*_TYPES_H*/
\ No newline at end of file
@@ -0,0 +1,135 @@
+#include "initiator_watch.h"
+#include <errno.h>
+#include <limits.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+/* written in place, or created elsewhere and renamed over the file */
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+struct ftm_config_watch *alloc_ftm_config_watch(const char *file_name,
+                                                const char *if_name,
+                                                const char *cache_path,
+                                                char *error) {
+    struct ftm_config_watch *watch = calloc(1, sizeof(struct ftm_config_watch));
+    if (!watch) {
+        ftm_report_error(error, "Fail to allocate config watch!");
+        return NULL;
+    }
+    watch->fd = -1;
+    watch->file_name = strdup(file_name);
+    watch->cache_path = cache_path ? strdup(cache_path) : NULL;
+    if (!watch->file_name || (cache_path && !watch->cache_path)) {
+        ftm_report_error(error, "Fail to allocate config watch!");
+        goto handle_free;
+    }
+    snprintf(watch->if_name, sizeof(watch->if_name), "%s", if_name);
+
+    watch->config = load_config_file(file_name, if_name, cache_path, error);
+    if (!watch->config)
+        goto handle_free;
+
+    /* watch the directory, the file itself may be replaced */
+    char *slash = strrchr(watch->file_name, '/');
+    watch->base_name = slash ? slash + 1 : watch->file_name;
+    char dir[PATH_MAX];
+    if (!slash)
+        snprintf(dir, sizeof(dir), ".");
+    else
+        snprintf(dir, sizeof(dir), "%.*s",
+                 slash == watch->file_name ? 1 :
+                 (int)(slash - watch->file_name), watch->file_name);
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd < 0 || inotify_add_watch(watch->fd, dir, WATCH_EVENTS) < 0) {
+        ftm_report_error(error, "Fail to watch %s: %s", dir, strerror(errno));
+        goto handle_free;
+    }
+    return watch;
+handle_free:
+    free_ftm_config_watch(watch);
+    return NULL;
+}
+
+void free_ftm_config_watch(struct ftm_config_watch *watch) {
+    if (!watch)
+        return;
+    if (watch->fd >= 0)
+        close(watch->fd);
+    if (watch->config)
+        free_ftm_config(watch->config);
+    free(watch->file_name);
+    free(watch->cache_path);
+    free(watch);
+}
+
+struct ftm_config *ftm_config_watch_check(struct ftm_config_watch *watch) {
+    char buf[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+    ssize_t len;
+
+    /* an editor saving the file may cause several events, reload once */
+    while ((len = read(watch->fd, buf, sizeof(buf))) > 0) {
+        for (char *pos = buf; pos < buf + len;) {
+            struct inotify_event *event = (struct inotify_event *)pos;
+            if (event->len && strcmp(event->name, watch->base_name) == 0)
+                changed = true;
+            pos += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    if (!changed)
+        return NULL;
+
+    watch->error[0] = '\0';
+    struct ftm_config *config = load_config_file(
+        watch->file_name, watch->if_name, watch->cache_path, watch->error);
+    if (!config)
+        watch->failures++;
+    return config;
+}
+
+/* swap in a new config, the old one is freed */
+static void swap_config(struct ftm_ctx *ctx, struct ftm_config_watch *watch,
+                        struct ftm_config *config, ftm_reload_handler reload,
+                        void *arg) {
+    int *map = ftm_config_peer_map(watch->config, config);
+    if (!map) {
+        ftm_report_error(watch->error, "Fail to allocate peer map!");
+        watch->failures++;
+        free_ftm_config(config);
+        return;
+    }
+    if (reload && reload(watch->config, config, map, arg)) {
+        ftm_report_error(watch->error, "Fail to apply the new config!");
+        watch->failures++;
+        free(map);
+        free_ftm_config(config);
+        return;
+    }
+    if (ftm_trace_remap_peers(ftm_ctx_trace(ctx), config, map))
+        ftm_trace_disable(ftm_ctx_trace(ctx));
+    free(map);
+    free_ftm_config(watch->config);
+    watch->config = config;
+    watch->reloads++;
+}
+
+int ftm_ctx_run_watch(struct ftm_ctx *ctx, struct ftm_config_watch *watch,
+                      ftm_result_handler handler, ftm_reload_handler reload,
+                      int attempts, void *arg) {
+    for (int i = 0; (attempts == FTM_ATTEMPTS_INF || i < attempts) &&
+                    !ftm_ctx_stopped(ctx); i++) {
+        struct ftm_config *config = ftm_config_watch_check(watch);
+        if (config)
+            swap_config(ctx, watch, config, reload, arg);
+
+        struct ftm_results_wrap *results_wrap =
+            ftm_ctx_session(ctx, watch->config);
+        if (!results_wrap)
+            return 1;
+        if (handler)
+            handler(results_wrap, attempts, i, arg);
+        FTM_TRACE_SESSION_END(ftm_ctx_trace(ctx));
+    }
+    return 0;
+}
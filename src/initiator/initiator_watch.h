@@ -0,0 +1,122 @@
+#ifndef _FTM_INITIATOR_WATCH_H
+#define _FTM_INITIATOR_WATCH_H
+
+#include <net/if.h>
+#include "initiator_start.h"
+#include "initiator_config.h"
+
+/**
+ * DOC: Reload the config file while measuring
+ * 
+ * A config watch loads the config file and keeps watching it with inotify.
+ * ftm_ctx_run_watch() checks the watch between sessions: when the file was
+ * written (or replaced by a rename, as most editors do), it is parsed again
+ * and the new config replaces the old one before the next session starts.
+ * A file that fails to parse is reported and the old config is kept.
+ * 
+ * Peers are matched by mac address. A reload handler moves the state kept
+ * for each peer to its index in the new config, and the context only
+ * builds the request attributes of the peers that were added or changed.
+ */
+
+/**
+ * typedef ftm_reload_handler - Function type to accept a new config
+ * 
+ * @old: config of the previous sessions, freed after the swap
+ * @new: config of the next sessions
+ * @map: for each peer of @new, its index in @old or -1 if it was added,
+ * see ftm_config_peer_map()
+ * @arg: pointer passed to ftm_ctx_run_watch()
+ * 
+ * @return 0 to use @new, non-zero to keep @old
+ */
+typedef int (*ftm_reload_handler)(struct ftm_config *old,
+                                  struct ftm_config *new, const int *map,
+                                  void *arg);
+
+/**
+ * struct ftm_config_watch - A config file being watched
+ * 
+ * @file_name: path of the config file
+ * @base_name: file name within its directory, part of @file_name
+ * @if_name: interface name
+ * @cache_path: compiled config, see load_config_file(), or NULL
+ * @fd: inotify instance watching the directory of the file
+ * @config: current config, owned by the watch
+ * @reloads: configs swapped in so far
+ * @failures: reloads that kept the old config, because the file did not
+ * parse or the reload handler rejected the new config
+ * @error: reason of the last failure, see ftm_report_error()
+ */
+struct ftm_config_watch {
+    char *file_name;
+    const char *base_name;
+    char if_name[IF_NAMESIZE];
+    char *cache_path;
+    int fd;
+    struct ftm_config *config;
+    uint64_t reloads;
+    uint64_t failures;
+    char error[FTM_ERROR_MAX];
+};
+
+/**
+ * alloc_ftm_config_watch - Load a config file and start watching it
+ * 
+ * @param file_name    relative or absolute path of the config file
+ * @param if_name      interface name
+ * @param cache_path   compiled config, NULL to always parse the file
+ * @param error        buffer of FTM_ERROR_MAX bytes, see ftm_report_error()
+ * 
+ * @return a valid ftm_config_watch pointer on success, NULL on failure.
+ */
+struct ftm_config_watch *alloc_ftm_config_watch(const char *file_name,
+                                                const char *if_name,
+                                                const char *cache_path,
+                                                char *error);
+
+/**
+ * free_ftm_config_watch - Stop watching and free the current config
+ * 
+ * @note
+ * Accepts NULL.
+ */
+void free_ftm_config_watch(struct ftm_config_watch *watch);
+
+/**
+ * ftm_config_watch_check - Load the config file again if it changed
+ * 
+ * @return the new config if the file changed and parsed, NULL otherwise.
+ * The new config is not swapped in: the caller owns it.
+ * 
+ * @note
+ * Never blocks. @fd is readable when there is something to check, so it
+ * can also be added to an event loop.
+ */
+struct ftm_config *ftm_config_watch_check(struct ftm_config_watch *watch);
+
+/**
+ * ftm_ctx_run_watch - ftm_ctx_run() with the config of a watch, reloaded
+ * between sessions
+ * 
+ * @param ctx        context
+ * @param watch      watch providing the config
+ * @param handler    the callback to handle measurement results, can be NULL
+ * @param reload     the callback to accept a new config, can be NULL to
+ *                   always accept
+ * @param attempts   how many times to measure, or FTM_ATTEMPTS_INF
+ * @param arg        pointer passed to @handler and @reload
+ * 
+ * @note
+ * A failed reload does not end the run: the old config is kept, and the
+ * failure is counted in @watch's failures with its reason in @watch's
+ * error. The per-peer histograms of the trace of @ctx follow the peers.
+ * Stops after the session in progress on ftm_ctx_stop(), like
+ * ftm_ctx_run().
+ * 
+ * @return 0 on success, 1 on failure with the reason in ftm_ctx_error()
+ */
+int ftm_ctx_run_watch(struct ftm_ctx *ctx, struct ftm_config_watch *watch,
+                      ftm_result_handler handler, ftm_reload_handler reload,
+                      int attempts, void *arg);
+#endif
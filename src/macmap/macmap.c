@@ -0,0 +1,91 @@
+#include "macmap.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Fibonacci hashing of the 48 bits of the address */
+static uint32_t mac_hash(const uint8_t *mac_addr) {
+    uint64_t key = 0;
+    memcpy(&key, mac_addr, 6);
+    return (key * 0x9e3779b97f4a7c15ull) >> 32;
+}
+
+static struct mac_map_slot *alloc_slots(uint32_t count) {
+    struct mac_map_slot *slots = malloc(count * sizeof(struct mac_map_slot));
+    for (uint32_t i = 0; slots && i < count; i++)
+        slots[i].value = -1;
+    return slots;
+}
+
+int mac_map_init(struct mac_map *map, int capacity) {
+    uint32_t count = MAC_MAP_MIN_SLOTS;
+    while (count < 2 * (uint32_t)(capacity > 0 ? capacity : 0))
+        count *= 2;
+    map->slots = alloc_slots(count);
+    map->mask = count - 1;
+    map->count = 0;
+    return !map->slots;
+}
+
+void mac_map_free(struct mac_map *map) {
+    free(map->slots);
+    map->slots = NULL;
+    map->mask = 0;
+    map->count = 0;
+}
+
+void mac_map_clear(struct mac_map *map) {
+    for (uint32_t i = 0; map->slots && i <= map->mask; i++)
+        map->slots[i].value = -1;
+    map->count = 0;
+}
+
+/* the slot of @mac_addr, or the empty slot where it would go */
+static struct mac_map_slot *find_slot(const struct mac_map *map,
+                                      const uint8_t *mac_addr) {
+    uint32_t i = mac_hash(mac_addr) & map->mask;
+    while (map->slots[i].value >= 0 &&
+           memcmp(map->slots[i].mac_addr, mac_addr, 6))
+        i = (i + 1) & map->mask;
+    return &map->slots[i];
+}
+
+int mac_map_get(const struct mac_map *map, const uint8_t *mac_addr) {
+    if (!map->slots)
+        return -1;
+    return find_slot(map, mac_addr)->value;
+}
+
+static int grow(struct mac_map *map) {
+    uint32_t count = (map->mask + 1) * 2;
+    struct mac_map old = *map;
+    map->slots = alloc_slots(count);
+    if (!map->slots) {
+        *map = old;
+        return 1;
+    }
+    map->mask = count - 1;
+    for (uint32_t i = 0; i <= old.mask; i++) {
+        if (old.slots[i].value >= 0)
+            *find_slot(map, old.slots[i].mac_addr) = old.slots[i];
+    }
+    free(old.slots);
+    return 0;
+}
+
+int mac_map_put(struct mac_map *map, const uint8_t *mac_addr, int value) {
+    if (!map->slots && mac_map_init(map, 0))
+        return 1;
+    struct mac_map_slot *slot = find_slot(map, mac_addr);
+    if (slot->value < 0) {
+        /* keep the table at most half full */
+        if (2 * (uint32_t)(map->count + 1) > map->mask + 1) {
+            if (grow(map))
+                return 1;
+            slot = find_slot(map, mac_addr);
+        }
+        memcpy(slot->mac_addr, mac_addr, 6);
+        map->count++;
+    }
+    slot->value = value;
+    return 0;
+}
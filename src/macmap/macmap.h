@@ -0,0 +1,79 @@
+#ifndef _FTM_MACMAP_H
+#define _FTM_MACMAP_H
+
+#include <stdint.h>
+
+/**
+ * DOC: Index of peers by mac address
+ * 
+ * An open-addressing hash table from a mac address to a non-negative
+ * index, like the index of a peer in an array, for lookups that take the
+ * same time with ten peers or ten thousand. The table is at most half full
+ * and doubles when it would not be.
+ */
+
+#define MAC_MAP_MIN_SLOTS 16
+
+/**
+ * struct mac_map_slot - An entry of the table
+ * 
+ * @mac_addr: the key
+ * @value: the index, -1 if the slot is empty
+ */
+struct mac_map_slot {
+    uint8_t mac_addr[6];
+    int32_t value;
+};
+
+/**
+ * struct mac_map - Hash table from mac address to index
+ * 
+ * @slots: the entries, a power of two of them
+ * @mask: number of @slots minus 1
+ * @count: entries in use
+ */
+struct mac_map {
+    struct mac_map_slot *slots;
+    uint32_t mask;
+    int count;
+};
+
+/**
+ * mac_map_init - Allocate a table
+ * 
+ * @param map        the table
+ * @param capacity   entries expected, the table grows past them
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int mac_map_init(struct mac_map *map, int capacity);
+
+/**
+ * mac_map_free - Free the entries of a table
+ * 
+ * @note
+ * Accepts a table that failed to initialize or was already freed.
+ */
+void mac_map_free(struct mac_map *map);
+
+/**
+ * mac_map_clear - Remove all the entries, keeping the room for them
+ */
+void mac_map_clear(struct mac_map *map);
+
+/**
+ * mac_map_get - Find the index of a mac address
+ * 
+ * @return the index, -1 if @mac_addr is not in @map
+ */
+int mac_map_get(const struct mac_map *map, const uint8_t *mac_addr);
+
+/**
+ * mac_map_put - Set the index of a mac address
+ * 
+ * @param value   the index, non-negative, replacing the one set before
+ * 
+ * @return 0 on success, 1 if the table failed to grow
+ */
+int mac_map_put(struct mac_map *map, const uint8_t *mac_addr, int value);
+#endif
@@ -2,6 +2,12 @@
 
 #include "initiator/initiator.h"
 #include "responder/responder.h"
+#include "ap/ap.h"
+#include "daemon/daemon.h"
+#include "shm/shm.h"
+#include "discover/discover.h"
+#include "analyze/analyze.h"
+#include "archive/archive.h"
 
 int main(int argc, char **argv) {
     if (argc <= 1) {
@@ -19,6 +25,22 @@ int main(int argc, char **argv) {
             printf("Fail to start ftm responder!\n");
             return 1;
         }
+    } else if (strcmp(cmd, "start_ap") == 0) {
+        if (ftm_ap_main(argc - 1, argv + 1))
+            return 1;
+    } else if (strcmp(cmd, "stop_ap") == 0) {
+        if (argc != 3) {
+            printf("Invalid arguments!\n");
+            return 1;
+        }
+        char error[FTM_ERROR_MAX] = "";
+        if (ftm_stop_ap(argv[2], error)) {
+            printf("Fail to stop AP: %s\n", error);
+            return 1;
+        }
+    } else if (strcmp(cmd, "responder_stats") == 0) {
+        if (ftm_responder_stats_main(argc - 1, argv + 1))
+            return 1;
     } else if (strcmp(cmd, "start_measurement") == 0) {
         argc--;
         argv++;
@@ -26,6 +48,27 @@ int main(int argc, char **argv) {
         if (err) {
             return 1;
         }
+    } else if (strcmp(cmd, "simulate") == 0) {
+        if (my_simulate_ftm(argc - 1, argv + 1))
+            return 1;
+    } else if (strcmp(cmd, "daemon") == 0) {
+        if (ftm_daemon_main(argc - 1, argv + 1))
+            return 1;
+    } else if (strcmp(cmd, "shm_read") == 0) {
+        if (ftm_shm_read_main(argc - 1, argv + 1))
+            return 1;
+    } else if (strcmp(cmd, "client") == 0) {
+        if (ftm_client_main(argc - 1, argv + 1))
+            return 1;
+    } else if (strcmp(cmd, "discover") == 0) {
+        if (ftm_discover_main(argc - 1, argv + 1))
+            return 1;
+    } else if (strcmp(cmd, "analyze") == 0) {
+        if (ftm_analyze_main(argc - 1, argv + 1))
+            return 1;
+    } else if (strcmp(cmd, "archive") == 0) {
+        if (ftm_archive_main(argc - 1, argv + 1))
+            return 1;
     } else {
         printf("Invalid arguments!\n");
         return 1;
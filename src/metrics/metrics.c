@@ -0,0 +1,464 @@
+#include "metrics.h"
+#include "../nl/nl.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define __LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_RELAXED)
+#define __STORE(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELAXED)
+#define __ADD(ptr, val) __atomic_fetch_add(ptr, val, __ATOMIC_RELAXED)
+
+/* weight of a new sample in the filtered distance, 1 / 2^FILTER_SHIFT */
+#define FILTER_SHIFT 3
+
+static const char *fail_reason_names[METRICS_FAIL_REASON_MAX] = {
+#define __REASON_NAME(reason, name) [NL80211_PMSR_FTM_FAILURE_##reason] = name
+    __REASON_NAME(UNSPECIFIED, "unspecified"),
+    __REASON_NAME(NO_RESPONSE, "no_response"),
+    __REASON_NAME(REJECTED, "rejected"),
+    __REASON_NAME(WRONG_CHANNEL, "wrong_channel"),
+    __REASON_NAME(PEER_NOT_CAPABLE, "peer_not_capable"),
+    __REASON_NAME(INVALID_TIMESTAMP, "invalid_timestamp"),
+    __REASON_NAME(PEER_BUSY, "peer_busy"),
+    __REASON_NAME(BAD_CHANGED_PARAMS, "bad_changed_params"),
+    [METRICS_FAIL_REASON_MAX - 1] = "other",
+};
+
+const char *metrics_fail_reason_name(uint32_t reason) {
+    if (reason >= METRICS_FAIL_REASON_MAX - 1)
+        reason = METRICS_FAIL_REASON_MAX - 1;
+    return fail_reason_names[reason];
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static struct metrics_peers *alloc_peers(int count) {
+    struct metrics_peers *table = calloc(
+        1, sizeof(struct metrics_peers) + count * sizeof(struct metrics_peer));
+    if (table)
+        table->count = count;
+    return table;
+}
+
+static void free_peers(struct metrics_peers *table) {
+    while (table) {
+        struct metrics_peers *retired = table->retired;
+        free(table);
+        table = retired;
+    }
+}
+
+/*
+ * A scrape counts itself in @scraping before loading @peers, so once
+ * @scraping is seen at 0 after a swap, no scrape can still read the
+ * tables swapped out before it.
+ */
+static void free_retired(struct metrics *metrics) {
+    if (!metrics->retired ||
+        __atomic_load_n(&metrics->scraping, __ATOMIC_SEQ_CST))
+        return;
+    free_peers(metrics->retired);
+    metrics->retired = NULL;
+}
+
+struct metrics *alloc_metrics(struct ftm_config *config) {
+    struct metrics *metrics = calloc(1, sizeof(struct metrics));
+    if (!metrics)
+        return NULL;
+    metrics->peers = alloc_peers(config->peer_count);
+    if (!metrics->peers) {
+        free(metrics);
+        return NULL;
+    }
+    for (int i = 0; i < config->peer_count; i++)
+        memcpy(metrics->peers->peers[i].mac_addr,
+               config->peers[i]->mac_addr, 6);
+    metrics->start_ns = now_ns();
+    metrics->last_scrape_ns = metrics->start_ns;
+    metrics->listen_fd = -1;
+    return metrics;
+}
+
+void free_metrics(struct metrics *metrics) {
+    if (!metrics)
+        return;
+    metrics_stop_server(metrics);
+    free_peers(metrics->peers);
+    free_peers(metrics->retired);
+    free(metrics);
+}
+
+int metrics_remap_peers(struct metrics *metrics, struct ftm_config *config,
+                        const int *map) {
+    struct metrics_peers *old = metrics->peers;
+    struct metrics_peers *table = alloc_peers(config->peer_count);
+    if (!table)
+        return 1;
+    for (int i = 0; i < config->peer_count; i++) {
+        if (map[i] >= 0 && map[i] < old->count)
+            table->peers[i] = old->peers[map[i]];
+        memcpy(table->peers[i].mac_addr, config->peers[i]->mac_addr, 6);
+    }
+    __atomic_store_n(&metrics->peers, table, __ATOMIC_SEQ_CST);
+    old->retired = metrics->retired;
+    metrics->retired = old;
+    free_retired(metrics);
+    return 0;
+}
+
+int metrics_add_value(struct metrics *metrics, const char *name,
+                      const char *type, const char *help, int decimals) {
+    if (metrics->gauge_count == METRICS_GAUGES_MAX)
+        return -1;
+    struct metrics_gauge *gauge = &metrics->gauges[metrics->gauge_count];
+    gauge->name = name;
+    gauge->help = help;
+    gauge->type = type;
+    gauge->decimals = decimals;
+    gauge->value = 0;
+    return metrics->gauge_count++;
+}
+
+int metrics_add_gauge(struct metrics *metrics, const char *name,
+                      const char *help) {
+    return metrics_add_value(metrics, name, "gauge", help, 0);
+}
+
+void metrics_set_gauge(struct metrics *metrics, int id, int64_t value) {
+    if (id >= 0 && id < metrics->gauge_count)
+        __STORE(&metrics->gauges[id].value, value);
+}
+
+int metrics_add_hist(struct metrics *metrics, const char *name,
+                     const char *label, const char *label_value,
+                     const struct hist *hist) {
+    if (metrics->hist_count == METRICS_HISTS_MAX)
+        return 1;
+    struct metrics_hist *entry = &metrics->hists[metrics->hist_count++];
+    entry->name = name;
+    entry->label = label;
+    snprintf(entry->label_value, sizeof(entry->label_value), "%s",
+             label_value);
+    entry->hist = hist;
+    return 0;
+}
+
+void metrics_record_results(struct metrics *metrics,
+                            struct ftm_results_wrap *results) {
+    /* only this thread swaps the table */
+    struct metrics_peers *table = metrics->peers;
+    free_retired(metrics);
+    int count = results->count < table->count ? results->count : table->count;
+    for (int i = 0; i < count; i++) {
+        struct ftm_resp_attr *resp = results->results[i];
+        struct metrics_peer *peer = &table->peers[i];
+        if (!resp)
+            continue;
+        __ADD(&peer->results, 1);
+        if (FTM_RESP_HAS(resp, fail_reason)) {
+            uint32_t reason = resp->fail_reason;
+            if (reason >= METRICS_FAIL_REASON_MAX - 1)
+                reason = METRICS_FAIL_REASON_MAX - 1;
+            __ADD(&peer->fail_reasons[reason], 1);
+            continue;
+        }
+        if (FTM_RESP_HAS(resp, rssi_avg))
+            __STORE(&peer->latest_rssi, resp->rssi_avg);
+        if (!FTM_RESP_HAS(resp, rtt_avg))
+            continue;
+        __ADD(&peer->successes, 1);
+
+        int64_t rtt = resp->rtt_avg;
+        if (FTM_RESP_HAS(resp, rtt_correct))
+            rtt += resp->rtt_correct;
+        int64_t dist_mm = RTT_TO_DIST(rtt) * 1000;
+        int64_t filtered = __LOAD(&peer->filtered_dist_mm);
+        if (__LOAD(&peer->successes) == 1)
+            filtered = dist_mm;
+        else
+            filtered += (dist_mm - filtered) / (1 << FILTER_SHIFT);
+        __STORE(&peer->latest_dist_mm, dist_mm);
+        __STORE(&peer->filtered_dist_mm, filtered);
+    }
+    __ADD(&metrics->sessions, 1);
+}
+
+void metrics_record_failure(struct metrics *metrics) {
+    __ADD(&metrics->session_failures, 1);
+}
+
+/**
+ * struct snapshot_buf - Output of metrics_snapshot()
+ * 
+ * @len counts every byte written, even those not fitting in @size, so the
+ * caller knows how much to allocate.
+ */
+struct snapshot_buf {
+    char *buf;
+    int size;
+    int len;
+};
+
+static void append(struct snapshot_buf *out, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int room = out->len < out->size ? out->size - out->len : 0;
+    int n = vsnprintf(room ? out->buf + out->len : NULL, room, fmt, args);
+    va_end(args);
+    if (n > 0)
+        out->len += n;
+}
+
+static void append_header(struct snapshot_buf *out, const char *name,
+                          const char *type, const char *help) {
+    append(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+#define __PEER_LABEL "peer=\"%02x:%02x:%02x:%02x:%02x:%02x\""
+#define __PEER_ADDR(addr) \
+    addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]
+
+int metrics_snapshot(struct metrics *metrics, char *buf, int size) {
+    struct snapshot_buf out = {buf, size, 0};
+    uint64_t now = now_ns();
+    uint64_t sessions = __LOAD(&metrics->sessions);
+
+    append_header(&out, "ftm_uptime_seconds", "gauge",
+                  "Seconds since the measurement started");
+    append(&out, "ftm_uptime_seconds %.3f\n",
+           (now - metrics->start_ns) / 1e9);
+
+    append_header(&out, "ftm_sessions_total", "counter",
+                  "Completed measurement sessions");
+    append(&out, "ftm_sessions_total %lu\n", sessions);
+    append_header(&out, "ftm_session_failures_total", "counter",
+                  "Failed measurement sessions");
+    append(&out, "ftm_session_failures_total %lu\n",
+           __LOAD(&metrics->session_failures));
+
+    append_header(&out, "ftm_sessions_per_second", "gauge",
+                  "Session rate since the previous scrape");
+    uint64_t elapsed = now - metrics->last_scrape_ns;
+    append(&out, "ftm_sessions_per_second %.3f\n",
+           elapsed ? (sessions - metrics->last_sessions) * 1e9 / elapsed : 0);
+
+    __atomic_fetch_add(&metrics->scraping, 1, __ATOMIC_SEQ_CST);
+    struct metrics_peers *table =
+        __atomic_load_n(&metrics->peers, __ATOMIC_SEQ_CST);
+    append_header(&out, "ftm_peer_results_total", "counter",
+                  "Results received per peer");
+    for (int i = 0; i < table->count; i++) {
+        struct metrics_peer *peer = &table->peers[i];
+        append(&out, "ftm_peer_results_total{" __PEER_LABEL "} %lu\n",
+               __PEER_ADDR(peer->mac_addr), __LOAD(&peer->results));
+    }
+    append_header(&out, "ftm_peer_success_ratio", "gauge",
+                  "Share of results carrying a valid rtt");
+    for (int i = 0; i < table->count; i++) {
+        struct metrics_peer *peer = &table->peers[i];
+        uint64_t results = __LOAD(&peer->results);
+        append(&out, "ftm_peer_success_ratio{" __PEER_LABEL "} %.4f\n",
+               __PEER_ADDR(peer->mac_addr),
+               results ? (double)__LOAD(&peer->successes) / results : 0);
+    }
+    append_header(&out, "ftm_peer_failures_total", "counter",
+                  "Failed results per peer and fail_reason");
+    for (int i = 0; i < table->count; i++) {
+        struct metrics_peer *peer = &table->peers[i];
+        for (int j = 0; j < METRICS_FAIL_REASON_MAX; j++) {
+            uint64_t count = __LOAD(&peer->fail_reasons[j]);
+            if (!count)
+                continue;
+            append(&out, "ftm_peer_failures_total{" __PEER_LABEL
+                   ",reason=\"%s\"} %lu\n",
+                   __PEER_ADDR(peer->mac_addr), fail_reason_names[j], count);
+        }
+    }
+    append_header(&out, "ftm_peer_distance_meters", "gauge",
+                  "Latest distance per peer");
+    for (int i = 0; i < table->count; i++) {
+        struct metrics_peer *peer = &table->peers[i];
+        append(&out, "ftm_peer_distance_meters{" __PEER_LABEL "} %.3f\n",
+               __PEER_ADDR(peer->mac_addr),
+               __LOAD(&peer->latest_dist_mm) / 1000.0);
+    }
+    append_header(&out, "ftm_peer_filtered_distance_meters", "gauge",
+                  "Moving average of the distance per peer");
+    for (int i = 0; i < table->count; i++) {
+        struct metrics_peer *peer = &table->peers[i];
+        append(&out, "ftm_peer_filtered_distance_meters{" __PEER_LABEL
+               "} %.3f\n", __PEER_ADDR(peer->mac_addr),
+               __LOAD(&peer->filtered_dist_mm) / 1000.0);
+    }
+    append_header(&out, "ftm_peer_rssi", "gauge", "Latest rssi_avg per peer");
+    for (int i = 0; i < table->count; i++) {
+        struct metrics_peer *peer = &table->peers[i];
+        append(&out, "ftm_peer_rssi{" __PEER_LABEL "} %ld\n",
+               __PEER_ADDR(peer->mac_addr), __LOAD(&peer->latest_rssi));
+    }
+    __atomic_fetch_sub(&metrics->scraping, 1, __ATOMIC_RELEASE);
+
+    for (int i = 0; i < metrics->gauge_count; i++) {
+        struct metrics_gauge *gauge = &metrics->gauges[i];
+        int64_t value = __LOAD(&gauge->value);
+        append_header(&out, gauge->name, gauge->type, gauge->help);
+        if (gauge->decimals) {
+            double scale = 1;
+            for (int j = 0; j < gauge->decimals; j++)
+                scale *= 10;
+            append(&out, "%s %.*f\n", gauge->name, gauge->decimals,
+                   value / scale);
+        } else {
+            append(&out, "%s %ld\n", gauge->name, value);
+        }
+    }
+
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    const char *last_name = NULL;
+    for (int i = 0; i < metrics->hist_count; i++) {
+        struct metrics_hist *entry = &metrics->hists[i];
+        if (!last_name || strcmp(last_name, entry->name)) {
+            append_header(&out, entry->name, "summary",
+                          "Latency in seconds");
+            last_name = entry->name;
+        }
+        for (int j = 0; j < sizeof(quantiles) / sizeof(quantiles[0]); j++) {
+            append(&out, "%s{%s=\"%s\",quantile=\"%g\"} %.9f\n",
+                   entry->name, entry->label, entry->label_value,
+                   quantiles[j],
+                   hist_quantile(entry->hist, quantiles[j]) / 1e9);
+        }
+        append(&out, "%s_sum{%s=\"%s\"} %.9f\n", entry->name, entry->label,
+               entry->label_value, __LOAD(&entry->hist->sum) / 1e9);
+        append(&out, "%s_count{%s=\"%s\"} %lu\n", entry->name, entry->label,
+               entry->label_value, __LOAD(&entry->hist->total));
+    }
+
+    metrics->last_sessions = sessions;
+    metrics->last_scrape_ns = now;
+    return out.len;
+}
+
+static int write_all(int fd, const char *buf, int len) {
+    while (len > 0) {
+        int n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void serve_client(struct metrics *metrics, int fd, char **buf,
+                         int *size) {
+    /* peek for an HTTP request without waiting on plain readers */
+    char request[512];
+    bool http = false;
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, 100) > 0) {
+        int n = read(fd, request, sizeof(request) - 1);
+        http = n >= 4 && memcmp(request, "GET ", 4) == 0;
+    }
+
+    int len = metrics_snapshot(metrics, *buf, *size);
+    if (len >= *size) {
+        char *bigger = realloc(*buf, len + 1);
+        if (!bigger)
+            return;
+        *buf = bigger;
+        *size = len + 1;
+        len = metrics_snapshot(metrics, *buf, *size);
+    }
+
+    if (http) {
+        char header[128];
+        int header_len = snprintf(header, sizeof(header),
+                                  "HTTP/1.0 200 OK\r\n"
+                                  "Content-Type: text/plain; version=0.0.4\r\n"
+                                  "Content-Length: %d\r\n\r\n", len);
+        if (write_all(fd, header, header_len))
+            return;
+    }
+    write_all(fd, *buf, len);
+}
+
+static void *server_thread(void *arg) {
+    struct metrics *metrics = arg;
+    int size = 16 * 1024;
+    char *buf = malloc(size);
+    if (!buf)
+        return NULL;
+    while (1) {
+        int fd = accept(metrics->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        serve_client(metrics, fd, &buf, &size);
+        close(fd);
+    }
+    free(buf);
+    return NULL;
+}
+
+int metrics_start_server(struct metrics *metrics, const char *path,
+                         char *error) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        ftm_report_error(error, "Metrics socket path %s is too long!", path);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        ftm_report_error(error, "Fail to create metrics socket: %s",
+                         strerror(errno));
+        return 1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        listen(fd, 8)) {
+        ftm_report_error(error, "Fail to listen on %s: %s", path,
+                         strerror(errno));
+        close(fd);
+        return 1;
+    }
+    metrics->listen_fd = fd;
+    strcpy(metrics->path, path);
+
+    if (pthread_create(&metrics->thread, NULL, server_thread, metrics)) {
+        ftm_report_error(error, "Fail to start metrics server!");
+        close(fd);
+        unlink(path);
+        metrics->listen_fd = -1;
+        return 1;
+    }
+    return 0;
+}
+
+void metrics_stop_server(struct metrics *metrics) {
+    if (metrics->listen_fd < 0)
+        return;
+    /* wakes up the blocking accept() */
+    shutdown(metrics->listen_fd, SHUT_RDWR);
+    pthread_join(metrics->thread, NULL);
+    close(metrics->listen_fd);
+    unlink(metrics->path);
+    metrics->listen_fd = -1;
+}
@@ -0,0 +1,268 @@
+#ifndef _FTM_METRICS_H
+#define _FTM_METRICS_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/un.h>
+#include <linux/nl80211.h>
+#include "../hist/hist.h"
+#include "../initiator/initiator_types.h"
+
+/**
+ * DOC: Metrics endpoint
+ * 
+ * The measurement thread updates plain 64-bit counters with relaxed atomic
+ * operations. A server thread accepts connections on a Unix domain socket
+ * and answers each one with a snapshot in the Prometheus text format, read
+ * with relaxed atomic loads, so scraping never takes a lock shared with
+ * the measurement.
+ * 
+ * The counters of the peers live in a table published through a pointer.
+ * A reload builds a new table and swaps the pointer, and the old table is
+ * freed once no scrape that may have loaded it is still running, so a slow
+ * scrape never holds up a result or a reload.
+ * 
+ * A plain connection (e.g. socat - UNIX-CONNECT:<path>) receives the text
+ * directly. If the client sends an HTTP request first (e.g. curl 
+ * --unix-socket <path> http://localhost/metrics), a minimal HTTP response
+ * header is prepended.
+ */
+
+#define METRICS_FAIL_REASON_MAX (NL80211_PMSR_FTM_FAILURE_BAD_CHANGED_PARAMS + 2)
+#define METRICS_GAUGES_MAX 32
+#define METRICS_HISTS_MAX 64
+
+/**
+ * struct metrics_peer - Counters of a peer
+ * 
+ * @mac_addr: mac address of the peer
+ * @results: number of results received
+ * @successes: number of results carrying an rtt and no fail_reason
+ * @fail_reasons: results per fail_reason, the last slot counts unknown
+ * reasons
+ * @latest_dist_mm: latest distance (corrected if rtt_correct is set), in mm
+ * @filtered_dist_mm: exponentially weighted moving average of the distance
+ * @latest_rssi: latest rssi_avg
+ */
+struct metrics_peer {
+    uint8_t mac_addr[6];
+    uint64_t results;
+    uint64_t successes;
+    uint64_t fail_reasons[METRICS_FAIL_REASON_MAX];
+    int64_t latest_dist_mm;
+    int64_t filtered_dist_mm;
+    int64_t latest_rssi;
+};
+
+/**
+ * struct metrics_peers - Table of the peers of a config
+ * 
+ * @count: number of @peers
+ * @retired: next table waiting to be freed, see @struct metrics
+ * @peers: the counters, in config order
+ */
+struct metrics_peers {
+    int count;
+    struct metrics_peers *retired;
+    struct metrics_peer peers[];
+};
+
+/**
+ * struct metrics_gauge - Named value set by its owner
+ * 
+ * @name: metric name
+ * @help: help text
+ * @type: "gauge" or "counter"
+ * @decimals: the value is exported divided by 10^@decimals
+ * @value: current value
+ */
+struct metrics_gauge {
+    const char *name;
+    const char *help;
+    const char *type;
+    int decimals;
+    int64_t value;
+};
+
+/**
+ * struct metrics_hist - Histogram exported as a summary
+ * 
+ * @name: metric name
+ * @label: label name, like stage
+ * @label_value: label value, like ack
+ * @hist: histogram, owned by the caller
+ */
+struct metrics_hist {
+    const char *name;
+    const char *label;
+    char label_value[24];
+    const struct hist *hist;
+};
+
+/**
+ * struct metrics - Metrics registry and server
+ * 
+ * @start_ns: creation time, CLOCK_MONOTONIC
+ * @sessions: number of completed sessions
+ * @session_failures: number of failed sessions
+ * @peers: per-peer counters, swapped on a reload
+ * @retired: tables swapped out while a scrape was running, freed by the
+ * measurement thread once none is
+ * @scraping: number of scrapes running
+ * @gauge_count: number of registered gauges
+ * @gauges: registered gauges
+ * @hist_count: number of registered histograms
+ * @hists: registered histograms
+ * @path: socket path
+ * @listen_fd: listening socket, -1 if the server is not running
+ * @thread: server thread
+ * @last_sessions: sessions at the previous scrape, server thread only
+ * @last_scrape_ns: time of the previous scrape, server thread only
+ */
+struct metrics {
+    uint64_t start_ns;
+    uint64_t sessions;
+    uint64_t session_failures;
+    struct metrics_peers *peers;
+    struct metrics_peers *retired;
+    int scraping;
+    int gauge_count;
+    struct metrics_gauge gauges[METRICS_GAUGES_MAX];
+    int hist_count;
+    struct metrics_hist hists[METRICS_HISTS_MAX];
+
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    int listen_fd;
+    pthread_t thread;
+    uint64_t last_sessions;
+    uint64_t last_scrape_ns;
+};
+
+/**
+ * alloc_metrics - Allocate metrics for the peers of a config
+ * 
+ * @param config   config of the measurement
+ * 
+ * @return a valid metrics pointer on success, NULL on failure.
+ */
+struct metrics *alloc_metrics(struct ftm_config *config);
+
+/**
+ * free_metrics - Stop the server if running and free the metrics
+ */
+void free_metrics(struct metrics *metrics);
+
+/**
+ * metrics_remap_peers - Follow the peers of a reloaded config
+ * 
+ * @param config   the new config
+ * @param map      see ftm_config_peer_map()
+ * 
+ * @note
+ * Counters of the peers kept by @config are kept, the others start at 0.
+ * Call it from the thread calling metrics_record_results().
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int metrics_remap_peers(struct metrics *metrics, struct ftm_config *config,
+                        const int *map);
+
+/**
+ * metrics_add_gauge - Register a gauge
+ * 
+ * @param metrics   metrics instance
+ * @param name      metric name, must outlive the metrics
+ * @param help      help text, must outlive the metrics
+ * 
+ * @note
+ * Register everything before metrics_start_server().
+ * 
+ * @return gauge id to pass to metrics_set_gauge(), -1 on failure
+ */
+int metrics_add_gauge(struct metrics *metrics, const char *name,
+                      const char *help);
+
+/**
+ * metrics_add_value - Register a gauge or counter of any precision
+ * 
+ * @param metrics    metrics instance
+ * @param name       metric name, must outlive the metrics
+ * @param type       "gauge" or "counter"
+ * @param help       help text, must outlive the metrics
+ * @param decimals   the value set is a fixed-point number with this many
+ *                   decimals, like 3 for a rate set in thousandths
+ * 
+ * @return id to pass to metrics_set_gauge(), -1 on failure
+ */
+int metrics_add_value(struct metrics *metrics, const char *name,
+                      const char *type, const char *help, int decimals);
+
+/**
+ * metrics_set_gauge - Set the value of a gauge
+ */
+void metrics_set_gauge(struct metrics *metrics, int id, int64_t value);
+
+/**
+ * metrics_add_hist - Register a histogram, exported as a summary
+ * 
+ * @param metrics       metrics instance
+ * @param name          metric name, must outlive the metrics
+ * @param label         label name, must outlive the metrics
+ * @param label_value   label value, copied
+ * @param hist          histogram in nanoseconds, owned by the caller
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int metrics_add_hist(struct metrics *metrics, const char *name,
+                     const char *label, const char *label_value,
+                     const struct hist *hist);
+
+/**
+ * metrics_record_results - Update counters with the results of a session
+ * 
+ * @param metrics   metrics instance
+ * @param results   results of the session, in config order
+ */
+void metrics_record_results(struct metrics *metrics,
+                            struct ftm_results_wrap *results);
+
+/**
+ * metrics_record_failure - Count a failed session
+ */
+void metrics_record_failure(struct metrics *metrics);
+
+/**
+ * metrics_fail_reason_name - Label of a fail_reason, like "no_response"
+ * 
+ * @return the label, "other" for unknown reasons
+ */
+const char *metrics_fail_reason_name(uint32_t reason);
+
+/**
+ * metrics_start_server - Serve snapshots on a Unix domain socket
+ * 
+ * @param metrics   metrics instance
+ * @param path      socket path, replaced if it exists
+ * @param error     buffer of FTM_ERROR_MAX bytes, see ftm_report_error()
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int metrics_start_server(struct metrics *metrics, const char *path,
+                         char *error);
+
+/**
+ * metrics_stop_server - Stop the server and remove the socket
+ */
+void metrics_stop_server(struct metrics *metrics);
+
+/**
+ * metrics_snapshot - Write a snapshot in the Prometheus text format
+ * 
+ * @param metrics   metrics instance
+ * @param buf       output buffer
+ * @param size      size of the buffer
+ * 
+ * @return number of bytes needed, which may exceed @size
+ */
+int metrics_snapshot(struct metrics *metrics, char *buf, int size);
+#endif
@@ -1,4 +1,71 @@
+#define _GNU_SOURCE
 #include "nl.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <time.h>
+
+/**
+ * struct nl_status - Progress of nl_sock_handle()
+ * 
+ * @err: 1 while receiving, 0 when done, negative error code on failure
+ * @error: where errors are reported
+ * 
+ * @note
+ * @err must stay the first member, handlers receive it as an int pointer.
+ */
+struct nl_status {
+    int err;
+    char *error;
+};
+
+/**
+ * struct nl_rx - Receive buffers of nl_sock_recv()
+ * 
+ * @slots: one message per datagram, whose buffer the datagram is received
+ * into, so that its first message is dispatched without a copy
+ * @scratch: message the other messages of a datagram are copied into
+ * @msgs: arguments of recvmmsg()
+ * @iov: buffers of @slots
+ * @addr: senders of the datagrams
+ * @control: ancillary data of the datagrams, room for SCM_TIMESTAMPNS
+ * @time_ns: receive time of the datagrams, CLOCK_REALTIME
+ * @count: datagrams received by the last recvmmsg()
+ * @next: first datagram not dispatched yet
+ * @offset: bytes of datagram @next already dispatched
+ */
+struct nl_rx {
+    struct nl_msg *slots[NL_RX_BATCH];
+    struct nl_msg *scratch;
+    struct mmsghdr msgs[NL_RX_BATCH];
+    struct iovec iov[NL_RX_BATCH];
+    struct sockaddr_nl addr[NL_RX_BATCH];
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(struct timespec))];
+    } control[NL_RX_BATCH];
+    uint64_t time_ns[NL_RX_BATCH];
+    int count;
+    int next;
+    int offset;
+};
+
+void ftm_report_error(char *error, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    if (error) {
+        vsnprintf(error, FTM_ERROR_MAX, fmt, args);
+    } else {
+        vfprintf(stderr, fmt, args);
+        fputc('\n', stderr);
+    }
+    va_end(args);
+}
 
 static int error_handler(struct sockaddr_nl *nla, struct nlmsgerr *err,
                          void *arg) {
@@ -6,13 +73,14 @@ static int error_handler(struct sockaddr_nl *nla, struct nlmsgerr *err,
     int len = nlh->nlmsg_len;
     struct nlattr *attrs;
     struct nlattr *tb[3 + 1];
-    int *ret = arg;
+    struct nl_status *status = arg;
+    int *ret = &status->err;
     int ack_len = sizeof(*nlh) + sizeof(int) + sizeof(*nlh);
 
     if (err->error > 0) {
-        fprintf(stderr,
-                "ERROR: received positive netlink error code %d\n",
-                err->error);
+        ftm_report_error(status->error,
+                         "ERROR: received positive netlink error code %d",
+                         err->error);
         *ret = -EPROTO;
     } else {
         *ret = err->error;
@@ -34,17 +102,13 @@ static int error_handler(struct sockaddr_nl *nla, struct nlmsgerr *err,
     if (tb[1]) {
         len = strnlen((char *)nla_data(tb[1]),
                       nla_len(tb[1]));
-        fprintf(stderr, "kernel reports: %*s\n", len,
-                (char *)nla_data(tb[1]));
+        ftm_report_error(status->error, "kernel reports: %*s", len,
+                         (char *)nla_data(tb[1]));
     }
 
     return NL_STOP;
 }
 
-int valid_handler(struct nl_msg *msg, void *arg) {
-    return NL_OK;
-}
-
 static int finish_handler(struct nl_msg *msg, void *arg) {
     int *ret = arg;
     *ret = 0;
@@ -57,8 +121,36 @@ static int ack_handler(struct nl_msg *msg, void *arg) {
     return NL_STOP;
 }
 
-static int no_seq_check(struct nl_msg *msg, void *arg) {
-    return NL_OK;
+static void free_nl_rx(struct nl_rx *rx) {
+    if (!rx)
+        return;
+    for (int i = 0; i < NL_RX_BATCH; i++) {
+        if (rx->slots[i])
+            nlmsg_free(rx->slots[i]);
+    }
+    if (rx->scratch)
+        nlmsg_free(rx->scratch);
+    free(rx);
+}
+
+static struct nl_rx *alloc_nl_rx() {
+    struct nl_rx *rx = calloc(1, sizeof(struct nl_rx));
+    if (!rx)
+        return NULL;
+    rx->scratch = nlmsg_alloc_size(NL_RX_SLOT);
+    if (!rx->scratch)
+        goto handle_free;
+    for (int i = 0; i < NL_RX_BATCH; i++) {
+        rx->slots[i] = nlmsg_alloc_size(NL_RX_SLOT);
+        if (!rx->slots[i])
+            goto handle_free;
+        rx->iov[i].iov_base = nlmsg_hdr(rx->slots[i]);
+        rx->iov[i].iov_len = NL_RX_SLOT;
+    }
+    return rx;
+handle_free:
+    free_nl_rx(rx);
+    return NULL;
 }
 
 int nl80211_init(struct nl80211_state *state) {  // from iw
@@ -66,81 +158,400 @@ int nl80211_init(struct nl80211_state *state) {  // from iw
 
     state->nl_sock = nl_socket_alloc();
     if (!state->nl_sock) {
-        fprintf(stderr, "Failed to allocate netlink socket.\n");
+        ftm_report_error(state->error, "Failed to allocate netlink socket.");
         return -ENOMEM;
     }
 
     if (genl_connect(state->nl_sock)) {
-        fprintf(stderr, "Failed to connect to generic netlink.\n");
+        ftm_report_error(state->error,
+                         "Failed to connect to generic netlink.");
         err = -ENOLINK;
         goto out_handle_destroy;
     }
 
-    err = nl_socket_set_buffer_size(state->nl_sock, 32 * 1024, 32 * 1024);
-
-    if (err)
-        return 1;
+    err = nl_socket_set_buffer_size(state->nl_sock, 0, 32 * 1024);
+    if (err || nl_sock_set_rcvbuf(state, state->rcvbuf > NL_RCVBUF_DEFAULT ?
+                                         state->rcvbuf : NL_RCVBUF_DEFAULT)) {
+        ftm_report_error(state->error, "Failed to set buffer size.");
+        err = -ENOBUFS;
+        goto out_handle_destroy;
+    }
     err = 1;
     setsockopt(nl_socket_get_fd(state->nl_sock), 270,
                1, &err, sizeof(err));
+    /* best effort, see struct nl80211_state */
+    setsockopt(nl_socket_get_fd(state->nl_sock), SOL_SOCKET, SO_TIMESTAMPNS,
+               &err, sizeof(err));
 
     state->nl80211_id = genl_ctrl_resolve(state->nl_sock, "nl80211");
     if (state->nl80211_id < 0) {
-        fprintf(stderr, "nl80211 not found.\n");
+        ftm_report_error(state->error, "nl80211 not found.");
         err = -ENOENT;
         goto out_handle_destroy;
     }
 
+    /* kept by nl_sock_resync() */
+    if (!state->rx) {
+        state->rx = alloc_nl_rx();
+        if (!state->rx) {
+            ftm_report_error(state->error,
+                             "Failed to allocate receive buffers.");
+            err = -ENOMEM;
+            goto out_handle_destroy;
+        }
+    }
+
     return 0;
 
 out_handle_destroy:
     nl_socket_free(state->nl_sock);
+    state->nl_sock = NULL;
     return err;
 }
 
+int nl_route_init(struct nl80211_state *state) {
+    state->nl_sock = nl_socket_alloc();
+    if (!state->nl_sock) {
+        ftm_report_error(state->error, "Failed to allocate netlink socket.");
+        return -ENOMEM;
+    }
+    int err;
+    if (nl_connect(state->nl_sock, NETLINK_ROUTE)) {
+        ftm_report_error(state->error, "Failed to connect to rtnetlink.");
+        err = -ENOLINK;
+        goto out_handle_destroy;
+    }
+    if (nl_sock_set_rcvbuf(state, NL_RCVBUF_DEFAULT)) {
+        err = -ENOBUFS;
+        goto out_handle_destroy;
+    }
+    state->rx = alloc_nl_rx();
+    if (!state->rx) {
+        ftm_report_error(state->error, "Failed to allocate receive buffers.");
+        err = -ENOMEM;
+        goto out_handle_destroy;
+    }
+    return 0;
+
+out_handle_destroy:
+    nl_socket_free(state->nl_sock);
+    state->nl_sock = NULL;
+    return err;
+}
+
+void nl80211_free(struct nl80211_state *state) {
+    if (state->nl_sock)
+        nl_socket_free(state->nl_sock);
+    state->nl_sock = NULL;
+    free_nl_rx(state->rx);
+    state->rx = NULL;
+}
+
 struct nl_cb_arg alloc_nl_cb_arg(void *arg) {
     struct nl_cb_arg cb_arg = {arg, NULL};
     return cb_arg;
 }
 
-int nl_sock_handle(struct nl80211_state *state, struct nl_msg *msg,
-                   nl_recvmsg_msg_cb_t handler, struct nl_cb_arg *arg) {
-    int err;
-    struct nl_cb *cb = nl_cb_alloc(NL_CB_CUSTOM);
-    if (!cb) {
-        fprintf(stderr, "Fail to allocate callback\n");
+int nl_sock_send(struct nl80211_state *state, struct nl_msg *msg) {
+    int err = nl_send_auto(state->nl_sock, msg);
+    nlmsg_free(msg);
+    if (err < 0) {
+        ftm_report_error(state->error, "Fail to send message: %s",
+                         nl_geterror(err));
         return 1;
     }
+    return 0;
+}
 
+int nl_sock_handle(struct nl80211_state *state, struct nl_msg *msg,
+                   nl_recvmsg_msg_cb_t handler, struct nl_cb_arg *arg) {
     if (msg) {
-        err = nl_send_auto(state->nl_sock, msg);
-        if (err < 0)
+        if (nl_send_auto(state->nl_sock, msg) < 0) {
+            ftm_report_error(state->error, "Fail to send message");
             return 1;
+        }
     }
-    
-    err = 1;
-    if (arg)
-        arg->state = &err;
+    return nl_sock_wait(state, handler, arg, -1, -1);
+}
+
+static int64_t monotonic_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-    nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, valid_handler, NULL);
-    nl_cb_err(cb, NL_CB_CUSTOM, error_handler, &err);
-    nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, finish_handler, &err);
-    nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, ack_handler, &err);
+int nl_sock_wait(struct nl80211_state *state, nl_recvmsg_msg_cb_t handler,
+                 struct nl_cb_arg *arg, int wake_fd, int timeout_ms) {
+    struct nl_status status = {1, state->error};
+    int *err = &status.err;
 
-    if (handler)
-        nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, handler, arg);
-    else
-        nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, valid_handler, NULL);
+    if (arg)
+        arg->state = err;
+
+    struct nl_rx_cb cb = {
+        .valid = handler,
+        .valid_arg = arg,
+        .ack = ack_handler,
+        .ack_arg = err,
+        .finish = finish_handler,
+        .finish_arg = err,
+        .error = error_handler,
+        .error_arg = &status,
+        .status = err,
+    };
     
-    while (err > 0)
-        nl_recvmsgs(state->nl_sock, cb);
-    if (err < 0) {
-        fprintf(stderr, "Command failed: %s (%d)\n", strerror(-err), err);
+    int64_t end = timeout_ms >= 0 ? monotonic_ms() + timeout_ms : -1;
+    while (*err > 0) {
+        /* messages already received are dispatched first */
+        struct nl_rx *rx = state->rx;
+        if ((wake_fd >= 0 || end >= 0) && rx->next >= rx->count) {
+            struct pollfd fds[2] = {
+                {nl_socket_get_fd(state->nl_sock), POLLIN, 0},
+                {wake_fd, POLLIN, 0},
+            };
+            int left = -1;
+            if (end >= 0) {
+                int64_t now = monotonic_ms();
+                left = end > now ? end - now : 0;
+            }
+            int count = poll(fds, 2, left);
+            if (count == 0)
+                return NL_SOCK_TIMEOUT;
+            if (count < 0) {
+                if (errno == EINTR)
+                    continue;
+                ftm_report_error(state->error, "Fail to wait: %s",
+                                 strerror(errno));
+                *err = -errno;
+                break;
+            }
+            if (fds[1].revents)
+                return NL_SOCK_WOKEN;
+        }
+        int res = nl_sock_recv(state, &cb, true);
+        if (res >= 0 || res == -NLE_AGAIN)
+            continue;
+        /* the reply we wait for may be lost, never wait forever */
+        if (nl_sock_is_overrun(res)) {
+            state->overruns++;
+            ftm_report_error(state->error,
+                             "Receive buffer overrun (%d bytes), "
+                             "messages lost", state->rcvbuf);
+            *err = -ENOBUFS;
+        } else {
+            ftm_report_error(state->error, "Fail to receive: %s",
+                             nl_geterror(res));
+            *err = -EIO;
+        }
+    }
+    if (*err < 0) {
+        /* keep the more specific message from the kernel if there is one */
+        if (!state->error || !*state->error)
+            ftm_report_error(state->error, "Command failed: %s (%d)",
+                             strerror(-*err), *err);
+        return 1;
+    }
+    return 0;
+}
+
+/* read the datagrams queued on the socket, at most NL_RX_BATCH */
+static int rx_fill(struct nl80211_state *state, bool wait) {
+    struct nl_rx *rx = state->rx;
+    int fd = nl_socket_get_fd(state->nl_sock);
+    int count;
+
+    for (int i = 0; i < NL_RX_BATCH; i++) {
+        struct msghdr *hdr = &rx->msgs[i].msg_hdr;
+        memset(hdr, 0, sizeof(struct msghdr));
+        hdr->msg_name = &rx->addr[i];
+        hdr->msg_namelen = sizeof(struct sockaddr_nl);
+        hdr->msg_iov = &rx->iov[i];
+        hdr->msg_iovlen = 1;
+        hdr->msg_control = rx->control[i].buf;
+        hdr->msg_controllen = sizeof(rx->control[i].buf);
+    }
+    do {
+        state->rx_stats.syscalls++;
+        /* MSG_WAITFORONE only blocks for the first datagram */
+        count = recvmmsg(fd, rx->msgs, NL_RX_BATCH,
+                         wait ? MSG_WAITFORONE : MSG_DONTWAIT, NULL);
+    } while (count < 0 && errno == EINTR);
+    /* before any dispatching, for the datagrams the kernel did not stamp */
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    rx->count = 0;
+    rx->next = 0;
+    rx->offset = 0;
+    if (count < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return -NLE_AGAIN;
+        if (errno == ENOBUFS)
+            return -NLE_NOMEM;
+        return -nl_syserr2nlerr(errno);
+    }
+    rx->count = count;
+    state->rx_stats.datagrams += count;
+    for (int i = 0; i < count; i++) {
+        struct msghdr *hdr = &rx->msgs[i].msg_hdr;
+        struct timespec *ts = &now;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg;
+             cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET &&
+                cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                ts = (struct timespec *)CMSG_DATA(cmsg);
+                state->rx_stats.stamped++;
+            }
+        }
+        rx->time_ns[i] = (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+        state->rx_stats.bytes += rx->msgs[i].msg_len;
+    }
+    return count;
+}
+
+static int rx_dispatch_msg(struct nl_msg *msg, const struct nl_rx_cb *cb) {
+    struct nlmsghdr *nlh = nlmsg_hdr(msg);
+    switch (nlh->nlmsg_type) {
+    case NLMSG_NOOP:
+        return NL_SKIP;
+    case NLMSG_OVERRUN:
+        return -NLE_MSG_OVERFLOW;
+    case NLMSG_DONE:
+        return cb->finish ? cb->finish(msg, cb->finish_arg) : NL_SKIP;
+    case NLMSG_ERROR: {
+        struct nlmsgerr *e = nlmsg_data(nlh);
+        if (nlh->nlmsg_len < nlmsg_size(sizeof(struct nlmsgerr)))
+            return -NLE_MSG_TRUNC;
+        if (!e->error)
+            return cb->ack ? cb->ack(msg, cb->ack_arg) : NL_SKIP;
+        if (!cb->error)
+            return -nl_syserr2nlerr(e->error);
+        return cb->error(nlmsg_get_src(msg), e, cb->error_arg);
+    }
+    default:
+        return cb->valid ? cb->valid(msg, cb->valid_arg) : NL_SKIP;
+    }
+}
+
+/* walk the datagrams received, 1 if a callback stopped, 0 when done */
+static int rx_dispatch(struct nl80211_state *state,
+                       const struct nl_rx_cb *cb) {
+    struct nl_rx *rx = state->rx;
+    while (rx->next < rx->count) {
+        int idx = rx->next;
+        struct mmsghdr *mmsg = &rx->msgs[idx];
+        struct nl_msg *msg = rx->slots[idx];
+        struct nlmsghdr *nlh = (struct nlmsghdr *)
+                               ((char *)nlmsg_hdr(msg) + rx->offset);
+        int len = mmsg->msg_len - rx->offset;
+
+        if (mmsg->msg_hdr.msg_flags & MSG_TRUNC) {
+            rx->next++;
+            return -NLE_MSG_TRUNC;
+        }
+        if (!nlmsg_ok(nlh, len)) {
+            rx->next++;
+            rx->offset = 0;
+            continue;
+        }
+        if (rx->offset) {
+            memcpy(nlmsg_hdr(rx->scratch), nlh, nlh->nlmsg_len);
+            state->rx_stats.copied += nlh->nlmsg_len;
+            msg = rx->scratch;
+        }
+        nlmsg_set_src(msg, &rx->addr[idx]);
+
+        /* move on first, a stop keeps the rest for the next call */
+        rx->offset += NLMSG_ALIGN(nlh->nlmsg_len);
+        if (rx->offset >= mmsg->msg_len) {
+            rx->next++;
+            rx->offset = 0;
+        }
+        state->rx_stats.messages++;
+        state->rx_time_ns = rx->time_ns[idx];
+        int res = rx_dispatch_msg(msg, cb);
+        if (res < 0)
+            return res;
+        if (res == NL_STOP || (cb->status && *cb->status <= 0))
+            return 1;
+    }
+    return 0;
+}
+
+int nl_sock_recv(struct nl80211_state *state, const struct nl_rx_cb *cb,
+                 bool wait) {
+    struct nl_rx *rx = state->rx;
+    bool received = rx->next < rx->count;
+    while (1) {
+        int res = rx_dispatch(state, cb);
+        if (res)
+            return res;
+        /* a batch that was not full emptied the queue */
+        if (received && rx->count < NL_RX_BATCH)
+            return 0;
+        res = rx_fill(state, wait && !received);
+        if (res == -NLE_AGAIN && received)
+            return 0;
+        if (res < 0)
+            return res;
+        received = true;
+    }
+}
+
+int nl_sock_set_rcvbuf(struct nl80211_state *state, int bytes) {
+    int fd = nl_socket_get_fd(state->nl_sock);
+    if (bytes > NL_RCVBUF_MAX)
+        bytes = NL_RCVBUF_MAX;
+    /* the kernel doubles the value for its bookkeeping overhead */
+    int value = bytes / 2;
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &value, sizeof(value)) &&
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &value, sizeof(value))) {
+        ftm_report_error(state->error, "Fail to set receive buffer: %s",
+                         strerror(errno));
         return 1;
     }
+    socklen_t len = sizeof(value);
+    if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &value, &len))
+        value = bytes;
+    state->rcvbuf = value;
     return 0;
 }
 
+bool nl_sock_is_overrun(int nl_err) {
+    return nl_err == -NLE_NOMEM;
+}
+
+/* move to a new socket with a receive buffer of @rcvbuf bytes */
+static int replace_sock(struct nl80211_state *state, int rcvbuf) {
+    struct nl80211_state fresh = *state;
+    fresh.rcvbuf = rcvbuf;
+    if (nl80211_init(&fresh))
+        return 1;
+    nl_socket_free(state->nl_sock);
+    /* whatever was received from the old socket is stale */
+    fresh.rx->count = 0;
+    fresh.rx->next = 0;
+    fresh.rx->offset = 0;
+    *state = fresh;
+    return 0;
+}
+
+int nl_sock_resync(struct nl80211_state *state) {
+    return replace_sock(state, state->rcvbuf < NL_RCVBUF_MAX / 2 ?
+                               state->rcvbuf * 2 : NL_RCVBUF_MAX);
+}
+
+int nl_sock_reopen(struct nl80211_state *state) {
+    return replace_sock(state, state->rcvbuf);
+}
+
+int nl_sock_rx_queued(struct nl80211_state *state) {
+    int queued;
+    if (ioctl(nl_socket_get_fd(state->nl_sock), SIOCINQ, &queued))
+        return -1;
+    return queued;
+}
+
 struct nl_msg *init_nl_msg_with_if(const char *if_name, int nl80211_id) {
     struct nl_msg *msg = nlmsg_alloc();
     if (!msg) {
@@ -149,11 +560,13 @@ struct nl_msg *init_nl_msg_with_if(const char *if_name, int nl80211_id) {
     }
     if (!if_name) {
         fprintf(stderr, "No interface name provided!\n");
+        nlmsg_free(msg);
         return NULL;
     }
     int if_idx = if_nametoindex(if_name);
     if (!if_idx) {
         fprintf(stderr, "Fail to find device interface %s!\n", if_name);
+        nlmsg_free(msg);
         return NULL;
     }
     NLA_PUT_U32(msg, NL80211_ATTR_IFINDEX, if_idx);
@@ -11,20 +11,119 @@
 #include <stdbool.h>
 #include <linux/nl80211.h>
 
+#define FTM_ERROR_MAX 256
+
+/* receive buffer of a new socket, and the most nl_sock_set_rcvbuf() sets */
+#define NL_RCVBUF_DEFAULT (64 * 1024)
+#define NL_RCVBUF_MAX (64 * 1024 * 1024)
+
+/*
+ * datagrams read by one recvmmsg(), and the bytes each may hold: netlink
+ * sizes its datagrams after the reads, up to 32 KiB
+ */
+#define NL_RX_BATCH 8
+#define NL_RX_SLOT (32 * 1024)
+
+/**
+ * ftm_report_error - Record an error message
+ * 
+ * @param error   buffer of FTM_ERROR_MAX bytes receiving the message, or
+ *                NULL to print the message on stderr
+ * @param fmt     printf() format of the message
+ */
+void ftm_report_error(char *error, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/**
+ * struct nl_rx_stats - Work done by nl_sock_recv()
+ * 
+ * @syscalls: recvmmsg() calls
+ * @datagrams: datagrams received
+ * @messages: netlink messages dispatched
+ * @bytes: bytes received
+ * @copied: bytes copied out of the receive buffers, the first message of a
+ * datagram is handed to the callbacks in place
+ * @stamped: datagrams carrying their kernel receive time (SCM_TIMESTAMPNS)
+ */
+struct nl_rx_stats {
+    uint64_t syscalls;
+    uint64_t datagrams;
+    uint64_t messages;
+    uint64_t bytes;
+    uint64_t copied;
+    uint64_t stamped;
+};
+
+struct nl_rx;
+
+/**
+ * struct nl80211_state - Netlink socket used to talk to nl80211
+ * 
+ * @nl_sock: the socket
+ * @nl80211_id: generic netlink family id of nl80211
+ * @error: where errors are reported, see ftm_report_error()
+ * @rcvbuf: bytes the kernel may queue on the socket, see
+ * nl_sock_set_rcvbuf()
+ * @overruns: number of times the receive buffer overflowed (ENOBUFS) and
+ * messages were lost
+ * @rx: receive buffers of nl_sock_recv(), allocated by nl80211_init() or
+ * nl_route_init() unless already set
+ * @rx_stats: counters of nl_sock_recv()
+ * @rx_time_ns: receive time of the message being dispatched by
+ * nl_sock_recv(), CLOCK_REALTIME
+ * 
+ * @note
+ * @rx_time_ns is CLOCK_REALTIME read right after recvmmsg() returns,
+ * before any message of the batch is dispatched, so the callbacks do not
+ * delay it. The kernel does not stamp netlink datagrams. nl80211_init()
+ * still asks for SO_TIMESTAMPNS, and a stamp would be used instead if one
+ * came, counted in @rx_stats.
+ */
 struct nl80211_state {
     struct nl_sock *nl_sock;
     int nl80211_id;
+    char *error;
+    int rcvbuf;
+    uint64_t overruns;
+    struct nl_rx *rx;
+    struct nl_rx_stats rx_stats;
+    uint64_t rx_time_ns;
 };
 
 /**
  * nl80211_init - Initialize socket and nl80211 identifier
  * 
- * @param state   nl80211_state pointer to be filled
+ * @param state   the state, zeroed before the first call
  * 
- * @return 0 on success, 1 on failure
+ * @note
+ * Set state->error before calling, NULL to report errors on stderr.
+ * state->rcvbuf and state->rx are read as well: a larger receive buffer
+ * is kept and existing receive buffers are reused, as nl_sock_resync()
+ * relies on. Garbage in them is used as is, so never pass an
+ * uninitialized state.
+ * 
+ * @return 0 on success, non-zero on failure
  */
 int nl80211_init(struct nl80211_state *state);
 
+/**
+ * nl_route_init - Open a NETLINK_ROUTE socket instead
+ * 
+ * @param state   the state, zeroed, nl80211_id is unused
+ * 
+ * @note
+ * For rtnetlink requests and events through nl_sock_recv(), free it with
+ * nl80211_free().
+ * 
+ * @return 0 on success, non-zero on failure
+ */
+int nl_route_init(struct nl80211_state *state);
+
+/**
+ * nl80211_free - Close the socket and free the receive buffers
+ */
+void nl80211_free(struct nl80211_state *state);
+
 /**
  * struct nl_cb_arg - Argument pass to the callback
  * 
@@ -48,6 +147,19 @@ struct nl_cb_arg {
  */
 struct nl_cb_arg alloc_nl_cb_arg(void *arg);
 
+/**
+ * nl_sock_send - Send a netlink message without waiting for the reply
+ * 
+ * @param state   nl80211_state instance created by nl80211_init()
+ * @param msg     Netlink message to be sent. It is freed on return.
+ * 
+ * @note
+ * Use nl_sock_handle() with a NULL message to receive the ACK.
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int nl_sock_send(struct nl80211_state *state, struct nl_msg *msg);
+
 /**
  * nl_sock_handle - Start receiving or sending netlink message
  * 
@@ -62,5 +174,130 @@ struct nl_cb_arg alloc_nl_cb_arg(void *arg);
 int nl_sock_handle(struct nl80211_state *state, struct nl_msg *msg,
                    nl_recvmsg_msg_cb_t handler, struct nl_cb_arg *arg);
 
+/* returned by nl_sock_wait() when woken up, or when the time is up */
+#define NL_SOCK_WOKEN 2
+#define NL_SOCK_TIMEOUT 3
+
+/**
+ * nl_sock_wait - nl_sock_handle() without sending, which other events or
+ * a timeout may interrupt
+ * 
+ * @param wake_fd      stop waiting once this fd is readable, -1 for none
+ * @param timeout_ms   stop waiting after this long, -1 for none
+ * 
+ * @note
+ * Messages received before waking up are dispatched, the others stay on
+ * the socket: call it again with the same handler to go on waiting.
+ * 
+ * @return 0 on success, 1 on failure, NL_SOCK_WOKEN if woken up,
+ * NL_SOCK_TIMEOUT if the time is up
+ */
+int nl_sock_wait(struct nl80211_state *state, nl_recvmsg_msg_cb_t handler,
+                 struct nl_cb_arg *arg, int wake_fd, int timeout_ms);
+
+/**
+ * struct nl_rx_cb - Callbacks of nl_sock_recv()
+ * 
+ * @valid: called with each message that is not a control message
+ * @ack: called with each NLMSG_ERROR carrying no error
+ * @finish: called with each NLMSG_DONE
+ * @error: called with each NLMSG_ERROR carrying an error, which fails
+ * nl_sock_recv() if NULL
+ * @status: if not NULL, dispatching stops once *@status <= 0
+ * 
+ * @note
+ * Unset callbacks skip the message. Callbacks return NL_OK or NL_SKIP to
+ * go on, NL_STOP to stop dispatching, or a negative error code.
+ */
+struct nl_rx_cb {
+    nl_recvmsg_msg_cb_t valid;
+    void *valid_arg;
+    nl_recvmsg_msg_cb_t ack;
+    void *ack_arg;
+    nl_recvmsg_msg_cb_t finish;
+    void *finish_arg;
+    nl_recvmsg_err_cb_t error;
+    void *error_arg;
+    int *status;
+};
+
+/**
+ * nl_sock_recv - Receive queued messages in batches
+ * 
+ * @param state   nl80211_state instance created by nl80211_init()
+ * @param cb      callbacks of the messages
+ * @param wait    block until a message arrives, otherwise return when the
+ *                queue is empty
+ * 
+ * @note
+ * Each recvmmsg() reads up to NL_RX_BATCH datagrams into buffers reused
+ * across calls, and the messages are walked in place. Messages left when
+ * dispatching stops are kept for the next call.
+ * 
+ * @return 1 if dispatching was stopped, 0 once the messages received are
+ * dispatched, -NLE_AGAIN if nothing was queued (without @wait), or another
+ * negative libnl error code, -NLE_NOMEM meaning an overrun
+ */
+int nl_sock_recv(struct nl80211_state *state, const struct nl_rx_cb *cb,
+                 bool wait);
+
+/**
+ * nl_sock_set_rcvbuf - Resize the receive buffer of the socket
+ * 
+ * @param state   nl80211_state instance created by nl80211_init()
+ * @param bytes   bytes the kernel may queue, capped at NL_RCVBUF_MAX
+ * 
+ * @note
+ * SO_RCVBUFFORCE is used when permitted (CAP_NET_ADMIN), otherwise
+ * SO_RCVBUF, which the kernel caps at net.core.rmem_max. state->rcvbuf
+ * receives the size actually set, which may be less than @bytes.
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int nl_sock_set_rcvbuf(struct nl80211_state *state, int bytes);
+
+/**
+ * nl_sock_is_overrun - Whether an error of nl_sock_recv() is an overrun
+ * 
+ * @note
+ * ENOBUFS is reported as NLE_NOMEM, as libnl does: the receive buffer
+ * overflowed and the kernel dropped messages, the stream must be
+ * resynchronized.
+ */
+bool nl_sock_is_overrun(int nl_err);
+
+/**
+ * nl_sock_resync - Replace the socket after an overrun
+ * 
+ * @param state   nl80211_state instance created by nl80211_init()
+ * 
+ * @note
+ * The new socket has a receive buffer twice as large. Closing the old one
+ * drops whatever was queued and makes the kernel abort the measurements it
+ * started, so the caller starts them again. @state->overruns, the receive
+ * buffers of nl_sock_recv() and their counters are kept.
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int nl_sock_resync(struct nl80211_state *state);
+
+/**
+ * nl_sock_reopen - Replace the socket, keeping the size of its buffer
+ * 
+ * @note
+ * Like nl_sock_resync(), this drops whatever was queued and aborts the
+ * measurements the old socket started.
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int nl_sock_reopen(struct nl80211_state *state);
+
+/**
+ * nl_sock_rx_queued - Bytes waiting in the receive queue of the socket
+ * 
+ * @return number of bytes, -1 on failure
+ */
+int nl_sock_rx_queued(struct nl80211_state *state);
+
 struct nl_msg *init_nl_msg_with_if(const char *if_name, int nl80211_id);
 #endif
\ No newline at end of file
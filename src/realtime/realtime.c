@@ -0,0 +1,162 @@
+#define _GNU_SOURCE
+#include "realtime.h"
+#include "../nl/nl.h"
+#include <errno.h>
+#include <malloc.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+int realtime_parse(const char *str, struct realtime *rt) {
+    char *end;
+    long cpu = strtol(str, &end, 10);
+    long priority = REALTIME_DEFAULT_PRIORITY;
+    bool use_probe = false;
+    if (end == str || cpu < 0 || cpu >= CPU_SETSIZE)
+        return 1;
+    if (*end == ':') {
+        const char *pos = end + 1;
+        priority = strtol(pos, &end, 10);
+        if (end == pos || priority < sched_get_priority_min(SCHED_FIFO) ||
+            priority > sched_get_priority_max(SCHED_FIFO))
+            return 1;
+    }
+    if (*end == ',') {
+        if (strcmp(end + 1, "probe") ||
+            priority <= sched_get_priority_min(SCHED_FIFO))
+            return 1;
+        use_probe = true;
+        end += strlen(end);
+    }
+    if (*end)
+        return 1;
+    memset(rt, 0, sizeof(struct realtime));
+    rt->cpu = cpu;
+    rt->priority = priority;
+    rt->use_probe = use_probe;
+    hist_init(&rt->wakeup);
+    hist_init(&rt->interval);
+    return 0;
+}
+
+int realtime_isolate(const struct realtime *rt, char *error) {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set)) {
+        ftm_report_error(error, "Fail to get the cpu affinity: %s!",
+                         strerror(errno));
+        return 1;
+    }
+    CPU_CLR(rt->cpu, &set);
+    if (!CPU_COUNT(&set)) {
+        ftm_report_error(error, "No other cpu for the helper threads, "
+                         "they share cpu %d!", rt->cpu);
+        return 0;
+    }
+    if (sched_setaffinity(0, sizeof(set), &set)) {
+        ftm_report_error(error, "Fail to set the cpu affinity: %s!",
+                         strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+/* touch the pages the stack may grow into, from a frame of that size */
+static void __attribute__((noinline)) prefault_stack() {
+    volatile char stack[REALTIME_STACK_PREFAULT];
+    for (size_t i = 0; i < sizeof(stack); i += 4096)
+        stack[i] = 0;
+}
+
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* inherits the core of realtime_enter(), one priority below it */
+static void *probe_thread(void *arg) {
+    struct realtime *rt = arg;
+    uint64_t target = monotonic_ns();
+    while (!__atomic_load_n(&rt->stop, __ATOMIC_RELAXED)) {
+        target += REALTIME_PROBE_NS;
+        struct timespec ts = {target / 1000000000, target % 1000000000};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+               EINTR)
+            ;
+        uint64_t now = monotonic_ns();
+        hist_record(&rt->wakeup, now > target ? now - target : 0);
+        /* skip the periods missed, like a suspend */
+        if (now > target + REALTIME_PROBE_NS)
+            target = now;
+    }
+    return NULL;
+}
+
+int realtime_enter(struct realtime *rt, char *error) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(rt->cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set)) {
+        ftm_report_error(error, "Fail to pin to cpu %d: %s!", rt->cpu,
+                         strerror(errno));
+        return 1;
+    }
+    struct sched_param param = {.sched_priority = rt->priority};
+    if (sched_setscheduler(0, SCHED_FIFO, &param)) {
+        ftm_report_error(error, "Fail to set SCHED_FIFO priority %d: %s!",
+                         rt->priority, strerror(errno));
+        return 1;
+    }
+    /* freed memory stays mapped and locked instead of faulting again */
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+        ftm_report_error(error, "Fail to lock memory: %s!", strerror(errno));
+        return 1;
+    }
+    prefault_stack();
+    if (!rt->use_probe)
+        return 0;
+    rt->stop = 0;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    param.sched_priority = rt->priority - 1;
+    pthread_attr_setschedparam(&attr, &param);
+    int err = pthread_create(&rt->probe, &attr, probe_thread, rt);
+    pthread_attr_destroy(&attr);
+    if (err) {
+        ftm_report_error(error, "Fail to start the probe thread: %s!",
+                         strerror(err));
+        return 1;
+    }
+    rt->probing = true;
+    return 0;
+}
+
+void realtime_stop(struct realtime *rt) {
+    if (!rt->probing)
+        return;
+    __atomic_store_n(&rt->stop, 1, __ATOMIC_RELAXED);
+    pthread_join(rt->probe, NULL);
+    rt->probing = false;
+}
+
+void realtime_mark(struct realtime *rt, uint64_t time_ns) {
+    if (rt->last_ns && time_ns > rt->last_ns)
+        hist_record(&rt->interval, time_ns - rt->last_ns);
+    rt->last_ns = time_ns;
+}
+
+void realtime_print(FILE *file, const struct realtime *rt) {
+    fprintf(file, "cpu %d, SCHED_FIFO priority %d, memory locked\n",
+            rt->cpu, rt->priority);
+    hist_print_header(file, "realtime (ns)");
+    if (rt->use_probe)
+        hist_print(file, "wakeup latency", &rt->wakeup);
+    hist_print(file, "sample interval", &rt->interval);
+}
@@ -0,0 +1,124 @@
+#ifndef _FTM_REALTIME_H
+#define _FTM_REALTIME_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "../hist/hist.h"
+
+/**
+ * DOC: Low-jitter real-time mode
+ * 
+ * Keeps the measurement thread from waiting behind other work on a loaded
+ * machine:
+ * 
+ * - realtime_isolate() moves the calling thread off the chosen core before
+ *   the helper threads (dashboard, metrics server) are created, so that
+ *   they inherit an affinity to every other core
+ * - realtime_enter() then pins the calling thread to the core, switches it
+ *   to SCHED_FIFO and locks all memory with mlockall(), which faults in
+ *   every buffer, pool and ring allocated so far and every mapping made
+ *   later. malloc() is told never to give memory back, and the stack is
+ *   touched down to REALTIME_STACK_PREFAULT bytes, so that no page fault
+ *   is left for the sessions
+ * 
+ * realtime_mark() records the spacing of the samples. On request, how well
+ * it works is also measured like cyclictest does: realtime_enter() starts a
+ * probe thread on the same core, one SCHED_FIFO priority below the
+ * measurement thread, which sleeps until an absolute time every
+ * REALTIME_PROBE_NS and records how late it woke up. Being below, it never
+ * preempts the measurement thread, and its latency includes the time the
+ * measurement thread itself keeps the core. The probe is opt-in as it
+ * still wakes the core up 1000 times per second.
+ */
+
+#define REALTIME_DEFAULT_PRIORITY 50
+#define REALTIME_PROBE_NS 1000000
+#define REALTIME_STACK_PREFAULT (512 * 1024)
+
+/**
+ * struct realtime - State of the real-time mode
+ * 
+ * @cpu: core the measurement thread is pinned to
+ * @priority: SCHED_FIFO priority of the measurement thread
+ * @use_probe: whether realtime_enter() starts @probe
+ * @wakeup: how late the probe thread woke up each time, in ns
+ * @interval: time between consecutive samples, in ns
+ * @last_ns: time of the last sample, 0 before the first one
+ * @probe: the probe thread
+ * @probing: whether @probe is running
+ * @stop: asks @probe to return
+ */
+struct realtime {
+    int cpu;
+    int priority;
+    bool use_probe;
+    struct hist wakeup;
+    struct hist interval;
+    uint64_t last_ns;
+    pthread_t probe;
+    bool probing;
+    int stop;
+};
+
+/**
+ * realtime_parse - Parse "<cpu>[:<priority>][,probe]"
+ * 
+ * @param str   the option value
+ * @param rt    receives the core, the priority and whether to probe,
+ *              histograms reset
+ * 
+ * @note
+ * The probe needs a priority above the minimum of SCHED_FIFO, to run
+ * below it.
+ * 
+ * @return 0 on success, 1 if malformed
+ */
+int realtime_parse(const char *str, struct realtime *rt);
+
+/**
+ * realtime_isolate - Keep the threads created from now on off @rt->cpu
+ * 
+ * @param rt      the options
+ * @param error   buffer of FTM_ERROR_MAX bytes, see ftm_report_error()
+ * 
+ * @note
+ * Without another core allowed, the affinity is left as is: a warning is
+ * reported in @error and 0 is returned.
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int realtime_isolate(const struct realtime *rt, char *error);
+
+/**
+ * realtime_enter - Pin the calling thread, make it SCHED_FIFO and lock
+ * all memory
+ * 
+ * @note
+ * Call it once every buffer used by the sessions is allocated. SCHED_FIFO
+ * and mlockall() need CAP_SYS_NICE and CAP_IPC_LOCK (or a large enough
+ * RLIMIT_MEMLOCK). Errors are reported in @error, see ftm_report_error().
+ * Starts the probe thread if asked for, stop it with realtime_stop().
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int realtime_enter(struct realtime *rt, char *error);
+
+/**
+ * realtime_stop - Stop the probe thread, if running
+ */
+void realtime_stop(struct realtime *rt);
+
+/**
+ * realtime_mark - Record the time of a sample
+ * 
+ * @param time_ns   CLOCK_REALTIME of the sample
+ */
+void realtime_mark(struct realtime *rt, uint64_t time_ns);
+
+/**
+ * realtime_print - Print the settings and both distributions
+ */
+void realtime_print(FILE *file, const struct realtime *rt);
+#endif
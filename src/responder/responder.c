@@ -1,7 +1,15 @@
 #include "responder.h"
+#include <getopt.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../initiator/initiator_output.h"
+#include "../metrics/metrics.h"
 
 int ftm_start_responder(const char *if_name) {
-    struct nl80211_state nlstate;
+    struct nl80211_state nlstate = {0};
     int err = 0;
     err = nl80211_init(&nlstate);
     if (err) {
@@ -28,8 +36,277 @@ int ftm_start_responder(const char *if_name) {
     nla_put_flag(msg, NL80211_FTM_RESP_ATTR_ENABLED);
     nla_nest_end(msg, ftm);
     err = nl_sock_handle(&nlstate, msg, NULL, NULL);
+    nl80211_free(&nlstate);
     return err;
 nla_put_failure:
     nlmsg_free(msg);
     return 1;
 }
+
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t realtime_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int responder_stats_handler(struct nl_msg *msg, void *arg) {
+    struct ftm_responder_stats *stats = ((struct nl_cb_arg *)arg)->arg;
+    struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+    struct nlattr *tb[NL80211_ATTR_MAX + 1];
+    struct nlattr *stats_tb[NL80211_FTM_STATS_MAX + 1];
+
+    nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+              genlmsg_attrlen(gnlh, 0), NULL);
+    if (!tb[NL80211_ATTR_FTM_RESPONDER_STATS] ||
+        nla_parse_nested(stats_tb, NL80211_FTM_STATS_MAX,
+                         tb[NL80211_ATTR_FTM_RESPONDER_STATS], NULL))
+        return NL_SKIP;
+#define __GET_RESPONDER_STAT(name, attr, type)                            \
+    if (stats_tb[NL80211_FTM_STATS_##attr]) {                             \
+        stats->name = nla_get_##type(stats_tb[NL80211_FTM_STATS_##attr]); \
+        stats->present |= 1u << FTM_RESPONDER_STAT_##name;                \
+    }
+    FTM_RESPONDER_STATS_FIELDS(__GET_RESPONDER_STAT)
+    return NL_SKIP;
+}
+
+int ftm_get_responder_stats(struct nl80211_state *state, uint32_t if_index,
+                            struct ftm_responder_stats *stats) {
+    memset(stats, 0, sizeof(struct ftm_responder_stats));
+    struct nl_msg *msg = nlmsg_alloc();
+    if (!msg) {
+        ftm_report_error(state->error, "Fail to allocate message!");
+        return 1;
+    }
+    if (!genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, state->nl80211_id, 0,
+                     0, NL80211_CMD_GET_FTM_RESPONDER_STATS, 0) ||
+        nla_put_u32(msg, NL80211_ATTR_IFINDEX, if_index)) {
+        ftm_report_error(state->error, "Fail to build stats request!");
+        nlmsg_free(msg);
+        return 1;
+    }
+    struct nl_cb_arg arg = alloc_nl_cb_arg(stats);
+    int err = nl_sock_handle(state, msg, responder_stats_handler, &arg);
+    nlmsg_free(msg);
+    if (err)
+        return 1;
+    if (!stats->present) {
+        ftm_report_error(state->error, "No responder statistics reported!");
+        return 1;
+    }
+    stats->timestamp_ns = monotonic_ns();
+    return 0;
+}
+
+int ftm_responder_stats_rates(const struct ftm_responder_stats *prev,
+                              const struct ftm_responder_stats *cur,
+                              struct ftm_responder_rates *rates) {
+    memset(rates, 0, sizeof(struct ftm_responder_rates));
+    if (cur->timestamp_ns <= prev->timestamp_ns)
+        return 1;
+    rates->interval = (cur->timestamp_ns - prev->timestamp_ns) / 1e9;
+    rates->present = prev->present & cur->present;
+#define __RESPONDER_RATE(name, attr, type)                  \
+    if (rates->present & (1u << FTM_RESPONDER_STAT_##name)) \
+        rates->name = (cur->name >= prev->name ?            \
+                       cur->name - prev->name : cur->name) / rates->interval;
+    FTM_RESPONDER_STATS_FIELDS(__RESPONDER_RATE)
+    return 0;
+}
+
+static volatile sig_atomic_t stats_stop;
+
+static void stop_stats(int sig) {
+    stats_stop = 1;
+}
+
+/**
+ * struct stats_metrics - Metrics ids of the counters and rates
+ */
+struct stats_metrics {
+    struct metrics *metrics;
+    int totals[FTM_RESPONDER_STAT_MAX];
+    int rates[FTM_RESPONDER_STAT_MAX];
+    int failures;
+};
+
+static int add_stats_metrics(struct stats_metrics *m) {
+#define __ADD_RESPONDER_METRICS(name, attr, type)                  \
+    m->totals[FTM_RESPONDER_STAT_##name] = metrics_add_value(      \
+        m->metrics, "ftm_responder_" #name "_total", "counter",    \
+        "NL80211_FTM_STATS_" #attr " of the responder", 0);        \
+    m->rates[FTM_RESPONDER_STAT_##name] = metrics_add_value(       \
+        m->metrics, "ftm_responder_" #name "_per_second", "gauge", \
+        "Increase of ftm_responder_" #name "_total per second", 3);
+    FTM_RESPONDER_STATS_FIELDS(__ADD_RESPONDER_METRICS)
+    m->failures = metrics_add_value(m->metrics,
+                                    "ftm_responder_poll_failures_total",
+                                    "counter",
+                                    "Failed readings of the statistics", 0);
+    return m->failures < 0;
+}
+
+static void set_stats_metrics(struct stats_metrics *m,
+                              const struct ftm_responder_stats *stats,
+                              const struct ftm_responder_rates *rates) {
+#define __SET_RESPONDER_METRICS(name, attr, type)                           \
+    if (stats->present & (1u << FTM_RESPONDER_STAT_##name))                 \
+        metrics_set_gauge(m->metrics, m->totals[FTM_RESPONDER_STAT_##name], \
+                          stats->name);                                     \
+    if (rates && rates->present & (1u << FTM_RESPONDER_STAT_##name))        \
+        metrics_set_gauge(m->metrics, m->rates[FTM_RESPONDER_STAT_##name],  \
+                          rates->name * 1000);
+    FTM_RESPONDER_STATS_FIELDS(__SET_RESPONDER_METRICS)
+}
+
+static void print_stats(const struct ftm_responder_stats *stats,
+                        const struct ftm_responder_rates *rates) {
+#define __PRINT_RESPONDER_STAT(name, attr, type)                         \
+    if (stats->present & (1u << FTM_RESPONDER_STAT_##name)) {            \
+        printf(#name " %lu", stats->name);                               \
+        if (rates && rates->present & (1u << FTM_RESPONDER_STAT_##name)) \
+            printf(" (%.2f/s)", rates->name);                            \
+        printf("  ");                                                    \
+    }
+    FTM_RESPONDER_STATS_FIELDS(__PRINT_RESPONDER_STAT)
+    /* share of the time spent in sessions, how loaded the responder is */
+    if (rates && rates->present & (1u << FTM_RESPONDER_STAT_duration_ms))
+        printf("busy %.1f%%", rates->duration_ms / 10);
+    printf("\n");
+    fflush(stdout);
+}
+
+static void print_stats_usage() {
+    printf("Valid args: [--interval=<ms>] [--count=<n>] "
+           "[--metrics=<socket_path>] [--output=csv|ndjson|bin] <if_name>\n");
+}
+
+int ftm_responder_stats_main(int argc, char **argv) {
+    static struct option long_options[] = {
+        {"interval", required_argument, NULL, 'i'},
+        {"count", required_argument, NULL, 'c'},
+        {"metrics", required_argument, NULL, 'm'},
+        {"output", required_argument, NULL, 'o'},
+        {NULL, 0, NULL, 0}
+    };
+    int interval_ms = 1000, count = 0, output_format = -1;
+    const char *metrics_path = NULL;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'i':
+                interval_ms = atoi(optarg);
+                break;
+            case 'c':
+                count = atoi(optarg);
+                break;
+            case 'm':
+                metrics_path = optarg;
+                break;
+            case 'o':
+                output_format = ftm_output_format_from_str(optarg);
+                /* archives only hold results of the initiator */
+                if (output_format < 0 ||
+                    output_format == FTM_OUTPUT_ARCHIVE) {
+                    print_stats_usage();
+                    return 1;
+                }
+                break;
+            default:
+                print_stats_usage();
+                return 1;
+        }
+    }
+    if (argc - optind != 1 || interval_ms <= 0) {
+        printf("Invalid arguments!\n");
+        print_stats_usage();
+        return 1;
+    }
+    uint32_t if_index = if_nametoindex(argv[optind]);
+    if (!if_index) {
+        fprintf(stderr, "Fail to find device interface %s!\n", argv[optind]);
+        return 1;
+    }
+
+    char error[FTM_ERROR_MAX] = "";
+    struct nl80211_state state = {0};
+    state.error = error;
+    if (nl80211_init(&state)) {
+        fprintf(stderr, "Fail to allocate socket: %s\n", error);
+        return 1;
+    }
+    int err = 1;
+    struct ftm_config no_peers = {if_index, 0, NULL};
+    struct stats_metrics m = {0};
+    struct ftm_output *output = NULL;
+    if (metrics_path) {
+        m.metrics = alloc_metrics(&no_peers);
+        if (!m.metrics || add_stats_metrics(&m) ||
+            metrics_start_server(m.metrics, metrics_path, NULL)) {
+            fprintf(stderr, "Fail to start metrics!\n");
+            goto clean_up;
+        }
+    }
+    if (output_format >= 0) {
+        output = alloc_ftm_output(output_format, STDOUT_FILENO, 0);
+        if (!output) {
+            fprintf(stderr, "Fail to allocate output!\n");
+            goto clean_up;
+        }
+    }
+
+    signal(SIGINT, stop_stats);
+    signal(SIGTERM, stop_stats);
+    struct ftm_responder_stats prev, cur;
+    bool has_prev = false;
+    int64_t failures = 0;
+    for (int i = 0; !stats_stop && (!count || i < count); i++) {
+        if (i) {
+            struct timespec ts = {interval_ms / 1000,
+                                  interval_ms % 1000 * 1000000};
+            /* interrupted by a signal to stop */
+            if (nanosleep(&ts, NULL) && stats_stop)
+                break;
+        }
+        if (ftm_get_responder_stats(&state, if_index, &cur)) {
+            fprintf(stderr, "Fail to read responder statistics: %s\n",
+                    error);
+            /* not a responder at all, or no support of the driver */
+            if (!has_prev)
+                goto clean_up;
+            if (m.metrics)
+                metrics_set_gauge(m.metrics, m.failures, ++failures);
+            continue;
+        }
+        struct ftm_responder_rates rates;
+        bool has_rates = has_prev &&
+                         !ftm_responder_stats_rates(&prev, &cur, &rates);
+        if (m.metrics)
+            set_stats_metrics(&m, &cur, has_rates ? &rates : NULL);
+        if (output) {
+            if (ftm_output_write_responder(output, &cur,
+                                           has_rates ? &rates : NULL,
+                                           realtime_ns())) {
+                fprintf(stderr, "Fail to write output!\n");
+                goto clean_up;
+            }
+        } else {
+            print_stats(&cur, has_rates ? &rates : NULL);
+        }
+        prev = cur;
+        has_prev = true;
+    }
+    err = 0;
+
+clean_up:
+    free_ftm_output(output);
+    free_metrics(m.metrics);
+    nl80211_free(&state);
+    return err;
+}
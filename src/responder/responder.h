@@ -1,5 +1,6 @@
 #ifndef _FTM_RESPONDER_H
 #define _FTM_RESPONDER_H
+#include <stdint.h>
 #include "../nl/nl.h"
 
 /**
@@ -11,4 +12,95 @@
  * A running AP is needed to start a responder.
  */
 int ftm_start_responder(const char* if_name);
-#endif
\ No newline at end of file
+
+/*
+ * Counters of NL80211_ATTR_FTM_RESPONDER_STATS: field name, suffix of
+ * NL80211_FTM_STATS_* and netlink type.
+ */
+#define FTM_RESPONDER_STATS_FIELDS(X)                          \
+    X(success, SUCCESS_NUM, u32)                               \
+    X(partial, PARTIAL_NUM, u32)                               \
+    X(failed, FAILED_NUM, u32)                                 \
+    X(asap, ASAP_NUM, u32)                                     \
+    X(non_asap, NON_ASAP_NUM, u32)                             \
+    X(duration_ms, TOTAL_DURATION_MSEC, u64)                   \
+    X(unknown_triggers, UNKNOWN_TRIGGERS_NUM, u32)             \
+    X(reschedule_requests, RESCHEDULE_REQUESTS_NUM, u32)       \
+    X(out_of_window_triggers, OUT_OF_WINDOW_TRIGGERS_NUM, u32)
+
+/**
+ * enum ftm_responder_stat - Bits of struct ftm_responder_stats.present
+ */
+enum ftm_responder_stat {
+#define __RESPONDER_STAT_ENUM(name, attr, type) FTM_RESPONDER_STAT_##name,
+    FTM_RESPONDER_STATS_FIELDS(__RESPONDER_STAT_ENUM)
+
+    /* keep last */
+    FTM_RESPONDER_STAT_MAX
+};
+
+/**
+ * struct ftm_responder_stats - Counters of a responder since it started
+ * 
+ * @timestamp_ns: CLOCK_MONOTONIC when the counters were read
+ * @present: bit n is set if the counter of @enum ftm_responder_stat n was
+ * reported by the driver
+ * other fields: see NL80211_FTM_STATS_* in linux/nl80211.h
+ */
+struct ftm_responder_stats {
+    uint64_t timestamp_ns;
+    uint32_t present;
+#define __RESPONDER_STAT_FIELD(name, attr, type) uint64_t name;
+    FTM_RESPONDER_STATS_FIELDS(__RESPONDER_STAT_FIELD)
+};
+
+/**
+ * struct ftm_responder_rates - Counters per second between two readings
+ * 
+ * @interval: seconds between the readings
+ * @present: counters present in both readings
+ * other fields: increase per second, duration_ms being the milliseconds
+ * spent in sessions per second
+ */
+struct ftm_responder_rates {
+    double interval;
+    uint32_t present;
+#define __RESPONDER_RATE_FIELD(name, attr, type) double name;
+    FTM_RESPONDER_STATS_FIELDS(__RESPONDER_RATE_FIELD)
+};
+
+/**
+ * ftm_get_responder_stats - Read the counters of the responder
+ * 
+ * @param state      nl80211 socket, kept open across readings
+ * @param if_index   interface running the responder
+ * @param stats      filled with the counters
+ * 
+ * @note
+ * Fails if the interface is not an AP with an FTM responder, or if the
+ * driver does not report statistics.
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int ftm_get_responder_stats(struct nl80211_state *state, uint32_t if_index,
+                            struct ftm_responder_stats *stats);
+
+/**
+ * ftm_responder_stats_rates - Compute the rates between two readings
+ * 
+ * @note
+ * A counter lower than in @prev (the responder restarted) counts from 0.
+ * 
+ * @return 0 on success, 1 if @cur is not later than @prev
+ */
+int ftm_responder_stats_rates(const struct ftm_responder_stats *prev,
+                              const struct ftm_responder_stats *cur,
+                              struct ftm_responder_rates *rates);
+
+/**
+ * ftm_responder_stats_main - Entry of "ftm responder_stats"
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int ftm_responder_stats_main(int argc, char **argv);
+#endif
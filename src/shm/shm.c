@@ -0,0 +1,151 @@
+#include "shm.h"
+#include "../nl/nl.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static struct shm_ring *map_ring(const char *name, int fd, size_t size,
+                                 bool writer, char *error) {
+    struct shm_ring *ring = calloc(1, sizeof(struct shm_ring));
+    if (!ring) {
+        ftm_report_error(error, "Fail to allocate ring!");
+        return NULL;
+    }
+    void *addr = mmap(NULL, size, writer ? PROT_READ | PROT_WRITE : PROT_READ,
+                      MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        ftm_report_error(error, "Fail to map %s: %s", name, strerror(errno));
+        free(ring);
+        return NULL;
+    }
+    ring->fd = fd;
+    ring->size = size;
+    ring->writer = writer;
+    snprintf(ring->name, sizeof(ring->name), "%s", name);
+    ring->header = addr;
+    ring->slots = (struct shm_slot *)(ring->header + 1);
+    return ring;
+}
+
+struct shm_ring *shm_ring_create(const char *name, uint32_t capacity,
+                                 char *error) {
+    uint32_t slots = 1;
+    while (slots < capacity)
+        slots <<= 1;
+    size_t size = sizeof(struct shm_ring_header) +
+                  (size_t)slots * sizeof(struct shm_slot);
+
+    int fd = shm_open(name, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ftm_report_error(error, "Fail to open shared memory %s: %s", name,
+                         strerror(errno));
+        return NULL;
+    }
+    /* drop the content of a previous run before resizing */
+    if (ftruncate(fd, 0) || ftruncate(fd, size)) {
+        ftm_report_error(error, "Fail to resize shared memory %s: %s", name,
+                         strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    struct shm_ring *ring = map_ring(name, fd, size, true, error);
+    if (!ring) {
+        close(fd);
+        return NULL;
+    }
+
+    /* the new object is zero-filled, so every slot reads as unpublished */
+    ring->header->slot_size = sizeof(struct shm_slot);
+    ring->header->capacity = slots;
+    ring->header->version = SHM_RING_VERSION;
+    __atomic_store_n(&ring->header->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+    return ring;
+}
+
+struct shm_ring *shm_ring_attach(const char *name, char *error) {
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        ftm_report_error(error, "Fail to open shared memory %s: %s", name,
+                         strerror(errno));
+        return NULL;
+    }
+    struct shm_ring_header header;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        header.magic != SHM_RING_MAGIC) {
+        ftm_report_error(error, "%s is not an ftm result ring!", name);
+        close(fd);
+        return NULL;
+    }
+    if (header.version != SHM_RING_VERSION ||
+        header.slot_size != sizeof(struct shm_slot)) {
+        ftm_report_error(error, "%s has version %u, expected %u!", name,
+                         header.version, SHM_RING_VERSION);
+        close(fd);
+        return NULL;
+    }
+    size_t size = sizeof(struct shm_ring_header) +
+                  (size_t)header.capacity * sizeof(struct shm_slot);
+    struct shm_ring *ring = map_ring(name, fd, size, false, error);
+    if (!ring)
+        close(fd);
+    return ring;
+}
+
+void shm_ring_close(struct shm_ring *ring) {
+    if (!ring)
+        return;
+    munmap(ring->header, ring->size);
+    close(ring->fd);
+    if (ring->writer)
+        shm_unlink(ring->name);
+    free(ring);
+}
+
+int ftm_shm_read_main(int argc, char **argv) {
+    if (argc != 2) {
+        printf("Invalid arguments!\n");
+        printf("Valid args: <name>\n");
+        return 1;
+    }
+    struct shm_ring *ring = shm_ring_attach(argv[1], NULL);
+    if (!ring)
+        return 1;
+
+    struct shm_record record;
+    uint64_t cursor = shm_ring_tail(ring);
+    while (1) {
+        int res = shm_ring_read(ring, &cursor, &record);
+        if (res == 0) {
+            usleep(1000);
+            continue;
+        }
+        if (res < 0) {
+            fprintf(stderr, "Reader fell behind, skipped to %lu\n", cursor);
+            continue;
+        }
+        uint8_t *addr = record.resp.mac_addr;
+        printf("%lu.%09lu %lu %02x:%02x:%02x:%02x:%02x:%02x %.3f %.3f\n",
+               record.timestamp_ns / 1000000000,
+               record.timestamp_ns % 1000000000, record.session,
+               addr[0], addr[1], addr[2], addr[3], addr[4], addr[5],
+               record.dist, record.dist_avg);
+        fflush(stdout);
+    }
+    return 0;
+}
+
+void shm_ring_publish(struct shm_ring *ring, const struct shm_record *record) {
+    struct shm_ring_header *header = ring->header;
+    uint64_t seq = __atomic_load_n(&header->write_seq, __ATOMIC_RELAXED);
+    struct shm_slot *slot = &ring->slots[seq & (header->capacity - 1)];
+
+    __atomic_store_n(&slot->seq, 2 * seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&slot->record, record, sizeof(struct shm_record));
+    __atomic_store_n(&slot->seq, 2 * seq + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&header->write_seq, seq + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,179 @@
+#ifndef _FTM_SHM_H
+#define _FTM_SHM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "../initiator/initiator_types.h"
+
+/**
+ * DOC: Shared-memory result ring
+ * 
+ * The initiator publishes every result into a fixed-layout ring of
+ * @SHM_RING_DEFAULT_CAPACITY slots in a POSIX shared memory object
+ * (/dev/shm/<name>). The writer never waits for readers: when the ring is
+ * full, the oldest slot is overwritten.
+ * 
+ * Each slot is protected by its own sequence number. For the record with
+ * sequence number n, the writer sets the slot sequence to 2n + 1, writes
+ * the record, then sets it to 2n + 2. A reader copies the record between
+ * two reads of the slot sequence and keeps the copy only if both read
+ * 2n + 2. Readers map the object once with shm_ring_attach() and then
+ * read with the inline shm_ring_read(), without syscalls.
+ * 
+ * Readers built against another layout are rejected by @SHM_RING_VERSION.
+ */
+
+#define SHM_RING_MAGIC 0x524d5446 /* "FTMR" */
+#define SHM_RING_VERSION 3
+#define SHM_RING_DEFAULT_CAPACITY 4096
+
+/**
+ * struct shm_record - A published result
+ * 
+ * @timestamp_ns: CLOCK_REALTIME when the result was published, the time
+ * it was received is in @resp
+ * @session: index of the session the result belongs to
+ * @dist: distance of this result in m, corrected by rtt_correct if set
+ * @dist_avg: distance from the average rtt of all sessions so far
+ * @resp: the result
+ */
+struct shm_record {
+    uint64_t timestamp_ns;
+    uint64_t session;
+    float dist;
+    float dist_avg;
+    struct ftm_resp_attr resp;
+};
+
+/**
+ * struct shm_slot - A slot of the ring
+ * 
+ * @seq: 2n + 1 while record n is written, 2n + 2 once it is complete
+ * @record: the record
+ */
+struct shm_slot {
+    uint64_t seq;
+    struct shm_record record;
+} __attribute__((aligned(64)));
+
+/**
+ * struct shm_ring_header - Header at the start of the shared object
+ * 
+ * @magic: @SHM_RING_MAGIC
+ * @version: @SHM_RING_VERSION
+ * @slot_size: sizeof(struct shm_slot) of the writer
+ * @capacity: number of slots, a power of two
+ * @write_seq: number of records published so far
+ */
+struct shm_ring_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_size;
+    uint32_t capacity;
+    uint64_t write_seq;
+} __attribute__((aligned(64)));
+
+/**
+ * struct shm_ring - A mapped ring, for the writer or a reader
+ */
+struct shm_ring {
+    int fd;
+    size_t size;
+    bool writer;
+    char name[64];
+    struct shm_ring_header *header;
+    struct shm_slot *slots;
+};
+
+/**
+ * shm_ring_create - Create (or replace) a ring for writing
+ * 
+ * @param name       name of the shared memory object, like "/ftm"
+ * @param capacity   number of slots, rounded up to a power of two
+ * @param error      buffer of FTM_ERROR_MAX bytes, see ftm_report_error()
+ * 
+ * @return a valid shm_ring pointer on success, NULL on failure.
+ */
+struct shm_ring *shm_ring_create(const char *name, uint32_t capacity,
+                                 char *error);
+
+/**
+ * shm_ring_attach - Map an existing ring for reading
+ * 
+ * @param name    name of the shared memory object
+ * @param error   buffer of FTM_ERROR_MAX bytes, see ftm_report_error()
+ * 
+ * @return a valid shm_ring pointer on success, NULL on failure.
+ */
+struct shm_ring *shm_ring_attach(const char *name, char *error);
+
+/**
+ * shm_ring_close - Unmap a ring
+ * 
+ * @note
+ * The writer also removes the shared memory object. Mapped readers keep
+ * their mapping until they close it.
+ */
+void shm_ring_close(struct shm_ring *ring);
+
+/**
+ * shm_ring_publish - Publish a record, never blocks
+ */
+void shm_ring_publish(struct shm_ring *ring, const struct shm_record *record);
+
+/**
+ * ftm_shm_read_main - Entry of "ftm shm_read <name>"
+ * 
+ * Follows a ring and prints every new record, as an example reader.
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int ftm_shm_read_main(int argc, char **argv);
+
+/**
+ * shm_ring_tail - Sequence number of the next record to be published
+ * 
+ * @note
+ * Use it as the initial cursor to read only new records.
+ */
+static inline uint64_t shm_ring_tail(const struct shm_ring *ring) {
+    return __atomic_load_n(&ring->header->write_seq, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * shm_ring_read - Read the record at a cursor
+ * 
+ * @param ring     ring attached with shm_ring_attach()
+ * @param cursor   sequence number of the record to read, advanced past the
+ *                 record on success
+ * @param record   copy of the record on success
+ * 
+ * @return 1 if a record was read, 0 if it is not published yet, -1 if the
+ * reader fell behind and records were overwritten. In that case @cursor is
+ * moved to the oldest record still in the ring.
+ */
+static inline int shm_ring_read(const struct shm_ring *ring, uint64_t *cursor,
+                                struct shm_record *record) {
+    uint32_t capacity = ring->header->capacity;
+    const struct shm_slot *slot = &ring->slots[*cursor & (capacity - 1)];
+    uint64_t expected = 2 * *cursor + 2;
+
+    uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq == expected) {
+        *record = slot->record;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == expected) {
+            (*cursor)++;
+            return 1;
+        }
+    } else if (seq < expected) {
+        return 0;
+    }
+
+    /* overwritten, skip to the oldest slot that is still valid */
+    uint64_t tail = shm_ring_tail(ring);
+    *cursor = tail > capacity ? tail - capacity + 1 : 0;
+    return -1;
+}
+#endif
@@ -0,0 +1,686 @@
+#define _GNU_SOURCE
+#include "simulate.h"
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+/* a parameter of SIMULATE_PARAMS and where it is stored */
+struct simulate_param {
+    const char *directive;
+    const char *key;
+    size_t offset;
+};
+
+static const struct simulate_param params[] = {
+#define __PARAM_ENTRY(directive, key, value) \
+    {#directive, #key, offsetof(struct simulate_scenario, directive##_##key)},
+    SIMULATE_PARAMS(__PARAM_ENTRY)
+};
+
+#define PARAM_COUNT (sizeof(params) / sizeof(params[0]))
+
+/* splitmix64, small and good enough for noise */
+static uint64_t next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+/* uniform in [0, 1) */
+static double next_uniform(uint64_t *state) {
+    return (next_random(state) >> 11) * (1.0 / (1ull << 53));
+}
+
+/* standard normal, Box-Muller */
+static double next_gaussian(uint64_t *state) {
+    double u = 1 - next_uniform(state);
+    double v = next_uniform(state);
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/* split a line into tokens in place, stopping at a comment */
+static int split_tokens(char *line, char **tokens, int max) {
+    int count = 0;
+    char *pos = line;
+    while (*pos) {
+        while (*pos && is_blank(*pos))
+            *pos++ = '\0';
+        if (!*pos || *pos == '#')
+            break;
+        if (count == max)
+            return -1;
+        tokens[count++] = pos;
+        while (*pos && !is_blank(*pos))
+            pos++;
+    }
+    return count;
+}
+
+static int parse_double(const char *str, double *value) {
+    char *end;
+    errno = 0;
+    *value = strtod(str, &end);
+    return end == str || *end || errno || !isfinite(*value);
+}
+
+static struct simulate_point *add_point(struct simulate_point **points,
+                                        int *count) {
+    /* the capacity doubles from 64 whenever the count reaches it */
+    if (!*points || (*count >= 64 && (*count & (*count - 1)) == 0)) {
+        int capacity = *count < 64 ? 64 : *count * 2;
+        struct simulate_point *grown = realloc(*points, capacity *
+                                               sizeof(struct simulate_point));
+        if (!grown)
+            return NULL;
+        *points = grown;
+    }
+    struct simulate_point *point = &(*points)[(*count)++];
+    memset(point, 0, sizeof(struct simulate_point));
+    return point;
+}
+
+/* keys of the responder, grid and waypoint lines */
+struct point_keys {
+    double x, y, z, t, count, spacing, rtt_correct;
+    bool has_t, has_count, has_spacing, has_correct;
+};
+
+static int set_point_key(struct point_keys *keys, const char *key,
+                         double value) {
+#define __POINT_KEY(name)                   \
+    if (strcmp(key, #name) == 0) {          \
+        keys->name = value;                 \
+        return 0;                           \
+    }
+    __POINT_KEY(x)
+    __POINT_KEY(y)
+    __POINT_KEY(z)
+    if (strcmp(key, "t") == 0) {
+        keys->t = value;
+        keys->has_t = true;
+        return 0;
+    }
+    if (strcmp(key, "count") == 0) {
+        keys->count = value;
+        keys->has_count = true;
+        return 0;
+    }
+    if (strcmp(key, "spacing") == 0) {
+        keys->spacing = value;
+        keys->has_spacing = true;
+        return 0;
+    }
+    if (strcmp(key, "rtt_correct") == 0) {
+        keys->rtt_correct = value;
+        keys->has_correct = true;
+        return 0;
+    }
+    return 1;
+}
+
+static int set_param(struct simulate_scenario *scenario,
+                     const char *directive, const char *key, double value) {
+    for (size_t i = 0; i < PARAM_COUNT; i++) {
+        if (strcmp(params[i].directive, directive) == 0 &&
+            strcmp(params[i].key, key) == 0) {
+            *(double *)((char *)scenario + params[i].offset) = value;
+            return 0;
+        }
+    }
+    if (strcmp(directive, "fail") == 0) {
+        for (int i = 0; i < METRICS_FAIL_REASON_MAX - 1; i++) {
+            if (strcmp(metrics_fail_reason_name(i), key) == 0) {
+                scenario->fail_weights[i] = value;
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static bool is_param_directive(const char *directive) {
+    for (size_t i = 0; i < PARAM_COUNT; i++) {
+        if (strcmp(params[i].directive, directive) == 0)
+            return true;
+    }
+    return false;
+}
+
+static int add_grid(struct simulate_scenario *scenario,
+                    const struct point_keys *keys, int *next_grid) {
+    int count = keys->count;
+    if (!keys->has_count || !keys->has_spacing || count <= 0 ||
+        count != keys->count || keys->spacing <= 0 ||
+        *next_grid + (int64_t)count > (1 << 24))
+        return 1;
+    int side = ceil(sqrt(count));
+    for (int i = 0; i < count; i++) {
+        struct simulate_point *point = add_point(&scenario->responders,
+                                                 &scenario->responder_count);
+        if (!point)
+            return 1;
+        int index = (*next_grid)++;
+        uint8_t mac[6] = {SIMULATE_GRID_OUI, 0, 0, index >> 16,
+                          index >> 8, index};
+        memcpy(point->mac_addr, mac, 6);
+        point->x = keys->x + (i % side) * keys->spacing;
+        point->y = keys->y + (i / side) * keys->spacing;
+        point->z = keys->z;
+    }
+    return 0;
+}
+
+/* apply a line, 0 on success, 1 with the error reported */
+static int parse_line(struct simulate_scenario *scenario, char *line,
+                      const char *path, int line_num, int *next_grid,
+                      char *error) {
+    char *tokens[64];
+    int count = split_tokens(line, tokens, 64);
+    if (count == 0)
+        return 0;
+    if (count < 0) {
+        ftm_report_error(error, "%s:%d: too many tokens!", path, line_num);
+        return 1;
+    }
+    const char *directive = tokens[0];
+    bool responder = strcmp(directive, "responder") == 0;
+    bool grid = strcmp(directive, "grid") == 0;
+    bool waypoint = strcmp(directive, "waypoint") == 0;
+    if (!responder && !grid && !waypoint && !is_param_directive(directive)) {
+        ftm_report_error(error, "%s:%d: unknown directive %s!", path, line_num,
+                         directive);
+        return 1;
+    }
+
+    int first = 1;
+    uint8_t mac[6];
+    if (responder) {
+        char end;
+        if (count < 2 ||
+            sscanf(tokens[1], "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx%c", &mac[0],
+                   &mac[1], &mac[2], &mac[3], &mac[4], &mac[5], &end) != 6) {
+            ftm_report_error(error, "%s:%d: invalid mac address!", path,
+                             line_num);
+            return 1;
+        }
+        first = 2;
+    }
+
+    struct point_keys keys;
+    memset(&keys, 0, sizeof(keys));
+    for (int i = first; i < count; i++) {
+        char *value = strchr(tokens[i], '=');
+        double number;
+        if (!value || parse_double(value + 1, &number)) {
+            ftm_report_error(error, "%s:%d: invalid value %s!", path, line_num,
+                             tokens[i]);
+            return 1;
+        }
+        *value = '\0';
+        int err = responder || grid || waypoint ?
+                  set_point_key(&keys, tokens[i], number) :
+                  set_param(scenario, directive, tokens[i], number);
+        if (err) {
+            ftm_report_error(error, "%s:%d: unknown key %s for %s!", path,
+                             line_num, tokens[i], directive);
+            return 1;
+        }
+    }
+
+    if (responder) {
+        struct simulate_point *point = add_point(&scenario->responders,
+                                                 &scenario->responder_count);
+        if (!point) {
+            ftm_report_error(error, "Fail to allocate responders!");
+            return 1;
+        }
+        memcpy(point->mac_addr, mac, 6);
+        point->x = keys.x;
+        point->y = keys.y;
+        point->z = keys.z;
+        point->rtt_correct = keys.rtt_correct;
+        point->has_correct = keys.has_correct;
+    } else if (grid) {
+        if (add_grid(scenario, &keys, next_grid)) {
+            ftm_report_error(error, "%s:%d: invalid grid, count and spacing "
+                             "must be positive, at most %d responders!",
+                             path, line_num, 1 << 24);
+            return 1;
+        }
+    } else if (waypoint) {
+        int last = scenario->waypoint_count - 1;
+        if (!keys.has_t || keys.t < 0 ||
+            (last >= 0 && keys.t <= scenario->waypoints[last].t)) {
+            ftm_report_error(error, "%s:%d: waypoints need increasing times!",
+                             path, line_num);
+            return 1;
+        }
+        struct simulate_point *point = add_point(&scenario->waypoints,
+                                                 &scenario->waypoint_count);
+        if (!point) {
+            ftm_report_error(error, "Fail to allocate waypoints!");
+            return 1;
+        }
+        point->x = keys.x;
+        point->y = keys.y;
+        point->z = keys.z;
+        point->t = keys.t;
+    }
+    return 0;
+}
+
+static int check_scenario(const struct simulate_scenario *scenario,
+                          const char *path, char *error) {
+    double weights = 0;
+    for (int i = 0; i < METRICS_FAIL_REASON_MAX - 1; i++) {
+        if (scenario->fail_weights[i] < 0) {
+            ftm_report_error(error, "%s: negative fail weight!", path);
+            return 1;
+        }
+        weights += scenario->fail_weights[i];
+    }
+    if (!scenario->responder_count) {
+        ftm_report_error(error, "%s: no responder!", path);
+        return 1;
+    }
+    if (scenario->fail_rate < 0 || scenario->fail_rate > 1 ||
+        scenario->multipath_prob < 0 || scenario->multipath_prob > 1) {
+        ftm_report_error(error, "%s: probabilities must be within [0, 1]!",
+                         path);
+        return 1;
+    }
+    if (scenario->session_interval <= 0 ||
+        scenario->session_ftms_per_burst < 1 ||
+        scenario->session_ftms_per_burst > 255 ||
+        scenario->noise_dist < 0 || scenario->noise_rssi < 0 ||
+        scenario->multipath_excess < 0 || scenario->range_max < 0) {
+        ftm_report_error(error, "%s: invalid session or model parameters!",
+                         path);
+        return 1;
+    }
+    if (scenario->fail_rate > 0 && weights <= 0) {
+        ftm_report_error(error, "%s: fail weights sum to 0!", path);
+        return 1;
+    }
+    return 0;
+}
+
+struct simulate_scenario *load_scenario(const char *path, char *error) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        ftm_report_error(error, "Fail to open %s: %s!", path, strerror(errno));
+        return NULL;
+    }
+    struct simulate_scenario *scenario =
+        calloc(1, sizeof(struct simulate_scenario));
+    if (!scenario) {
+        ftm_report_error(error, "Fail to allocate scenario!");
+        fclose(file);
+        return NULL;
+    }
+#define __PARAM_DEFAULT(directive, key, value) \
+    scenario->directive##_##key = value;
+    SIMULATE_PARAMS(__PARAM_DEFAULT)
+
+    char *line = NULL;
+    size_t size = 0;
+    int line_num = 0, next_grid = 0, err = 0;
+    bool weighted = false;
+    while (!err && getline(&line, &size, file) != -1) {
+        line_num++;
+        err = parse_line(scenario, line, path, line_num, &next_grid,
+                         error);
+    }
+    free(line);
+    fclose(file);
+
+    for (int i = 0; i < METRICS_FAIL_REASON_MAX - 1; i++)
+        weighted |= scenario->fail_weights[i] != 0;
+    if (!weighted)
+        scenario->fail_weights[NL80211_PMSR_FTM_FAILURE_NO_RESPONSE] = 1;
+    if (err || check_scenario(scenario, path, error)) {
+        free_scenario(scenario);
+        return NULL;
+    }
+    return scenario;
+}
+
+void free_scenario(struct simulate_scenario *scenario) {
+    if (!scenario)
+        return;
+    free(scenario->responders);
+    free(scenario->waypoints);
+    free(scenario);
+}
+
+struct ftm_config *simulate_config(const struct simulate_scenario *scenario) {
+    struct ftm_config *config = calloc(1, sizeof(struct ftm_config));
+    if (!config)
+        return NULL;
+    config->peers = calloc(scenario->responder_count,
+                           sizeof(struct ftm_peer_attr *));
+    if (!config->peers) {
+        free(config);
+        return NULL;
+    }
+    for (int i = 0; i < scenario->responder_count; i++) {
+        const struct simulate_point *responder = &scenario->responders[i];
+        struct ftm_peer_attr *peer = alloc_ftm_peer();
+        if (!peer) {
+            free_ftm_config(config);
+            return NULL;
+        }
+        config->peers[config->peer_count++] = peer;
+        FTM_PEER_SET_ATTR_ADDR(peer, responder->mac_addr);
+        FTM_PEER_SET_ATTR(peer, ftms_per_burst,
+                          scenario->session_ftms_per_burst);
+        if (responder->has_correct)
+            FTM_PEER_SET_ATTR(peer, rtt_correct, responder->rtt_correct);
+    }
+    return config;
+}
+
+/* where the initiator is at @t seconds */
+static void initiator_at(const struct simulate_scenario *scenario, double t,
+                         double *pos) {
+    const struct simulate_point *points = scenario->waypoints;
+    int count = scenario->waypoint_count;
+    pos[0] = pos[1] = pos[2] = 0;
+    if (!count)
+        return;
+    if (count > 1 && points[count - 1].t > 0)
+        t = fmod(t, points[count - 1].t);
+    int i = 0;
+    while (i < count - 1 && points[i + 1].t <= t)
+        i++;
+    const struct simulate_point *a = &points[i];
+    const struct simulate_point *b = i + 1 < count ? &points[i + 1] : a;
+    double f = b->t > a->t && t > a->t ? (t - a->t) / (b->t - a->t) : 0;
+    pos[0] = a->x + (b->x - a->x) * f;
+    pos[1] = a->y + (b->y - a->y) * f;
+    pos[2] = a->z + (b->z - a->z) * f;
+}
+
+static uint32_t pick_fail_reason(const struct simulate_scenario *scenario,
+                                 uint64_t *state) {
+    double total = 0;
+    for (int i = 0; i < METRICS_FAIL_REASON_MAX - 1; i++)
+        total += scenario->fail_weights[i];
+    double pick = next_uniform(state) * total;
+    int last = 0;
+    for (int i = 0; i < METRICS_FAIL_REASON_MAX - 1; i++) {
+        if (scenario->fail_weights[i] <= 0)
+            continue;
+        last = i;
+        if (pick < scenario->fail_weights[i])
+            return i;
+        pick -= scenario->fail_weights[i];
+    }
+    return last;
+}
+
+/* fill @resp, reset with its peer, with a result at distance @dist */
+static void generate_result(const struct simulate_scenario *scenario,
+                            const struct simulate_point *responder,
+                            double dist, struct ftm_resp_attr *resp,
+                            uint64_t *state) {
+    uint32_t reason = 0;
+    bool failed = true;
+    if (scenario->range_max > 0 && dist > scenario->range_max)
+        reason = NL80211_PMSR_FTM_FAILURE_NO_RESPONSE;
+    else if (next_uniform(state) < scenario->fail_rate)
+        reason = pick_fail_reason(scenario, state);
+    else
+        failed = false;
+
+    int frames = scenario->session_ftms_per_burst;
+    resp->burst_index = 0;
+    resp->num_ftmr_attempts = 1;
+    resp->num_ftmr_successes = !failed;
+    resp->num_bursts_exp = 0;
+    resp->ftms_per_burst = frames;
+    FTM_RESP_SET_FLAG(resp, burst_index);
+    FTM_RESP_SET_FLAG(resp, num_ftmr_attempts);
+    FTM_RESP_SET_FLAG(resp, num_ftmr_successes);
+    FTM_RESP_SET_FLAG(resp, num_bursts_exp);
+    FTM_RESP_SET_FLAG(resp, ftms_per_burst);
+    if (failed) {
+        resp->fail_reason = reason;
+        FTM_RESP_SET_FLAG(resp, fail_reason);
+        if (reason == NL80211_PMSR_FTM_FAILURE_PEER_BUSY) {
+            resp->busy_retry_time = 1 + next_random(state) % 5;
+            FTM_RESP_SET_FLAG(resp, busy_retry_time);
+        }
+        return;
+    }
+
+    /* a longer path holds for the whole burst */
+    double excess = 0;
+    if (next_uniform(state) < scenario->multipath_prob)
+        excess = -scenario->multipath_excess * log(1 - next_uniform(state));
+    int64_t correct = responder->has_correct ? responder->rtt_correct : 0;
+    double sum = 0, sq_sum = 0, min = INFINITY, max = -INFINITY;
+    for (int i = 0; i < frames; i++) {
+        double frame = dist + excess +
+                       next_gaussian(state) * scenario->noise_dist;
+        double rtt = DIST_TO_RTT(frame) - correct;
+        sum += rtt;
+        sq_sum += rtt * rtt;
+        min = rtt < min ? rtt : min;
+        max = rtt > max ? rtt : max;
+    }
+    double mean = sum / frames;
+    double variance = sq_sum / frames - mean * mean;
+    resp->rtt_avg = llround(mean);
+    resp->rtt_variance = variance > 0 ? llround(variance) : 0;
+    resp->rtt_spread = llround(max - min);
+    FTM_RESP_SET_FLAG(resp, rtt_avg);
+    FTM_RESP_SET_FLAG(resp, rtt_variance);
+    FTM_RESP_SET_FLAG(resp, rtt_spread);
+
+    double rssi = scenario->rssi_ref -
+                  10 * scenario->rssi_exponent * log10(dist > 1 ? dist : 1);
+    resp->rssi_avg = lround(rssi + next_gaussian(state) *
+                            scenario->noise_rssi);
+    resp->rssi_spread = lround(fabs(next_gaussian(state)) *
+                               scenario->noise_rssi * 2);
+    FTM_RESP_SET_FLAG(resp, rssi_avg);
+    FTM_RESP_SET_FLAG(resp, rssi_spread);
+}
+
+/* a PEER_MEASUREMENT_RESULT carrying @resp, as cfg80211 builds it */
+static struct nl_msg *encode_result(const struct ftm_resp_attr *resp,
+                                    uint64_t cookie) {
+    struct nl_msg *msg = nlmsg_alloc();
+    if (!msg)
+        return NULL;
+    if (!genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, 0, 0, 0,
+                     NL80211_CMD_PEER_MEASUREMENT_RESULT, 0))
+        goto nla_put_failure;
+    NLA_PUT_U64(msg, NL80211_ATTR_COOKIE, cookie);
+    struct nlattr *pmsr = nla_nest_start(msg, NL80211_ATTR_PEER_MEASUREMENTS);
+    struct nlattr *peers = nla_nest_start(msg, NL80211_PMSR_ATTR_PEERS);
+    struct nlattr *peer = nla_nest_start(msg, 1);
+    if (!pmsr || !peers || !peer)
+        goto nla_put_failure;
+    NLA_PUT(msg, NL80211_PMSR_PEER_ATTR_ADDR, 6, resp->mac_addr);
+    struct nlattr *result = nla_nest_start(msg, NL80211_PMSR_PEER_ATTR_RESP);
+    if (!result)
+        goto nla_put_failure;
+    NLA_PUT_U32(msg, NL80211_PMSR_RESP_ATTR_STATUS,
+                FTM_RESP_HAS(resp, fail_reason) ? NL80211_PMSR_STATUS_FAILURE :
+                NL80211_PMSR_STATUS_SUCCESS);
+    NLA_PUT_FLAG(msg, NL80211_PMSR_RESP_ATTR_FINAL);
+    struct nlattr *data = nla_nest_start(msg, NL80211_PMSR_RESP_ATTR_DATA);
+    struct nlattr *ftm = nla_nest_start(msg, NL80211_PMSR_TYPE_FTM);
+    if (!data || !ftm)
+        goto nla_put_failure;
+#define __FTM_ENCODE(name, attr, type, nla, spec)                         \
+    if (FTM_RESP_HAS(resp, name) &&                                       \
+        nla_put_##nla(msg, NL80211_PMSR_FTM_RESP_ATTR_##attr, resp->name)) \
+        goto nla_put_failure;
+    FTM_RESP_FIELDS(__FTM_ENCODE)
+    nla_nest_end(msg, ftm);
+    nla_nest_end(msg, data);
+    nla_nest_end(msg, result);
+    nla_nest_end(msg, peer);
+    nla_nest_end(msg, peers);
+    nla_nest_end(msg, pmsr);
+    return msg;
+
+nla_put_failure:
+    nlmsg_free(msg);
+    return NULL;
+}
+
+/* hand @generated over to @results through a netlink message */
+static int pass_through_netlink(struct ftm_results_wrap *results,
+                                const struct ftm_resp_attr *generated,
+                                uint64_t cookie, char *error) {
+    struct nl_msg *msg = encode_result(generated, cookie);
+    if (!msg) {
+        ftm_report_error(error, "Fail to encode a result!");
+        return 1;
+    }
+    char reason[FTM_ERROR_MAX] = "";
+    int err = ftm_parse_result(results, msg, generated->rx_time_ns, reason);
+    nlmsg_free(msg);
+    if (err != NL_OK) {
+        ftm_report_error(error, "Fail to parse a result: %s!", reason);
+        return 1;
+    }
+    return 0;
+}
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int simulate_run(const struct simulate_scenario *scenario,
+                 struct ftm_config *config,
+                 const struct simulate_options *options,
+                 ftm_result_handler handler, void *arg,
+                 struct simulate_stats *stats, char *error) {
+    memset(stats, 0, sizeof(struct simulate_stats));
+    hist_init(&stats->generate);
+    hist_init(&stats->handler);
+    if (config->peer_count != scenario->responder_count) {
+        ftm_report_error(error, "Config does not match the scenario!");
+        return 1;
+    }
+    struct ftm_results_wrap *results = alloc_ftm_results_wrap(config);
+    if (!results) {
+        ftm_report_error(error, "Fail to allocate results!");
+        return 1;
+    }
+
+    uint64_t state = options->seed;
+    uint64_t interval_ns = scenario->session_interval * 1000000;
+    uint64_t per_peer_ns = interval_ns / config->peer_count;
+    uint64_t base_ns = clock_ns(CLOCK_REALTIME);
+    uint64_t start = clock_ns(CLOCK_MONOTONIC);
+    int err = 0;
+    for (int session = 0; session < options->sessions && !err; session++) {
+        uint64_t sim_ns = session * interval_ns;
+        if (options->speedup > 0) {
+            uint64_t target = start + sim_ns / options->speedup;
+            if (clock_ns(CLOCK_MONOTONIC) > target) {
+                stats->late += session > 0;
+            } else {
+                struct timespec ts = {target / 1000000000,
+                                      target % 1000000000};
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+                                       NULL) == EINTR)
+                    ;
+            }
+        }
+
+        uint64_t begin = clock_ns(CLOCK_MONOTONIC);
+        if (reset_ftm_results_wrap(results, config)) {
+            err = 1;
+            break;
+        }
+        double pos[3];
+        initiator_at(scenario, sim_ns / 1e9, pos);
+        for (int i = 0; i < config->peer_count && !err; i++) {
+            const struct simulate_point *responder = &scenario->responders[i];
+            double dx = responder->x - pos[0], dy = responder->y - pos[1];
+            double dz = responder->z - pos[2];
+            double dist = sqrt(dx * dx + dy * dy + dz * dz);
+            struct ftm_resp_attr *resp = results->results[i];
+            struct ftm_resp_attr generated;
+            if (options->netlink) {
+                memset(&generated, 0, sizeof(generated));
+                memcpy(generated.mac_addr, resp->mac_addr, 6);
+            }
+            struct ftm_resp_attr *target = options->netlink ? &generated :
+                                           resp;
+            generate_result(scenario, responder, dist, target, &state);
+            target->rx_time_ns = base_ns + sim_ns + (i + 1) * per_peer_ns;
+            FTM_RESP_SET_FLAG(target, rx_time_ns);
+            if (options->netlink)
+                err = pass_through_netlink(results, &generated, session,
+                                           error);
+            /* the truth does not travel through netlink */
+            resp->dist_truth = dist;
+            FTM_RESP_SET_FLAG(resp, dist_truth);
+            stats->results++;
+            stats->failures += FTM_RESP_HAS(target, fail_reason);
+        }
+        if (err)
+            break;
+        uint64_t generated = clock_ns(CLOCK_MONOTONIC);
+        hist_record(&stats->generate, generated - begin);
+        handler(results, options->sessions, session, arg);
+        hist_record(&stats->handler, clock_ns(CLOCK_MONOTONIC) - generated);
+        stats->sessions++;
+    }
+    stats->wall_ns = clock_ns(CLOCK_MONOTONIC) - start;
+    stats->simulated_ns = stats->sessions * interval_ns;
+    free_ftm_results_wrap(results);
+    return err;
+}
+
+/* resident set size in KiB, from /proc/self/statm */
+static long current_rss_kb() {
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (!file)
+        return -1;
+    long pages, resident;
+    int count = fscanf(file, "%ld %ld", &pages, &resident);
+    fclose(file);
+    return count == 2 ? resident * (sysconf(_SC_PAGESIZE) / 1024) : -1;
+}
+
+void simulate_print(FILE *file, const struct simulate_stats *stats) {
+    double wall = stats->wall_ns / 1e9;
+    double simulated = stats->simulated_ns / 1e9;
+    fprintf(file, "%lu sessions, %lu results (%lu failed), %.3f s simulated "
+            "in %.3f s (%.1fx)\n", stats->sessions, stats->results,
+            stats->failures, simulated, wall,
+            wall > 0 ? simulated / wall : 0);
+    fprintf(file, "%.0f results/s, %.1f sessions/s, %lu sessions late\n",
+            wall > 0 ? stats->results / wall : 0,
+            wall > 0 ? stats->sessions / wall : 0, stats->late);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    /* ru_maxrss lags behind the current size */
+    long rss = current_rss_kb();
+    fprintf(file, "memory: %ld KiB resident, %ld KiB at peak\n", rss,
+            usage.ru_maxrss > rss ? usage.ru_maxrss : rss);
+    hist_print_header(file, "session (ns)");
+    hist_print(file, "generate", &stats->generate);
+    hist_print(file, "handler", &stats->handler);
+}
@@ -0,0 +1,203 @@
+#ifndef _FTM_SIMULATE_H
+#define _FTM_SIMULATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../hist/hist.h"
+#include "../metrics/metrics.h"
+#include "../initiator/initiator_start.h"
+
+/**
+ * DOC: Synthetic measurement scenarios
+ * 
+ * A scenario places responders and moves the initiator among them, and
+ * generates the results a measurement would give, session by session,
+ * for the result handlers of start_measurement to process at scale.
+ * 
+ * A scenario file holds one directive per line, everything after a "#"
+ * starting a token being a comment:
+ * 
+ * responder <mac_addr> x=<m> y=<m> [z=<m>] [rtt_correct=<ps>]
+ *     a responder at a position, whose rtt is off by -rtt_correct
+ * grid count=<n> spacing=<m> [x=<m>] [y=<m>] [z=<m>]
+ *     n responders on a square grid starting at (x, y), their mac
+ *     addresses counting up from 02:00:00:00:00:00
+ * waypoint t=<s> x=<m> y=<m> [z=<m>]
+ *     the initiator is there at time t, moving in a straight line between
+ *     waypoints and starting over after the last one, it stays at the
+ *     origin without waypoints
+ * noise dist=<m> rssi=<dB>
+ *     standard deviation of the distance of each FTM frame and of rssi
+ * multipath prob=<p> excess=<m>
+ *     probability that a burst takes a longer path, and the mean of the
+ *     extra distance, exponentially distributed
+ * rssi ref=<dBm> exponent=<n>
+ *     rssi at 1 m and path-loss exponent
+ * range max=<m>
+ *     responders further away do not answer (no_response), 0 for no limit
+ * fail rate=<p> [<fail_reason>=<weight>]...
+ *     probability that a result fails, and the mix of the reasons named
+ *     as metrics_fail_reason_name() does, no_response by default
+ * session interval=<ms> ftms_per_burst=<n>
+ *     time between sessions and FTM frames per burst
+ * 
+ * A successful result carries the rtt_avg, rtt_variance and rtt_spread of
+ * its ftms_per_burst frames, rssi_avg and rssi_spread, and the true
+ * distance in dist_truth. Its rx_time_ns spreads the results of a session
+ * over the session, from the start of the run in simulated time.
+ */
+
+#define SIMULATE_GRID_OUI 0x02
+
+/*
+ * Parameters of the models: directive, key, default. Each is a double of
+ * struct simulate_scenario named <directive>_<key>.
+ */
+#define SIMULATE_PARAMS(X)          \
+    X(noise, dist, 0.5)             \
+    X(noise, rssi, 2)               \
+    X(multipath, prob, 0)           \
+    X(multipath, excess, 3)         \
+    X(rssi, ref, -40)               \
+    X(rssi, exponent, 2.5)          \
+    X(range, max, 0)                \
+    X(fail, rate, 0)                \
+    X(session, interval, 100)       \
+    X(session, ftms_per_burst, 8)
+
+/**
+ * struct simulate_point - A responder, or a waypoint of the initiator
+ * 
+ * @mac_addr: mac address of the responder
+ * @x: position in m
+ * @y: position in m
+ * @z: position in m
+ * @t: time of the waypoint in s
+ * @rtt_correct: rtt missing from the results of the responder, in ps
+ * @has_correct: whether @rtt_correct was given
+ */
+struct simulate_point {
+    uint8_t mac_addr[6];
+    double x;
+    double y;
+    double z;
+    double t;
+    int64_t rtt_correct;
+    bool has_correct;
+};
+
+/**
+ * struct simulate_scenario - A loaded scenario
+ * 
+ * @responders: the responders, in file order
+ * @responder_count: number of @responders
+ * @waypoints: the trajectory of the initiator, in order of time
+ * @waypoint_count: number of @waypoints
+ * @fail_weights: weight of each fail reason among the failures
+ * other fields: see SIMULATE_PARAMS
+ */
+struct simulate_scenario {
+    struct simulate_point *responders;
+    int responder_count;
+    struct simulate_point *waypoints;
+    int waypoint_count;
+    double fail_weights[METRICS_FAIL_REASON_MAX - 1];
+#define __SIMULATE_PARAM_FIELD(directive, key, value) \
+    double directive##_##key;
+    SIMULATE_PARAMS(__SIMULATE_PARAM_FIELD)
+};
+
+/**
+ * load_scenario - Parse a scenario file
+ * 
+ * @param path    path of the scenario file
+ * @param error   buffer of FTM_ERROR_MAX bytes, see ftm_report_error()
+ * 
+ * @note
+ * Errors carry their line. Free with free_scenario().
+ * 
+ * @return a valid simulate_scenario pointer on success, NULL on failure
+ */
+struct simulate_scenario *load_scenario(const char *path, char *error);
+
+void free_scenario(struct simulate_scenario *scenario);
+
+/**
+ * simulate_config - A config with a peer per responder
+ * 
+ * @note
+ * The peers carry the mac address, rtt_correct and ftms_per_burst of the
+ * scenario, and no interface. Free with free_ftm_config().
+ * 
+ * @return a valid ftm_config pointer on success, NULL on failure
+ */
+struct ftm_config *simulate_config(const struct simulate_scenario *scenario);
+
+/**
+ * struct simulate_options - How a scenario is run
+ * 
+ * @sessions: number of sessions
+ * @speedup: simulated time per wall time, sessions are paced to it, 0 to
+ * run as fast as possible
+ * @netlink: encode each result into a NL80211_CMD_PEER_MEASUREMENT_RESULT
+ * message, one peer per message as the kernel sends them, and decode it
+ * with ftm_parse_result(), instead of handing the results over as is
+ * @seed: seed of the random generator, the same seed giving the same
+ * results
+ */
+struct simulate_options {
+    int sessions;
+    double speedup;
+    bool netlink;
+    uint64_t seed;
+};
+
+/**
+ * struct simulate_stats - Work done by simulate_run()
+ * 
+ * @sessions: sessions run
+ * @results: results generated
+ * @failures: results generated with a fail_reason
+ * @late: sessions that started behind the pace of the speedup
+ * @wall_ns: time taken
+ * @simulated_ns: simulated time covered
+ * @generate: time to generate (and with netlink, encode and decode) the
+ * results of each session, in ns
+ * @handler: time the handler took on each session, in ns
+ */
+struct simulate_stats {
+    uint64_t sessions;
+    uint64_t results;
+    uint64_t failures;
+    uint64_t late;
+    uint64_t wall_ns;
+    uint64_t simulated_ns;
+    struct hist generate;
+    struct hist handler;
+};
+
+/**
+ * simulate_run - Generate the sessions of a scenario
+ * 
+ * @param scenario   the scenario
+ * @param config     its config, see simulate_config()
+ * @param options    how to run it
+ * @param handler    called with the results of each session, in config
+ *                   order, like ftm_ctx_run() does
+ * @param arg        passed to @handler
+ * @param stats      receives the work done
+ * @param error      buffer of FTM_ERROR_MAX bytes, see ftm_report_error()
+ * 
+ * @return 0 on success, 1 on failure
+ */
+int simulate_run(const struct simulate_scenario *scenario,
+                 struct ftm_config *config,
+                 const struct simulate_options *options,
+                 ftm_result_handler handler, void *arg,
+                 struct simulate_stats *stats, char *error);
+
+/**
+ * simulate_print - Print the throughput, the latencies and the memory used
+ */
+void simulate_print(FILE *file, const struct simulate_stats *stats);
+#endif